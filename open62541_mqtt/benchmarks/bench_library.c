@@ -0,0 +1,902 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Benchmarks of the binary encoding, the services and client round trips.
+ * The services are called directly, the way examples/server_readspeed.c
+ * does; the round trips go over loopback to a server thread. */
+
+#ifndef _XOPEN_SOURCE
+# define _XOPEN_SOURCE 600 /* clock_gettime, getopt */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ua_types.h"
+#include "ua_server.h"
+#include "ua_client.h"
+#include "ua_client_highlevel.h"
+#include "ua_config_standard.h"
+#include "ua_network_tcp.h"
+#include "ua_types_encoding_binary.h"
+#include "ua_server_internal.h"
+#include "ua_services.h"
+#include "ua_securechannel.h"
+#include "ua_connection_internal.h"
+#include "ua_session.h"
+#include "ua_subscription.h"
+#include "ua_timer.h"
+#include "benchmark.h"
+
+#define BENCH_PORT 16680
+
+/**
+ * Encoding
+ * -------- */
+
+typedef struct {
+    const UA_DataType *type;
+    void *value;
+    void *decoded;
+    UA_ByteString buffer;
+    UA_ByteString encoded;
+} CodecCase;
+
+static void encodeOp(void *context) {
+    CodecCase *c = (CodecCase*)context;
+    size_t offset = 0;
+    UA_StatusCode retval = UA_encodeBinary(c->value, c->type, NULL, NULL, &c->buffer, &offset);
+    (void)retval;
+}
+
+static void decodeOp(void *context) {
+    CodecCase *c = (CodecCase*)context;
+    size_t offset = 0;
+    UA_StatusCode retval = UA_decodeBinary(&c->encoded, &offset, c->decoded, c->type, 0, NULL);
+    (void)retval;
+    UA_deleteMembers(c->decoded, c->type);
+}
+
+static void benchCodec(const char *family, void *value, const UA_DataType *type) {
+    char name[64];
+    CodecCase c;
+    c.type = type;
+    c.value = value;
+    c.decoded = UA_new(type);
+    size_t size = UA_calcSizeBinary(value, type);
+    UA_ByteString_allocBuffer(&c.buffer, size);
+    size_t offset = 0;
+    UA_StatusCode retval = UA_encodeBinary(value, type, NULL, NULL, &c.buffer, &offset);
+    if(retval != UA_STATUSCODE_GOOD) {
+        fprintf(stderr, "%s: encoding failed with 0x%08x\n", family, retval);
+        UA_ByteString_deleteMembers(&c.buffer);
+        UA_delete(c.decoded, type);
+        return;
+    }
+    c.encoded = c.buffer;
+
+    snprintf(name, sizeof(name), "encode/%s", family);
+    Bench_run(name, encodeOp, &c, (double)size);
+    snprintf(name, sizeof(name), "decode/%s", family);
+    Bench_run(name, decodeOp, &c, (double)size);
+
+    UA_ByteString_deleteMembers(&c.buffer);
+    UA_delete(c.decoded, type);
+}
+
+static void benchEncoding(void) {
+    UA_Boolean b = true;
+    benchCodec("Boolean", &b, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    UA_Int32 int32 = -123456;
+    benchCodec("Int32", &int32, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Double d = 3.14159;
+    benchCodec("Double", &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_DateTime dt = UA_DateTime_now();
+    benchCodec("DateTime", &dt, &UA_TYPES[UA_TYPES_DATETIME]);
+    UA_Guid guid = UA_Guid_random();
+    benchCodec("Guid", &guid, &UA_TYPES[UA_TYPES_GUID]);
+
+    UA_String s = UA_STRING("a string of thirty-two characters");
+    benchCodec("String", &s, &UA_TYPES[UA_TYPES_STRING]);
+    UA_ByteString bs;
+    UA_ByteString_allocBuffer(&bs, 1024);
+    memset(bs.data, 0x5a, bs.length);
+    benchCodec("ByteString[1024]", &bs, &UA_TYPES[UA_TYPES_BYTESTRING]);
+    UA_ByteString_deleteMembers(&bs);
+
+    UA_NodeId numeric = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS);
+    benchCodec("NodeId/numeric", &numeric, &UA_TYPES[UA_TYPES_NODEID]);
+    UA_NodeId string = UA_NODEID_STRING(1, "plc.line1.motor.speed");
+    benchCodec("NodeId/string", &string, &UA_TYPES[UA_TYPES_NODEID]);
+    UA_LocalizedText text = UA_LOCALIZEDTEXT("en_US", "the answer");
+    benchCodec("LocalizedText", &text, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]);
+
+    UA_Variant scalar;
+    UA_Variant_setScalar(&scalar, &int32, &UA_TYPES[UA_TYPES_INT32]);
+    benchCodec("Variant/Int32", &scalar, &UA_TYPES[UA_TYPES_VARIANT]);
+    UA_Double doubles[1000];
+    for(size_t i = 0; i < 1000; i++)
+        doubles[i] = (UA_Double)i * 0.5;
+    UA_Variant array;
+    UA_Variant_setArray(&array, doubles, 1000, &UA_TYPES[UA_TYPES_DOUBLE]);
+    benchCodec("Variant/Double[1000]", &array, &UA_TYPES[UA_TYPES_VARIANT]);
+
+    UA_DataValue dv;
+    UA_DataValue_init(&dv);
+    UA_Variant_setScalar(&dv.value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    dv.hasValue = true;
+    dv.sourceTimestamp = dt;
+    dv.hasSourceTimestamp = true;
+    dv.serverTimestamp = dt;
+    dv.hasServerTimestamp = true;
+    benchCodec("DataValue", &dv, &UA_TYPES[UA_TYPES_DATAVALUE]);
+
+    /* structures: a Read of ten values and its response */
+    UA_ReadValueId rvis[10];
+    UA_DataValue values[10];
+    for(size_t i = 0; i < 10; i++) {
+        UA_ReadValueId_init(&rvis[i]);
+        rvis[i].nodeId = UA_NODEID_NUMERIC(1, (UA_UInt32)(1000 + i));
+        rvis[i].attributeId = UA_ATTRIBUTEID_VALUE;
+        values[i] = dv;
+    }
+    UA_ReadRequest rreq;
+    UA_ReadRequest_init(&rreq);
+    rreq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    rreq.nodesToRead = rvis;
+    rreq.nodesToReadSize = 10;
+    benchCodec("ReadRequest[10]", &rreq, &UA_TYPES[UA_TYPES_READREQUEST]);
+    UA_ReadResponse rresp;
+    UA_ReadResponse_init(&rresp);
+    rresp.results = values;
+    rresp.resultsSize = 10;
+    benchCodec("ReadResponse[10]", &rresp, &UA_TYPES[UA_TYPES_READRESPONSE]);
+}
+
+/**
+ * Services
+ * -------- */
+
+typedef struct {
+    UA_Server *server;
+    UA_ReadRequest read;
+    UA_BrowseRequest browse;
+} ServiceCase;
+
+static void readOp(void *context) {
+    ServiceCase *c = (ServiceCase*)context;
+    UA_ReadResponse response;
+    UA_ReadResponse_init(&response);
+    Service_Read(c->server, &adminSession, &c->read, &response);
+    UA_ReadResponse_deleteMembers(&response);
+}
+
+static void browseOp(void *context) {
+    ServiceCase *c = (ServiceCase*)context;
+    UA_BrowseResponse response;
+    UA_BrowseResponse_init(&response);
+    Service_Browse(c->server, &adminSession, &c->browse, &response);
+    UA_BrowseResponse_deleteMembers(&response);
+}
+
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+/* The session of a client whose responses are encoded and discarded */
+static UA_StatusCode
+discardGetSendBuffer(UA_Connection *connection, size_t length, UA_ByteString *buf) {
+    return UA_ByteString_allocBuffer(buf, length);
+}
+
+static void
+discardReleaseSendBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    UA_ByteString_deleteMembers(buf);
+}
+
+static UA_StatusCode
+discardSend(UA_Connection *connection, UA_ByteString *buf) {
+    UA_ByteString_deleteMembers(buf);
+    return UA_STATUSCODE_GOOD;
+}
+
+typedef struct {
+    UA_Server *server;
+    UA_Connection connection;
+    UA_SecureChannel channel;
+    UA_Session session;
+    UA_Subscription *sub;
+    UA_MonitoredItem *mon;
+    UA_NodeId node;
+    UA_Int32 value;
+    UA_UInt32 requestId;
+} PublishCase;
+
+/* one value change: sampled, published and encoded, then acknowledged with
+ * the next request */
+static void publishOp(void *context) {
+    PublishCase *c = (PublishCase*)context;
+    UA_Variant v;
+    c->value++;
+    UA_Variant_setScalar(&v, &c->value, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Server_writeValue(c->server, c->node, v);
+    UA_MoniteredItem_SampleCallback(c->server, c->mon);
+
+    UA_PublishRequest request;
+    UA_PublishRequest_init(&request);
+    UA_SubscriptionAcknowledgement ack;
+    if(c->sub->sequenceNumber > 0) {
+        ack.subscriptionId = c->sub->subscriptionID;
+        ack.sequenceNumber = c->sub->sequenceNumber;
+        request.subscriptionAcknowledgements = &ack;
+        request.subscriptionAcknowledgementsSize = 1;
+    }
+    Service_Publish(c->server, &c->session, &request, ++c->requestId);
+    UA_Subscription_publishCallback(c->server, c->sub);
+}
+
+static void
+initDiscardSession(UA_Connection *connection, UA_SecureChannel *channel,
+                   UA_Session *session) {
+    connection->state = UA_CONNECTION_ESTABLISHED;
+    connection->localConf = UA_ConnectionConfig_standard;
+    connection->remoteConf = UA_ConnectionConfig_standard;
+    connection->getSendBuffer = discardGetSendBuffer;
+    connection->releaseSendBuffer = discardReleaseSendBuffer;
+    connection->send = discardSend;
+    UA_SecureChannel_init(channel);
+    channel->connection = connection;
+    UA_Session_init(session);
+    session->activated = true;
+    session->channel = channel;
+}
+
+static UA_Subscription *
+createSubscription(UA_Server *server, UA_Session *session, UA_Double publishingInterval) {
+    UA_CreateSubscriptionRequest sreq;
+    UA_CreateSubscriptionRequest_init(&sreq);
+    sreq.publishingEnabled = true;
+    sreq.requestedPublishingInterval = publishingInterval;
+    sreq.requestedMaxKeepAliveCount = 10;
+    sreq.requestedLifetimeCount = 1000;
+    UA_CreateSubscriptionResponse sresp;
+    UA_CreateSubscriptionResponse_init(&sresp);
+    Service_CreateSubscription(server, session, &sreq, &sresp);
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(session, sresp.subscriptionId);
+    UA_CreateSubscriptionResponse_deleteMembers(&sresp);
+    return sub;
+}
+
+static void benchPublish(UA_Server *server, UA_NodeId node) {
+    if(!Bench_selected("Service_Publish"))
+        return;
+
+    PublishCase c;
+    memset(&c, 0, sizeof(c));
+    c.server = server;
+    c.node = node;
+    initDiscardSession(&c.connection, &c.channel, &c.session);
+    c.sub = createSubscription(server, &c.session, 1000.0);
+
+    UA_MonitoredItemCreateRequest item;
+    UA_MonitoredItemCreateRequest_init(&item);
+    item.itemToMonitor.nodeId = node;
+    item.itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+    item.monitoringMode = UA_MONITORINGMODE_REPORTING;
+    item.requestedParameters.samplingInterval = 1000.0;
+    item.requestedParameters.queueSize = 1;
+    item.requestedParameters.discardOldest = true;
+    UA_CreateMonitoredItemsRequest mreq;
+    UA_CreateMonitoredItemsRequest_init(&mreq);
+    mreq.subscriptionId = c.sub ? c.sub->subscriptionID : 0;
+    mreq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    mreq.itemsToCreate = &item;
+    mreq.itemsToCreateSize = 1;
+    UA_CreateMonitoredItemsResponse mresp;
+    UA_CreateMonitoredItemsResponse_init(&mresp);
+    Service_CreateMonitoredItems(server, &c.session, &mreq, &mresp);
+    if(c.sub && mresp.resultsSize == 1 && mresp.results[0].statusCode == UA_STATUSCODE_GOOD)
+        c.mon = UA_Subscription_getMonitoredItem(c.sub, mresp.results[0].monitoredItemId);
+    UA_CreateMonitoredItemsResponse_deleteMembers(&mresp);
+
+    if(c.mon)
+        Bench_run("Service_Publish", publishOp, &c, 0);
+    else
+        fprintf(stderr, "Service_Publish: could not create the monitored item\n");
+
+    UA_Session_deleteMembersCleanup(&c.session, server);
+    UA_SecureChannel_deleteMembersCleanup(&c.channel);
+}
+
+/* Monitored items on distinct variables that are sampled with the same
+ * interval but do not change. The clock of the repeated jobs is simulated. */
+
+#define SAMPLING_ITEMS 1000
+
+typedef struct {
+    UA_Server *server;
+    UA_DateTime now;
+} SamplingCase;
+
+static void samplingOp(void *context) {
+    SamplingCase *c = (SamplingCase*)context;
+    UA_Boolean dispatched = false;
+    c->now += 250 * UA_MSEC_TO_DATETIME;
+    UA_RepeatedJobsList_process(&c->server->repeatedJobs, c->now, &dispatched);
+}
+
+static void benchSampling(void) {
+    if(!Bench_selected("sampling/"))
+        return;
+
+    UA_ServerConfig config = UA_ServerConfig_standard;
+    config.logger = NULL;
+    UA_Server *server = UA_Server_new(config);
+    UA_Connection connection;
+    memset(&connection, 0, sizeof(connection));
+    UA_SecureChannel channel;
+    UA_Session session;
+    initDiscardSession(&connection, &channel, &session);
+    UA_Subscription *sub = createSubscription(server, &session, 3600000.0);
+
+    UA_MonitoredItemCreateRequest *items = (UA_MonitoredItemCreateRequest*)
+        UA_Array_new(SAMPLING_ITEMS, &UA_TYPES[UA_TYPES_MONITOREDITEMCREATEREQUEST]);
+    for(UA_UInt32 i = 0; i < SAMPLING_ITEMS; i++) {
+        UA_VariableAttributes attr;
+        UA_VariableAttributes_init(&attr);
+        UA_Double value = i;
+        UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+        attr.displayName = UA_LOCALIZEDTEXT("en_US", "sampled");
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+        UA_NodeId id = UA_NODEID_NUMERIC(1, 100000 + i);
+        UA_Server_addVariableNode(server, id, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "sampled"), UA_NODEID_NULL,
+                                  attr, NULL, NULL);
+        items[i].itemToMonitor.nodeId = id;
+        items[i].itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+        items[i].monitoringMode = UA_MONITORINGMODE_REPORTING;
+        items[i].requestedParameters.samplingInterval = 250.0;
+        items[i].requestedParameters.queueSize = 1;
+        items[i].requestedParameters.discardOldest = true;
+    }
+    UA_CreateMonitoredItemsRequest mreq;
+    UA_CreateMonitoredItemsRequest_init(&mreq);
+    mreq.subscriptionId = sub ? sub->subscriptionID : 0;
+    mreq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    mreq.itemsToCreate = items;
+    mreq.itemsToCreateSize = SAMPLING_ITEMS;
+    UA_CreateMonitoredItemsResponse mresp;
+    UA_CreateMonitoredItemsResponse_init(&mresp);
+    Service_CreateMonitoredItems(server, &session, &mreq, &mresp);
+    UA_CreateMonitoredItemsResponse_deleteMembers(&mresp);
+    UA_Array_delete(items, SAMPLING_ITEMS, &UA_TYPES[UA_TYPES_MONITOREDITEMCREATEREQUEST]);
+
+    /* the first sample is a change */
+    SamplingCase c;
+    c.server = server;
+    c.now = UA_DateTime_nowMonotonic();
+    samplingOp(&c);
+    Bench_run("sampling/Double[1000 items]", samplingOp, &c, 0);
+
+    UA_Session_deleteMembersCleanup(&session, server);
+    UA_SecureChannel_deleteMembersCleanup(&channel);
+    UA_Server_delete(server);
+}
+#endif
+
+static UA_NodeId addVariable(UA_Server *server) {
+    UA_VariableAttributes attr;
+    UA_VariableAttributes_init(&attr);
+    UA_Int32 value = 42;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    attr.displayName = UA_LOCALIZEDTEXT("en_US", "the answer");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+    UA_NodeId id = UA_NODEID_STRING(1, "the.answer");
+    UA_Server_addVariableNode(server, id, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                              UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                              UA_QUALIFIEDNAME(1, "the answer"), UA_NODEID_NULL,
+                              attr, NULL, NULL);
+    return id;
+}
+
+static void benchServices(void) {
+    UA_ServerConfig config = UA_ServerConfig_standard;
+    config.logger = NULL;
+    UA_Server *server = UA_Server_new(config);
+    UA_NodeId node = addVariable(server);
+
+    ServiceCase c;
+    c.server = server;
+    UA_ReadValueId rvi;
+    UA_ReadValueId_init(&rvi);
+    rvi.nodeId = node;
+    rvi.attributeId = UA_ATTRIBUTEID_VALUE;
+    UA_ReadRequest_init(&c.read);
+    c.read.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    c.read.nodesToRead = &rvi;
+    c.read.nodesToReadSize = 1;
+    Bench_run("Service_Read", readOp, &c, 0);
+
+    UA_BrowseDescription bd;
+    UA_BrowseDescription_init(&bd);
+    bd.nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+    bd.browseDirection = UA_BROWSEDIRECTION_FORWARD;
+    bd.resultMask = UA_BROWSERESULTMASK_ALL;
+    UA_BrowseRequest_init(&c.browse);
+    c.browse.nodesToBrowse = &bd;
+    c.browse.nodesToBrowseSize = 1;
+    Bench_run("Service_Browse", browseOp, &c, 0);
+
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    benchPublish(server, node);
+#endif
+
+    UA_Server_delete(server);
+}
+
+/**
+ * Repeated Jobs
+ * -------------
+ * Sampling jobs with a mix of intervals, added over time so that their phases
+ * differ. The clock is simulated, a tick advances it by 10ms. */
+
+#define TIMER_JOBS 5000
+
+typedef struct {
+    UA_RepeatedJobsList rjl;
+    UA_DateTime now;
+    size_t fired;
+} TimerCase;
+
+static void timerFire(void *context, UA_Job *job) {
+    ((TimerCase*)context)->fired++;
+}
+
+static void timerTickOp(void *context) {
+    TimerCase *c = (TimerCase*)context;
+    UA_Boolean dispatched = false;
+    c->now += 10 * UA_MSEC_TO_DATETIME;
+    UA_RepeatedJobsList_process(&c->rjl, c->now, &dispatched);
+}
+
+static void timerAddRemoveOp(void *context) {
+    TimerCase *c = (TimerCase*)context;
+    UA_Boolean dispatched = false;
+    UA_Job job;
+    job.type = UA_JOBTYPE_NOTHING;
+    UA_Guid id;
+    UA_RepeatedJobsList_addRepeatedJob(&c->rjl, job, 300, &id);
+    UA_RepeatedJobsList_process(&c->rjl, c->now, &dispatched);
+    UA_RepeatedJobsList_removeRepeatedJob(&c->rjl, id);
+    UA_RepeatedJobsList_process(&c->rjl, c->now, &dispatched);
+}
+
+static void benchTimer(void) {
+    if(!Bench_selected("timer/"))
+        return;
+
+    static const UA_UInt32 intervals[] = {100, 250, 500, 1000, 1500};
+    TimerCase c;
+    c.now = UA_DateTime_nowMonotonic();
+    c.fired = 0;
+    UA_RepeatedJobsList_init(&c.rjl, timerFire, &c);
+    UA_Job job;
+    job.type = UA_JOBTYPE_NOTHING;
+    for(size_t i = 0; i < TIMER_JOBS; i++) {
+        UA_RepeatedJobsList_addRepeatedJob(&c.rjl, job, intervals[i % 5], NULL);
+        if(i % 50 == 49) {
+            UA_Boolean dispatched = false;
+            c.now += 7 * UA_MSEC_TO_DATETIME;
+            UA_RepeatedJobsList_process(&c.rjl, c.now, &dispatched);
+        }
+    }
+
+    Bench_run("timer/tick[5000 jobs]", timerTickOp, &c, 0);
+    Bench_run("timer/addRemove[5000 jobs]", timerAddRemoveOp, &c, 0);
+    UA_RepeatedJobsList_deleteMembers(&c.rjl);
+}
+
+/**
+ * Chunks
+ * ------
+ * A Read response of 4 MB in chunks of the standard 64 KB. "recv" reassembles
+ * it from a connection that reads the way the TCP layer does. The first read
+ * is short, so the reads start off the chunk boundaries. The reassembled
+ * message is decoded once to check it, decoding is not part of the case.
+ * "send" encodes and sends it over a TCP connection to loopback, where a
+ * thread reads and drops it. */
+
+#define LARGE_VALUE 500000
+
+typedef struct {
+    UA_Connection connection;
+    UA_SecureChannel channel;
+    UA_ByteString stream;
+    size_t streamSize;
+    UA_Boolean verify;
+    size_t messages;
+    size_t decoded;
+} ChunkCase;
+
+static UA_StatusCode
+chunkGetSendBuffer(UA_Connection *connection, size_t length, UA_ByteString *buf) {
+    return UA_ByteString_allocBuffer(buf, length);
+}
+
+static void
+chunkReleaseSendBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    UA_ByteString_deleteMembers(buf);
+}
+
+/* the received buffers point into the stream */
+static void
+chunkReleaseRecvBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    *buf = UA_BYTESTRING_NULL;
+}
+
+/* the stream collects the sent chunks */
+static UA_StatusCode
+chunkSend(UA_Connection *connection, UA_ByteString *buf) {
+    ChunkCase *c = (ChunkCase*)connection->handle;
+    if(c->stream.length + buf->length > c->streamSize) {
+        c->streamSize = 2 * (c->stream.length + buf->length);
+        c->stream.data = (UA_Byte*)UA_realloc(c->stream.data, c->streamSize);
+    }
+    memcpy(&c->stream.data[c->stream.length], buf->data, buf->length);
+    c->stream.length += buf->length;
+    UA_ByteString_deleteMembers(buf);
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+chunkProcess(void *application, UA_SecureChannel *channel, UA_MessageType messageType,
+             UA_UInt32 requestId, const UA_ByteString *message) {
+    ChunkCase *c = (ChunkCase*)application;
+    c->messages++;
+    if(!c->verify)
+        return;
+    size_t offset = 0;
+    UA_NodeId typeId;
+    UA_ReadResponse response;
+    if(UA_decodeBinary(message, &offset, &typeId, &UA_TYPES[UA_TYPES_NODEID], 0, NULL) != UA_STATUSCODE_GOOD)
+        return;
+    if(UA_decodeBinary(message, &offset, &response, &UA_TYPES[UA_TYPES_READRESPONSE],
+                       0, NULL) != UA_STATUSCODE_GOOD)
+        return;
+    if(response.resultsSize == 1 && response.results[0].value.arrayLength == LARGE_VALUE)
+        c->decoded++;
+    UA_ReadResponse_deleteMembers(&response);
+}
+
+/* as much as the TCP layer reads, the rest of a half-received chunk at most */
+static size_t chunkRecvSize(const UA_Connection *connection) {
+    size_t size = connection->localConf.recvBufferSize;
+    const UA_ByteString *incomplete = &connection->incompleteMessage;
+    if(incomplete->length < 8)
+        return size;
+    size_t chunkLength = (size_t)incomplete->data[4] + ((size_t)incomplete->data[5] << 8) +
+        ((size_t)incomplete->data[6] << 16) + ((size_t)incomplete->data[7] << 24);
+    if(chunkLength > incomplete->length && chunkLength - incomplete->length < size)
+        size = chunkLength - incomplete->length;
+    return size;
+}
+
+static void reassembleOp(void *context) {
+    ChunkCase *c = (ChunkCase*)context;
+    c->channel.receiveSequenceNumber = 0;
+    size_t offset = 0;
+    size_t first = 1000;
+    while(offset < c->stream.length) {
+        size_t size = chunkRecvSize(&c->connection);
+        if(size > first)
+            size = first;
+        if(size > c->stream.length - offset)
+            size = c->stream.length - offset;
+        first = c->connection.localConf.recvBufferSize;
+        UA_ByteString message = {size, &c->stream.data[offset]};
+        offset += size;
+        UA_Boolean realloced = false;
+        if(UA_Connection_completeMessages(&c->connection, &message, &realloced) != UA_STATUSCODE_GOOD)
+            return;
+        if(message.length > 0)
+            UA_SecureChannel_processChunks(&c->channel, &message, chunkProcess, c);
+        if(realloced)
+            UA_ByteString_deleteMembers(&message);
+    }
+}
+
+typedef struct {
+    UA_Connection connection;
+    UA_SecureChannel channel;
+    const UA_ReadResponse *response;
+    int listener;
+    int socket;
+} ChunkSendCase;
+
+static void *chunkDrain(void *context) {
+    ChunkSendCase *c = (ChunkSendCase*)context;
+    c->socket = accept(c->listener, NULL, NULL);
+    char buf[65536];
+    while(c->socket >= 0 && recv(c->socket, buf, sizeof(buf), 0) > 0) {}
+    return NULL;
+}
+
+static void sendOp(void *context) {
+    ChunkSendCase *c = (ChunkSendCase*)context;
+    UA_StatusCode retval = UA_SecureChannel_sendBinaryMessage(&c->channel, 1, c->response,
+                                                              &UA_TYPES[UA_TYPES_READRESPONSE]);
+    (void)retval;
+}
+
+static void benchChunkSend(const char *name, UA_UInt32 chunkSize,
+                           const UA_ReadResponse *response, size_t size) {
+    ChunkSendCase c;
+    memset(&c, 0, sizeof(c));
+    c.response = response;
+    c.socket = -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT + 1);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    c.listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(c.listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(c.listener < 0 || bind(c.listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(c.listener, 1) != 0) {
+        fprintf(stderr, "chunks: can't listen on port %d\n", BENCH_PORT + 1);
+        if(c.listener >= 0)
+            close(c.listener);
+        return;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, chunkDrain, &c);
+
+    char url[64];
+    snprintf(url, sizeof(url), "opc.tcp://127.0.0.1:%d", BENCH_PORT + 1);
+    UA_ConnectionConfig conf = UA_ConnectionConfig_standard;
+    conf.sendBufferSize = chunkSize;
+    c.connection = UA_ClientConnectionTCP(conf, url, NULL);
+    if(c.connection.state == UA_CONNECTION_OPENING) {
+        UA_SecureChannel_init(&c.channel);
+        c.channel.securityToken.channelId = 1;
+        c.channel.securityToken.tokenId = 1;
+        c.channel.connection = &c.connection;
+        Bench_run(name, sendOp, &c, (double)size);
+        c.channel.connection = NULL;
+        UA_SecureChannel_deleteMembersCleanup(&c.channel);
+        c.connection.close(&c.connection);
+    } else {
+        fprintf(stderr, "chunks: connect failed\n");
+        shutdown(c.listener, SHUT_RDWR);
+    }
+    UA_Connection_deleteMembers(&c.connection);
+
+    pthread_join(thread, NULL);
+    if(c.socket >= 0)
+        close(c.socket);
+    close(c.listener);
+}
+
+static void benchChunks(void) {
+    if(!Bench_selected("chunks/"))
+        return;
+
+    ChunkCase c;
+    memset(&c, 0, sizeof(c));
+    c.connection.state = UA_CONNECTION_ESTABLISHED;
+    c.connection.localConf = UA_ConnectionConfig_standard;
+    c.connection.remoteConf = UA_ConnectionConfig_standard;
+    c.connection.handle = &c;
+    c.connection.getSendBuffer = chunkGetSendBuffer;
+    c.connection.releaseSendBuffer = chunkReleaseSendBuffer;
+    c.connection.send = chunkSend;
+    c.connection.releaseRecvBuffer = chunkReleaseRecvBuffer;
+    UA_SecureChannel_init(&c.channel);
+    c.channel.securityToken.channelId = 1;
+    c.channel.securityToken.tokenId = 1;
+    c.channel.connection = &c.connection;
+
+    /* encode the response into the stream once */
+    UA_Double *values = (UA_Double*)UA_Array_new(LARGE_VALUE, &UA_TYPES[UA_TYPES_DOUBLE]);
+    for(size_t i = 0; i < LARGE_VALUE; i++)
+        values[i] = (UA_Double)i * 0.5;
+    UA_DataValue dv;
+    UA_DataValue_init(&dv);
+    UA_Variant_setArray(&dv.value, values, LARGE_VALUE, &UA_TYPES[UA_TYPES_DOUBLE]);
+    dv.hasValue = true;
+    UA_ReadResponse response;
+    UA_ReadResponse_init(&response);
+    response.results = &dv;
+    response.resultsSize = 1;
+    UA_StatusCode retval = UA_SecureChannel_sendBinaryMessage(&c.channel, 1, &response,
+                                                              &UA_TYPES[UA_TYPES_READRESPONSE]);
+    benchChunkSend("chunks/send/ReadResponse[4MB]", 65535, &response, c.stream.length);
+    benchChunkSend("chunks/send8k/ReadResponse[4MB]", 8192, &response, c.stream.length);
+    UA_Array_delete(values, LARGE_VALUE, &UA_TYPES[UA_TYPES_DOUBLE]);
+
+    if(retval == UA_STATUSCODE_GOOD) {
+        c.verify = true;
+        reassembleOp(&c);
+        c.verify = false;
+        if(c.messages != 1 || c.decoded != 1)
+            fprintf(stderr, "chunks: the response was not reassembled\n");
+        else
+            Bench_run("chunks/recv/ReadResponse[4MB]", reassembleOp, &c, (double)c.stream.length);
+    } else {
+        fprintf(stderr, "chunks: encoding failed with 0x%08x\n", retval);
+    }
+
+    UA_Connection_deleteMembers(&c.connection);
+    c.channel.connection = NULL;
+    UA_SecureChannel_deleteMembersCleanup(&c.channel);
+    UA_ByteString_deleteMembers(&c.stream);
+}
+
+/**
+ * Client Round Trips
+ * ------------------ */
+
+typedef struct {
+    UA_Server *server;
+    volatile UA_Boolean running;
+    UA_Client *client;
+    UA_NodeId node;
+    UA_Int32 value;
+} RoundTripCase;
+
+static void *serverLoop(void *context) {
+    RoundTripCase *c = (RoundTripCase*)context;
+    while(c->running)
+        UA_Server_run_iterate(c->server, true);
+    return NULL;
+}
+
+static void clientReadOp(void *context) {
+    RoundTripCase *c = (RoundTripCase*)context;
+    UA_Variant v;
+    UA_Variant_init(&v);
+    UA_StatusCode retval = UA_Client_readValueAttribute(c->client, c->node, &v);
+    (void)retval;
+    UA_Variant_deleteMembers(&v);
+}
+
+static void clientWriteOp(void *context) {
+    RoundTripCase *c = (RoundTripCase*)context;
+    UA_Variant v;
+    c->value++;
+    UA_Variant_setScalar(&v, &c->value, &UA_TYPES[UA_TYPES_INT32]);
+    UA_StatusCode retval = UA_Client_writeValueAttribute(c->client, c->node, &v);
+    (void)retval;
+}
+
+static void clientBrowseOp(void *context) {
+    RoundTripCase *c = (RoundTripCase*)context;
+    UA_BrowseRequest request;
+    UA_BrowseRequest_init(&request);
+    UA_BrowseDescription bd;
+    UA_BrowseDescription_init(&bd);
+    bd.nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+    bd.browseDirection = UA_BROWSEDIRECTION_FORWARD;
+    bd.resultMask = UA_BROWSERESULTMASK_ALL;
+    request.nodesToBrowse = &bd;
+    request.nodesToBrowseSize = 1;
+    UA_BrowseResponse response = UA_Client_Service_browse(c->client, request);
+    UA_BrowseResponse_deleteMembers(&response);
+}
+
+typedef UA_ServerNetworkLayer (*NetworkLayerConstructor)(UA_ConnectionConfig conf, UA_UInt16 port);
+
+/* idle clients connect without saying hello, the server keeps them open */
+static size_t connectIdle(int *sockets, size_t count) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    size_t i = 0;
+    for(; i < count; i++) {
+        sockets[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if(sockets[i] < 0 || connect(sockets[i], (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if(sockets[i] >= 0)
+                close(sockets[i]);
+            break;
+        }
+    }
+    return i;
+}
+
+static void benchRoundTrips(const char *prefix, NetworkLayerConstructor layer, size_t idle) {
+    if(!Bench_selected(prefix))
+        return;
+
+    RoundTripCase c;
+    memset(&c, 0, sizeof(c));
+    UA_ServerConfig config = UA_ServerConfig_standard;
+    config.logger = NULL;
+    UA_ServerNetworkLayer nl = layer(UA_ConnectionConfig_standard, BENCH_PORT);
+    config.networkLayers = &nl;
+    config.networkLayersSize = 1;
+    c.server = UA_Server_new(config);
+    c.node = addVariable(c.server);
+    UA_Server_run_startup(c.server);
+    c.running = true;
+    pthread_t thread;
+    pthread_create(&thread, NULL, serverLoop, &c);
+
+    int *sockets = (int*)calloc(idle > 0 ? idle : 1, sizeof(int));
+    size_t idleSize = connectIdle(sockets, idle);
+
+    UA_ClientConfig cc = UA_ClientConfig_standard;
+    cc.logger = NULL;
+    c.client = UA_Client_new(cc);
+    char url[64];
+    snprintf(url, sizeof(url), "opc.tcp://localhost:%d", BENCH_PORT);
+    UA_StatusCode retval = UA_Client_connect(c.client, url);
+    if(retval == UA_STATUSCODE_GOOD) {
+        char name[64];
+        snprintf(name, sizeof(name), "%sRead", prefix);
+        Bench_run(name, clientReadOp, &c, 0);
+        snprintf(name, sizeof(name), "%sWrite", prefix);
+        Bench_run(name, clientWriteOp, &c, 0);
+        snprintf(name, sizeof(name), "%sBrowse", prefix);
+        Bench_run(name, clientBrowseOp, &c, 0);
+        UA_Client_disconnect(c.client);
+    } else {
+        fprintf(stderr, "client: connect failed with 0x%08x\n", retval);
+    }
+    UA_Client_delete(c.client);
+
+    for(size_t i = 0; i < idleSize; i++)
+        close(sockets[i]);
+    free(sockets);
+
+    c.running = false;
+    pthread_join(thread, NULL);
+    UA_Server_run_shutdown(c.server);
+    UA_Server_delete(c.server);
+    nl.deleteMembers(&nl);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    const char *output = NULL;
+    double budget = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "f:t:o:h")) != -1) {
+        switch(opt) {
+        case 'f': filter = optarg; break;
+        case 't': budget = atof(optarg); break;
+        case 'o': output = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-f filter] [-t seconds per case] [-o results.json]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    char version[32];
+    snprintf(version, sizeof(version), "%d.%d.%d%s", UA_OPEN62541_VER_MAJOR,
+             UA_OPEN62541_VER_MINOR, UA_OPEN62541_VER_PATCH, UA_OPEN62541_VER_LABEL);
+    if(Bench_init("open62541", version, filter, budget, output) != 0)
+        return 2;
+
+    benchEncoding();
+    benchServices();
+    benchTimer();
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    benchSampling();
+#endif
+    benchChunks();
+    benchRoundTrips("client/", UA_ServerNetworkLayerTCP, 0);
+    /* select is limited to FD_SETSIZE descriptors */
+    benchRoundTrips("client/idle500/select/", UA_ServerNetworkLayerTCP, 500);
+#ifdef __linux__
+    benchRoundTrips("client/idle500/epoll/", UA_ServerNetworkLayerTCP_epoll, 500);
+#endif
+
+    return Bench_finish();
+}
@@ -0,0 +1,201 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef _XOPEN_SOURCE
+# define _XOPEN_SOURCE 600 /* clock_gettime, getopt */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "benchmark.h"
+
+#define BENCH_MAX_RESULTS 256
+#define BENCH_MAX_SAMPLES 100000
+#define BENCH_MIN_BATCH_NS 10000ULL
+
+/**
+ * Allocation Counting
+ * ------------------- */
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long long allocations;
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+long long Bench_allocations(void) {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+#else
+long long Bench_allocations(void) {
+    return -1;
+}
+#endif
+
+unsigned long long Bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Runs
+ * ---- */
+
+static const char *suite = "";
+static const char *version = "";
+static const char *filter = NULL;
+static const char *output = NULL;
+static double budget = 0.5;
+
+static Bench_Result results[BENCH_MAX_RESULTS];
+static char names[BENCH_MAX_RESULTS][64]; /* the names of the callers may be temporary */
+static size_t resultsSize;
+static double *samples;
+
+int Bench_init(const char *suiteName, const char *suiteVersion, const char *filterText,
+               double budgetSecs, const char *outputFile) {
+    suite = suiteName;
+    version = suiteVersion;
+    filter = filterText;
+    output = outputFile;
+    if(budgetSecs > 0)
+        budget = budgetSecs;
+    samples = (double*)malloc(BENCH_MAX_SAMPLES * sizeof(double));
+    if(!samples)
+        return 1;
+    printf("%-40s %12s %12s %10s %10s %12s %12s\n", "case", "iterations",
+           "ns/op", "allocs/op", "bytes/op", "p50 ns", "p99 ns");
+    return 0;
+}
+
+int Bench_selected(const char *name) {
+    return !filter || strstr(name, filter) != NULL;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t size, double q) {
+    size_t i = (size_t)(q * (double)(size - 1) + 0.5);
+    return sorted[i];
+}
+
+void Bench_run(const char *name, Bench_Operation op, void *context, double bytesPerOp) {
+    if(!Bench_selected(name))
+        return;
+
+    /* warm up and size the batches */
+    op(context);
+    size_t batch = 1;
+    for(;;) {
+        unsigned long long start = Bench_now();
+        for(size_t i = 0; i < batch; i++)
+            op(context);
+        if(Bench_now() - start >= BENCH_MIN_BATCH_NS || batch >= (1 << 24))
+            break;
+        batch *= 2;
+    }
+
+    size_t batches = 0;
+    size_t iterations = 0;
+    unsigned long long total = 0;
+    unsigned long long limit = (unsigned long long)(budget * 1e9);
+    long long allocs = Bench_allocations();
+    while(batches < BENCH_MAX_SAMPLES && (total < limit || batches < 10)) {
+        unsigned long long start = Bench_now();
+        for(size_t i = 0; i < batch; i++)
+            op(context);
+        unsigned long long elapsed = Bench_now() - start;
+        samples[batches++] = (double)elapsed / (double)batch;
+        iterations += batch;
+        total += elapsed;
+    }
+    long long allocsAfter = Bench_allocations();
+
+    qsort(samples, batches, sizeof(double), compareDouble);
+    Bench_Result r;
+    r.name = name;
+    r.iterations = iterations;
+    r.nsPerOp = (double)total / (double)iterations;
+    r.allocsPerOp = allocs < 0 ? -1 : (double)(allocsAfter - allocs) / (double)iterations;
+    r.bytesPerOp = bytesPerOp;
+    r.p50 = percentile(samples, batches, 0.5);
+    r.p90 = percentile(samples, batches, 0.9);
+    r.p99 = percentile(samples, batches, 0.99);
+    r.max = samples[batches - 1];
+    Bench_report(&r);
+}
+
+void Bench_report(const Bench_Result *result) {
+    printf("%-40s %12zu %12.1f %10.2f %10.0f %12.1f %12.1f\n", result->name,
+           result->iterations, result->nsPerOp, result->allocsPerOp,
+           result->bytesPerOp, result->p50, result->p99);
+    fflush(stdout);
+    if(resultsSize < BENCH_MAX_RESULTS) {
+        snprintf(names[resultsSize], sizeof(names[resultsSize]), "%s", result->name);
+        results[resultsSize] = *result;
+        results[resultsSize].name = names[resultsSize];
+        resultsSize++;
+    }
+}
+
+static void writeString(FILE *f, const char *s) {
+    fputc('"', f);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+int Bench_finish(void) {
+    free(samples);
+    samples = NULL;
+    if(!output)
+        return 0;
+
+    FILE *f = fopen(output, "w");
+    if(!f) {
+        fprintf(stderr, "cannot write %s\n", output);
+        return 1;
+    }
+    fprintf(f, "{\"suite\": ");
+    writeString(f, suite);
+    fprintf(f, ", \"version\": ");
+    writeString(f, version);
+    fprintf(f, ", \"time\": %lld, \"results\": [", (long long)time(NULL));
+    for(size_t i = 0; i < resultsSize; i++) {
+        const Bench_Result *r = &results[i];
+        fprintf(f, "%s\n  {\"name\": ", i > 0 ? "," : "");
+        writeString(f, r->name);
+        fprintf(f, ", \"iterations\": %zu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+                "\"bytes_per_op\": %.1f, \"p50_ns\": %.2f, \"p90_ns\": %.2f, "
+                "\"p99_ns\": %.2f, \"max_ns\": %.2f}", r->iterations, r->nsPerOp,
+                r->allocsPerOp, r->bytesPerOp, r->p50, r->p90, r->p99, r->max);
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * Benchmark Harness
+ * -----------------
+ * An operation is run in batches of calibrated size (at least 10us per
+ * batch), until the time budget of the case is spent. The result has the mean
+ * ns/op, the percentiles of ns/op over the batches (an operation slower than
+ * 10us is timed one by one), and the heap allocations per operation of the
+ * whole process, counted by wrapping malloc (glibc only, -1 elsewhere).
+ *
+ * Command line of bench_library:
+ *
+ *   -f <text>    run only the cases whose name contains the text
+ *   -t <secs>    time budget per case (default 0.5)
+ *   -o <file>    write the results as JSON
+ *
+ * The JSON output is one object per run:
+ *
+ *   {"suite": "open62541", "version": "0.3.0-mqtt", "time": 1500000000,
+ *    "results": [{"name": "encode/Int32", "iterations": 1000000,
+ *                 "ns_per_op": 5.1, "allocs_per_op": 0, "bytes_per_op": 4,
+ *                 "p50_ns": 5.0, "p90_ns": 5.3, "p99_ns": 7.9, "max_ns": 40.2}]} */
+
+typedef void (*Bench_Operation)(void *context);
+
+typedef struct {
+    const char *name;
+    size_t iterations;
+    double nsPerOp;
+    double allocsPerOp;
+    double bytesPerOp;
+    double p50, p90, p99, max; /* ns per op */
+} Bench_Result;
+
+/* filter and output may be NULL, budget is in seconds per case (<= 0 for the
+ * default). Returns nonzero if out of memory. */
+int Bench_init(const char *suite, const char *version, const char *filter,
+               double budget, const char *output);
+
+int Bench_selected(const char *name);
+
+/* Runs and reports a case if it is selected. bytesPerOp is informational
+ * (e.g. the encoded size), 0 if it doesn't apply. */
+void Bench_run(const char *name, Bench_Operation op, void *context, double bytesPerOp);
+
+/* Reports a result measured by the caller */
+void Bench_report(const Bench_Result *result);
+
+/* Writes the JSON file. Returns nonzero if that failed. */
+int Bench_finish(void);
+
+/* Allocations since the start of the process, -1 if not counted */
+long long Bench_allocations(void);
+
+/* Monotonic clock in ns */
+unsigned long long Bench_now(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* BENCHMARK_H_ */
@@ -188,6 +188,17 @@ UA_StatusCode UA_EXPORT UA_Client_disconnect(UA_Client *client);
 /* Renew the underlying secure channel */
 UA_StatusCode UA_EXPORT UA_Client_manuallyRenewSecureChannel(UA_Client *client);
 
+/* Renew the underlying secure channel now, even if the renewal is not yet due */
+UA_StatusCode UA_EXPORT UA_Client_renewSecureChannel(UA_Client *client);
+
+/* Recover from a broken connection without losing the session. A new
+ * connection and secure channel are opened to the endpoint the client was
+ * connected to and the existing session is activated on them. The
+ * subscriptions of the session continue, notifications missed in between are
+ * republished by the next publish requests. Fails if the server no longer
+ * knows the session, a full connect is needed then. */
+UA_StatusCode UA_EXPORT UA_Client_reconnect(UA_Client *client);
+
 /**
  * .. _client-services:
  *
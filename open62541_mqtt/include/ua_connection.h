@@ -66,7 +66,11 @@ struct UA_Connection {
                                         simplifies the design. */
     void *handle;                    /* A pointer to internal data */
     UA_ByteString incompleteMessage; /* A half-received message (TCP is a
-                                        streaming protocol) is stored here */
+                                        streaming protocol) is stored here.
+                                        Once its header is in, the buffer
+                                        holds the full chunk. A network layer
+                                        may then read only the rest of the
+                                        chunk. */
 
     /* Get a buffer for sending */
     UA_StatusCode (*getSendBuffer)(UA_Connection *connection, size_t length,
@@ -83,6 +87,17 @@ struct UA_Connection {
      * @return Returns an error code or UA_STATUSCODE_GOOD. */
     UA_StatusCode (*send)(UA_Connection *connection, UA_ByteString *buf);
 
+    /* Optional. Sends several message buffers in order, in as few system
+     * calls as possible. The buffers are always freed, even if sending fails.
+     * Without it, send is called for every buffer.
+     *
+     * @param connection The connection
+     * @param bufs The message buffers
+     * @param bufsSize The number of message buffers
+     * @return Returns an error code or UA_STATUSCODE_GOOD. */
+    UA_StatusCode (*sendv)(UA_Connection *connection, UA_ByteString *bufs,
+                           size_t bufsSize);
+
     /* Receive a message from the remote connection
      *
      * @param connection The connection
@@ -101,6 +116,10 @@ struct UA_Connection {
 
     /* Close the connection */
     void (*close)(UA_Connection *connection);
+
+    /* Optional. Frees the internal data of the connection, called from
+     * UA_Connection_deleteMembers when all buffers are released */
+    void (*cleanup)(UA_Connection *connection);
 };
 
 void UA_EXPORT UA_Connection_deleteMembers(UA_Connection *connection);
@@ -55,6 +55,14 @@ struct UA_ServerNetworkLayer {
      *         an error has occurred. */
     size_t (*getJobs)(UA_ServerNetworkLayer *nl, UA_Job **jobs, UA_UInt16 timeout);
 
+    /* Optional. Takes back the jobs array of getJobs after the jobs were
+     * dispatched, for network layers that reuse the array. When it is NULL,
+     * the array is freed with UA_free.
+     *
+     * @param nl The network layer
+     * @param jobs The jobs array returned by getJobs */
+    void (*releaseJobs)(UA_ServerNetworkLayer *nl, UA_Job *jobs);
+
     /* Closes the network connection and returns all the jobs that need to be
      * finished before the network layer can be safely deleted.
      *
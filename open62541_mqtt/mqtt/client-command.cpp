@@ -0,0 +1,1020 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodeid.h"
+#include "client-topology.h"
+#include "client-command.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-realtime.h"
+#include "json.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+/* calls and node ids outside the node-map can't tell the server themselves */
+#define SERVER_REQUIRED "\"server\" is required with more than one opcuaServer"
+
+/* commands waiting for the next interval, more are refused */
+#define QUEUE_MAX 10000
+
+/* tcp command connections, and the longest line taken from one */
+#define CONNECTIONS_MAX 16
+#define LINE_MAX 65536
+
+typedef struct Command {
+	int origin;
+	unsigned long connection;
+	uint64_t received;
+	json_object* request;
+	json_object* reply;		/* the answer, built while the command is served */
+	json_object* results;	/* write: status per key, call: the outputs */
+	UA_StatusCode status;
+	int endpoint;			/* "server" of the command, -1 = by node */
+	bool call;
+} Command;
+
+/* one node of the Write request of a server */
+typedef struct Write {
+	string id;
+	json_object* value;		/* the last one of the interval */
+	UA_StatusCode result;
+} Write;
+
+/* what a server gets in one interval */
+typedef struct Batch {
+	map<string, size_t> index;
+	vector<Write> writes;
+	vector<Command*> calls;
+} Batch;
+
+/* a key of a write command and the node it went to */
+typedef struct Target {
+	Command* command;
+	string key;
+	int endpoint;			/* -1 = refused */
+	size_t write;
+	UA_StatusCode refused;
+} Target;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueSignal = PTHREAD_COND_INITIALIZER;
+static vector<Command*> queue;
+
+/* value types of written nodes and argument types of methods, per server.
+ * only the command thread uses them. */
+static map<string, const UA_DataType*> nodeTypes[UAMQ_MAX_ENDPOINTS];
+static map<string, vector<const UA_DataType*> > argumentTypes[UAMQ_MAX_ENDPOINTS];
+
+/* a tcp command connection. answers are sent without connectionLock, a slow
+ * client only holds up its own answers; the socket is closed when the last
+ * answer on it is out. */
+typedef struct Connection {
+	int fd;
+	int users;					/* the listener and the answers being sent */
+	pthread_mutex_t sending;	/* keeps the lines of concurrent answers apart */
+} Connection;
+
+/* open tcp command connections by number, the answers go back on them */
+static pthread_mutex_t connectionLock = PTHREAD_MUTEX_INITIALIZER;
+static map<unsigned long, Connection*> connections;
+
+/* with connectionLock held */
+static void connection_release(Connection* c)
+{
+	if(--c->users == 0) {
+		close(c->fd);
+		pthread_mutex_destroy(&c->sending);
+		delete c;
+	}
+}
+
+static int answered[2][2] = { { -1, -1 }, { -1, -1 } };	/* [call][failed] */
+static int invalid = -1;
+static int seconds = -1;
+
+static void send_all(int fd, const char* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+		if(w <= 0) {
+			return;
+		}
+		p += w;
+		len -= (size_t)w;
+	}
+}
+
+//===================================================================================================================================================================
+// values
+
+static bool is_node_id(const char* s)
+{
+	return !strncmp(s, "ns=", 3) || !strncmp(s, "i=", 2) || !strncmp(s, "s=", 2);
+}
+
+static bool valid_node_id(const char* s)
+{
+	UA_NodeId ua;
+	if(getUA_NodeID(s, &ua) != UA_STATUSCODE_GOOD) {
+		return false;
+	}
+	UA_NodeId_deleteMembers(&ua);
+	return true;
+}
+
+/* the id was validated when the command was taken in */
+static UA_NodeId node_id(const string& id)
+{
+	UA_NodeId ua;
+	getUA_NodeID(id.c_str(), &ua);
+	return ua;
+}
+
+/* the type a JSON value is written as when the server doesn't tell */
+static const UA_DataType* inferred(json_object* v)
+{
+	switch(json_object_get_type(v)) {
+		case json_type_boolean : return &UA_TYPES[UA_TYPES_BOOLEAN];
+		case json_type_int : {
+			int64_t n = json_object_get_int64(v);
+			return n >= INT32_MIN && n <= INT32_MAX ? &UA_TYPES[UA_TYPES_INT32] : &UA_TYPES[UA_TYPES_INT64];
+		}
+		case json_type_double : return &UA_TYPES[UA_TYPES_DOUBLE];
+		case json_type_string : return &UA_TYPES[UA_TYPES_STRING];
+		case json_type_array : return json_object_array_length(v) > 0 ? inferred(json_object_array_get_idx(v, 0)) : NULL;
+		default : return NULL;
+	}
+}
+
+static UA_StatusCode integer(json_object* v, int64_t lo, int64_t hi, int64_t* out)
+{
+	enum json_type t = json_object_get_type(v);
+	if(t == json_type_double) {
+		double d = json_object_get_double(v);
+		if(d != (double)(int64_t)d) {
+			return UA_STATUSCODE_BADTYPEMISMATCH;
+		}
+	} else if(t != json_type_int && t != json_type_boolean) {
+		return UA_STATUSCODE_BADTYPEMISMATCH;
+	}
+	*out = json_object_get_int64(v);
+	return *out < lo || *out > hi ? UA_STATUSCODE_BADOUTOFRANGE : UA_STATUSCODE_GOOD;
+}
+
+/* converts a JSON scalar into the memory of a value of the type */
+static UA_StatusCode to_scalar(json_object* v, const UA_DataType* type, void* p)
+{
+	int64_t n = 0;
+	UA_StatusCode rc = UA_STATUSCODE_GOOD;
+	enum json_type t = json_object_get_type(v);
+
+	switch(type->typeIndex) {
+		case UA_TYPES_BOOLEAN : {
+			if(t != json_type_boolean && t != json_type_int) {
+				return UA_STATUSCODE_BADTYPEMISMATCH;
+			}
+			*(UA_Boolean*)p = json_object_get_boolean(v);
+		}
+		break;
+		case UA_TYPES_SBYTE : if((rc = integer(v, INT8_MIN, INT8_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_SByte*)p = (UA_SByte)n; break;
+		case UA_TYPES_BYTE : if((rc = integer(v, 0, UINT8_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_Byte*)p = (UA_Byte)n; break;
+		case UA_TYPES_INT16 : if((rc = integer(v, INT16_MIN, INT16_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_Int16*)p = (UA_Int16)n; break;
+		case UA_TYPES_UINT16 : if((rc = integer(v, 0, UINT16_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_UInt16*)p = (UA_UInt16)n; break;
+		case UA_TYPES_INT32 : if((rc = integer(v, INT32_MIN, INT32_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_Int32*)p = (UA_Int32)n; break;
+		case UA_TYPES_UINT32 : if((rc = integer(v, 0, UINT32_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_UInt32*)p = (UA_UInt32)n; break;
+		case UA_TYPES_INT64 : if((rc = integer(v, INT64_MIN, INT64_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_Int64*)p = n; break;
+		case UA_TYPES_UINT64 : if((rc = integer(v, 0, INT64_MAX, &n)) == UA_STATUSCODE_GOOD) *(UA_UInt64*)p = (UA_UInt64)n; break;
+		case UA_TYPES_FLOAT :
+		case UA_TYPES_DOUBLE : {
+			if(t != json_type_double && t != json_type_int) {
+				return UA_STATUSCODE_BADTYPEMISMATCH;
+			}
+			if(type->typeIndex == UA_TYPES_FLOAT) {
+				*(UA_Float*)p = (UA_Float)json_object_get_double(v);
+			} else {
+				*(UA_Double*)p = json_object_get_double(v);
+			}
+		}
+		break;
+		case UA_TYPES_STRING : {
+			if(t != json_type_string) {
+				return UA_STATUSCODE_BADTYPEMISMATCH;
+			}
+			*(UA_String*)p = UA_STRING_ALLOC(json_object_get_string(v));
+		}
+		break;
+		default : return UA_STATUSCODE_BADNOTSUPPORTED;
+	}
+	return rc;
+}
+
+/* a JSON scalar or array as a variant of the type, NULL infers the type */
+static UA_StatusCode to_variant(json_object* v, const UA_DataType* type, UA_Variant* out)
+{
+	UA_Variant_init(out);
+	if(!type) {
+		type = inferred(v);
+	}
+	if(!type) {
+		return UA_STATUSCODE_BADTYPEMISMATCH;
+	}
+
+	if(json_object_get_type(v) != json_type_array) {
+		void* p = UA_new(type);
+		UA_StatusCode rc = to_scalar(v, type, p);
+		if(rc != UA_STATUSCODE_GOOD) {
+			UA_delete(p, type);
+			return rc;
+		}
+		UA_Variant_setScalar(out, p, type);
+		return UA_STATUSCODE_GOOD;
+	}
+
+	size_t size = json_object_array_length(v);
+	void* a = UA_Array_new(size, type);
+	for (size_t i = 0; i < size; i++) {
+		UA_StatusCode rc = to_scalar(json_object_array_get_idx(v, i), type, (char*)a + i * type->memSize);
+		if(rc != UA_STATUSCODE_GOOD) {
+			UA_Array_delete(a, size, type);
+			return rc;
+		}
+	}
+	UA_Variant_setArray(out, a, size, type);
+	return UA_STATUSCODE_GOOD;
+}
+
+static json_object* scalar_json(const void* p, const UA_DataType* type)
+{
+	switch(type->typeIndex) {
+		case UA_TYPES_BOOLEAN : return json_object_new_boolean(*(const UA_Boolean*)p);
+		case UA_TYPES_SBYTE : return json_object_new_int(*(const UA_SByte*)p);
+		case UA_TYPES_BYTE : return json_object_new_int(*(const UA_Byte*)p);
+		case UA_TYPES_INT16 : return json_object_new_int(*(const UA_Int16*)p);
+		case UA_TYPES_UINT16 : return json_object_new_int(*(const UA_UInt16*)p);
+		case UA_TYPES_INT32 : return json_object_new_int(*(const UA_Int32*)p);
+		case UA_TYPES_UINT32 : return json_object_new_int64(*(const UA_UInt32*)p);
+		case UA_TYPES_INT64 : return json_object_new_int64(*(const UA_Int64*)p);
+		case UA_TYPES_UINT64 : return json_object_new_int64((int64_t)*(const UA_UInt64*)p);
+		case UA_TYPES_FLOAT : return json_object_new_double(*(const UA_Float*)p);
+		case UA_TYPES_DOUBLE : return json_object_new_double(*(const UA_Double*)p);
+		case UA_TYPES_STRING : {
+			const UA_String* s = (const UA_String*)p;
+			return json_object_new_string_len(s->length ? (const char*)s->data : "", (int)s->length);
+		}
+		default : return json_object_new_string(type->typeName);
+	}
+}
+
+/* an output argument, types without a JSON form are given by name */
+static json_object* variant_json(const UA_Variant* v)
+{
+	if(!v->type) {
+		return NULL;
+	}
+	if(UA_Variant_isScalar(v)) {
+		return scalar_json(v->data, v->type);
+	}
+	json_object* a = json_object_new_array();
+	for (size_t i = 0; i < v->arrayLength; i++) {
+		json_object_array_add(a, scalar_json((const char*)v->data + i * v->type->memSize, v->type));
+	}
+	return a;
+}
+
+//===================================================================================================================================================================
+// answers
+
+static void answer(Command* c)
+{
+	json_object_object_add(c->reply, "status", json_object_new_int64(c->status));
+	if(c->results) {
+		json_object_object_add(c->reply, c->call ? "outputs" : "results", c->results);
+		c->results = NULL;
+	}
+
+	const char* text = json_object_to_json_string_ext(c->reply, JSON_C_TO_STRING_PLAIN);
+	log_debug("[command] answer %s", text);
+
+	if(c->origin == COMMAND_MQTT) {
+		mqtt_publish("command", g_config->commandResponseTopic, text);
+	} else {
+		pthread_mutex_lock(&connectionLock);
+		map<unsigned long, Connection*>::iterator i = connections.find(c->connection);
+		Connection* to = i != connections.end() ? i->second : NULL;
+		if(to) {
+			to->users++;
+		}
+		pthread_mutex_unlock(&connectionLock);
+
+		if(to) {
+			pthread_mutex_lock(&to->sending);
+			send_all(to->fd, text, strlen(text));
+			send_all(to->fd, "\n", 1);
+			pthread_mutex_unlock(&to->sending);
+
+			pthread_mutex_lock(&connectionLock);
+			connection_release(to);
+			pthread_mutex_unlock(&connectionLock);
+		}
+	}
+
+	if(!c->request) {
+		metrics_add(invalid, 1);
+	} else {
+		metrics_add(answered[c->call][c->status != UA_STATUSCODE_GOOD], 1);
+	}
+	metrics_observe(seconds, metrics_now() - c->received);
+
+	json_object_put(c->request);
+	json_object_put(c->reply);
+	json_object_put(c->results);
+	delete c;
+}
+
+static void refuse(Command* c, UA_StatusCode status, const char* error)
+{
+	log_warn("[command] refused: %s", error);
+	json_object_object_add(c->reply, "error", json_object_new_string(error));
+	c->status = status;
+	answer(c);
+}
+
+//===================================================================================================================================================================
+// ingress
+
+void command_submit(int origin, unsigned long connection, const char* payload, int len)
+{
+	Command* c = new Command();
+	c->origin = origin;
+	c->connection = connection;
+	c->received = metrics_now();
+	c->reply = json_object_new_object();
+	c->endpoint = -1;
+
+	json_tokener* tok = json_tokener_new();
+	json_object* r = json_tokener_parse_ex(tok, payload, len);
+	bool parsed = json_tokener_get_error(tok) == json_tokener_success && json_object_get_type(r) == json_type_object;
+	json_tokener_free(tok);
+
+	if(!parsed) {
+		json_object_put(r);
+		refuse(c, UA_STATUSCODE_BADDECODINGERROR, "a command is a JSON object");
+		return;
+	}
+
+	json_object* v = NULL;
+	if(json_object_object_get_ex(r, "id", &v)) {
+		json_object_object_add(c->reply, "id", json_object_get(v));
+	}
+
+	json_object* w = NULL;
+	json_object* m = NULL;
+	bool write = json_object_object_get_ex(r, "write", &w);
+	bool call = json_object_object_get_ex(r, "call", &m);
+	json_object* object = NULL;
+	json_object* method = NULL;
+	json_object* args = NULL;
+
+	const char* error = NULL;
+	if(write == call) {
+		error = "a command has either \"write\" or \"call\"";
+	} else if(write && json_object_get_type(w) != json_type_object) {
+		error = "\"write\" is an object of node ids or aliases and values";
+	} else if(call && (json_object_get_type(m) != json_type_object ||
+		!json_object_object_get_ex(m, "object", &object) || json_object_get_type(object) != json_type_string ||
+		!json_object_object_get_ex(m, "method", &method) || json_object_get_type(method) != json_type_string ||
+		(json_object_object_get_ex(m, "args", &args) && json_object_get_type(args) != json_type_array))) {
+		error = "\"call\" has the node ids \"object\" and \"method\" and an optional list \"args\"";
+	} else if(call && (!valid_node_id(json_object_get_string(object)) || !valid_node_id(json_object_get_string(method)))) {
+		error = "\"object\" and \"method\" are node ids of the form [ns=<n>;]i=<n> or [ns=<n>;]s=<string>";
+	} else if(json_object_object_get_ex(r, "server", &v)) {
+		UAMQ_Endpoint* ep = endpoint_find(json_object_get_string(v));
+		if(!ep) {
+			error = "unknown server";
+		} else {
+			c->endpoint = ep->index;
+		}
+	} else if(call && g_config->endpointCount > 1) {
+		error = SERVER_REQUIRED;
+	}
+	if(error) {
+		json_object_put(r);
+		refuse(c, UA_STATUSCODE_BADINVALIDARGUMENT, error);
+		return;
+	}
+
+	c->request = r;
+	c->call = call;
+
+	pthread_mutex_lock(&queueLock);
+	bool full = queue.size() >= QUEUE_MAX;
+	if(!full) {
+		queue.push_back(c);
+		pthread_cond_signal(&queueSignal);
+	}
+	pthread_mutex_unlock(&queueLock);
+
+	if(full) {
+		refuse(c, UA_STATUSCODE_BADTOOMANYOPERATIONS, "too many commands queued");
+	}
+}
+
+//===================================================================================================================================================================
+// sending
+
+/* a write key names a node of the node-map by alias or by id, other node ids
+ * only with "anyNode" and, when there is more than one server, "server" */
+static UA_StatusCode resolve(Topology* t, const char* key, int server, string* id, int* endpoint)
+{
+	bool byId = is_node_id(key);
+	for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
+		for (size_t n = 0; n < p->nodes.size(); n++) {
+			Node* d = &p->nodes[n];
+			if(byId ? !strcmp(d->id, key) : (d->alias[0] && !strcmp(d->alias, key))) {
+				*id = d->id;
+				*endpoint = server < 0 ? p->endpoint : server;
+				return UA_STATUSCODE_GOOD;
+			}
+		}
+	}
+
+	if(!byId) {
+		return UA_STATUSCODE_BADNODEIDUNKNOWN;
+	}
+	if(!valid_node_id(key)) {
+		return UA_STATUSCODE_BADNODEIDINVALID;
+	}
+	if(!g_config->commandAnyNode) {
+		return UA_STATUSCODE_BADUSERACCESSDENIED;
+	}
+	if(server < 0 && g_config->endpointCount > 1) {
+		return UA_STATUSCODE_BADINVALIDARGUMENT;
+	}
+	*id = key;
+	*endpoint = server < 0 ? 0 : server;
+	return UA_STATUSCODE_GOOD;
+}
+
+static bool method_allowed(const char* id)
+{
+	if(g_config->commandAnyNode) {
+		return true;
+	}
+	for (int i = 0; i < g_config->commandMethodCount; i++) {
+		if(!strcmp(g_config->commandMethods[i], id)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* learns the value types of the nodes written for the first time, one Read */
+static void learn_types(UAMQ_Endpoint* ep, Batch* b)
+{
+	map<string, const UA_DataType*>& known = nodeTypes[ep->index];
+	vector<string> ids;
+	for (size_t i = 0; i < b->writes.size(); i++) {
+		if(!known.count(b->writes[i].id)) {
+			ids.push_back(b->writes[i].id);
+		}
+	}
+	if(ids.empty()) {
+		return;
+	}
+
+	UA_ReadValueId* nodes = (UA_ReadValueId*)UA_Array_new(ids.size(), &UA_TYPES[UA_TYPES_READVALUEID]);
+	for (size_t i = 0; i < ids.size(); i++) {
+		nodes[i].nodeId = node_id(ids[i]);
+		nodes[i].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+
+	UA_ReadRequest req;
+	UA_ReadRequest_init(&req);
+	req.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+	req.nodesToRead = nodes;
+	req.nodesToReadSize = ids.size();
+
+	UA_ReadResponse resp = UA_Client_Service_read(ep->client, req);
+	if(resp.responseHeader.serviceResult == UA_STATUSCODE_GOOD && resp.resultsSize == ids.size()) {
+		for (size_t i = 0; i < ids.size(); i++) {
+			/* nodes without a value are written with the type of the JSON value */
+			if(resp.results[i].hasValue && resp.results[i].value.type) {
+				known[ids[i]] = resp.results[i].value.type;
+			}
+		}
+	}
+	UA_ReadResponse_deleteMembers(&resp);
+	UA_Array_delete(nodes, ids.size(), &UA_TYPES[UA_TYPES_READVALUEID]);
+}
+
+static void send_writes(UAMQ_Endpoint* ep, Batch* b)
+{
+	if(b->writes.empty()) {
+		return;
+	}
+	learn_types(ep, b);
+
+	map<string, const UA_DataType*>& known = nodeTypes[ep->index];
+	UA_WriteValue* nodes = (UA_WriteValue*)UA_Array_new(b->writes.size(), &UA_TYPES[UA_TYPES_WRITEVALUE]);
+	vector<size_t> sent;
+	for (size_t i = 0; i < b->writes.size(); i++) {
+		Write* w = &b->writes[i];
+		map<string, const UA_DataType*>::iterator t = known.find(w->id);
+		UA_WriteValue* n = &nodes[sent.size()];
+		w->result = to_variant(w->value, t != known.end() ? t->second : NULL, &n->value.value);
+		if(w->result != UA_STATUSCODE_GOOD) {
+			continue;
+		}
+		n->nodeId = node_id(w->id);
+		n->attributeId = UA_ATTRIBUTEID_VALUE;
+		n->value.hasValue = true;
+		sent.push_back(i);
+	}
+
+	if(!sent.empty()) {
+		UA_WriteRequest req;
+		UA_WriteRequest_init(&req);
+		req.nodesToWrite = nodes;
+		req.nodesToWriteSize = sent.size();
+
+		UA_WriteResponse resp = UA_Client_Service_write(ep->client, req);
+		UA_StatusCode rc = resp.responseHeader.serviceResult;
+		if(rc == UA_STATUSCODE_GOOD && resp.resultsSize != sent.size()) {
+			rc = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		}
+		if(rc != UA_STATUSCODE_GOOD) {
+			log_warn("[command] %s: write failed (0x%08x).", ep->name, rc);
+			opcua_fault(ep, rc);
+		}
+		for (size_t i = 0; i < sent.size(); i++) {
+			Write* w = &b->writes[sent[i]];
+			w->result = rc != UA_STATUSCODE_GOOD ? rc : resp.results[i];
+			/* the type may have changed, learn it again */
+			if(w->result == UA_STATUSCODE_BADTYPEMISMATCH) {
+				known.erase(w->id);
+			}
+		}
+		UA_WriteResponse_deleteMembers(&resp);
+	}
+
+	UA_Array_delete(nodes, b->writes.size(), &UA_TYPES[UA_TYPES_WRITEVALUE]);
+}
+
+/* the types of the input arguments of a method, from its InputArguments
+ * property. false if the server couldn't be asked. */
+static bool learn_arguments(UAMQ_Endpoint* ep, const string& id, vector<const UA_DataType*>* types)
+{
+	map<string, vector<const UA_DataType*> >::iterator known = argumentTypes[ep->index].find(id);
+	if(known != argumentTypes[ep->index].end()) {
+		*types = known->second;
+		return true;
+	}
+
+	static char property[] = "InputArguments";
+	UA_NodeId method = node_id(id);
+
+	UA_RelativePathElement element;
+	UA_RelativePathElement_init(&element);
+	element.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY);
+	element.targetName = UA_QUALIFIEDNAME(0, property);
+
+	UA_BrowsePath path;
+	UA_BrowsePath_init(&path);
+	path.startingNode = method;
+	path.relativePath.elements = &element;
+	path.relativePath.elementsSize = 1;
+
+	UA_TranslateBrowsePathsToNodeIdsRequest req;
+	UA_TranslateBrowsePathsToNodeIdsRequest_init(&req);
+	req.browsePaths = &path;
+	req.browsePathsSize = 1;
+
+	UA_TranslateBrowsePathsToNodeIdsResponse resp = UA_Client_Service_translateBrowsePathsToNodeIds(ep->client, req);
+	bool asked = resp.responseHeader.serviceResult == UA_STATUSCODE_GOOD && resp.resultsSize == 1;
+	types->clear();
+
+	/* a method without the property takes no arguments */
+	if(asked && resp.results[0].statusCode == UA_STATUSCODE_GOOD && resp.results[0].targetsSize > 0) {
+		UA_Variant v;
+		UA_Variant_init(&v);
+		UA_StatusCode rc = UA_Client_readValueAttribute(ep->client, resp.results[0].targets[0].targetId.nodeId, &v);
+		if(rc != UA_STATUSCODE_GOOD) {
+			asked = false;
+		} else if(v.type == &UA_TYPES[UA_TYPES_ARGUMENT]) {
+			UA_Argument* a = (UA_Argument*)v.data;
+			size_t size = UA_Variant_isScalar(&v) ? 1 : v.arrayLength;
+			for (size_t i = 0; i < size; i++) {
+				/* abstract types (BaseDataType, Number) take the JSON type */
+				types->push_back(UA_findDataType(&a[i].dataType));
+			}
+		}
+		UA_Variant_deleteMembers(&v);
+	}
+	UA_TranslateBrowsePathsToNodeIdsResponse_deleteMembers(&resp);
+	UA_NodeId_deleteMembers(&method);
+
+	if(asked) {
+		argumentTypes[ep->index][id] = *types;
+	}
+	return asked;
+}
+
+static void send_calls(UAMQ_Endpoint* ep, Batch* b)
+{
+	if(b->calls.empty()) {
+		return;
+	}
+
+	UA_CallMethodRequest* methods = (UA_CallMethodRequest*)UA_Array_new(b->calls.size(), &UA_TYPES[UA_TYPES_CALLMETHODREQUEST]);
+	vector<Command*> sent;
+	for (size_t i = 0; i < b->calls.size(); i++) {
+		Command* c = b->calls[i];
+		json_object* m = NULL;
+		json_object* v = NULL;
+		json_object* args = NULL;
+		json_object_object_get_ex(c->request, "call", &m);
+		json_object_object_get_ex(m, "method", &v);
+		string method = json_object_get_string(v);
+		json_object_object_get_ex(m, "object", &v);
+		string object = json_object_get_string(v);
+		size_t size = json_object_object_get_ex(m, "args", &args) ? json_object_array_length(args) : 0;
+
+		vector<const UA_DataType*> types;
+		if(!learn_arguments(ep, method, &types)) {
+			c->status = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+			continue;
+		}
+
+		UA_CallMethodRequest* r = &methods[sent.size()];
+		r->inputArguments = (UA_Variant*)UA_Array_new(size, &UA_TYPES[UA_TYPES_VARIANT]);
+		r->inputArgumentsSize = size;
+		r->objectId = node_id(object);
+		r->methodId = node_id(method);
+		c->status = UA_STATUSCODE_GOOD;
+		for (size_t a = 0; a < size && c->status == UA_STATUSCODE_GOOD; a++) {
+			c->status = to_variant(json_object_array_get_idx(args, a), a < types.size() ? types[a] : NULL, &r->inputArguments[a]);
+		}
+		if(c->status != UA_STATUSCODE_GOOD) {
+			UA_CallMethodRequest_deleteMembers(r);
+			UA_CallMethodRequest_init(r);
+			continue;
+		}
+		sent.push_back(c);
+	}
+
+	if(!sent.empty()) {
+		UA_CallRequest req;
+		UA_CallRequest_init(&req);
+		req.methodsToCall = methods;
+		req.methodsToCallSize = sent.size();
+
+		UA_CallResponse resp = UA_Client_Service_call(ep->client, req);
+		UA_StatusCode rc = resp.responseHeader.serviceResult;
+		if(rc == UA_STATUSCODE_GOOD && resp.resultsSize != sent.size()) {
+			rc = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		}
+		if(rc != UA_STATUSCODE_GOOD) {
+			log_warn("[command] %s: call failed (0x%08x).", ep->name, rc);
+			opcua_fault(ep, rc);
+		}
+		for (size_t i = 0; i < sent.size(); i++) {
+			Command* c = sent[i];
+			if(rc != UA_STATUSCODE_GOOD) {
+				c->status = rc;
+				continue;
+			}
+			UA_CallMethodResult* r = &resp.results[i];
+			c->status = r->statusCode;
+			c->results = json_object_new_array();
+			for (size_t o = 0; o < r->outputArgumentsSize; o++) {
+				json_object_array_add(c->results, variant_json(&r->outputArguments[o]));
+			}
+		}
+		UA_CallResponse_deleteMembers(&resp);
+	}
+
+	UA_Array_delete(methods, b->calls.size(), &UA_TYPES[UA_TYPES_CALLMETHODREQUEST]);
+}
+
+/* serves the commands of one interval, one Write and one Call per server */
+static void flush(vector<Command*>& commands)
+{
+	map<int, Batch> batches;
+	vector<Target> targets;
+
+	topology_read_begin();
+	Topology* t = topology_current();
+	for (size_t i = 0; i < commands.size(); i++) {
+		Command* c = commands[i];
+		json_object* body = NULL;
+
+		if(c->call) {
+			json_object* v = NULL;
+			json_object_object_get_ex(c->request, "call", &body);
+			json_object_object_get_ex(body, "method", &v);
+			if(!method_allowed(json_object_get_string(v))) {
+				c->status = UA_STATUSCODE_BADUSERACCESSDENIED;
+				continue;
+			}
+			/* without "server" there is only one */
+			batches[c->endpoint < 0 ? 0 : c->endpoint].calls.push_back(c);
+			continue;
+		}
+
+		json_object_object_get_ex(c->request, "write", &body);
+		c->status = UA_STATUSCODE_GOOD;
+		json_object_object_foreach(body, key, value) {
+			Target target;
+			target.command = c;
+			target.key = key;
+			target.endpoint = -1;
+			target.write = 0;
+			target.refused = UA_STATUSCODE_GOOD;
+
+			string id;
+			int endpoint = 0;
+			target.refused = resolve(t, key, c->endpoint, &id, &endpoint);
+			if(target.refused != UA_STATUSCODE_GOOD) {
+				if(target.refused == UA_STATUSCODE_BADINVALIDARGUMENT) {
+					json_object_object_add(c->reply, "error", json_object_new_string(SERVER_REQUIRED));
+				}
+				targets.push_back(target);
+				continue;
+			}
+			target.endpoint = endpoint;
+
+			/* later writes of a node in the interval win */
+			Batch* b = &batches[target.endpoint];
+			map<string, size_t>::iterator w = b->index.find(id);
+			if(w == b->index.end()) {
+				Write write;
+				write.id = id;
+				write.value = value;
+				write.result = UA_STATUSCODE_GOOD;
+				w = b->index.insert(make_pair(id, b->writes.size())).first;
+				b->writes.push_back(write);
+			} else {
+				b->writes[w->second].value = value;
+			}
+			target.write = w->second;
+			targets.push_back(target);
+		}
+	}
+	topology_read_end();
+
+	for (map<int, Batch>::iterator i = batches.begin(); i != batches.end(); ++i) {
+		UAMQ_Endpoint* ep = &g_config->endpoints[i->first];
+		Batch* b = &i->second;
+
+		if(opcua_acquire(ep)) {
+			send_writes(ep, b);
+			send_calls(ep, b);
+			opcua_unlock(ep);
+		} else {
+			for (size_t w = 0; w < b->writes.size(); w++) {
+				b->writes[w].result = UA_STATUSCODE_BADSERVERNOTCONNECTED;
+			}
+			for (size_t c = 0; c < b->calls.size(); c++) {
+				b->calls[c]->status = UA_STATUSCODE_BADSERVERNOTCONNECTED;
+			}
+		}
+	}
+
+	/* a write command is good when all of its nodes were written */
+	for (size_t i = 0; i < targets.size(); i++) {
+		Target* target = &targets[i];
+		Command* c = target->command;
+		UA_StatusCode rc = target->endpoint < 0 ? target->refused : batches[target->endpoint].writes[target->write].result;
+		if(!c->results) {
+			c->results = json_object_new_object();
+		}
+		json_object_object_add(c->results, target->key.c_str(), json_object_new_int64(rc));
+		if(rc != UA_STATUSCODE_GOOD && c->status == UA_STATUSCODE_GOOD) {
+			c->status = rc;
+		}
+	}
+
+	for (size_t i = 0; i < commands.size(); i++) {
+		answer(commands[i]);
+	}
+	commands.clear();
+}
+
+void* command_run(void* param)
+{
+	if(!g_config->commandEnable) {
+		return NULL;
+	}
+	rt_thread(UAMQ_ROLE_COMMAND, -1, "command");
+
+	answered[0][0] = metrics_series(METRIC_COMMANDS, "kind=\"write\",result=\"good\"");
+	answered[0][1] = metrics_series(METRIC_COMMANDS, "kind=\"write\",result=\"bad\"");
+	answered[1][0] = metrics_series(METRIC_COMMANDS, "kind=\"call\",result=\"good\"");
+	answered[1][1] = metrics_series(METRIC_COMMANDS, "kind=\"call\",result=\"bad\"");
+	invalid = metrics_series(METRIC_COMMANDS, "kind=\"invalid\",result=\"bad\"");
+	seconds = metrics_series(METRIC_COMMAND_SECONDS, "");
+
+	log_info("[command] answering on %s, every %d us.", g_config->commandResponseTopic, g_config->commandIntervalUs);
+
+	vector<Command*> batch;
+	while (!beStop) {
+		pthread_mutex_lock(&queueLock);
+		while (queue.empty() && !beStop) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec += 1;
+			pthread_cond_timedwait(&queueSignal, &queueLock, &until);
+		}
+		pthread_mutex_unlock(&queueLock);
+		if(beStop) {
+			break;
+		}
+
+		/* what arrives within the interval goes out with the first command */
+		usleep(g_config->commandIntervalUs);
+
+		pthread_mutex_lock(&queueLock);
+		batch.swap(queue);
+		pthread_mutex_unlock(&queueLock);
+
+		flush(batch);
+	}
+
+	pthread_mutex_lock(&queueLock);
+	for (size_t i = 0; i < queue.size(); i++) {
+		json_object_put(queue[i]->request);
+		json_object_put(queue[i]->reply);
+		delete queue[i];
+	}
+	queue.clear();
+	pthread_mutex_unlock(&queueLock);
+
+	return NULL;
+}
+
+//===================================================================================================================================================================
+// tcp command port
+
+static void disconnect(unsigned long id)
+{
+	pthread_mutex_lock(&connectionLock);
+	map<unsigned long, Connection*>::iterator i = connections.find(id);
+	if(i != connections.end()) {
+		/* answers being sent still use the socket, the peer is told by a
+		 * shutdown rather than when the last of them is done */
+		shutdown(i->second->fd, SHUT_RDWR);
+		connection_release(i->second);
+		connections.erase(i);
+	}
+	pthread_mutex_unlock(&connectionLock);
+}
+
+void* command_listen(void* param)
+{
+	if(!g_config->commandEnable || g_config->commandPort <= 0) {
+		return NULL;
+	}
+	rt_thread(UAMQ_ROLE_COMMAND, -1, "command listener");
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)g_config->commandPort);
+	if(inet_pton(AF_INET, g_config->commandAddress, &addr.sin_addr) != 1) {
+		log_error("[command] invalid address %s.", g_config->commandAddress);
+		return NULL;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+		log_error("[command] can't listen on %s:%d.", g_config->commandAddress, g_config->commandPort);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	log_info("[command] listening on %s:%d.", g_config->commandAddress, g_config->commandPort);
+
+	/* the partial line of every connection */
+	map<unsigned long, string> lines;
+	unsigned long next = 1;
+
+	while (!beStop) {
+		vector<struct pollfd> fds;
+		vector<unsigned long> ids;
+		struct pollfd l = { fd, POLLIN, 0 };
+		fds.push_back(l);
+
+		pthread_mutex_lock(&connectionLock);
+		for (map<unsigned long, Connection*>::iterator i = connections.begin(); i != connections.end(); ++i) {
+			struct pollfd p = { i->second->fd, POLLIN, 0 };
+			fds.push_back(p);
+			ids.push_back(i->first);
+		}
+		pthread_mutex_unlock(&connectionLock);
+
+		if(poll(&fds[0], fds.size(), 1000) <= 0) {
+			continue;
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int c = accept(fd, NULL, NULL);
+			if(c >= 0 && ids.size() >= CONNECTIONS_MAX) {
+				log_warn("[command] more than %d connections, refused.", CONNECTIONS_MAX);
+				close(c);
+			} else if(c >= 0) {
+				struct timeval tv = { 1, 0 };
+				setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+				Connection* n = new Connection();
+				n->fd = c;
+				n->users = 1;
+				pthread_mutex_init(&n->sending, NULL);
+				pthread_mutex_lock(&connectionLock);
+				connections[next] = n;
+				pthread_mutex_unlock(&connectionLock);
+				lines[next] = "";
+				next++;
+			}
+		}
+
+		for (size_t i = 1; i < fds.size(); i++) {
+			if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			unsigned long id = ids[i - 1];
+			string& line = lines[id];
+
+			char buf[4096];
+			ssize_t r = recv(fds[i].fd, buf, sizeof(buf), 0);
+			if(r <= 0) {
+				disconnect(id);
+				lines.erase(id);
+				continue;
+			}
+			line.append(buf, (size_t)r);
+
+			size_t start = 0;
+			size_t end;
+			while ((end = line.find('\n', start)) != string::npos) {
+				size_t len = end - start;
+				if(len > 0 && line[end - 1] == '\r') {
+					len--;
+				}
+				if(len > 0) {
+					command_submit(COMMAND_TCP, id, line.data() + start, (int)len);
+				}
+				start = end + 1;
+			}
+			line.erase(0, start);
+
+			if(line.size() > LINE_MAX) {
+				log_warn("[command] line longer than %d bytes, connection closed.", LINE_MAX);
+				disconnect(id);
+				lines.erase(id);
+			}
+		}
+	}
+
+	pthread_mutex_lock(&connectionLock);
+	for (map<unsigned long, Connection*>::iterator i = connections.begin(); i != connections.end(); ++i) {
+		shutdown(i->second->fd, SHUT_RDWR);
+		connection_release(i->second);
+	}
+	connections.clear();
+	pthread_mutex_unlock(&connectionLock);
+	close(fd);
+
+	return NULL;
+}
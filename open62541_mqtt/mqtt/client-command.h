@@ -0,0 +1,46 @@
+#ifndef OPCUA_MQTT_BRIDGE_COMMAND_H_
+#define OPCUA_MQTT_BRIDGE_COMMAND_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Commands from the sinks to the OPC UA servers: OPC UA Write and Call,
+ * requested as JSON on the mqtt command topics or as lines on the tcp
+ * command port.
+ *
+ *   {"id": 42, "write": {"setpoint": 12.5, "ns=1;s=mode": 2}}
+ *   {"id": 43, "call": {"object": "ns=1;i=5001", "method": "ns=1;i=5002", "args": [1, "fast"]}, "server": "line2"}
+ *
+ * A write names nodes by node-map alias or node id. Nodes of the node-map go
+ * to their server, calls and other node ids need "server" when the bridge
+ * has more than one. The commands are collected for one interval, then every
+ * server gets all of its writes in one Write request and all of its calls in
+ * one Call request. A node written more than once in an interval gets the
+ * last value. Every command is answered the way it came, on the response
+ * topic or on its tcp connection:
+ *
+ *   {"id": 42, "status": 0, "results": {"setpoint": 0, "ns=1;s=mode": 0}}
+ *   {"id": 43, "status": 0, "outputs": [42]}
+ */
+
+#define COMMAND_MQTT 0
+#define COMMAND_TCP 1
+
+/* parses and queues a command, connection is the tcp connection to answer on */
+void command_submit(int origin, unsigned long connection, const char* payload, int len);
+
+/* sends the queued commands every interval */
+void* command_run(void* param);
+
+/* accepts commands on the tcp command port, one JSON document per line */
+void* command_listen(void* param);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_COMMAND_H_ */
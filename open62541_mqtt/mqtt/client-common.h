@@ -26,17 +26,56 @@ extern "C" {
 #include "pub.h"
 #include "client-config.h"
 
-UA_StatusCode opcua_server_connect(UA_Client *client);
+UA_StatusCode opcua_server_connect(UAMQ_Endpoint *ep);
 UA_StatusCode opcua_server_browse(UA_Client *client);
 
-void monitor_start(UA_Client* client);
+void opcua_init(void);
+
+/* the client of an endpoint is shared, every service call holds the lock */
+void opcua_lock(UAMQ_Endpoint *ep);
+void opcua_unlock(UAMQ_Endpoint *ep);
+
+/* takes the lock if the client is connected, 0 without waiting for a
+ * reconnect or during shutdown */
+int opcua_acquire(UAMQ_Endpoint *ep);
+
+/* reports a failed service call to the supervisor of the endpoint */
+void opcua_fault(UAMQ_Endpoint *ep, UA_StatusCode code);
+
+/* places the calling thread by its role, next to the endpoint unless the role has cores */
+void opcua_pin(UAMQ_Endpoint *ep, int role, const char *what);
+
+/* whether the endpoint serves groups with the given method */
+int endpoint_allows(UAMQ_Endpoint *ep, const char *method);
+
+/* connects an endpoint and sends its publish requests */
+void* opcua_worker(void* param);
+
+/* owns the recovery of the connection and the session of an endpoint */
+void* opcua_supervise(void* param);
+
+void monitor_start(UAMQ_Endpoint* ep);
+void monitor_update(UAMQ_Endpoint* ep);
+
+/* creates the subscription and the monitored items again for a new session */
+void monitor_restart(UAMQ_Endpoint* ep);
+
+/* called after a node-map reload */
+void monitor_schedule(void);
+void poll_schedule(void);
 
 int mqtt_publish(const char* mode, char* topic, const char* value);
+/* whether the topic filter, wildcards included, matches the topic */
+int mqtt_topic_matches(const char* filter, const char* topic);
 int amqp_publish(const char* mode, char* topic, const char* value);
 int tcp_publish(const char* mode, char* topic, const char* value);
 
 void* mqtt_run(void* param);
 void* tcp_run(void* param);
+
+/* the sink is connected; while it isn't, published messages are dropped */
+int mqtt_ready(void);
+int tcp_ready(void);
 void* amqp_run(void* param);
 void* opcua_poll(void* param);
 
@@ -0,0 +1,469 @@
+/*******************************************************************************
+ * Copyright (c) 2017 MDS Technology Ltd.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    lonycell - initial implementation and/or initial documentation
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef UAMQ_ENABLE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#ifdef UAMQ_ENABLE_LZ4
+#include <lz4.h>
+#endif
+
+#include "client-compress.h"
+#include "client-log.h"
+
+#define DEFAULT_DICT_BYTES (4 * 1024)
+#define MAX_TRAIN_BYTES (1024 * 1024)
+
+struct UAMQ_Codec {
+	int codec;
+	int level;
+	int minBytes;
+	const char* sink;
+
+	/* guards the contexts, the dictionary and the training */
+	pthread_mutex_t lock;
+
+	/* dictionary shared with the consumers */
+	unsigned char* dict;
+	int dictSize;
+	unsigned int dictId;
+	bool dictAnnounced;
+
+	/* samples collected for training a dictionary */
+	int trainSamples;
+	int dictBytes;
+	unsigned char* samples;
+	size_t* sampleSizes;
+	int samplesCount;
+	size_t samplesBytes;
+
+#ifdef UAMQ_ENABLE_ZSTD
+	ZSTD_CCtx* cctx;
+	ZSTD_CDict* cdict;
+#endif
+#ifdef UAMQ_ENABLE_LZ4
+	LZ4_stream_t* lz4;
+#endif
+};
+
+static void put32(unsigned char* p, unsigned int v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void put_header(unsigned char* p, int codec, unsigned int dictId, int rawlen, int len)
+{
+	p[0] = 'U';
+	p[1] = 'Z';
+	p[2] = UAMQ_FRAME_VERSION;
+	p[3] = (unsigned char)codec;
+	put32(p + 4, dictId);
+	put32(p + 8, (unsigned int)rawlen);
+	put32(p + 12, (unsigned int)len);
+}
+
+/* FNV-1a, used as id for dictionaries that do not carry one */
+static unsigned int hash32(const unsigned char* p, int len)
+{
+	unsigned int h = 2166136261u;
+	for(int i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h ? h : 1;
+}
+
+/* frames are built in a buffer of the calling thread, so that the codec is
+ * not locked while the sink sends them */
+static __thread unsigned char* frame = NULL;
+static __thread int frameSize = 0;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t leave;
+
+static void frame_release(void* p)
+{
+	free(p);
+}
+
+static void frame_key(void)
+{
+	pthread_key_create(&leave, frame_release);
+}
+
+static bool reserve(int size)
+{
+	if(frameSize >= size) {
+		return true;
+	}
+
+	unsigned char* b = (unsigned char*)realloc(frame, (size_t)size);
+	if(!b) {
+		return false;
+	}
+	pthread_once(&once, frame_key);
+	pthread_setspecific(leave, b);
+	frame = b;
+	frameSize = size;
+	return true;
+}
+
+int getCompressionCodec(const char* name)
+{
+	if(!name || !strcmp(name, "") || !strcmp(name, "none")) {
+		return UAMQ_CODEC_NONE;
+	} else if(!strcmp(name, "lz4")) {
+		return UAMQ_CODEC_LZ4;
+	} else if(!strcmp(name, "zstd")) {
+		return UAMQ_CODEC_ZSTD;
+	}
+	return -1;
+}
+
+/* called with the lock held; the codec keeps its old dictionary when the
+ * new one can't be set up */
+static bool codec_use_dictionary(UAMQ_Codec* c, const unsigned char* dict, int size, unsigned int id)
+{
+	unsigned char* copy = (unsigned char*)malloc((size_t)size);
+	if(!copy) {
+		return false;
+	}
+	memcpy(copy, dict, (size_t)size);
+
+#ifdef UAMQ_ENABLE_ZSTD
+	if(c->codec == UAMQ_CODEC_ZSTD) {
+		ZSTD_CDict* cdict = ZSTD_createCDict(dict, (size_t)size, c->level);
+		if(!cdict) {
+			free(copy);
+			return false;
+		}
+		if(c->cdict) {
+			ZSTD_freeCDict(c->cdict);
+		}
+		c->cdict = cdict;
+		if(!id) {
+			id = ZDICT_getDictID(dict, (size_t)size);
+		}
+	}
+#endif
+
+	free(c->dict);
+	c->dict = copy;
+	c->dictSize = size;
+	c->dictId = id ? id : hash32(dict, size);
+	c->dictAnnounced = false;
+
+	log_info("[%s] compression dictionary #%u (%d bytes) in use.", c->sink, c->dictId, size);
+
+	return true;
+}
+
+static bool codec_load_dictionary(UAMQ_Codec* c, const char* fn)
+{
+	FILE* file = fopen(fn, "rb");
+	if(!file) {
+		printf("[%s] compression dictionary (%s) not found.\n", c->sink, fn);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	bool ok = false;
+	unsigned char* dict = NULL;
+	if(size > 0 && (dict = (unsigned char*)malloc((size_t)size)) != NULL) {
+		if(fread(dict, 1, (size_t)size, file) == (size_t)size) {
+			pthread_mutex_lock(&c->lock);
+			ok = codec_use_dictionary(c, dict, (int)size, 0);
+			pthread_mutex_unlock(&c->lock);
+		}
+	}
+
+	free(dict);
+	fclose(file);
+
+	return ok;
+}
+
+#ifdef UAMQ_ENABLE_ZSTD
+/* Collects the first payloads of a sink and trains a dictionary from them.
+ * Small messages such as single node json objects hardly compress on their
+ * own, but share almost all of their bytes with each other. Called with the
+ * lock held. */
+static void codec_train(UAMQ_Codec* c, const unsigned char* in, int inlen)
+{
+	if(c->samplesCount >= c->trainSamples || c->samplesBytes + (size_t)inlen > MAX_TRAIN_BYTES) {
+		return;
+	}
+
+	if(!c->samples) {
+		c->samples = (unsigned char*)malloc(MAX_TRAIN_BYTES);
+		c->sampleSizes = (size_t*)calloc((size_t)c->trainSamples, sizeof(size_t));
+		if(!c->samples || !c->sampleSizes) {
+			c->trainSamples = 0;
+			return;
+		}
+	}
+
+	memcpy(c->samples + c->samplesBytes, in, (size_t)inlen);
+	c->sampleSizes[c->samplesCount++] = (size_t)inlen;
+	c->samplesBytes += (size_t)inlen;
+
+	if(c->samplesCount < c->trainSamples) {
+		return;
+	}
+
+	unsigned char* dict = (unsigned char*)malloc((size_t)c->dictBytes);
+	if(dict) {
+		size_t size = ZDICT_trainFromBuffer(dict, (size_t)c->dictBytes, c->samples,
+		                                    c->sampleSizes, (unsigned)c->samplesCount);
+		if(ZDICT_isError(size)) {
+			log_warn("[%s] compression dictionary training failed: %s", c->sink, ZDICT_getErrorName(size));
+		} else {
+			codec_use_dictionary(c, dict, (int)size, 0);
+		}
+		free(dict);
+	}
+
+	/* train once, successful or not */
+	free(c->samples);
+	free(c->sampleSizes);
+	c->samples = NULL;
+	c->sampleSizes = NULL;
+	c->trainSamples = 0;
+}
+#endif
+
+UAMQ_Codec* codec_new(const UAMQ_Compression* conf, const char* sink)
+{
+	int codec = getCompressionCodec(conf->codec);
+	if(codec < 0) {
+		printf("[%s] unknown compression codec '%s', sending uncompressed.\n", sink, conf->codec);
+		return NULL;
+	}
+
+#ifndef UAMQ_ENABLE_LZ4
+	if(codec == UAMQ_CODEC_LZ4) {
+		printf("[%s] lz4 support is not compiled in, sending uncompressed.\n", sink);
+		return NULL;
+	}
+#endif
+#ifndef UAMQ_ENABLE_ZSTD
+	if(codec == UAMQ_CODEC_ZSTD) {
+		printf("[%s] zstd support is not compiled in, sending uncompressed.\n", sink);
+		return NULL;
+	}
+#endif
+
+	if(codec == UAMQ_CODEC_NONE) {
+		return NULL;
+	}
+
+	UAMQ_Codec* c = (UAMQ_Codec*)calloc(1, sizeof(UAMQ_Codec));
+	if(!c) {
+		return NULL;
+	}
+
+	c->codec = codec;
+	c->level = conf->level;
+	c->minBytes = conf->minBytes;
+	c->sink = sink;
+	c->dictBytes = conf->dictBytes > 0 ? conf->dictBytes : DEFAULT_DICT_BYTES;
+	pthread_mutex_init(&c->lock, NULL);
+
+#ifdef UAMQ_ENABLE_ZSTD
+	if(codec == UAMQ_CODEC_ZSTD) {
+		c->cctx = ZSTD_createCCtx();
+		if(!c->cctx) {
+			codec_delete(c);
+			return NULL;
+		}
+		/* training needs zdict, which only zstd offers */
+		c->trainSamples = conf->trainSamples;
+	}
+#endif
+#ifdef UAMQ_ENABLE_LZ4
+	if(codec == UAMQ_CODEC_LZ4) {
+		c->lz4 = LZ4_createStream();
+		if(!c->lz4) {
+			codec_delete(c);
+			return NULL;
+		}
+	}
+#endif
+
+	if(strlen(conf->dictionary) > 0) {
+		if(codec_load_dictionary(c, conf->dictionary)) {
+			c->trainSamples = 0;
+		}
+	}
+
+	printf("[%s] compression %s (level %d, min %d bytes%s).\n", sink, conf->codec, c->level, c->minBytes,
+		c->trainSamples > 0 ? ", training dictionary" : "");
+
+	return c;
+}
+
+void codec_delete(UAMQ_Codec* c)
+{
+	if(!c) {
+		return;
+	}
+
+#ifdef UAMQ_ENABLE_ZSTD
+	if(c->cdict) ZSTD_freeCDict(c->cdict);
+	if(c->cctx) ZSTD_freeCCtx(c->cctx);
+#endif
+#ifdef UAMQ_ENABLE_LZ4
+	if(c->lz4) LZ4_freeStream(c->lz4);
+#endif
+
+	pthread_mutex_destroy(&c->lock);
+	free(c->samples);
+	free(c->sampleSizes);
+	free(c->dict);
+	free(c);
+}
+
+int codec_encode(UAMQ_Codec* c, const unsigned char* in, int inlen, unsigned char** out)
+{
+	if(!c || inlen < c->minBytes) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&c->lock);
+
+	int len = -1;
+	int bound = inlen;
+
+	/* a dictionary is only used once the consumers could have seen it */
+	bool dict = c->dict && c->dictAnnounced;
+	unsigned int dictId = dict ? c->dictId : 0;
+
+#ifdef UAMQ_ENABLE_ZSTD
+	if(c->codec == UAMQ_CODEC_ZSTD) {
+		if(c->trainSamples > 0) {
+			codec_train(c, in, inlen);
+		}
+
+		bound = (int)ZSTD_compressBound((size_t)inlen);
+		if(reserve(UAMQ_FRAME_HEADER_SIZE + bound)) {
+			size_t r;
+			if(dict) {
+				r = ZSTD_compress_usingCDict(c->cctx, frame + UAMQ_FRAME_HEADER_SIZE, (size_t)bound,
+				                             in, (size_t)inlen, c->cdict);
+			} else {
+				r = ZSTD_compressCCtx(c->cctx, frame + UAMQ_FRAME_HEADER_SIZE, (size_t)bound,
+				                      in, (size_t)inlen, c->level);
+			}
+			if(ZSTD_isError(r)) {
+				log_warn("[%s] compression failed: %s", c->sink, ZSTD_getErrorName(r));
+			} else {
+				len = (int)r;
+			}
+		}
+	}
+#endif
+#ifdef UAMQ_ENABLE_LZ4
+	if(c->codec == UAMQ_CODEC_LZ4) {
+		bound = LZ4_compressBound(inlen);
+		if(reserve(UAMQ_FRAME_HEADER_SIZE + bound)) {
+			/* lz4 has no reusable dictionary object, the stream is reset
+			 * and primed with the dictionary for every message */
+			LZ4_resetStream(c->lz4);
+			if(dict) {
+				LZ4_loadDict(c->lz4, (const char*)c->dict, c->dictSize);
+			}
+			len = LZ4_compress_fast_continue(c->lz4, (const char*)in, (char*)frame + UAMQ_FRAME_HEADER_SIZE,
+			                                 inlen, bound, c->level > 0 ? c->level : 1);
+			if(len <= 0) {
+				log_warn("[%s] compression failed.", c->sink);
+				len = -1;
+			}
+		}
+	}
+#endif
+
+	pthread_mutex_unlock(&c->lock);
+
+	/* not worth it, send the original payload */
+	if(len < 0 || len + UAMQ_FRAME_HEADER_SIZE >= inlen) {
+		return 0;
+	}
+
+	put_header(frame, c->codec, dictId, inlen, len);
+	*out = frame;
+
+	return UAMQ_FRAME_HEADER_SIZE + len;
+}
+
+int codec_take_dictionary(UAMQ_Codec* c, unsigned char** out, unsigned int* id)
+{
+	if(!c) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&c->lock);
+
+	int len = 0;
+	if(c->dict && !c->dictAnnounced && reserve(UAMQ_FRAME_HEADER_SIZE + c->dictSize)) {
+		put_header(frame, c->codec | UAMQ_FRAME_DICTIONARY, c->dictId, c->dictSize, c->dictSize);
+		memcpy(frame + UAMQ_FRAME_HEADER_SIZE, c->dict, (size_t)c->dictSize);
+		*out = frame;
+		*id = c->dictId;
+		len = UAMQ_FRAME_HEADER_SIZE + c->dictSize;
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return len;
+}
+
+void codec_dictionary_sent(UAMQ_Codec* c, unsigned int id)
+{
+	if(!c) {
+		return;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	/* a dictionary trained meanwhile is still to be announced */
+	if(c->dict && c->dictId == id) {
+		c->dictAnnounced = true;
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+void codec_dictionary_lost(UAMQ_Codec* c)
+{
+	if(!c) {
+		return;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	c->dictAnnounced = false;
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,66 @@
+#ifndef OPCUA_MQTT_BRIDGE_COMPRESS_H_
+#define OPCUA_MQTT_BRIDGE_COMPRESS_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "client-config.h"
+
+/*
+ * Compressed payloads are sent as a frame with a fixed 16 byte header
+ * (all fields big endian), followed by the compressed bytes:
+ *
+ *   0  'U' 'Z'      magic
+ *   2  version      UAMQ_FRAME_VERSION
+ *   3  codec        UAMQ_CODEC_xxx, or'ed with UAMQ_FRAME_DICTIONARY when the
+ *                   frame carries a dictionary instead of a payload
+ *   4  dictionary   id of the dictionary used (0 = none)
+ *   8  raw length   length of the original payload
+ *  12  length       number of bytes following the header
+ *
+ * MQTT 3.1.1 has no user properties, so the header is the content-encoding
+ * marker. Payloads below the configured minimum size are sent as is.
+ */
+#define UAMQ_FRAME_HEADER_SIZE 16
+#define UAMQ_FRAME_VERSION 1
+#define UAMQ_FRAME_DICTIONARY 0x80
+
+enum {
+	UAMQ_CODEC_NONE = 0,
+	UAMQ_CODEC_LZ4 = 1,
+	UAMQ_CODEC_ZSTD = 2
+};
+
+typedef struct UAMQ_Codec UAMQ_Codec;
+
+int getCompressionCodec(const char* name);
+
+/* returns NULL when the sink has compression disabled */
+UAMQ_Codec* codec_new(const UAMQ_Compression* conf, const char* sink);
+void codec_delete(UAMQ_Codec* codec);
+
+/* Compresses the payload into a frame. Returns the frame length and sets
+ * *out to a buffer of the calling thread, valid until its next call of
+ * codec_encode or codec_take_dictionary. Returns 0 when the payload should be
+ * sent uncompressed. The codec is not locked while the frame is sent. */
+int codec_encode(UAMQ_Codec* codec, const unsigned char* in, int inlen, unsigned char** out);
+
+/* Returns a dictionary frame (in the same buffer as codec_encode) after a
+ * dictionary has been loaded or trained, until codec_dictionary_sent reports
+ * it delivered; the sink announces it to its consumers before the payloads
+ * compressed with it. */
+int codec_take_dictionary(UAMQ_Codec* codec, unsigned char** out, unsigned int* id);
+void codec_dictionary_sent(UAMQ_Codec* codec, unsigned int id);
+
+/* The consumers may have missed the dictionary (the sink reconnected), it is
+ * announced again before it is used. */
+void codec_dictionary_lost(UAMQ_Codec* codec);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_COMPRESS_H_ */
@@ -15,8 +15,10 @@
 #endif
 
 #include <unistd.h>
+#include <errno.h>
 #include <stdio.h>
 #include <signal.h>
+#include <sched.h>
 
 #include <iostream>
 #include <list>
@@ -26,14 +28,17 @@ using namespace std;
 #include "MQTTPacket.h"
 #include "pub.h"
 #include "client-config.h"
+#include "client-common.h"
 #include "json.h"
 #include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-topology.h"
+#include "client-discovery.h"
+#include "client-log.h"
+#include "client-realtime.h"
 
 extern int beStop;
 
-map<int, Group> m;
-map<int, Group>* gmap = &m;
-
 UAMQ_Configuration g_Configutation;
 UAMQ_Configuration* g_config = &g_Configutation;
 
@@ -62,231 +67,589 @@ int config(int argc, char *argv[])
 	strcpy(&g_Configutation.configFile[0], argv[2]);
 
 	if(load(&g_Configutation.configFile[0]) != UA_STATUSCODE_GOOD) {
-		printf("[error] the file (%s) has invalid json syntax or path is not valid.\n", &g_Configutation.configFile[0]);
+		printf("[error] the file (%s) could not be loaded.\n", &g_Configutation.configFile[0]);
 		return -1;
 	}
 
     return (int)UA_STATUSCODE_GOOD;
 }
 
-void travers(json_object *parent, json_object *r, enum json_type t)
+/* the value of a node-map key must have the type the key expects */
+static bool expect(json_object *v, enum json_type t)
 {
-	enum json_type type;
-
-	switch(t) {
-		case json_type_object: {
-
-			json_object_object_foreach(r, key, val) {
-				printf("key:%s > ", key);
-
-				type = json_object_get_type(val);
-				switch(type) {
-					case json_type_null: printf("2 %s\n", "null"); break;
-					case json_type_boolean: printf("2 %s=%d\n", "boolean", json_object_get_boolean(val)); break;
-					case json_type_double: printf("2 %s=%lf\n", "double", json_object_get_double(val)); break;
-					case json_type_int: printf("2 %s=%d\n", "int", json_object_get_int(val)); break;
-					case json_type_object: travers(r, val, json_type_object); break;
-					case json_type_array: travers(r, val, json_type_array); break;
-					case json_type_string: printf("2 %s=%s\n", "string", json_object_get_string(val)); break;
-					default :  printf("2 %s\n", "unknown"); break;
-				}
-			}
+	enum json_type type = json_object_get_type(v);
+	return type == t || (t == json_type_double && type == json_type_int);
+}
+
+static void unexpected(json_object *v, enum json_type t, const char* path, const char* key)
+{
+	printf("[error] %s.%s: expected %s, got %s.\n", path, key, json_type_to_name(t), json_type_to_name(json_object_get_type(v)));
+}
+
+/* the path of a node is only formatted when there is something to report */
+static int make_node(json_object *r, Node* n, Strings* pool, const char* group, int index)
+{
+	char path[64];
+
+	if(json_object_get_type(r) != json_type_object) {
+		printf("[error] %s.nodes[%d]: expected an object.\n", group, index);
+		return -1;
+	}
+
+	json_object_object_foreach(r, key, v) {
+		char** field = NULL;
+
+		if(!strcmp(key, "id")) {
+			field = &n->id;
+		} else if(!strcmp(key, "topic")) {
+			field = &n->topic;
+		} else if(!strcmp(key, "alias")) {
+			field = &n->alias;
+		} else {
+			printf("[error] %s.nodes[%d].%s: unknown key.\n", group, index, key);
+			return -1;
 		}
-		break;
-		case json_type_array: {
-			int l = json_object_array_length(r);
+
+		if(!expect(v, json_type_string)) {
+			snprintf(path, sizeof(path), "%s.nodes[%d]", group, index);
+			unexpected(v, json_type_string, path, key);
+			return -1;
+		}
+		*field = strings_intern(pool, json_object_get_string(v));
+	}
+
+	if(!n->id || !n->topic) {
+		printf("[error] %s.nodes[%d]: \"%s\" is required.\n", group, index, n->id ? "topic" : "id");
+		return -1;
+	}
+
+	UA_NodeId ua;
+	if(getUA_NodeID(n->id, &ua) != UA_STATUSCODE_GOOD) {
+		printf("[error] %s.nodes[%d].id: \"%s\" is not a node id of the form [ns=<n>;]i=<n> or [ns=<n>;]s=<string>.\n", group, index, n->id);
+		return -1;
+	}
+	UA_NodeId_deleteMembers(&ua);
+
+	/* an empty alias publishes the value under the node topic */
+	if(!n->alias || !n->alias[0]) {
+		n->alias = n->topic;
+	}
+
+	return 0;
+}
+
+static int command_topic_of(const char* topic)
+{
+	for (int i = 0; g_Configutation.commandEnable && i < g_Configutation.commandTopicCount; i++) {
+		if(mqtt_topic_matches(g_Configutation.commandTopics[i], topic)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* the values of the group must not come back in as commands */
+static int data_on_command_topic(Group* G, const char* path)
+{
+	char topic[512];
+	int c = -1;
+
+	if(getMonitorMode(G->method) == enumPoll) {
+		snprintf(topic, sizeof(topic), "%s/%s/%s", g_Configutation.topicBase, g_Configutation.deviceID, G->topic);
+		c = command_topic_of(topic);
+	}
+	for (size_t n = 0; c < 0 && getMonitorMode(G->method) == enumEvent && n < G->nodes.size(); n++) {
+		snprintf(topic, sizeof(topic), "%s/%s/%s/%s", g_Configutation.topicBase, g_Configutation.deviceID, G->topic, G->nodes[n].topic);
+		c = command_topic_of(topic);
+	}
+
+	if(c >= 0) {
+		printf("[error] %s.topic: the data topic \"%s\" matches commands.mqttTopics[%d] \"%s\".\n", path, topic, c, g_Configutation.commandTopics[c]);
+		return -1;
+	}
+	return 0;
+}
+
+int make_group(json_object *r, Group* G, Strings* pool, const char* path)
+{
+	json_object_object_foreach(r, key, val) {
+
+		if(!strcmp(key, "name") || !strcmp(key, "method") || !strcmp(key, "topic") || !strcmp(key, "format") || !strcmp(key, "server")) {
+			if(!expect(val, json_type_string)) {
+				unexpected(val, json_type_string, path, key);
+				return -1;
+			}
+			char* s = strings_intern(pool, json_object_get_string(val));
+			switch(key[0]) {
+				case 'n': G->name = s; break;
+				case 'm': G->method = s; break;
+				case 't': G->topic = s; break;
+				case 's': G->server = s; break;
+				default: G->format = s; break;
+			}
+		} else if(!strcmp(key, "intervalUSec")) {
+			if(!expect(val, json_type_int)) {
+				unexpected(val, json_type_int, path, key);
+				return -1;
+			}
+			G->intervalUSec = json_object_get_int(val);
+		} else if(!strcmp(key, "mqtt") || !strcmp(key, "amqp") || !strcmp(key, "tcp") || !strcmp(key, "enable")) {
+			if(!expect(val, json_type_boolean)) {
+				unexpected(val, json_type_boolean, path, key);
+				return -1;
+			}
+			bool b = json_object_get_boolean(val);
+			switch(key[0]) {
+				case 'm': G->mqtt = b; break;
+				case 'a': G->amqp = b; break;
+				case 't': G->tcp = b; break;
+				default: G->enable = b; break;
+			}
+		} else if(!strcmp(key, "nodes")) {
+			if(!expect(val, json_type_array)) {
+				unexpected(val, json_type_array, path, key);
+				return -1;
+			}
+
+			int l = json_object_array_length(val);
+			G->nodes.reserve(l);
 
 			for (int i = 0; i < l; i++) {
-				json_object *val = json_object_array_get_idx(r, i);
-
-				enum json_type type;
-				type = json_object_get_type(val);
-				switch(type) {
-					case json_type_null: printf("3 %s\n", "null"); break;
-					case json_type_boolean: printf("3 %s=%d\n", "boolean", json_object_get_boolean(val)); break;
-					case json_type_double: printf("3 %s=%lf\n", "double", json_object_get_double(val)); break;
-					case json_type_int: printf("3 %s=%d\n", "int", json_object_get_int(val)); break;
-					case json_type_object: travers(r, val, json_type_object); break;
-					case json_type_array: travers(r, val, json_type_array); break;
-					case json_type_string: printf("3 %s=%s\n", "string", json_object_get_string(val)); break;
-					default : printf("3 %s\n", "unknown"); break;
+				Node n = Node();
+				if(make_node(json_object_array_get_idx(val, i), &n, pool, path, i) != 0) {
+					return -1;
 				}
+				G->nodes.push_back(n);
 			}
+		} else {
+			printf("[error] %s.%s: unknown key.\n", path, key);
+			return -1;
 		}
-		break;
-		default: {
-			return;
+	}
+
+	if(!G->name || !G->method || !G->topic) {
+		printf("[error] %s: \"%s\" is required.\n", path, !G->name ? "name" : !G->method ? "method" : "topic");
+		return -1;
+	}
+
+	if(!G->format) {
+		G->format = strings_intern(pool, "json");
+	}
+
+	UAMQ_Endpoint* e = G->server ? endpoint_find(G->server) : &g_Configutation.endpoints[0];
+	if(!e) {
+		printf("[error] %s.server: no opcuaServer is named \"%s\".\n", path, G->server);
+		return -1;
+	}
+	G->server = strings_intern(pool, e->name);
+	G->endpoint = e->index;
+
+	if(G->mqtt && data_on_command_topic(G, path) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* optional "compression" block of a sink */
+void load_compression(json_object *r, UAMQ_Compression* z)
+{
+	json_object *c = NULL;
+	json_object *v = NULL;
+
+	strcpy(z->codec, "none");
+	z->level = 0;
+	z->minBytes = 64;
+	z->dictionary[0] = 0;
+	z->trainSamples = 0;
+	z->dictBytes = 0;
+
+	if(!json_object_object_get_ex(r, "compression", &c)) {
+		return;
+	}
+
+	if(json_object_object_get_ex(c, "codec", &v)) {
+		snprintf(z->codec, sizeof(z->codec), "%s", json_object_get_string(v));
+	}
+	if(json_object_object_get_ex(c, "level", &v)) {
+		z->level = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "minBytes", &v)) {
+		z->minBytes = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "dictionary", &v)) {
+		snprintf(z->dictionary, sizeof(z->dictionary), "%s", json_object_get_string(v));
+	}
+	if(json_object_object_get_ex(c, "trainSamples", &v)) {
+		z->trainSamples = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "dictBytes", &v)) {
+		z->dictBytes = json_object_get_int(v);
+	}
+}
+
+/* optional "metrics" block, the endpoint is local unless configured otherwise */
+static void load_metrics(json_object *r)
+{
+	json_object *c = NULL;
+	json_object *v = NULL;
+
+	g_Configutation.metricsEnable = false;
+	strcpy(g_Configutation.metricsAddress, "127.0.0.1");
+	g_Configutation.metricsPort = 9464;
+
+	if(!json_object_object_get_ex(r, "metrics", &c)) {
+		return;
+	}
+
+	if(json_object_object_get_ex(c, "enable", &v)) {
+		g_Configutation.metricsEnable = json_object_get_boolean(v);
+	}
+	if(json_object_object_get_ex(c, "address", &v)) {
+		snprintf(g_Configutation.metricsAddress, sizeof(g_Configutation.metricsAddress), "%s", json_object_get_string(v));
+	}
+	if(json_object_object_get_ex(c, "port", &v)) {
+		g_Configutation.metricsPort = json_object_get_int(v);
+	}
+}
+
+/* optional "log" block */
+static int load_log(json_object *r)
+{
+	json_object *c = NULL;
+	json_object *v = NULL;
+
+	if(!json_object_object_get_ex(r, "log", &c)) {
+		return 0;
+	}
+
+	if(json_object_object_get_ex(c, "level", &v)) {
+		int level = log_level_of(json_object_get_string(v));
+		if(level < 0) {
+			printf("[error] log.level: \"%s\" is none of error, warn, info, debug, trace.\n", json_object_get_string(v));
+			return -1;
+		}
+		if(level > UAMQ_LOG_COMPILED) {
+			printf("[log] level %s is not compiled in (UAMQ_LOG_COMPILED %d).\n", json_object_get_string(v), UAMQ_LOG_COMPILED);
 		}
+		log_level = level;
+	}
+	if(json_object_object_get_ex(c, "ratePerSecond", &v)) {
+		log_rate = json_object_get_int(v);
 	}
+
+	return 0;
 }
 
-//===================================================================================================================================================================
-void make_node_list(int group, int depth, json_object *parent, json_object *r)
+/* reads a list of strings into fixed slots, returns the count or -1 */
+static int load_strings(json_object* a, char (*out)[128], int max, const char* path)
 {
-	enum json_type type;
+	if(json_object_get_type(a) != json_type_array || (int)json_object_array_length(a) > max) {
+		printf("[error] %s: a list of up to %d strings is expected.\n", path, max);
+		return -1;
+	}
+	int n = (int)json_object_array_length(a);
+	for (int i = 0; i < n; i++) {
+		json_object* s = json_object_array_get_idx(a, i);
+		if(json_object_get_type(s) != json_type_string || json_object_get_string_len(s) >= 128) {
+			printf("[error] %s[%d]: a string of up to 127 characters is expected.\n", path, i);
+			return -1;
+		}
+		strcpy(out[i], json_object_get_string(s));
+	}
+	return n;
+}
 
-	printf("make node list >> [G:%d/D:%d]\n",  group, depth);
+/*
+ * Optional "commands" block, the write-back path. Commands are taken from the
+ * mqtt topics and from the tcp port, answers go to the response topic or back
+ * on the tcp connection. Without "anyNode" only nodes of the node-map can be
+ * written and only the listed methods called.
+ */
+static int load_commands(json_object *r)
+{
+	json_object *c = NULL;
+	json_object *v = NULL;
 
-	int l = json_object_array_length(r);
+	g_Configutation.commandEnable = false;
+	g_Configutation.commandTopicCount = 1;
+	snprintf(g_Configutation.commandTopics[0], sizeof(g_Configutation.commandTopics[0]), "%s/%s/command", g_Configutation.topicBase, g_Configutation.deviceID);
+	snprintf(g_Configutation.commandResponseTopic, sizeof(g_Configutation.commandResponseTopic), "%s/%s/response", g_Configutation.topicBase, g_Configutation.deviceID);
+	strcpy(g_Configutation.commandAddress, "127.0.0.1");
+	g_Configutation.commandPort = 0;
+	g_Configutation.commandIntervalUs = 100000;
+	g_Configutation.commandAnyNode = false;
+	g_Configutation.commandMethodCount = 0;
+
+	if(!json_object_object_get_ex(r, "commands", &c)) {
+		return 0;
+	}
 
-	for (int i = 0; i < l; i++) {
-		json_object *val = json_object_array_get_idx(r, i);
+	if(json_object_object_get_ex(c, "enable", &v)) {
+		g_Configutation.commandEnable = json_object_get_boolean(v);
+	}
+	if(json_object_object_get_ex(c, "mqttTopics", &v)) {
+		g_Configutation.commandTopicCount = load_strings(v, g_Configutation.commandTopics, UAMQ_MAX_COMMAND_TOPICS, "commands.mqttTopics");
+		if(g_Configutation.commandTopicCount < 0) {
+			return -1;
+		}
+	}
+	if(json_object_object_get_ex(c, "responseTopic", &v)) {
+		snprintf(g_Configutation.commandResponseTopic, sizeof(g_Configutation.commandResponseTopic), "%s", json_object_get_string(v));
+	}
+	if(json_object_object_get_ex(c, "address", &v)) {
+		snprintf(g_Configutation.commandAddress, sizeof(g_Configutation.commandAddress), "%s", json_object_get_string(v));
+	}
+	if(json_object_object_get_ex(c, "tcpPort", &v)) {
+		g_Configutation.commandPort = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "intervalUs", &v)) {
+		g_Configutation.commandIntervalUs = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "anyNode", &v)) {
+		g_Configutation.commandAnyNode = json_object_get_boolean(v);
+	}
+	if(json_object_object_get_ex(c, "methods", &v)) {
+		g_Configutation.commandMethodCount = load_strings(v, g_Configutation.commandMethods, UAMQ_MAX_COMMAND_METHODS, "commands.methods");
+		if(g_Configutation.commandMethodCount < 0) {
+			return -1;
+		}
+	}
 
-		enum json_type type;
-		type = json_object_get_type(val);
-		switch(type) {
-			case json_type_null: printf("%d/%d %s\n", group, i, "null"); break;
-			case json_type_boolean: printf("%d/%d %s=%d\n", group, i, "boolean", json_object_get_boolean(val)); break;
-			case json_type_double: printf("%d/%d %s=%lf\n", group, i,  "double", json_object_get_double(val)); break;
-			case json_type_int: printf("%d/%d %s=%d\n", group, i, "int",  json_object_get_int(val)); break;
-			case json_type_string: printf("%d/%d %s=%s\n", group, i,"string",   json_object_get_string(val)); break;
+	/* a command topic that takes in our own output would answer itself */
+	for (int i = 0; i < g_Configutation.commandTopicCount; i++) {
+		if(mqtt_topic_matches(g_Configutation.commandTopics[i], g_Configutation.commandResponseTopic)) {
+			printf("[error] commands.mqttTopics[%d]: \"%s\" matches the response topic \"%s\".\n", i,
+				g_Configutation.commandTopics[i], g_Configutation.commandResponseTopic);
+			return -1;
+		}
+	}
 
-			case json_type_object: {
-				printf("%d/%d %s\n",  group, i, " ===> object");
-				//make_group(group, depth + 1, i, r, val);
-			}
-			break;
+	if(g_Configutation.commandEnable) {
+		printf("commands: %d mqtt topics, tcp port %d, interval(us): %d, any node: %d, methods: %d\n", g_Configutation.commandTopicCount,
+			g_Configutation.commandPort, g_Configutation.commandIntervalUs, g_Configutation.commandAnyNode, g_Configutation.commandMethodCount);
+	}
+	return 0;
+}
 
-			case json_type_array: {
-				printf("%d/%d %s\n",  group, i, "===> array");
-				//make_node_list(group, depth + 1, r, val);
-			}
-			break;
-			
-			default :  printf("%d/%d %s\n",  group, i, "unknown"); break;
+/* "cpu" of a role: a core or a list of cores, below 64 */
+static int load_cpus(json_object* v, unsigned long long* cpus, const char* role)
+{
+	int n = json_object_get_type(v) == json_type_array ? (int)json_object_array_length(v) : 1;
+	for (int i = 0; i < n; i++) {
+		json_object* c = json_object_get_type(v) == json_type_array ? json_object_array_get_idx(v, i) : v;
+		int cpu = json_object_get_type(c) == json_type_int ? json_object_get_int(c) : -1;
+		if(cpu < 0 || cpu >= 64) {
+			printf("[error] realtime.threads.%s.cpu: a core or a list of cores from 0 to 63 is expected.\n", role);
+			return -1;
 		}
+		*cpus |= 1ULL << cpu;
 	}
+	return 0;
 }
 
-int make_group(json_object *r, Group* G)
+/*
+ * Optional "realtime" block: cores and SCHED_FIFO priorities of the threads
+ * by role, locked and prefaulted memory. Nothing is changed without it.
+ */
+static int load_realtime(json_object *r)
 {
-	enum json_type type;
-	int field = 0;
+	json_object *c = NULL;
+	json_object *v = NULL;
 
-	json_object_object_foreach(r, key, val) {
+	memset(g_Configutation.placement, 0, sizeof(g_Configutation.placement));
+	g_Configutation.lockMemory = false;
+	g_Configutation.prefaultKB = 0;
+	g_Configutation.stackKB = 0;
 
-		if(!strncmp(key, "name", strlen(key))) {
-			G->name = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "method", strlen(key))) {
-			G->method = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "intervalUSec", strlen(key))) {
-			G->intervalUSec = json_object_get_int(val);
-		} else if(!strncmp(key, "topic", strlen(key))) {
-			G->topic = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		}  else if(!strncmp(key, "format", strlen(key))) {
-			G->format = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "mqtt", strlen(key))) {
-			G->mqtt = json_object_get_boolean(val);
-		} else if(!strncmp(key, "amqp", strlen(key))) {
-			G->amqp = json_object_get_boolean(val);
-		} else if(!strncmp(key, "tcp", strlen(key))) {
-			G->tcp = json_object_get_boolean(val);
-		} else if(!strncmp(key, "enable", strlen(key))) {
-			G->enable = json_object_get_boolean(val);
-		} else if(!strncmp(key, "nodes", strlen(key))) {
-
-			type = json_object_get_type(val);
-
-			switch(type) {
-				case json_type_array: {
-
-					Node n;
-
-					int l = json_object_array_length(val);
-
-					for (int i = 0; i < l; i++) {
-						json_object *node = json_object_array_get_idx(val, i);
-
-						type = json_object_get_type(node);
-
-						switch(type) {
-							case json_type_object: {
-								json_object_object_foreach(node, field, v) {
-									
-									if(!strncmp(field, "id", strlen(field))) {
-										n.id = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-									} else if(!strncmp(field, "topic", strlen(field))) {
-										n.topic = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-									} else if(!strncmp(field, "alias", strlen(field))) {
-										if(strlen(json_object_get_string(v)) == 0) {
-											n.alias = strndup(n.topic, strlen(n.topic));
-										} else {
-											n.alias = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-										}
-									}
-								}
-							}
-							break;
-
-							default :  {
-								printf("%d %s\n", i, " ===> other");
-							}
-							break;
-						}
-						cout << "\t[" << i << "] id: " << n.id << ", topic: " << n.topic << ", alias: " << n.alias << "\n";
-						G->nodes.insert(pair<int, Node>(i, n));
-					}
-				}
-				break;
-				default : {
-					printf("%s\n", " ===> other"); 
-					break;
+	if(!json_object_object_get_ex(r, "realtime", &c)) {
+		return 0;
+	}
+
+	if(json_object_object_get_ex(c, "lockMemory", &v)) {
+		g_Configutation.lockMemory = json_object_get_boolean(v);
+	}
+	if(json_object_object_get_ex(c, "prefaultKB", &v)) {
+		g_Configutation.prefaultKB = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(c, "stackKB", &v)) {
+		g_Configutation.stackKB = json_object_get_int(v);
+		if(g_Configutation.stackKB != 0 && g_Configutation.stackKB < 128) {
+			printf("[error] realtime.stackKB: at least 128 is expected.\n");
+			return -1;
+		}
+	}
+
+	if(json_object_object_get_ex(c, "threads", &v)) {
+		json_object_object_foreach(v, key, val) {
+			int role = rt_role_of(key);
+			if(role < 0) {
+				printf("[error] realtime.threads.%s: none of main, poll, opcua, mqtt, tcp, command, metrics, log.\n", key);
+				return -1;
+			}
+
+			UAMQ_Placement* p = &g_Configutation.placement[role];
+			json_object *o = NULL;
+			if(json_object_object_get_ex(val, "cpu", &o) && load_cpus(o, &p->cpus, key) != 0) {
+				return -1;
+			}
+			if(json_object_object_get_ex(val, "priority", &o)) {
+				p->priority = json_object_get_int(o);
+				if(p->priority < 0 || p->priority > sched_get_priority_max(SCHED_FIFO)) {
+					printf("[error] realtime.threads.%s.priority: 0 to %d is expected.\n", key, sched_get_priority_max(SCHED_FIFO));
+					return -1;
 				}
 			}
-		} else {
-			return -1;
+			printf("realtime: %s cpus 0x%llx, priority %d\n", key, p->cpus, p->priority);
 		}
 	}
 
+	printf("realtime: lock memory: %d, prefault(KB): %d, stack(KB): %d\n", g_Configutation.lockMemory,
+		g_Configutation.prefaultKB, g_Configutation.stackKB);
 	return 0;
 }
 
-int load(char* fn)
+UAMQ_Endpoint* endpoint_find(const char* name)
 {
-	char exe[256] = {0, };
-	ssize_t count = readlink( "/proc/self/exe", exe, 256 );
+	for (int i = 0; i < g_Configutation.endpointCount; i++) {
+		if(!strcmp(g_Configutation.endpoints[i].name, name)) {
+			return &g_Configutation.endpoints[i];
+		}
+	}
+	return NULL;
+}
 
-	char *folder = NULL;
-	char *slash = NULL;
-	slash = strrchr(exe, '/'); 
-	folder = strndup(exe, strlen(exe) - strlen(slash));
-	
-	strcpy(&g_Configutation.configFolder[0], folder);
-	
-	char configFn[256] = {0, };
+/* a key the bridge can't do without */
+static bool required(json_object *o, const char* path, const char* key, json_object **v)
+{
+	if(json_object_object_get_ex(o, key, v)) {
+		return true;
+	}
+	printf("[error] %s: \"%s\" is required.\n", path, key);
+	return false;
+}
 
-	if(!strncmp(fn, "/", strlen("/"))) {
-		strcpy(configFn, g_Configutation.configFile);
+/*
+ * One entry of "opcuaServer". "name" is what node-map groups refer to with
+ * "server", groups without it go to the first server. The connection worker
+ * of a server runs on core "cpu"; with several servers they are spread over
+ * the cores unless "cpu" is -1.
+ */
+static int load_endpoint(json_object *c, int index, int count)
+{
+	json_object *v = NULL;
+	UAMQ_Endpoint* e = &g_Configutation.endpoints[index];
+
+	memset(e, 0, sizeof(UAMQ_Endpoint));
+	e->index = index;
+
+	char path[32];
+	snprintf(path, sizeof(path), "opcuaServer[%d]", index);
+
+	if(json_object_object_get_ex(c, "name", &v)) {
+		snprintf(e->name, sizeof(e->name), "%s", json_object_get_string(v));
 	} else {
-		sprintf(configFn, "%s/%s", folder, fn);
-		sprintf(g_Configutation.configFile, "%s", configFn);
+		snprintf(e->name, sizeof(e->name), "%s%d", "server", index);
+	}
+	if(endpoint_find(e->name)) {
+		printf("[error] opcuaServer[%d]: the name \"%s\" is used twice.\n", index, e->name);
+		return -1;
 	}
 
-	free(folder);
+	if(!required(c, path, "EndpointURL", &v)) {
+		return -1;
+	}
+	snprintf(e->uaServerAddress, sizeof(e->uaServerAddress), "%s", json_object_get_string(v));
+
+	if(!required(c, path, "publishIntervalUs", &v)) {
+		return -1;
+	}
+	e->uaPublishIntervalUsecs = json_object_get_int(v);
+
+	if(!required(c, path, "asycRequestSupported", &v)) {
+		return -1;
+	}
+	e->asycRequestSupported = json_object_get_boolean(v);
 
-	#define CHUNK 1024 * 1024
-	char data[CHUNK] = {0,};
-	FILE *file;
+	if(!required(c, path, "method", &v)) {
+		return -1;
+	}
+	snprintf(e->method, sizeof(e->method), "%s", json_object_get_string(v));
 
-	file = fopen(configFn, "r");
-	if (file) {
-		size_t nread;
-		while ((nread = fread(data, 1, sizeof data, file)) > 0) {
-			//fwrite(data, 1, nread, stdout);
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(json_object_object_get_ex(c, "cpu", &v)) {
+		e->cpu = json_object_get_int(v);
+	} else {
+		e->cpu = count > 1 && cores > 1 ? (int)(index % cores) : -1;
+	}
 
-			//allowed first 1MB only.
-			break;
-		}
+	printf("opcuaServer[%d] \"%s\": %s, method: %s, cpu: %d\n", index, e->name, e->uaServerAddress, e->method, e->cpu);
+
+	g_Configutation.endpointCount++;
+	return 0;
+}
+
+/*
+ * Reads and parses the config file, NULL if it can't be read or parsed. The
+ * file is fed to the tokener in chunks, so there is no limit on its size,
+ * and a syntax error is reported with its line and column.
+ */
+json_object* read_config(const char* fn)
+{
+	#define CHUNK 64 * 1024
+	char data[CHUNK];
+
+	FILE *file = fopen(fn, "r");
+	if (!file) {
+		return NULL;
+	}
 
-		if (ferror(file)) {
-			/* deal with error */
+	json_tokener* tok = json_tokener_new();
+	json_object* jobj = NULL;
+	enum json_tokener_error jerr = json_tokener_continue;
+	int line = 1, column = 1;
+
+	size_t nread;
+	while (jerr == json_tokener_continue && (nread = fread(data, 1, sizeof data, file)) > 0) {
+		jobj = json_tokener_parse_ex(tok, data, (int)nread);
+		jerr = json_tokener_get_error(tok);
+
+		/* position of the last character the tokener consumed */
+		size_t used = jerr == json_tokener_continue ? nread : (size_t)tok->char_offset;
+		for (size_t i = 0; i < used; i++) {
+			if(data[i] == '\n') {
+				line++;
+				column = 1;
+			} else {
+				column++;
+			}
 		}
-		fclose(file);
-	} else {
-		return -1;
 	}
 
-	json_object *jobj = json_tokener_parse(data);
+	if(ferror(file)) {
+		printf("[error] %s: read failed.\n", fn);
+		jerr = json_tokener_error_parse_eof;
+	} else if(jerr == json_tokener_continue) {
+		/* a document that ends without a delimiter, e.g. a bare number */
+		jobj = json_tokener_parse_ex(tok, "", 1);
+		jerr = json_tokener_get_error(tok);
+	}
+
+	if(jerr != json_tokener_success) {
+		printf("[error] %s:%d:%d: %s.\n", fn, line, column, json_tokener_error_desc(jerr));
+		json_object_put(jobj);
+		jobj = NULL;
+	}
+
+	json_tokener_free(tok);
+	fclose(file);
+
+	return jobj;
+}
+
+/* the device and server settings, the node-map is loaded by load() */
+static int load_settings(json_object *jobj)
+{
 	json_object *o = NULL;
 	json_object *c = NULL;
 	json_object *v = NULL;
@@ -294,11 +657,11 @@ int load(char* fn)
 	bool b = json_object_object_get_ex(jobj, "device-configuration", &o);
 	if(b) {
 		printf("[[[ %s ]]]\n", "device-configuration");
-		if(!json_object_object_get_ex(o, "Device", &c)) {
+		if(!required(o, "device-configuration", "Device", &c)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "deviceID", &v)) {
+		if(!required(c, "device-configuration.Device", "deviceID", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.deviceID, json_object_get_string(v));
@@ -307,152 +670,188 @@ int load(char* fn)
 	b = json_object_object_get_ex(jobj, "server-configuration", &o);
 	if(b) {
 		printf("[[[ %s ]]]\n", "server-configuration");
-		//travers(jobj, o, json_type_object);
-
-		if(!json_object_object_get_ex(o, "opcuaServer", &c)) {
-			return -1;
-		}
-
-		if(!json_object_object_get_ex(c, "EndpointURL", &v)) {
-			return -1;
-		}
-		strcpy(g_Configutation.uaServerAddress, json_object_get_string(v));
-
-		if(!json_object_object_get_ex(c, "publishIntervalUs", &v)) {
+		if(!required(o, "server-configuration", "opcuaServer", &c)) {
 			return -1;
 		}
-		g_Configutation.uaPublishIntervalUsecs = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "asycRequestSupported", &v)) {
+		/* a single server or a list of them */
+		bool list = json_object_get_type(c) == json_type_array;
+		int l = list ? json_object_array_length(c) : 1;
+		if(l < 1 || l > UAMQ_MAX_ENDPOINTS) {
+			printf("[error] opcuaServer: 1 to %d servers are supported.\n", UAMQ_MAX_ENDPOINTS);
 			return -1;
 		}
-		g_Configutation.asycRequestSupported = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "method", &v)) {
-			return -1;
+		g_Configutation.endpointCount = 0;
+		for (int i = 0; i < l; i++) {
+			if(load_endpoint(list ? json_object_array_get_idx(c, i) : c, i, l) != 0) {
+				return -1;
+			}
 		}
-		strcpy(g_Configutation.method, json_object_get_string(v));
 
 		// MQTT =========
-		if(!json_object_object_get_ex(o, "mqttBrocker", &c)) {
+		if(!required(o, "server-configuration", "mqttBrocker", &c)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "enable", &v)) {
 			return -1;
 		}
 		g_Configutation.mqttEnable = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.mqttBrockerIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "port", &v)) {
 			return -1;
 		}
 		g_Configutation.mqttBrockerPORT = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "topicBase", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "topicBase", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.topicBase, json_object_get_string(v));
 
+		load_compression(c, &g_Configutation.mqttCompression);
+
 		// AMQP Rabbit =========
-		if(!json_object_object_get_ex(o, "amqpRabbit", &c)) {
+		if(!required(o, "server-configuration", "amqpRabbit", &c)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "enable", &v)) {
 			return -1;
 		}
 		g_Configutation.amqpEnable = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.amqpIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "port", &v)) {
 			return -1;
 		}
 		g_Configutation.amqpPORT = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "topicBase", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "topicBase", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.amqpTopicBase, json_object_get_string(v));
 
 		// TCP ============
-		if(!json_object_object_get_ex(o, "tcpSever", &c)) {
+		if(!required(o, "server-configuration", "tcpSever", &c)) {
 			return -1;
 		}
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.tcpBrockerIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "port", &v)) {
 			return -1;
 		}
 		g_Configutation.tcpBrockerPORT = json_object_get_int(v);
 		
-		if(!json_object_object_get_ex(c, "sampleIntervalUs", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "sampleIntervalUs", &v)) {
 			return -1;
 		}
 		g_Configutation.tcpSampleIntervalUs = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "singleshot", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "singleshot", &v)) {
 			return -1;
 		}
 		g_Configutation.singleshot = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "enable", &v)) {
 			return -1;
 		}
 		g_Configutation.tcpEnable = json_object_get_boolean(v);
+
+		load_compression(c, &g_Configutation.tcpCompression);
+
+		load_metrics(o);
+		if(load_log(o) != 0) {
+			return -1;
+		}
+		if(load_commands(o) != 0) {
+			return -1;
+		}
+		if(load_realtime(o) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int load(char* fn)
+{
+	char exe[256] = {0, };
+	ssize_t count = readlink( "/proc/self/exe", exe, 256 );
+
+	char *folder = NULL;
+	char *slash = NULL;
+	slash = strrchr(exe, '/'); 
+	folder = strndup(exe, strlen(exe) - strlen(slash));
+	
+	strcpy(&g_Configutation.configFolder[0], folder);
+	
+	char configFn[256] = {0, };
+
+	if(!strncmp(fn, "/", strlen("/"))) {
+		strcpy(configFn, g_Configutation.configFile);
+	} else {
+		sprintf(configFn, "%s/%s", folder, fn);
+		sprintf(g_Configutation.configFile, "%s", configFn);
+	}
+
+	free(folder);
+
+	if(access(configFn, R_OK) != 0) {
+		printf("[error] %s: %s.\n", configFn, strerror(errno));
+		return -1;
 	}
 
-	b = json_object_object_get_ex(jobj, "node-map", &o);
+	json_object *jobj = read_config(configFn);
+	if(!jobj) {
+		return -1;
+	}
+
+	if(load_settings(jobj) != 0) {
+		json_object_put(jobj);
+		return -1;
+	}
+
+	json_object *o = NULL;
+	bool b = json_object_object_get_ex(jobj, "node-map", &o);
 	if(b) {
 		printf("[[[ %s ]]]\n", "node-map");
+	} else {
+		o = json_object_new_array();
+		json_object_object_add(jobj, "node-map", o);
+	}
+	discovery_append(jobj, o);
 
-		int l = json_object_array_length(o);
+	Topology* t = topology_build(o);
+	json_object_put(jobj);
 
-		for (int i = 0; i < l; i++) {
-			json_object *n = json_object_array_get_idx(o, i);
-
-			enum json_type type;
-			type = json_object_get_type(n);
-			switch(type) {
-				case json_type_object: {
-					printf("[[[ %s : RECORD GROUP(OBJ) #%d ]]]\n", "node-map", i);
-					Group g;
-					make_group(n, &g);
-					m.insert(pair<int, Group>(i, g));
-				}
-				break;
-				default : {
-					printf("%s\n", "node-map should be contained object array only.");
-					break;
-				}
-			}
-		}
+	if(!t) {
+		return -1;
 	}
+	topology_publish(t);
 
 	cout << "\n";
 
-	map<int, Group>::iterator i;
-	for (i = m.begin(); i != m.end(); ++i) {
-		Group* p = (Group*)&i->second;
-		cout << "[" << i->first << "] name: " << p->name << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
-
-		map<int, Node>::iterator n;
-		for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
-			Node* d = (Node*)&n->second;
-			cout << "\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
-		}
+	size_t nodes = 0;
+	for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
+		cout << "[" << i << "] name: " << p->name << ", server: " << p->server << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << ", nodes: " << p->nodes.size() << "\n";
+		nodes += p->nodes.size();
 	}
+	cout << "node-map: " << t->groups.size() << " groups, " << nodes << " nodes, " << t->strings.index.size() << " strings.\n";
 
 	return (int)UA_STATUSCODE_GOOD;
 }
@@ -20,37 +20,105 @@ extern "C" {
 #endif
 
 typedef struct {
-	char configFile[128];
-	char configFolder[128];
+	char codec[16];
+	int level;
+	int minBytes;
+	char dictionary[128];
+	int trainSamples;
+	int dictBytes;
+} UAMQ_Compression;
 
-	char deviceID[64];
-    char uaServerAddress[128];
+#define UAMQ_MAX_ENDPOINTS 64
+#define UAMQ_MAX_COMMAND_TOPICS 8
+#define UAMQ_MAX_COMMAND_METHODS 32
+
+/* the threads of the bridge by role, each role is placed on its own */
+enum {
+	UAMQ_ROLE_MAIN,				/* main thread, the threads without a role inherit its placement */
+	UAMQ_ROLE_POLL,				/* poll group threads, they time the samples */
+	UAMQ_ROLE_OPCUA,			/* connection workers and supervisors */
+	UAMQ_ROLE_MQTT,
+	UAMQ_ROLE_TCP,
+	UAMQ_ROLE_COMMAND,
+	UAMQ_ROLE_METRICS,
+	UAMQ_ROLE_LOG,
+	UAMQ_ROLES
+};
+
+typedef struct {
+	unsigned long long cpus;	/* bit n = core n, 0 = not pinned */
+	int priority;				/* SCHED_FIFO priority, 0 = normal scheduling */
+} UAMQ_Placement;
+
+/* one OPC UA server, served by its own client and connection worker */
+typedef struct {
+	int index;
+	char name[64];				/* node-map groups select the server by name */
+	char uaServerAddress[128];
 	int uaPublishIntervalUsecs;
 	bool asycRequestSupported;
 	char method[32];
+	int cpu;					/* core of the connection worker, -1 = not pinned */
+
+	UA_Client* client;
+	volatile unsigned long session;		/* counts successful connects, node registrations are per session */
+	volatile int connected;				/* the first connect succeeded */
+} UAMQ_Endpoint;
+
+typedef struct {
+	char configFile[128];
+	char configFolder[128];
+
+	char deviceID[64];
+
+	UAMQ_Endpoint endpoints[UAMQ_MAX_ENDPOINTS];
+	int endpointCount;
 
 	bool mqttEnable;
 	char mqttBrockerIP[128];
 	int mqttBrockerPORT;
 	char topicBase[32];
+	UAMQ_Compression mqttCompression;
 	
 	bool tcpEnable;
 	char tcpBrockerIP[128];
 	int tcpBrockerPORT;
 	int tcpSampleIntervalUs;
 	bool singleshot;
+	UAMQ_Compression tcpCompression;
 
 	bool amqpEnable;
 	char amqpIP[128];
 	int amqpPORT;
 	char amqpTopicBase[32];
 
-	UA_Client* client;
+	bool metricsEnable;
+	char metricsAddress[64];
+	int metricsPort;
+
+	bool commandEnable;
+	char commandTopics[UAMQ_MAX_COMMAND_TOPICS][128];	/* subscribed on the mqtt broker */
+	int commandTopicCount;
+	char commandResponseTopic[128];
+	char commandAddress[64];
+	int commandPort;			/* tcp command port, 0 = none */
+	int commandIntervalUs;		/* writes and calls of an interval are sent together */
+	bool commandAnyNode;		/* false: only the nodes of the node-map are written */
+	char commandMethods[UAMQ_MAX_COMMAND_METHODS][128];	/* methods that may be called */
+	int commandMethodCount;
+
+	UAMQ_Placement placement[UAMQ_ROLES];
+	bool lockMemory;			/* mlockall, no page faults once running */
+	int prefaultKB;				/* heap touched at startup and kept, 0 = none */
+	int stackKB;				/* stack size of the threads, 0 = the default */
 } UAMQ_Configuration;
 
 
 int config(int argc, char *argv[]);
 
+/* the endpoint with the given name, NULL if there is none */
+UAMQ_Endpoint* endpoint_find(const char* name);
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -15,38 +15,349 @@
 #endif
 
 #include <stdio.h>
-#include "client-config.h"
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "client-common.h"
+#include "client-discovery.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-realtime.h"
 
 extern int beStop;
 extern UAMQ_Configuration g_Configutation;
 
-UA_StatusCode opcua_server_connect(UA_Client *client)
+#define CONN_NOTE "[connection %s] "
+
+UA_StatusCode opcua_server_connect(UAMQ_Endpoint *ep)
 {
+    UA_Client *client = ep->client;
     UA_EndpointDescription* endpoints = NULL;
 
-    printf(">> connect opc.ua server ... to %s\n", g_Configutation.uaServerAddress);
+    log_info(">> connect opc.ua server ... to %s", ep->uaServerAddress);
 
     size_t epsize = 0;
-    UA_StatusCode retval = UA_Client_getEndpoints(client, g_Configutation.uaServerAddress, &epsize, &endpoints);
+    UA_StatusCode retval = UA_Client_getEndpoints(client, ep->uaServerAddress, &epsize, &endpoints);
     if(retval != UA_STATUSCODE_GOOD) {
         UA_Array_delete(endpoints, epsize, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]);
-        UA_Client_delete(client);
         return (int)retval;
     }
 
-    printf("%i endpoints found\n", (int)epsize);
+    log_debug("%i endpoints found", (int)epsize);
     for(size_t i = 0; i < epsize; i++) {
-        printf("URL of endpoint %i is %.*s\n", (int)i,
+        log_debug("URL of endpoint %i is %.*s", (int)i,
                (int)endpoints[i].endpointUrl.length,
                endpoints[i].endpointUrl.data);
     }
     UA_Array_delete(endpoints, epsize, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]);
 
-    retval = UA_Client_connect(client, g_Configutation.uaServerAddress);
+    retval = UA_Client_connect(client, ep->uaServerAddress);
     if(retval != UA_STATUSCODE_GOOD) {
-        UA_Client_delete(client);
         return (int)retval;
     }
 
+    __sync_add_and_fetch(&ep->session, 1);
+
     return retval;
-}
\ No newline at end of file
+}
+
+/*
+ * The client is not thread-safe: poll threads, the publish loop and the
+ * supervisor of an endpoint take turns on it. A thread whose service call
+ * fails reports the fault and carries on, the supervisor alone recovers the
+ * connection, from the cheapest step to the most expensive one:
+ *
+ *   1. renew the secure channel on the same connection
+ *   2. open a new connection and channel, activate the existing session on it;
+ *      the subscription continues and missed notifications are republished
+ *   3. create a new session, the subscription and the monitored items again
+ */
+
+typedef struct {
+    pthread_mutex_t session;
+    pthread_mutex_t faults;
+    pthread_cond_t faulted;
+    int fault;
+    volatile int down;      /* the session is being created again */
+
+    /* metric series */
+    int failed;
+    int reconnects[3];
+} Supervision;
+
+static Supervision supervision[UAMQ_MAX_ENDPOINTS];
+
+void opcua_init(void)
+{
+    for(int i = 0; i < UAMQ_MAX_ENDPOINTS; i++) {
+        pthread_mutex_init(&supervision[i].session, NULL);
+        pthread_mutex_init(&supervision[i].faults, NULL);
+        pthread_cond_init(&supervision[i].faulted, NULL);
+        supervision[i].fault = 0;
+        supervision[i].down = 0;
+        supervision[i].failed = -1;
+        for(int k = 0; k < 3; k++) {
+            supervision[i].reconnects[k] = -1;
+        }
+    }
+}
+
+void opcua_lock(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_lock(&supervision[ep->index].session);
+}
+
+void opcua_unlock(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_unlock(&supervision[ep->index].session);
+}
+
+int opcua_acquire(UAMQ_Endpoint *ep)
+{
+    Supervision *s = &supervision[ep->index];
+
+    /* the client is of no use while it connects again, don't wait for it */
+    if(beStop || s->down || !ep->connected) {
+        return 0;
+    }
+
+    opcua_lock(ep);
+    if(beStop || s->down || !ep->connected || !ep->client) {
+        opcua_unlock(ep);
+        return 0;
+    }
+    return 1;
+}
+
+void opcua_fault(UAMQ_Endpoint *ep, UA_StatusCode code)
+{
+    Supervision *s = &supervision[ep->index];
+
+    /* calls interrupted by the stop signal fail as well */
+    if(beStop) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->faults);
+    if(!s->fault) {
+        log_warn(CONN_NOTE "service failed (0x%08x), recovering.", ep->name, code);
+        metrics_add(s->failed, 1);
+    }
+    s->fault = 1;
+    pthread_cond_signal(&s->faulted);
+    pthread_mutex_unlock(&s->faults);
+}
+
+int endpoint_allows(UAMQ_Endpoint *ep, const char *method)
+{
+    int event = !strncmp(ep->method, "event", strlen(ep->method));
+    return ep->asycRequestSupported || event == !strcmp(method, "event");
+}
+
+void opcua_pin(UAMQ_Endpoint *ep, int role, const char *what)
+{
+    char name[96];
+    snprintf(name, sizeof(name), "%s %s", what, ep->name);
+    rt_thread(role, ep->cpu, name);
+}
+
+/* a read of the server state tells whether the session works */
+static UA_StatusCode probe(UA_Client *client)
+{
+    UA_Variant value;
+    UA_Variant_init(&value);
+    UA_StatusCode retval = UA_Client_readValueAttribute(client,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_STATE), &value);
+    UA_Variant_deleteMembers(&value);
+    return retval;
+}
+
+static void recover(UAMQ_Endpoint *ep)
+{
+    UA_Client *client = ep->client;
+    Supervision *s = &supervision[ep->index];
+
+    if(UA_Client_getState(client) == UA_CLIENTSTATE_CONNECTED &&
+       UA_Client_renewSecureChannel(client) == UA_STATUSCODE_GOOD && probe(client) == UA_STATUSCODE_GOOD) {
+        log_info(CONN_NOTE "recovered, secure channel renewed.", ep->name);
+        metrics_add(s->reconnects[0], 1);
+        return;
+    }
+
+    UA_StatusCode retval = UA_Client_reconnect(client);
+    if(retval == UA_STATUSCODE_GOOD) {
+        log_info(CONN_NOTE "recovered, session reactivated on a new connection.", ep->name);
+        metrics_add(s->reconnects[1], 1);
+        return;
+    }
+    log_warn(CONN_NOTE "session not recovered (0x%08x), connecting again.", ep->name, retval);
+
+    /* the lock is only held during an attempt, callers fail fast meanwhile */
+    s->down = 1;
+
+    useconds_t backoff = 100000;
+    for(;;) {
+        UA_Client_reset(client);
+        retval = opcua_server_connect(ep);
+        if(retval == UA_STATUSCODE_GOOD || beStop) {
+            break;
+        }
+        log_warn(CONN_NOTE "connect failed (0x%08x), retry in %u ms.", ep->name, retval, backoff / 1000);
+
+        opcua_unlock(ep);
+        for(useconds_t slept = 0; slept < backoff && !beStop; slept += 100000) {
+            usleep(100000);
+        }
+        opcua_lock(ep);
+
+        if(beStop) {
+            break;
+        }
+        backoff = backoff < 2500000 ? backoff * 2 : 5000000;
+    }
+
+    if(retval == UA_STATUSCODE_GOOD) {
+        monitor_restart(ep);
+        log_info(CONN_NOTE "recovered with a new session.", ep->name);
+        metrics_add(s->reconnects[2], 1);
+    }
+    s->down = 0;
+}
+
+void* opcua_supervise(void* param)
+{
+    UAMQ_Endpoint *ep = (UAMQ_Endpoint*)param;
+    Supervision *s = &supervision[ep->index];
+
+    opcua_pin(ep, UAMQ_ROLE_OPCUA, "supervisor");
+
+    while (!beStop) {
+        pthread_mutex_lock(&s->faults);
+        if(!s->fault) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += 1;
+            pthread_cond_timedwait(&s->faulted, &s->faults, &until);
+        }
+        pthread_mutex_unlock(&s->faults);
+
+        if(beStop) {
+            break;
+        }
+
+        opcua_lock(ep);
+        pthread_mutex_lock(&s->faults);
+        int pending = s->fault;
+        pthread_mutex_unlock(&s->faults);
+
+        /* a failed call can leave the client faulted without being reported */
+        if(pending || UA_Client_getState(ep->client) != UA_CLIENTSTATE_CONNECTED) {
+            recover(ep);
+
+            /* reports of the calls that failed before the recovery are stale */
+            pthread_mutex_lock(&s->faults);
+            s->fault = 0;
+            pthread_mutex_unlock(&s->faults);
+        }
+        opcua_unlock(ep);
+    }
+
+    return NULL;
+}
+
+/* read by the metrics endpoint, the state is a plain enum */
+static long server_up(void* arg)
+{
+    UAMQ_Endpoint *ep = (UAMQ_Endpoint*)arg;
+    return ep->connected && ep->client && UA_Client_getState(ep->client) == UA_CLIENTSTATE_CONNECTED;
+}
+
+static void register_metrics(UAMQ_Endpoint *ep)
+{
+    static const char* steps[3] = { "renew", "reactivate", "session" };
+    Supervision *s = &supervision[ep->index];
+    char server[128], labels[200];
+
+    metrics_label(server, sizeof(server), ep->name);
+    snprintf(labels, sizeof(labels), "server=\"%s\"", server);
+    s->failed = metrics_series(METRIC_FAULTS, labels);
+    metrics_gauge(METRIC_SERVER_UP, labels, server_up, ep);
+
+    for(int k = 0; k < 3; k++) {
+        snprintf(labels, sizeof(labels), "server=\"%s\",step=\"%s\"", server, steps[k]);
+        s->reconnects[k] = metrics_series(METRIC_RECONNECTS, labels);
+    }
+}
+
+/*
+ * The connection worker of an endpoint: connects, starts the subscription
+ * and its supervisor, then sends the publish requests. Poll groups of the
+ * endpoint run on their own threads and wait for the first connect.
+ */
+void* opcua_worker(void* param)
+{
+    UAMQ_Endpoint *ep = (UAMQ_Endpoint*)param;
+    UA_Client *client = ep->client;
+
+    opcua_pin(ep, UAMQ_ROLE_OPCUA, "opcua");
+    register_metrics(ep);
+
+    UA_StatusCode state = UA_STATUSCODE_GOOD;
+
+    do {
+        state = opcua_server_connect(ep);
+        if(state == UA_STATUSCODE_GOOD) {
+            state = opcua_server_browse(client);
+        } else {
+            sleep(2);
+            log_warn("retry connect to opcua server %s.", ep->uaServerAddress);
+        }
+    } while(!beStop && state != UA_STATUSCODE_GOOD);
+
+    if(state != UA_STATUSCODE_GOOD) {
+        return NULL;
+    }
+
+    discovery_run(ep);
+
+    monitor_start(ep);
+    ep->connected = 1;
+
+    pthread_t tid = 0;
+    void* s = NULL;
+    int th = pthread_create(&tid, NULL, opcua_supervise, (void*)ep);
+
+    while (!beStop)
+    {
+        usleep(ep->uaPublishIntervalUsecs);
+
+        if(!endpoint_allows(ep, "event")) {
+            sleep(2);
+            continue;
+        }
+
+        if(!opcua_acquire(ep)) {
+            continue;
+        }
+        monitor_update(ep);
+        UA_StatusCode retval = UA_Client_Subscriptions_manuallySendPublishRequest(client);
+        UA_ClientState cs = UA_Client_getState(client);
+        opcua_unlock(ep);
+
+        if(retval != UA_STATUSCODE_GOOD || cs != UA_CLIENTSTATE_CONNECTED) {
+            opcua_fault(ep, retval);
+        }
+    }
+
+    if(th == 0) {
+        pthread_join(tid, &s);
+    }
+
+    opcua_lock(ep);
+    UA_Client_disconnect(client);
+    opcua_unlock(ep);
+
+    return NULL;
+}
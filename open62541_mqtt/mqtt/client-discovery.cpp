@@ -0,0 +1,601 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <fnmatch.h>
+#include <libgen.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-topology.h"
+#include "client-discovery.h"
+#include "client-log.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+json_object* read_config(const char* fn);
+
+typedef struct Discovered {
+    string path;
+    string id;
+} Discovered;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<Discovered> snapshot;
+
+/* the forms getUA_NodeID() understands, false for guid and opaque ids */
+static bool nodeid_string(const UA_NodeId* id, string& out)
+{
+    char buf[32];
+
+    switch(id->identifierType) {
+        case UA_NODEIDTYPE_NUMERIC : {
+            snprintf(buf, sizeof(buf), "ns=%u;i=%u", id->namespaceIndex, id->identifier.numeric);
+            out = buf;
+            return true;
+        }
+        case UA_NODEIDTYPE_STRING : {
+            snprintf(buf, sizeof(buf), "ns=%u;s=", id->namespaceIndex);
+            out = buf;
+            out.append((const char*)id->identifier.string.data, id->identifier.string.length);
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+/* the cache is only valid for the address space it was browsed from */
+static string namespaces_key(UA_Client* client, const char* root, json_object* namespaces)
+{
+    UA_Variant v;
+    UA_Variant_init(&v);
+
+    unsigned long long h = 14695981039346656037ULL;
+    for (const char* p = root; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+
+    UA_StatusCode retval = UA_Client_readValueAttribute(client, UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_NAMESPACEARRAY), &v);
+    if(retval != UA_STATUSCODE_GOOD || v.type != &UA_TYPES[UA_TYPES_STRING]) {
+        UA_Variant_deleteMembers(&v);
+        return string();
+    }
+
+    UA_String* ns = (UA_String*)v.data;
+    for (size_t i = 0; i < v.arrayLength; i++) {
+        h = (h ^ 0xff) * 1099511628211ULL;
+        for (size_t j = 0; j < ns[i].length; j++) {
+            h = (h ^ ns[i].data[j]) * 1099511628211ULL;
+        }
+        json_object_array_add(namespaces, json_object_new_string_len((const char*)ns[i].data, (int)ns[i].length));
+    }
+    UA_Variant_deleteMembers(&v);
+
+    char key[20];
+    snprintf(key, sizeof(key), "%016llx", h);
+    return key;
+}
+
+//===================================================================================================================================================================
+// browse
+
+typedef struct Pending {
+    UA_NodeId id;
+    string path;
+    int depth;
+} Pending;
+
+typedef struct Browser {
+    UA_Client* client;
+    int maxDepth;
+    int batch;
+    int maxReferences;
+    vector<Pending> queue;
+    set<string> visited;
+    vector<Discovered> found;
+    size_t requests;
+} Browser;
+
+static void browsed(Browser* b, size_t item, UA_ReferenceDescription* refs, size_t size)
+{
+    /* copies, the queue grows below */
+    string parent = b->queue[item].path;
+    int depth = b->queue[item].depth;
+
+    for (size_t i = 0; i < size; i++) {
+        UA_ReferenceDescription* ref = &refs[i];
+
+        /* references into other servers can't be read through this session */
+        if(ref->nodeId.serverIndex != 0 || ref->nodeId.namespaceUri.length > 0) {
+            continue;
+        }
+
+        string id;
+        bool named = nodeid_string(&ref->nodeId.nodeId, id);
+        if(named && !b->visited.insert(id).second) {
+            continue;
+        }
+
+        string name((const char*)ref->browseName.name.data, ref->browseName.name.length);
+        string path = parent.empty() ? name : parent + "/" + name;
+
+        if(named && ref->nodeClass == UA_NODECLASS_VARIABLE) {
+            Discovered d;
+            d.path = path;
+            d.id = id;
+            b->found.push_back(d);
+        }
+
+        if(depth + 1 < b->maxDepth) {
+            Pending p;
+            UA_NodeId_copy(&ref->nodeId.nodeId, &p.id);
+            p.path = path;
+            p.depth = depth + 1;
+            b->queue.push_back(p);
+        }
+    }
+}
+
+/* hands continuation points back unused. the server keeps them until the
+ * session ends otherwise, and it has only a few per session */
+static void release_points(Browser* b, vector<UA_ByteString>& points)
+{
+    for (size_t at = 0; at < points.size(); at += (size_t)b->batch) {
+        size_t n = points.size() - at < (size_t)b->batch ? points.size() - at : (size_t)b->batch;
+
+        UA_BrowseNextRequest req;
+        UA_BrowseNextRequest_init(&req);
+        req.releaseContinuationPoints = true;
+        req.continuationPointsSize = n;
+        req.continuationPoints = &points[at];
+
+        UA_BrowseNextResponse resp = UA_Client_Service_browseNext(b->client, req);
+        b->requests++;
+        UA_BrowseNextResponse_deleteMembers(&resp);
+    }
+
+    for (size_t i = 0; i < points.size(); i++) {
+        UA_ByteString_deleteMembers(&points[i]);
+    }
+    points.clear();
+}
+
+/* follows the continuation points of a batch until every node is complete */
+static UA_StatusCode browse_next(Browser* b, vector<UA_ByteString>& points, vector<size_t>& items)
+{
+    while (!points.empty() && !beStop) {
+        size_t n = points.size() < (size_t)b->batch ? points.size() : (size_t)b->batch;
+
+        UA_BrowseNextRequest req;
+        UA_BrowseNextRequest_init(&req);
+        req.releaseContinuationPoints = false;
+        req.continuationPointsSize = n;
+        req.continuationPoints = &points[0];
+
+        UA_BrowseNextResponse resp = UA_Client_Service_browseNext(b->client, req);
+        b->requests++;
+
+        UA_StatusCode retval = resp.responseHeader.serviceResult;
+        if(retval == UA_STATUSCODE_GOOD && resp.resultsSize != n) {
+            retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+        }
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_BrowseNextResponse_deleteMembers(&resp);
+            release_points(b, points);
+            return retval;
+        }
+
+        vector<UA_ByteString> next;
+        vector<size_t> nextItems;
+
+        for (size_t i = 0; i < n; i++) {
+            UA_BrowseResult* r = &resp.results[i];
+            browsed(b, items[i], r->references, r->referencesSize);
+
+            if(r->continuationPoint.length > 0) {
+                UA_ByteString cp;
+                UA_ByteString_copy(&r->continuationPoint, &cp);
+                next.push_back(cp);
+                nextItems.push_back(items[i]);
+            }
+        }
+        UA_BrowseNextResponse_deleteMembers(&resp);
+
+        for (size_t i = 0; i < n; i++) {
+            UA_ByteString_deleteMembers(&points[i]);
+        }
+        points.erase(points.begin(), points.begin() + n);
+        items.erase(items.begin(), items.begin() + n);
+
+        points.insert(points.end(), next.begin(), next.end());
+        items.insert(items.end(), nextItems.begin(), nextItems.end());
+    }
+
+    /* stopped before the nodes were complete */
+    release_points(b, points);
+
+    return UA_STATUSCODE_GOOD;
+}
+
+/*
+ * Breadth first, up to "batch" nodes per Browse request. References that
+ * don't fit into maxReferencesPerNode come back with a continuation point
+ * and are fetched with BrowseNext, again batched. The synchronous client has
+ * one request in flight, batching is what keeps the round trips down.
+ */
+static UA_StatusCode browse(Browser* b)
+{
+    size_t head = 0;
+    vector<UA_BrowseDescription> nodes;
+
+    while (head < b->queue.size() && !beStop) {
+        size_t n = b->queue.size() - head;
+        if(n > (size_t)b->batch) {
+            n = b->batch;
+        }
+
+        nodes.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            UA_BrowseDescription_init(&nodes[i]);
+            nodes[i].nodeId = b->queue[head + i].id;
+            nodes[i].browseDirection = UA_BROWSEDIRECTION_FORWARD;
+            nodes[i].referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+            nodes[i].includeSubtypes = true;
+            nodes[i].nodeClassMask = UA_NODECLASS_OBJECT | UA_NODECLASS_VARIABLE;
+            nodes[i].resultMask = UA_BROWSERESULTMASK_BROWSENAME | UA_BROWSERESULTMASK_NODECLASS;
+        }
+
+        UA_BrowseRequest req;
+        UA_BrowseRequest_init(&req);
+        req.requestedMaxReferencesPerNode = b->maxReferences;
+        req.nodesToBrowseSize = n;
+        req.nodesToBrowse = &nodes[0];
+
+        UA_BrowseResponse resp = UA_Client_Service_browse(b->client, req);
+        b->requests++;
+
+        UA_StatusCode retval = resp.responseHeader.serviceResult;
+        if(retval == UA_STATUSCODE_GOOD && resp.resultsSize != n) {
+            retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+        }
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_BrowseResponse_deleteMembers(&resp);
+            return retval;
+        }
+
+        vector<UA_ByteString> points;
+        vector<size_t> items;
+
+        for (size_t i = 0; i < n; i++) {
+            UA_BrowseResult* r = &resp.results[i];
+            browsed(b, head + i, r->references, r->referencesSize);
+
+            if(r->continuationPoint.length > 0) {
+                UA_ByteString cp;
+                UA_ByteString_copy(&r->continuationPoint, &cp);
+                points.push_back(cp);
+                items.push_back(head + i);
+            }
+        }
+        UA_BrowseResponse_deleteMembers(&resp);
+
+        retval = browse_next(b, points, items);
+
+        for (size_t i = 0; i < n; i++) {
+            UA_NodeId_deleteMembers(&b->queue[head + i].id);
+        }
+        head += n;
+
+        if(retval != UA_STATUSCODE_GOOD) {
+            return retval;
+        }
+
+        if(b->requests % 64 == 0) {
+            log_info("[discovery] %lu nodes browsed, %lu variables.", (unsigned long)head, (unsigned long)b->found.size());
+        }
+    }
+
+    /* an interrupted browse must not end up in the cache */
+    return beStop ? UA_STATUSCODE_BADSHUTDOWN : UA_STATUSCODE_GOOD;
+}
+
+//===================================================================================================================================================================
+// cache
+
+static bool cache_load(const char* fn, const string& key, vector<Discovered>& out)
+{
+    json_object* cache = read_config(fn);
+    if(!cache) {
+        return false;
+    }
+
+    json_object* v = NULL;
+    json_object* nodes = NULL;
+
+    bool valid = json_object_object_get_ex(cache, "key", &v) && json_object_is_type(v, json_type_string) &&
+                 key == json_object_get_string(v) &&
+                 json_object_object_get_ex(cache, "nodes", &nodes) && json_object_is_type(nodes, json_type_array);
+
+    if(valid) {
+        int l = json_object_array_length(nodes);
+        out.reserve(l);
+
+        for (int i = 0; i < l; i++) {
+            json_object* e = json_object_array_get_idx(nodes, i);
+            if(!json_object_is_type(e, json_type_array) || json_object_array_length(e) != 2) {
+                valid = false;
+                break;
+            }
+            json_object* path = json_object_array_get_idx(e, 0);
+            json_object* id = json_object_array_get_idx(e, 1);
+            if(!json_object_is_type(path, json_type_string) || !json_object_is_type(id, json_type_string)) {
+                valid = false;
+                break;
+            }
+            Discovered d;
+            d.path = json_object_get_string(path);
+            d.id = json_object_get_string(id);
+            out.push_back(d);
+        }
+    }
+
+    /* a damaged cache is browsed again and rewritten */
+    if(!valid) {
+        out.clear();
+    }
+
+    json_object_put(cache);
+    return valid;
+}
+
+static void cache_save(const char* fn, const string& key, const char* root, json_object* namespaces, const vector<Discovered>& found)
+{
+    json_object* cache = json_object_new_object();
+    json_object_object_add(cache, "key", json_object_new_string(key.c_str()));
+    json_object_object_add(cache, "root", json_object_new_string(root));
+    json_object_object_add(cache, "namespaces", json_object_get(namespaces));
+
+    json_object* nodes = json_object_new_array();
+    for (size_t i = 0; i < found.size(); i++) {
+        json_object* e = json_object_new_array();
+        json_object_array_add(e, json_object_new_string(found[i].path.c_str()));
+        json_object_array_add(e, json_object_new_string(found[i].id.c_str()));
+        json_object_array_add(nodes, e);
+    }
+    json_object_object_add(cache, "nodes", nodes);
+
+    /* write aside and rename, a crash must not leave half a cache */
+    string tmp = string(fn) + ".tmp";
+    if(json_object_to_file_ext(tmp.c_str(), cache, JSON_C_TO_STRING_PLAIN) != 0 || rename(tmp.c_str(), fn) != 0) {
+        log_warn("[discovery] failed to write the cache %s.", fn);
+        remove(tmp.c_str());
+    }
+
+    json_object_put(cache);
+}
+
+//===================================================================================================================================================================
+
+static const char* get_string(json_object* o, const char* key, const char* def)
+{
+    json_object* v = NULL;
+    return json_object_object_get_ex(o, key, &v) ? json_object_get_string(v) : def;
+}
+
+static int get_int(json_object* o, const char* key, int def)
+{
+    json_object* v = NULL;
+    return json_object_object_get_ex(o, key, &v) ? json_object_get_int(v) : def;
+}
+
+static bool enabled(json_object* config, json_object** d)
+{
+    json_object* v = NULL;
+
+    if(!json_object_object_get_ex(config, "discovery", d)) {
+        return false;
+    }
+    return !json_object_object_get_ex(*d, "enable", &v) || json_object_get_boolean(v);
+}
+
+/* the endpoint the discovery block browses */
+static const char* server_of(json_object* d)
+{
+    return get_string(d, "server", g_config->endpoints[0].name);
+}
+
+UA_StatusCode discovery_run(UAMQ_Endpoint* ep)
+{
+    UA_Client* client = ep->client;
+    json_object* config = read_config(g_config->configFile);
+    json_object* d = NULL;
+
+    if(!config || !enabled(config, &d) || strcmp(server_of(d), ep->name)) {
+        json_object_put(config);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    char root[256];
+    snprintf(root, sizeof(root), "%s", get_string(d, "root", "ns=0;i=85"));
+
+    UA_NodeId rootId;
+    if(getUA_NodeID(root, &rootId) != UA_STATUSCODE_GOOD) {
+        log_error("discovery.root: \"%s\" is not a node id of the form [ns=<n>;]i=<n> or [ns=<n>;]s=<string>.", root);
+        json_object_put(config);
+        return UA_STATUSCODE_BADNODEIDINVALID;
+    }
+    UA_NodeId_deleteMembers(&rootId);
+
+    /* the cache lives next to the config unless the path is absolute */
+    char folder[256];
+    snprintf(folder, sizeof(folder), "%s", g_config->configFile);
+    const char* name = get_string(d, "cache", "discovery.cache");
+    string cache = name[0] == '/' ? string(name) : string(dirname(folder)) + "/" + name;
+
+    json_object* namespaces = json_object_new_array();
+    string key = namespaces_key(client, root, namespaces);
+
+    vector<Discovered> found;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+
+    if(!key.empty() && cache_load(cache.c_str(), key, found)) {
+        log_info("[discovery] %lu variables from %s.", (unsigned long)found.size(), cache.c_str());
+    } else {
+        Browser b;
+        b.client = client;
+        b.maxDepth = get_int(d, "maxDepth", 16);
+        b.batch = get_int(d, "batch", 256);
+        b.maxReferences = get_int(d, "maxReferencesPerNode", 1000);
+        b.requests = 0;
+        if(b.batch < 1) {
+            b.batch = 1;
+        }
+
+        Pending p;
+        UA_NodeId_init(&p.id);
+        getUA_NodeID(root, &p.id);
+        p.depth = 0;
+        b.queue.push_back(p);
+
+        string id;
+        if(nodeid_string(&p.id, id)) {
+            b.visited.insert(id);
+        }
+
+        log_info("[discovery] browsing %s ...", root);
+        retval = browse(&b);
+
+        for (size_t i = 0; i < b.queue.size(); i++) {
+            UA_NodeId_deleteMembers(&b.queue[i].id);
+        }
+
+        if(retval != UA_STATUSCODE_GOOD) {
+            log_error("[discovery] browse failed (%s), keeping the previous snapshot.", UA_StatusCode_name(retval));
+        } else {
+            log_info("[discovery] %lu variables in %lu requests.", (unsigned long)b.found.size(), (unsigned long)b.requests);
+            found.swap(b.found);
+            if(!key.empty()) {
+                cache_save(cache.c_str(), key, root, namespaces, found);
+            }
+        }
+    }
+
+    json_object_put(namespaces);
+    json_object_put(config);
+
+    if(retval == UA_STATUSCODE_GOOD) {
+        pthread_mutex_lock(&lock);
+        snapshot.swap(found);
+        pthread_mutex_unlock(&lock);
+
+        topology_reload();
+    }
+
+    return retval;
+}
+
+/* '+' and '#' are wildcards in mqtt topic filters */
+static string topic_safe(string s)
+{
+    for (size_t i = 0; i < s.size(); i++) {
+        if(s[i] == '+' || s[i] == '#') {
+            s[i] = '_';
+        }
+    }
+    return s;
+}
+
+void discovery_append(json_object* config, json_object* nodemap)
+{
+    json_object* d = NULL;
+    json_object* rules = NULL;
+
+    if(!enabled(config, &d) || !json_object_object_get_ex(d, "rules", &rules)) {
+        return;
+    }
+
+    set<string> claimed;
+    const char* server = server_of(d);
+
+    pthread_mutex_lock(&lock);
+
+    int l = json_object_array_length(rules);
+    for (int i = 0; i < l; i++) {
+        json_object* rule = json_object_array_get_idx(rules, i);
+        const char* pattern = get_string(rule, "path", NULL);
+        if(!pattern) {
+            printf("[error] discovery.rules[%d]: \"path\" is required.\n", i);
+            continue;
+        }
+        const char* name = get_string(rule, "name", "");
+        const char* topic = get_string(rule, "topic", "");
+
+        map<string, json_object*> groups;
+
+        for (size_t n = 0; n < snapshot.size(); n++) {
+            const Discovered& e = snapshot[n];
+            if(claimed.count(e.id) || fnmatch(pattern, e.path.c_str(), FNM_PATHNAME) != 0) {
+                continue;
+            }
+            claimed.insert(e.id);
+
+            size_t slash = e.path.rfind('/');
+            string parent = slash == string::npos ? string() : e.path.substr(0, slash);
+            string leaf = slash == string::npos ? e.path : e.path.substr(slash + 1);
+
+            json_object*& g = groups[parent];
+            if(!g) {
+                g = json_object_new_object();
+                json_object_object_foreach(rule, key, val) {
+                    if(strcmp(key, "path") && strcmp(key, "name") && strcmp(key, "topic") && strcmp(key, "server")) {
+                        json_object_object_add(g, key, json_object_get(val));
+                    }
+                }
+                string gname = name[0] ? (parent.empty() ? string(name) : string(name) + "/" + parent) : parent;
+                string gtopic = topic[0] ? (parent.empty() ? string(topic) : string(topic) + "/" + parent) : parent;
+                json_object_object_add(g, "name", json_object_new_string(gname.c_str()));
+                json_object_object_add(g, "topic", json_object_new_string(topic_safe(gtopic).c_str()));
+                json_object_object_add(g, "server", json_object_new_string(server));
+                json_object_object_add(g, "nodes", json_object_new_array());
+            }
+
+            json_object* nodes = NULL;
+            json_object_object_get_ex(g, "nodes", &nodes);
+
+            json_object* node = json_object_new_object();
+            json_object_object_add(node, "id", json_object_new_string(e.id.c_str()));
+            json_object_object_add(node, "topic", json_object_new_string(topic_safe(leaf).c_str()));
+            json_object_array_add(nodes, node);
+        }
+
+        map<string, json_object*>::iterator g;
+        for (g = groups.begin(); g != groups.end(); ++g) {
+            json_object_array_add(nodemap, g->second);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,66 @@
+#ifndef OPCUA_MQTT_BRIDGE_DISCOVERY_H_
+#define OPCUA_MQTT_BRIDGE_DISCOVERY_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include "json.h"
+#include "client-config.h"
+
+/*
+ * Optional "discovery" block of the config:
+ *
+ *   "discovery": {
+ *       "enable": true,
+ *       "root": "ns=0;i=85",          where to start browsing (Objects)
+ *       "maxDepth": 16,
+ *       "batch": 256,                 nodes per Browse / BrowseNext request
+ *       "maxReferencesPerNode": 1000,
+ *       "cache": "discovery.cache",   snapshot file, relative to the config
+ *       "server": "line1",            opcuaServer to browse, the first one by default
+ *       "rules": [
+ *           { "path": "Plant/Line?/Cell?/Temp", "name": "cells", "topic": "plant",
+ *             "method": "poll", "intervalUSec": 1000000, "mqtt": true }
+ *       ]
+ *   }
+ *
+ * The address space below root is browsed once and the variables found are
+ * kept as a snapshot of browse paths (browse names joined by '/'). The
+ * snapshot is cached on disk together with the server's NamespaceArray and
+ * reused as long as the NamespaceArray does not change.
+ *
+ * Every rule matches browse paths with fnmatch(), '*' does not cross '/'.
+ * The matched variables become groups, one per parent path, named and
+ * published under "<name>/<parent path>" and "<topic>/<parent path>", and
+ * are served by the browsed server. The other keys of a rule are copied
+ * into the groups as is. A variable only goes to the first rule it matches.
+ */
+
+/* loads the snapshot from the cache or browses the server, if the endpoint
+ * is the one the discovery block names */
+UA_StatusCode discovery_run(UAMQ_Endpoint* ep);
+
+/* appends the groups the rules of the config generate to the node-map */
+void discovery_append(json_object* config, json_object* nodemap);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_DISCOVERY_H_ */
@@ -0,0 +1,259 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <atomic>
+using namespace std;
+
+#include "client-log.h"
+#include "client-config.h"
+#include "client-realtime.h"
+
+int log_level = UAMQ_LOG_INFO;
+int log_rate = 0;
+
+#define MAX_RINGS 256
+#define RING_SLOTS 128
+#define SLOT_TEXT 480
+
+typedef struct {
+	uint64_t usec;
+	int level;
+	char text[SLOT_TEXT];
+} Slot;
+
+/* a ring is written by its thread and read by the writer thread only */
+enum { RING_FREE, RING_OWNED, RING_ORPHANED };
+
+typedef struct {
+	atomic<int> state;
+	atomic<uint64_t> head;
+	atomic<uint64_t> tail;
+	Slot slots[RING_SLOTS];
+} Ring;
+
+static atomic<Ring*> rings[MAX_RINGS];
+static atomic<uint64_t> dropped(0);
+
+static __thread Ring* mine = NULL;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t leave;
+
+static pthread_t writer;
+static atomic<bool> running(false);
+static atomic<bool> stopping(false);
+
+static const char* names[] = { "error", "warn", "info", "debug", "trace" };
+
+int log_level_of(const char* name)
+{
+	for (int i = 0; i <= UAMQ_LOG_TRACE; i++) {
+		if(!strcmp(name, names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* the writer drains what the thread left and hands the ring on */
+static void ring_release(void* p)
+{
+	((Ring*)p)->state.store(RING_ORPHANED);
+}
+
+static void ring_key(void)
+{
+	pthread_key_create(&leave, ring_release);
+}
+
+static Ring* ring(void)
+{
+	if(mine) {
+		return mine;
+	}
+
+	pthread_once(&once, ring_key);
+
+	for (int i = 0; i < MAX_RINGS; i++) {
+		Ring* r = rings[i].load();
+		if(!r) {
+			Ring* n = new Ring();
+			n->state.store(RING_OWNED);
+			Ring* expected = NULL;
+			if(rings[i].compare_exchange_strong(expected, n)) {
+				mine = n;
+				break;
+			}
+			delete n;
+			r = expected;
+		}
+		int free = RING_FREE;
+		if(r->state.compare_exchange_strong(free, RING_OWNED)) {
+			mine = r;
+			break;
+		}
+	}
+
+	if(mine) {
+		pthread_setspecific(leave, mine);
+	}
+	return mine;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void put(int level, const char* fmt, va_list ap)
+{
+	Ring* r = ring();
+	if(!r) {
+		dropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	uint64_t head = r->head.load(memory_order_relaxed);
+	if(head - r->tail.load(memory_order_acquire) >= RING_SLOTS) {
+		dropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	Slot* s = &r->slots[head % RING_SLOTS];
+	s->usec = now_usec();
+	s->level = level;
+	vsnprintf(s->text, sizeof(s->text), fmt, ap);
+	r->head.store(head + 1, memory_order_release);
+}
+
+static void note(int level, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	put(level, fmt, ap);
+	va_end(ap);
+}
+
+void log_write(LogSite* site, int level, const char* file, int line, const char* fmt, ...)
+{
+	if(log_rate > 0) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		uint64_t second = (uint64_t)ts.tv_sec;
+
+		uint64_t window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+		if(window != second && __atomic_compare_exchange_n(&site->window, &window, second, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			uint32_t suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+			if(suppressed) {
+				const char* base = strrchr(file, '/');
+				note(level, "[log] %s:%d: %u messages suppressed.", base ? base + 1 : file, line, suppressed);
+			}
+		}
+
+		if(__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > (uint32_t)log_rate) {
+			__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	va_list ap;
+	va_start(ap, fmt);
+	put(level, fmt, ap);
+	va_end(ap);
+}
+
+//===================================================================================================================================================================
+// writer
+
+static void emit(Slot* s)
+{
+	time_t sec = (time_t)(s->usec / 1000000);
+	struct tm tm;
+	localtime_r(&sec, &tm);
+
+	size_t len = strlen(s->text);
+	bool nl = len > 0 && s->text[len - 1] == '\n';
+	fprintf(stdout, "%02d:%02d:%02d.%06u %-5s %s%s", tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)(s->usec % 1000000),
+		names[s->level], s->text, nl ? "" : "\n");
+}
+
+static bool drain(void)
+{
+	bool any = false;
+
+	for (int i = 0; i < MAX_RINGS; i++) {
+		Ring* r = rings[i].load();
+		if(!r) {
+			break;
+		}
+
+		/* read the state first, an orphan may only be freed once emptied */
+		int state = r->state.load();
+		uint64_t head = r->head.load(memory_order_acquire);
+		uint64_t tail = r->tail.load(memory_order_relaxed);
+
+		for (; tail < head; tail++) {
+			emit(&r->slots[tail % RING_SLOTS]);
+			r->tail.store(tail + 1, memory_order_release);
+			any = true;
+		}
+
+		if(state == RING_ORPHANED) {
+			r->state.store(RING_FREE);
+		}
+	}
+
+	static uint64_t reported = 0;
+	uint64_t d = dropped.load();
+	if(d != reported) {
+		fprintf(stdout, "[log] %lu messages dropped, the log can't keep up.\n", (unsigned long)(d - reported));
+		reported = d;
+	}
+
+	if(any) {
+		fflush(stdout);
+	}
+	return any;
+}
+
+static void* log_run(void* param)
+{
+	rt_thread(UAMQ_ROLE_LOG, -1, "log");
+	while (!stopping.load()) {
+		if(!drain()) {
+			usleep(20000);
+		}
+	}
+	drain();
+	return NULL;
+}
+
+void log_start(void)
+{
+	if(running.load()) {
+		return;
+	}
+	stopping.store(false);
+	running.store(pthread_create(&writer, NULL, log_run, NULL) == 0);
+}
+
+void log_stop(void)
+{
+	if(!running.load()) {
+		drain();
+		return;
+	}
+	stopping.store(true);
+	pthread_join(writer, NULL);
+	running.store(false);
+}
@@ -0,0 +1,76 @@
+#ifndef OPCUA_MQTT_BRIDGE_LOG_H_
+#define OPCUA_MQTT_BRIDGE_LOG_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Leveled log of the running bridge. A message is formatted into a ring of
+ * the calling thread and written to stdout by a background thread, so a
+ * producer never waits for the terminal; when its ring is full the message
+ * is dropped and counted. Lines of different threads may be written out of
+ * order, their time stamps are those of the call.
+ *
+ * Levels above UAMQ_LOG_COMPILED are compiled out, levels above the level
+ * of the "log" block in the config cost one comparison:
+ *
+ *   "log": { "level": "info", "ratePerSecond": 20 }
+ *
+ * Every call site logs at most ratePerSecond messages per second (0 = no
+ * limit), the rest are counted and reported by the next message of that
+ * site in a later second.
+ */
+enum {
+	UAMQ_LOG_ERROR = 0,
+	UAMQ_LOG_WARN = 1,
+	UAMQ_LOG_INFO = 2,
+	UAMQ_LOG_DEBUG = 3,
+	UAMQ_LOG_TRACE = 4
+};
+
+#ifndef UAMQ_LOG_COMPILED
+# define UAMQ_LOG_COMPILED UAMQ_LOG_DEBUG
+#endif
+
+typedef struct {
+	uint64_t window;	/* second the count is for */
+	uint32_t count;
+	uint32_t suppressed;
+} LogSite;
+
+extern int log_level;
+extern int log_rate;
+
+void log_write(LogSite* site, int level, const char* file, int line, const char* fmt, ...)
+	__attribute__ ((format (printf, 5, 6)));
+
+#define uamq_log(level, ...) do { \
+	if((level) <= UAMQ_LOG_COMPILED && (level) <= log_level) { \
+		static LogSite log_site_; \
+		log_write(&log_site_, (level), __FILE__, __LINE__, __VA_ARGS__); \
+	} \
+} while(0)
+
+#define log_error(...) uamq_log(UAMQ_LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) uamq_log(UAMQ_LOG_WARN, __VA_ARGS__)
+#define log_info(...) uamq_log(UAMQ_LOG_INFO, __VA_ARGS__)
+#define log_debug(...) uamq_log(UAMQ_LOG_DEBUG, __VA_ARGS__)
+#define log_trace(...) uamq_log(UAMQ_LOG_TRACE, __VA_ARGS__)
+
+/* "error" ... "trace", -1 for an unknown name */
+int log_level_of(const char* name);
+
+/* starts the writer thread; log_stop() writes what is left and ends it */
+void log_start(void);
+void log_stop(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_LOG_H_ */
@@ -23,6 +23,12 @@ using namespace std;
 #include "MQTTPacket.h"
 #include "client-common.h"
 #include "client-trans-tcp.h"
+#include "client-topology.h"
+#include "client-discovery.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-command.h"
+#include "client-realtime.h"
 
 int beStop = 0;
 
@@ -34,11 +40,17 @@ void signal_finish(int sig)
 	beStop = 1;
 }
 
+void signal_reload(int sig)
+{
+	config_watch_signal();
+}
+
 void signal_stop(void)
 {
 	signal(SIGINT, signal_finish);
 	signal(SIGTERM, signal_finish);
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGHUP, signal_reload);
 }
 
 int main(int argc, char *argv[]) {
@@ -49,63 +61,96 @@ int main(int argc, char *argv[]) {
 		return (int) UA_STATUSCODE_GOOD;
 	}
 
-    UA_Client *client = NULL;
-    g_config->client = NULL;
-
-    UA_StatusCode state = UA_STATUSCODE_GOOD;
-
-    do {
-        g_config->client = client = UA_Client_new(UA_ClientConfig_standard);
+    log_start();
+    rt_process();
+    opcua_init();
 
-        state = opcua_server_connect(client);
-        if(state == UA_STATUSCODE_GOOD) {
-            state = opcua_server_browse(client);
-        } else {
-			sleep(2);
-            printf("retry connect to opcua server.\n");
-		}
-    } while(!beStop && state != UA_STATUSCODE_GOOD);
+    /* one client and connection worker per server, the sinks are shared */
+    pthread_t workers[UAMQ_MAX_ENDPOINTS];
+    int started[UAMQ_MAX_ENDPOINTS];
 
-    monitor_start(client);
+    for (int i = 0; i < g_config->endpointCount; i++) {
+        UAMQ_Endpoint* ep = &g_config->endpoints[i];
+        ep->client = UA_Client_new(UA_ClientConfig_standard);
+        started[i] = pthread_create(&workers[i], NULL, opcua_worker, (void*)ep) == 0;
+    }
 
     pthread_t tid1 = 0;
     void* s1 = NULL;
-	int th1 = pthread_create(&tid1, NULL, mqtt_run, (void*)client);
+	int th1 = pthread_create(&tid1, NULL, mqtt_run, NULL);
 
     pthread_t tid2 = 0;
     void* s2 = NULL;
-	int th2 = pthread_create(&tid2, NULL, tcp_run, (void*)client);
+	int th2 = pthread_create(&tid2, NULL, tcp_run, NULL);
 
     pthread_t tid3 = 0;
     void* s3 = NULL;
-	//int th3 = pthread_create(&tid3, NULL, amqp_run, (void*)client);
+	//int th3 = pthread_create(&tid3, NULL, amqp_run, NULL);
 
     pthread_t tid4 = 0;
     void* s4 = NULL;
-	int th4 = pthread_create(&tid4, NULL, opcua_poll, (void*)client);
+	int th4 = pthread_create(&tid4, NULL, opcua_poll, NULL);
+
+    pthread_t tid5 = 0;
+    void* s5 = NULL;
+	int th5 = pthread_create(&tid5, NULL, config_watch, NULL);
+
+    pthread_t tid6 = 0;
+    void* s6 = NULL;
+	int th6 = pthread_create(&tid6, NULL, metrics_run, NULL);
+
+    pthread_t tid7 = 0;
+    void* s7 = NULL;
+	int th7 = pthread_create(&tid7, NULL, command_run, NULL);
+
+    pthread_t tid8 = 0;
+    void* s8 = NULL;
+	int th8 = pthread_create(&tid8, NULL, command_listen, NULL);
 
 	while (!beStop)
 	{
-        usleep(g_config->uaPublishIntervalUsecs);
+        sleep(1);
+    }
 
-        if(!g_config->asycRequestSupported && (!strncmp(g_config->method, "poll", strlen(g_config->method)))) {
-            sleep(2);
-            continue;
-        } else {
-            UA_Client_Subscriptions_manuallySendPublishRequest(client);
-        }
+    /* the last answers still go out through the sinks */
+    if(th7 == 0) {
+        pthread_join(tid7, &s7);
+    }
+    if(th8 == 0) {
+        pthread_join(tid8, &s8);
     }
 
     pthread_cancel(tid1);
     pthread_cancel(tid2);
-    pthread_cancel(tid3);
 	pthread_join(tid1, &s1);
 	pthread_join(tid2, &s2);
-    pthread_join(tid3, &s3);
+    if(tid3) {
+        pthread_cancel(tid3);
+        pthread_join(tid3, &s3);
+    }
+    pthread_join(tid5, &s5);
 
-    UA_Client_disconnect(client);
-    UA_Client_delete(client);
+    /* the gauges look at the clients */
+    if(th6 == 0) {
+        pthread_join(tid6, &s6);
+    }
+
+    for (int i = 0; i < g_config->endpointCount; i++) {
+        void* s = NULL;
+        if(started[i]) {
+            pthread_join(workers[i], &s);
+        }
+
+        /* poll threads may still be on their way out */
+        UAMQ_Endpoint* ep = &g_config->endpoints[i];
+        opcua_lock(ep);
+        ep->connected = 0;
+        UA_Client_delete(ep->client);
+        ep->client = NULL;
+        opcua_unlock(ep);
+    }
 
+    log_stop();
     printf("stopped.\n");
 
     return (int) UA_STATUSCODE_GOOD;
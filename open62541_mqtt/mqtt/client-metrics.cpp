@@ -0,0 +1,443 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+using namespace std;
+
+#include "client-config.h"
+#include "client-metrics.h"
+#include "client-realtime.h"
+#include "client-log.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+#define MAX_SERIES 4096
+#define MAX_SHARDS 256
+
+/* bounded buckets up to 2^26 us (67 s), one more for the rest */
+#define BUCKETS 52
+#define HISTOGRAM_CELLS (2 + BUCKETS + 1)	/* count, sum in us, buckets */
+
+typedef struct {
+	const char* name;
+	const char* type;
+	const char* help;
+} Family;
+
+static const Family families[METRIC_FAMILIES] = {
+	{ "uamq_read_seconds", "histogram", "Round trip of the Read request of a poll group." },
+	{ "uamq_latency_seconds", "histogram", "Source timestamp of a value to its publish." },
+	{ "uamq_server_latency_seconds", "histogram", "Server timestamp of a value to its publish." },
+	{ "uamq_read_failures_total", "counter", "Reads of a poll group that failed." },
+	{ "uamq_published_total", "counter", "Messages handed to a sink." },
+	{ "uamq_published_bytes_total", "counter", "Bytes sent by a sink, after compression." },
+	{ "uamq_dropped_total", "counter", "Messages a sink could not send." },
+	{ "uamq_faults_total", "counter", "Failed service calls reported to the connection supervisor." },
+	{ "uamq_reconnects_total", "counter", "Recoveries of the connection, by step." },
+	{ "uamq_queued_bytes", "gauge", "Bytes in the send queue of a sink socket." },
+	{ "uamq_server_up", "gauge", "Whether the OPC UA server is connected." },
+	{ "uamq_monitored_items", "gauge", "Monitored items of the subscription of a server." },
+	{ "uamq_poll_groups", "gauge", "Running poll group threads." },
+	{ "uamq_commands_total", "counter", "Commands answered, by kind and result." },
+	{ "uamq_command_seconds", "histogram", "Receipt of a command to its answer." },
+};
+
+typedef struct {
+	MetricFamily family;
+	string labels;
+	long (*read)(void*);
+	void* arg;
+} Series;
+
+static Series table[MAX_SERIES];
+static atomic<int> count(0);
+static map<string, int> byName;
+static pthread_mutex_t registry = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The values of a thread. Only the owner writes them, so an update is a
+ * plain load and store; a scrape may see an update of a histogram half done,
+ * which the next scrape corrects. Shards outlive their threads and go to the
+ * next thread that starts, the totals never go backwards.
+ */
+typedef struct {
+	atomic<atomic<uint64_t>*> cells[MAX_SERIES];
+} Shard;
+
+static atomic<Shard*> shards[MAX_SHARDS];
+static atomic<bool> used[MAX_SHARDS];
+
+/* threads beyond MAX_SHARDS share one shard and update it atomically */
+static Shard overflow;
+
+static __thread Shard* mine = NULL;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t leave;
+
+static void shard_release(void* p)
+{
+	used[(long)p - 1].store(false);
+}
+
+static void shard_key(void)
+{
+	pthread_key_create(&leave, shard_release);
+}
+
+static Shard* shard(void)
+{
+	if(mine) {
+		return mine;
+	}
+
+	pthread_once(&once, shard_key);
+
+	for (int i = 0; i < MAX_SHARDS; i++) {
+		bool expected = false;
+		if(!used[i].compare_exchange_strong(expected, true)) {
+			continue;
+		}
+		if(!shards[i].load()) {
+			shards[i].store(new Shard());
+		}
+		mine = shards[i].load();
+		pthread_setspecific(leave, (void*)(long)(i + 1));
+		return mine;
+	}
+
+	mine = &overflow;
+	return mine;
+}
+
+static atomic<uint64_t>* cells(Shard* s, int series)
+{
+	atomic<uint64_t>* c = s->cells[series].load(memory_order_acquire);
+	if(c) {
+		return c;
+	}
+
+	MetricFamily f = table[series].family;
+	int n = !strcmp(families[f].type, "histogram") ? HISTOGRAM_CELLS : 1;
+	c = new atomic<uint64_t>[n]();
+
+	atomic<uint64_t>* expected = NULL;
+	if(!s->cells[series].compare_exchange_strong(expected, c)) {
+		delete[] c;
+		return expected;
+	}
+	return c;
+}
+
+static inline void bump(Shard* s, atomic<uint64_t>* c, uint64_t n)
+{
+	if(s == &overflow) {
+		c->fetch_add(n, memory_order_relaxed);
+	} else {
+		c->store(c->load(memory_order_relaxed) + n, memory_order_relaxed);
+	}
+}
+
+/* the smallest bucket whose bound is >= v: 1, 2, 3, 4, 6, 8, 12 ... */
+static inline int bucket(uint64_t v)
+{
+	if(v <= 2) {
+		return v ? (int)v - 1 : 0;
+	}
+	uint64_t u = v - 1;
+	int e = 63 - __builtin_clzll(u);
+	int i = 2 * e + (int)((u >> (e - 1)) & 1);
+	return i < BUCKETS ? i : BUCKETS;
+}
+
+static uint64_t bound(int i)
+{
+	if(i < 2) {
+		return (uint64_t)i + 1;
+	}
+	int e = i / 2;
+	return i & 1 ? (uint64_t)1 << (e + 1) : (uint64_t)3 << (e - 1);
+}
+
+static int series_add(MetricFamily family, const char* labels, long (*read)(void*), void* arg)
+{
+	pthread_mutex_lock(&registry);
+
+	string key = string(families[family].name) + '{' + labels + '}';
+	map<string, int>::iterator i = byName.find(key);
+	if(i != byName.end()) {
+		pthread_mutex_unlock(&registry);
+		return i->second;
+	}
+
+	int n = count.load();
+	if(n == MAX_SERIES) {
+		pthread_mutex_unlock(&registry);
+		log_warn("[metrics] more than %d series, %s is not counted.", MAX_SERIES, key.c_str());
+		return -1;
+	}
+
+	table[n].family = family;
+	table[n].labels = labels;
+	table[n].read = read;
+	table[n].arg = arg;
+	byName[key] = n;
+	count.store(n + 1);
+
+	pthread_mutex_unlock(&registry);
+	return n;
+}
+
+int metrics_series(MetricFamily family, const char* labels)
+{
+	return series_add(family, labels, NULL, NULL);
+}
+
+void metrics_gauge(MetricFamily family, const char* labels, long (*read)(void* arg), void* arg)
+{
+	series_add(family, labels, read, arg);
+}
+
+void metrics_add(int series, uint64_t n)
+{
+	if(series < 0) {
+		return;
+	}
+	Shard* s = shard();
+	bump(s, cells(s, series), n);
+}
+
+void metrics_observe(int series, uint64_t usecs)
+{
+	if(series < 0) {
+		return;
+	}
+	Shard* s = shard();
+	atomic<uint64_t>* c = cells(s, series);
+	bump(s, &c[0], 1);
+	bump(s, &c[1], usecs);
+	bump(s, &c[2 + bucket(usecs)], 1);
+}
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void metrics_label(char* out, size_t size, const char* value)
+{
+	size_t n = 0;
+	for (; *value && n + 3 < size; value++) {
+		if(*value == '"' || *value == '\\') {
+			out[n++] = '\\';
+			out[n++] = *value;
+		} else if(*value == '\n') {
+			out[n++] = '\\';
+			out[n++] = 'n';
+		} else {
+			out[n++] = *value;
+		}
+	}
+	out[n] = 0;
+}
+
+//===================================================================================================================================================================
+// exposition
+
+static void sum(int series, uint64_t* v, int n)
+{
+	memset(v, 0, n * sizeof(uint64_t));
+
+	for (int i = 0; i <= MAX_SHARDS; i++) {
+		Shard* s = i < MAX_SHARDS ? shards[i].load() : &overflow;
+		atomic<uint64_t>* c = s ? s->cells[series].load(memory_order_acquire) : NULL;
+		if(!c) {
+			continue;
+		}
+		for (int k = 0; k < n; k++) {
+			v[k] += c[k].load(memory_order_relaxed);
+		}
+	}
+}
+
+static void line(string& out, const char* name, const char* suffix, const string& labels, const char* extra, const char* value)
+{
+	out += name;
+	out += suffix;
+	if(!labels.empty() || extra) {
+		out += '{';
+		out += labels;
+		if(extra) {
+			out += labels.empty() ? "" : ",";
+			out += extra;
+		}
+		out += '}';
+	}
+	out += ' ';
+	out += value;
+	out += '\n';
+}
+
+static string exposition(void)
+{
+	string out;
+	char value[64];
+	char le[64];
+	int n = count.load();
+
+	for (int f = 0; f < METRIC_FAMILIES; f++) {
+		const Family* F = &families[f];
+		bool header = false;
+
+		for (int i = 0; i < n; i++) {
+			Series* s = &table[i];
+			if(s->family != f) {
+				continue;
+			}
+			if(!header) {
+				out += string("# HELP ") + F->name + " " + F->help + "\n";
+				out += string("# TYPE ") + F->name + " " + F->type + "\n";
+				header = true;
+			}
+
+			if(s->read) {
+				snprintf(value, sizeof(value), "%ld", s->read(s->arg));
+				line(out, F->name, "", s->labels, NULL, value);
+			} else if(!strcmp(F->type, "histogram")) {
+				uint64_t v[HISTOGRAM_CELLS];
+				sum(i, v, HISTOGRAM_CELLS);
+
+				uint64_t cumulative = 0;
+				for (int b = 0; b < BUCKETS; b++) {
+					cumulative += v[2 + b];
+					snprintf(le, sizeof(le), "le=\"%g\"", bound(b) / 1e6);
+					snprintf(value, sizeof(value), "%lu", (unsigned long)cumulative);
+					line(out, F->name, "_bucket", s->labels, le, value);
+				}
+				snprintf(value, sizeof(value), "%lu", (unsigned long)v[0]);
+				line(out, F->name, "_bucket", s->labels, "le=\"+Inf\"", value);
+				snprintf(value, sizeof(value), "%.6f", v[1] / 1e6);
+				line(out, F->name, "_sum", s->labels, NULL, value);
+				snprintf(value, sizeof(value), "%lu", (unsigned long)v[0]);
+				line(out, F->name, "_count", s->labels, NULL, value);
+			} else {
+				uint64_t v;
+				sum(i, &v, 1);
+				snprintf(value, sizeof(value), "%lu", (unsigned long)v);
+				line(out, F->name, "", s->labels, NULL, value);
+			}
+		}
+	}
+
+	return out;
+}
+
+static void send_all(int fd, const char* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+		if(w <= 0) {
+			return;
+		}
+		p += w;
+		len -= (size_t)w;
+	}
+}
+
+static void serve(int fd)
+{
+	struct timeval tv = { 1, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* only the request line matters */
+	char req[2048];
+	size_t len = 0;
+	while (len < sizeof(req) - 1) {
+		ssize_t r = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if(r <= 0) {
+			break;
+		}
+		len += (size_t)r;
+		req[len] = 0;
+		if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+			break;
+		}
+	}
+	req[len] = 0;
+
+	string body;
+	const char* status = "200 OK";
+	if(!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET /metrics?", 13)) {
+		body = exposition();
+	} else {
+		status = "404 Not Found";
+		body = "try /metrics\n";
+	}
+
+	char head[256];
+	int n = snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+		status, (unsigned long)body.size());
+	send_all(fd, head, (size_t)n);
+	send_all(fd, body.data(), body.size());
+}
+
+void* metrics_run(void* param)
+{
+	if(!g_config->metricsEnable) {
+		return NULL;
+	}
+	rt_thread(UAMQ_ROLE_METRICS, -1, "metrics");
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)g_config->metricsPort);
+	if(inet_pton(AF_INET, g_config->metricsAddress, &addr.sin_addr) != 1) {
+		log_error("[metrics] invalid address %s.", g_config->metricsAddress);
+		return NULL;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	if(fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+		log_error("[metrics] can't listen on %s:%d.", g_config->metricsAddress, g_config->metricsPort);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	log_info("[metrics] serving http://%s:%d/metrics", g_config->metricsAddress, g_config->metricsPort);
+
+	while (!beStop) {
+		struct pollfd p = { fd, POLLIN, 0 };
+		if(poll(&p, 1, 1000) <= 0) {
+			continue;
+		}
+		int c = accept(fd, NULL, NULL);
+		if(c < 0) {
+			continue;
+		}
+		serve(c);
+		close(c);
+	}
+
+	close(fd);
+	return NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef OPCUA_MQTT_BRIDGE_METRICS_H_
+#define OPCUA_MQTT_BRIDGE_METRICS_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Counters and latency histograms of the bridge, served in the Prometheus
+ * text format by a small HTTP endpoint ("metrics" block of the config):
+ *
+ *   "metrics": { "enable": true, "address": "127.0.0.1", "port": 9464 }
+ *
+ * A series is a metric family with a fixed set of labels, e.g.
+ * metrics_series(METRIC_READ_SECONDS, "group=\"line1\",server=\"plc\""),
+ * registered once and then updated through its handle. Every thread updates
+ * its own copy of the values and never waits; a scrape adds them up.
+ *
+ * Histograms take microseconds and have log-linear buckets, two per power of
+ * two (1, 2, 3, 4, 6, 8, 12, 16 ... us), so any value is off by at most 25%.
+ */
+typedef enum {
+	METRIC_READ_SECONDS,		/* histogram, round trip of the Read of a poll group */
+	METRIC_LATENCY_SECONDS,		/* histogram, source timestamp to publish */
+	METRIC_SERVER_LATENCY_SECONDS,	/* histogram, server timestamp to publish */
+	METRIC_READ_FAILURES,
+	METRIC_PUBLISHED,			/* messages handed to a sink */
+	METRIC_PUBLISHED_BYTES,		/* bytes sent, after compression */
+	METRIC_DROPPED,				/* messages a sink could not send */
+	METRIC_FAULTS,				/* failed service calls reported to the supervisor */
+	METRIC_RECONNECTS,			/* recoveries by step */
+	METRIC_QUEUED_BYTES,		/* gauge, send queue of a sink socket */
+	METRIC_SERVER_UP,			/* gauge */
+	METRIC_MONITORED_ITEMS,		/* gauge */
+	METRIC_POLL_GROUPS,			/* gauge, running poll threads */
+	METRIC_COMMANDS,			/* commands answered, by kind and result */
+	METRIC_COMMAND_SECONDS,		/* histogram, receipt of a command to its answer */
+	METRIC_FAMILIES
+} MetricFamily;
+
+/* returns the handle of the series, the same one for the same labels. -1 when
+ * the table is full, updates of -1 are ignored */
+int metrics_series(MetricFamily family, const char* labels);
+
+/* gauges are read when scraped */
+void metrics_gauge(MetricFamily family, const char* labels, long (*read)(void* arg), void* arg);
+
+void metrics_add(int series, uint64_t n);
+void metrics_observe(int series, uint64_t usecs);
+
+/* monotonic clock in microseconds, for round trips */
+uint64_t metrics_now(void);
+
+/* writes a label value with '"', '\' and newlines escaped */
+void metrics_label(char* out, size_t size, const char* value);
+
+/* serves GET /metrics until the bridge stops */
+void* metrics_run(void* param);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_METRICS_H_ */
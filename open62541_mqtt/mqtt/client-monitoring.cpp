@@ -21,17 +21,23 @@
 #include <sstream>
 #include <iterator>
 #include <map>
+#include <set>
+#include <string>
 using namespace std;
 
 #include "client-nodemap.h"
 #include "client-nodeid.h"
+#include "client-topology.h"
+#include "client-reader.h"
 #include "MQTTPacket.h"
 #include "client-common.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-realtime.h"
 #include "json.h"
 
 extern int beStop;
 
-extern map<int, Group>* gmap;
 extern UAMQ_Configuration* g_config;
 
 #include <stdio.h>
@@ -61,6 +67,41 @@ int64_t epoch(void) {
     return micros;
 }
 
+/* UA_DateTime (100ns since 1601) to epoch us */
+static int64_t epoch_of(UA_DateTime t)
+{
+    return (t - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME;
+}
+
+/*
+ * The time of a sample as the payloads carry it: the source timestamp, the
+ * server timestamp from servers that send none, the time of publishing when
+ * there is neither. Values are read with both timestamps.
+ */
+static int64_t sample_time(const UA_DataValue* dv)
+{
+    if(dv->hasSourceTimestamp) {
+        return epoch_of(dv->sourceTimestamp);
+    }
+    if(dv->hasServerTimestamp) {
+        return epoch_of(dv->serverTimestamp);
+    }
+    return epoch();
+}
+
+static UA_StatusCode sample_status(const UA_DataValue* dv)
+{
+    return dv->hasStatus ? dv->status : UA_STATUSCODE_GOOD;
+}
+
+/* age of a timestamp at publishing, 0 = no timestamp */
+static void observe_age(int series, int64_t stamp, int64_t now)
+{
+    if(stamp > 0) {
+        metrics_observe(series, now > stamp ? (uint64_t)(now - stamp) : 0);
+    }
+}
+
 static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
 
     if(!data->hasValue) {
@@ -73,9 +114,9 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
     UA_Variant val = data->value;
     const UA_DataType* type = val.type;
 
-    static char topic[64] = {0,};
-    static char payload[256] = {0,};
-    static char value[32] = {0,};
+    char topic[64] = {0,};
+    char payload[256] = {0,};
+    char value[32] = {0,};
 
     json_object* jobj = json_object_new_object();
 
@@ -100,7 +141,7 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
         }
         break;
         default : {
-            printf("not supported dataType : %s, typeIndex:%d\n", val.type->typeName, val.type->typeIndex);
+            log_warn("not supported dataType : %s, typeIndex:%d", val.type->typeName, val.type->typeIndex);
         }
     }
 
@@ -112,9 +153,21 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
     }
 
     if(!bEmpty) {
-        int64_t t = epoch();
+        int64_t t = sample_time(data);
+        int64_t server = data->hasServerTimestamp ? epoch_of(data->serverTimestamp) : 0;
+        UA_StatusCode status = sample_status(data);
+
         json_object_object_add(jobj, "time", json_object_new_int64(t));
-        sprintf(payload, "%s=%ld, %s=%s", "time", t, d->alias, value);
+        if(server) {
+            json_object_object_add(jobj, "serverTime", json_object_new_int64(server));
+        }
+        json_object_object_add(jobj, "status", json_object_new_int64(status));
+
+        int len = snprintf(payload, sizeof(payload), "%s=%" PRId64 ", ", "time", t);
+        if(server) {
+            len += snprintf(payload + len, sizeof(payload) - len, "%s=%" PRId64 ", ", "serverTime", server);
+        }
+        snprintf(payload + len, sizeof(payload) - len, "%s=%u, %s=%s", "status", status, d->alias, value);
 
         const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
         
@@ -137,102 +190,360 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
             }
             break;
         }        
+
+        /* servers that send no timestamps are not measured */
+        int64_t now = epoch();
+        observe_age(p->latency, data->hasSourceTimestamp || data->hasServerTimestamp ? t : 0, now);
+        observe_age(p->serverLatency, server, now);
     }
 
     json_object_put(jobj);
 }
 
-void monitor_start(UA_Client* client)
+/*
+ * A monitored item is bound to its own copy of the node and group settings,
+ * so it stays valid while the topology it was created from is replaced. The
+ * key covers everything the callback uses: a node whose settings change gets
+ * a new binding and the old one is removed.
+ */
+typedef struct Binding {
+    Group group;
+    Node node;
+    UA_UInt32 monId;
+} Binding;
+
+/* the subscription of an endpoint, used by its worker and supervisor only */
+typedef struct Monitor {
+    map<string, Binding*> bindings;
+    UA_UInt32 subId;
+    bool monitoring;
+    volatile int rebind;
+    volatile long items;    /* size of bindings, for the metrics */
+} Monitor;
+
+static Monitor monitors[UAMQ_MAX_ENDPOINTS];
+
+static string binding_key(Group* p, Node* d)
 {
-    if(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumPoll)) {
-        cout << "\n[EVENT MODE] DISCARDED.\n";
+    ostringstream ss;
+    ss << p->key << '\x1f' << p->topic << '\x1f' << p->format << '\x1f' << p->mqtt << p->tcp << '\x1f'
+       << d->id << '\x1f' << d->topic << '\x1f' << d->alias;
+    return ss.str();
+}
+
+static void binding_delete(Binding* b)
+{
+    free(b->group.key);
+    free(b->group.topic);
+    free(b->group.format);
+    free(b->node.id);
+    free(b->node.topic);
+    free(b->node.alias);
+    UA_NodeId_deleteMembers(&b->node.ua);
+    delete b;
+}
+
+static void monitor_bind(UA_Client* client, Monitor* m, const string& key, Group* p, Node* d)
+{
+    UA_UInt32 subId = m->subId;
+
+    Binding* b = new Binding();
+    b->group.key = strdup(p->key);
+    b->group.topic = strdup(p->topic);
+    b->group.format = strdup(p->format);
+    b->group.mqtt = p->mqtt;
+    b->group.tcp = p->tcp;
+    b->group.latency = p->latency;
+    b->group.serverLatency = p->serverLatency;
+    b->node.id = strdup(d->id);
+    b->node.topic = strdup(d->topic);
+    b->node.alias = strdup(d->alias);
+    UA_NodeId_copy(&d->ua, &b->node.ua);
+    b->node.parent = &b->group;
+
+    UA_Client_Subscriptions_addMonitoredItem(client, subId, b->node.ua, UA_ATTRIBUTEID_VALUE, &callback, &b->node, &b->monId);
+    if (!b->monId) {
+        switch(b->node.ua.identifierType) {
+            case UA_NODEIDTYPE_STRING : {
+                log_error("Monitoring id %u for %.*s ==> FAILED.", subId, (int)b->node.ua.identifier.string.length, b->node.ua.identifier.string.data);
+            }
+            break;
+            case UA_NODEIDTYPE_NUMERIC : {
+                log_error("Monitoring id %u for %d ==> FAILED.", subId, b->node.ua.identifier.numeric);
+            }
+            break;
+            default: {
+                log_error("Monitoring FAILED.");
+                break;
+            }
+        }
+        binding_delete(b);
         return;
     }
 
-    UA_UInt32 subId = 0;
-    UA_Client_Subscriptions_new(client, UA_SubscriptionSettings_standard, &subId);
-    if(subId)
-        printf("Create subscription succeeded, id %u\n", subId);
+    m->bindings[key] = b;
+}
 
-    printf("\n[EVENT MODE]\n");
-	map<int, Group>::iterator i;
-	for (i = gmap->begin(); i != gmap->end(); ++i) {
-		Group* p = (Group*)&i->second;
+/* brings the monitored items in line with the current topology, items of
+ * unchanged nodes are left alone */
+static void rebind_all(UAMQ_Endpoint* ep, bool verbose, const char* tag)
+{
+    UA_Client* client = ep->client;
+    Monitor* m = &monitors[ep->index];
+    set<string> wanted;
+    int added = 0, removed = 0;
 
-        if(getMonitorMode(p->method) == enumEvent) {
-            cout << "\t[" << i->first << "] name: \"" << p->name << "\", enable: " << p->enable << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
+    /* hold the topology rather than staying in the read section, the
+     * service calls below block */
+    Topology* t = topology_acquire();
 
-            if(!p->enable) {
-                continue;
+	for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
+
+        if(getMonitorMode(p->method) != enumEvent || p->endpoint != ep->index) {
+            continue;
+        }
+        if(verbose) {
+            log_info("\t[%d] name: \"%s\", enable: %d, method: %s, interval(us): %d, mqtt: %d, tcp: %d", (int)i, p->name, p->enable, p->method, p->intervalUSec, p->mqtt, p->tcp);
+        }
+        if(!p->enable) {
+            continue;
+        }
+
+        for (size_t n = 0; n < p->nodes.size(); n++) {
+            Node* d = &p->nodes[n];
+            if(verbose) {
+                log_debug("\t\t[%d] id: %s, topic: %s, alias: %s", (int)n, d->id, d->topic, d->alias);
             }
-            map<int, Node>::iterator n;
-            for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
-                Node* d = (Node*)&n->second;
-                d->parent = p;
-                cout << "\t\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
-
-                UA_NodeIdType type = getUA_NodeID(d->id, &d->ua);
-
-                UA_UInt32 monId = 0; 
-                UA_Client_Subscriptions_addMonitoredItem(client, subId, d->ua, UA_ATTRIBUTEID_VALUE, &callback, d, &monId);
-                if (!monId) {
-                    switch(d->ua.identifierType) {
-                        case UA_NODEIDTYPE_STRING : {
-                            printf("Monitoring id %u for %s ==> FAILED.\n", subId, d->ua.identifier.string.data);
-                        }
-                        break;
-                        case UA_NODEIDTYPE_NUMERIC : {
-                            printf("Monitoring id %u for %d ==> FAILED.\n", subId, d->ua.identifier.numeric);
-                        }
-                        break;
-                        default: {
-                            printf("Monitoring FAILED.\n");
-                            break;
-                        }
-                    }
-                }
+
+            string key = binding_key(p, d);
+            if(!wanted.insert(key).second || m->bindings.count(key)) {
+                continue;
             }
+            monitor_bind(client, m, key, p, d);
+            added++;
         }
 	}
+
+    topology_release(t);
+
+    map<string, Binding*>::iterator b = m->bindings.begin();
+    while (b != m->bindings.end()) {
+        if(wanted.count(b->first)) {
+            ++b;
+            continue;
+        }
+        UA_Client_Subscriptions_removeMonitoredItem(client, m->subId, b->second->monId);
+        binding_delete(b->second);
+        m->bindings.erase(b++);
+        removed++;
+    }
+    m->items = (long)m->bindings.size();
+
+    if(!verbose) {
+        log_info("[%s] %s: monitored items: %d added, %d removed, %d total.", tag, ep->name, added, removed, (int)m->bindings.size());
+    }
+}
+
+static long monitored_items(void* arg)
+{
+    return ((Monitor*)arg)->items;
 }
 
+void monitor_start(UAMQ_Endpoint* ep)
+{
+    Monitor* m = &monitors[ep->index];
+
+    if(!endpoint_allows(ep, "event")) {
+        log_info("[EVENT MODE] %s DISCARDED.", ep->name);
+        return;
+    }
+
+    UA_Client_Subscriptions_new(ep->client, UA_SubscriptionSettings_standard, &m->subId);
+    if(m->subId)
+        log_info("Create subscription succeeded, id %u", m->subId);
+
+    log_info("[EVENT MODE] %s", ep->name);
+    m->monitoring = true;
+
+    char server[128], labels[160];
+    metrics_label(server, sizeof(server), ep->name);
+    snprintf(labels, sizeof(labels), "server=\"%s\"", server);
+    metrics_gauge(METRIC_MONITORED_ITEMS, labels, monitored_items, m);
+
+    rebind_all(ep, true, NULL);
+}
+
+void monitor_schedule(void)
+{
+    for (int i = 0; i < g_config->endpointCount; i++) {
+        monitors[i].rebind = 1;
+    }
+}
+
+/* runs on the thread that owns the subscription, between publish requests */
+void monitor_update(UAMQ_Endpoint* ep)
+{
+    Monitor* m = &monitors[ep->index];
+
+    if(!m->rebind) {
+        return;
+    }
+    m->rebind = 0;
+
+    if(m->monitoring) {
+        rebind_all(ep, false, "reload");
+    }
+}
+
+/* the subscription ended with the old session, the items are created anew */
+void monitor_restart(UAMQ_Endpoint* ep)
+{
+    Monitor* m = &monitors[ep->index];
+
+    if(!m->monitoring) {
+        return;
+    }
+
+    map<string, Binding*>::iterator b;
+    for (b = m->bindings.begin(); b != m->bindings.end(); ++b) {
+        binding_delete(b->second);
+    }
+    m->bindings.clear();
+    m->items = 0;
+
+    m->subId = 0;
+    UA_Client_Subscriptions_new(ep->client, UA_SubscriptionSettings_standard, &m->subId);
+    if(m->subId)
+        log_info("Create subscription succeeded, id %u", m->subId);
+
+    rebind_all(ep, false, "connection");
+}
+
+static pthread_mutex_t pollers = PTHREAD_MUTEX_INITIALIZER;
+static set<string> polling;
+
+static long poll_groups(void* arg)
+{
+    pthread_mutex_lock(&pollers);
+    long n = (long)polling.size();
+    pthread_mutex_unlock(&pollers);
+    return n;
+}
+
+static bool pollable(Group* p)
+{
+    return p && p->enable && getMonitorMode(p->method) == enumPoll && endpoint_allows(&g_config->endpoints[p->endpoint], "poll");
+}
+
+/*
+ * A poll thread serves the group with the given key. The group is looked up
+ * again every cycle, so it follows a reload without locking and stops when
+ * its group is removed or disabled.
+ */
 void* opcua_poll_group(void* param)
 {
-    UA_Client* client = (UA_Client*)g_config->client;
-    Group* p = (Group*)param;
+    char* key = (char*)param;
+    int pinned = -1;
+
+    GroupReader reader;
+    reader_init(&reader);
 
     do {
+        /* hold the topology rather than staying in the read section, the
+         * read and the publishes below block */
+        Topology* topo = topology_acquire();
+        Group* p = topology_find(topo, key);
+
+        if(!pollable(p)) {
+            topology_release(topo);
+
+            /* recheck under the lock, poll_schedule() may just have seen us
+             * in the running set after bringing the group back */
+            pthread_mutex_lock(&pollers);
+            topology_read_begin();
+            bool gone = !pollable(topology_group(key));
+            topology_read_end();
+            if(gone) {
+                polling.erase(key);
+            }
+            pthread_mutex_unlock(&pollers);
+
+            if(gone) {
+                break;
+            }
+            continue;
+        }
+
+        /* the group runs next to the connection worker of its server */
+        UAMQ_Endpoint* ep = &g_config->endpoints[p->endpoint];
+        if(pinned != ep->index) {
+            char what[96];
+            snprintf(what, sizeof(what), "poll %s on", key);
+            opcua_pin(ep, UAMQ_ROLE_POLL, what);
+            pinned = ep->index;
+        }
+
+        /* wait for the first connect and for reconnects */
+        if(!opcua_acquire(ep)) {
+            topology_release(topo);
+            usleep(100000);
+            continue;
+        }
+
         json_object* jobj = json_object_new_object();
+        json_object* times = json_object_new_object();
+        json_object* statuses = json_object_new_object();
         vector<char*> kvs;
+        bool failed = false;
+
+        /* the oldest timestamps of the message, 0 = none */
+        int64_t oldest = 0, oldestServer = 0;
+
+        /* one Read for the whole group */
+        UA_ReadResponse resp;
+        UA_ReadResponse_init(&resp);
+        uint64_t sent = metrics_now();
+        bool prepared = reader_prepare(&reader, ep, p, topo->generation);
+        if(prepared) {
+            resp = reader_read(&reader, ep);
+        }
+        opcua_unlock(ep);
+
+        if(!prepared) {
+            log_warn("%s: no memory for the read request.", p->key);
+            metrics_add(p->failures, 1);
+            failed = true;
+        } else if(resp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+            log_warn("%s: read failed (0x%08x).", p->key, resp.responseHeader.serviceResult);
+            opcua_fault(ep, resp.responseHeader.serviceResult);
+            metrics_add(p->failures, 1);
+            failed = true;
+        } else {
+            metrics_observe(p->rtt, metrics_now() - sent);
+        }
+
+        for (size_t n = 0; !failed && n < p->nodes.size(); n++) {
+            Node* d = &p->nodes[n];
+            UA_DataValue* dv = &resp.results[n];
 
-        map<int, Node>::iterator n;
-        for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
-            Node* d = (Node*)&n->second;
-
-            UA_Variant *val = UA_Variant_new();
-            UA_StatusCode retval = UA_Client_readValueAttribute(client, d->ua, val);
-
-            if(retval != UA_STATUSCODE_GOOD) {
-                UA_Variant_delete(val);
-                printf("read failed.\n");
-                usleep(p->intervalUSec);
-
-				UA_StatusCode state = UA_STATUSCODE_GOOD;
-
-				do {
-					state = opcua_server_connect(client);
-					if (state == UA_STATUSCODE_GOOD) {
-						state = opcua_server_browse(client);
-						
-					} else {
-						sleep(2);
-						printf("OPC UA Server connect failed.");
-					}
-				} while(state != UA_STATUSCODE_GOOD);
-                
-				continue;
+            /* uncertain values are published with their status */
+            UA_StatusCode status = sample_status(dv);
+            if(status & 0x80000000) {
+                log_warn("%s: read %s failed (0x%08x).", p->key, d->id, status);
+
+                /* the server may have dropped the registration */
+                if(dv->status == UA_STATUSCODE_BADNODEIDUNKNOWN || dv->status == UA_STATUSCODE_BADNODEIDINVALID) {
+                    reader_invalidate(&reader);
+                }
+                continue;
+            }
+            if(!dv->hasValue || !dv->value.type) {
+                continue;
             }
 
+            UA_Variant *val = &dv->value;
+
             // typedef struct {
             //     const UA_DataType *type;      /* The data type description */
             //     UA_VariantStorageType storageType;
@@ -321,20 +632,31 @@ void* opcua_poll_group(void* param)
                 }
                 break;
                 default : {
-                    printf("not supported dataType : %s, typeIndex:%d\n", val->type->typeName, val->type->typeIndex);
-                    UA_Variant_delete(val);
+                    log_warn("not supported dataType : %s, typeIndex:%d", val->type->typeName, val->type->typeIndex);
                     usleep(p->intervalUSec);
                     continue;
                 }
             }
-            UA_Variant_delete(val);
 
-            static char skv[32] = {0,};
-            sprintf(skv, "%s=%s", d->alias, value);
-            kvs.push_back(strndup(skv, strlen(skv)));
+            int64_t t = sample_time(dv);
+            json_object_object_add(times, d->alias, json_object_new_int64(t));
+            json_object_object_add(statuses, d->alias, json_object_new_int64(status));
+            if((dv->hasSourceTimestamp || dv->hasServerTimestamp) && (!oldest || t < oldest)) {
+                oldest = t;
+            }
+            if(dv->hasServerTimestamp) {
+                int64_t server = epoch_of(dv->serverTimestamp);
+                if(!oldestServer || server < oldestServer) {
+                    oldestServer = server;
+                }
+            }
+
+            char skv[640] = {0,};
+            snprintf(skv, sizeof(skv), "%s=%s, %s.time=%" PRId64 ", %s.status=%u", d->alias, value, d->alias, t, d->alias, status);
+            kvs.push_back(strdup(skv));
         }
 
-        static char topic[64] = {0,};
+        char topic[64] = {0,};
         sprintf(topic, "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
 
         bool bEmpty = true;
@@ -343,14 +665,23 @@ void* opcua_poll_group(void* param)
         }
 
         if(!bEmpty) {
-            int64_t t = epoch();
+            int64_t now = epoch();
+            int64_t t = oldest ? oldest : now;
             json_object_object_add(jobj, "time", json_object_new_int64(t));
+            if(oldestServer) {
+                json_object_object_add(jobj, "serverTime", json_object_new_int64(oldestServer));
+            }
+            json_object_object_add(jobj, "times", json_object_get(times));
+            json_object_object_add(jobj, "status", json_object_get(statuses));
 
-            static char skv[32] = {0,};
-            sprintf(skv, "%s=%lu", "time", t);
-            kvs.push_back(strndup(skv, strlen(skv)));
+            char skv[64] = {0,};
+            int len = snprintf(skv, sizeof(skv), "%s=%" PRId64, "time", t);
+            if(oldestServer) {
+                snprintf(skv + len, sizeof(skv) - len, ", %s=%" PRId64, "serverTime", oldestServer);
+            }
+            kvs.push_back(strdup(skv));
 
-            static char payload[512] = {0,};
+            char payload[512] = {0,};
 
             ostringstream ss;
 
@@ -381,68 +712,106 @@ void* opcua_poll_group(void* param)
                 }
                 break;
             }  
+
+            /* the oldest sample of the message, servers that send no
+             * timestamps are not measured */
+            now = epoch();
+            observe_age(p->latency, oldest, now);
+            observe_age(p->serverLatency, oldestServer, now);
         }
 
+        UA_ReadResponse_deleteMembers(&resp);
+        json_object_put(times);
+        json_object_put(statuses);
         json_object_put(jobj);
         for ( size_t i = 0; i < kvs.size(); i++)
         {
-            delete kvs[i];
+            free(kvs[i]);
         }
         vector<char*>().swap(kvs);
 
-        usleep(p->intervalUSec);
+        int interval = p->intervalUSec;
+        topology_release(topo);
+
+        usleep(interval);
 
     } while (!beStop);
 
+    if(reader.endpoint >= 0 && !beStop) {
+        UAMQ_Endpoint* ep = &g_config->endpoints[reader.endpoint];
+        opcua_lock(ep);
+        reader_clear(&reader, ep);
+        opcua_unlock(ep);
+    } else {
+        reader_clear(&reader, NULL);
+    }
+    topology_thread_exit();
+    free(key);
+
     return NULL;
 
 }
 
-void* opcua_poll(void* param)
+/* starts a poll thread for every poll group that has none */
+void poll_schedule(void)
 {
-    if(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumEvent)) {
-        cout << "\n[POLL MODE] DISCARDED.\n";
-        return NULL;
-    }
+    pthread_mutex_lock(&pollers);
+    topology_read_begin();
 
-    UA_Client* client = (UA_Client*)param;
+    Topology* t = topology_current();
+    for (size_t i = 0; i < t->groups.size(); i++) {
+        Group* p = &t->groups[i];
 
-    printf("\n[POLL MODE]\n");
-    map<int, Group>::iterator i;
-	for (i = gmap->begin(); i != gmap->end(); ++i) {
-		Group* p = (Group*)&i->second;
+        if(!pollable(p) || polling.count(p->key)) {
+            continue;
+        }
 
-        if(getMonitorMode(p->method) == enumPoll) {
-            cout << "\t[" << i->first << "] name: \"" << p->name << "\", enable: " << p->enable << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
-            if(!p->enable) {
-                continue;
-            }
+        pthread_t tid = 0;
+        char* key = strdup(p->key);
+        if(pthread_create(&tid, NULL, opcua_poll_group, (void*)key) != 0) {
+            free(key);
+            continue;
+        }
+        pthread_detach(tid);
+        polling.insert(p->key);
+    }
 
-            map<int, Node>::iterator n;
-            for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
-                Node* d = (Node*)&n->second;
-                d->parent = p;
+    topology_read_end();
+    pthread_mutex_unlock(&pollers);
+}
 
-                cout << "\t\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
+void* opcua_poll(void* param)
+{
+    rt_thread(UAMQ_ROLE_POLL, -1, "poll");
+    log_info("[POLL MODE]");
+    metrics_gauge(METRIC_POLL_GROUPS, "", poll_groups, NULL);
 
-                UA_NodeIdType type = getUA_NodeID(d->id, &d->ua);
-            }
-        }
-	}
+    topology_read_begin();
+    Topology* t = topology_current();
 
-    for (i = gmap->begin(); i != gmap->end(); ++i) {
-        Group* p = (Group*)&i->second;
+    for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
 
         if(getMonitorMode(p->method) == enumPoll) {
+            if(!endpoint_allows(&g_config->endpoints[p->endpoint], "poll")) {
+                log_info("\t[%d] name: \"%s\", server: %s DISCARDED.", (int)i, p->name, p->server);
+                continue;
+            }
+            log_info("\t[%d] name: \"%s\", server: %s, enable: %d, method: %s, interval(us): %d, mqtt: %d, tcp: %d", (int)i, p->name, p->server, p->enable, p->method, p->intervalUSec, p->mqtt, p->tcp);
             if(!p->enable) {
                 continue;
             }
 
-            pthread_t tid = 0;
-            void* s = NULL;
-            int th = pthread_create(&tid, NULL, opcua_poll_group, (void*)p);               
+            for (size_t n = 0; n < p->nodes.size(); n++) {
+                Node* d = &p->nodes[n];
+                log_debug("\t\t[%d] id: %s, topic: %s, alias: %s", (int)n, d->id, d->topic, d->alias);
+            }
         }
-    }
+	}
+
+    topology_read_end();
+
+    poll_schedule();
 
     return NULL;
 }
\ No newline at end of file
@@ -19,12 +19,45 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include "MQTTPacket.h"
 #include "transport.h"
 #include "client-config.h"
+#include "client-compress.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-realtime.h"
+#include "client-command.h"
 
 static int sock = 0;
+static UAMQ_Codec* codec = NULL;
+
+/* publishers of all groups share the connection, a frame is written whole */
+static pthread_mutex_t sending = PTHREAD_MUTEX_INITIALIZER;
+static volatile int connected = 0;
+
+/* reconnect backoff, doubled up to the limit while the broker is away */
+#define BACKOFF_MIN 100000
+#define BACKOFF_MAX 5000000
+
+/* a PINGREQ is sent after half the keep alive without a packet; a broker
+ * that stops in the middle of a packet is given up after the timeout */
+#define KEEPALIVE 20
+#define RECEIVE_TIMEOUT 5
+
+/* packets from the broker: acks and commands */
+static unsigned char inbuf[65536];
+static time_t lastSent = 0;
+
+/* metric series, registered before the connect */
+static int published = -1;
+static int bytes = -1;
+static int dropped = -1;
 
 extern int beStop;
 extern UAMQ_Configuration* g_config;
@@ -40,60 +73,281 @@ int mqtt_connect(int argc, char *argv[])
 	char* host = g_config->mqttBrockerIP;
 	int port = g_config->mqttBrockerPORT;
 	
-	sock = transport_open(host, port);
-	if(sock < 0) {
-		printf("open mqtt trasport (hostname '%s' port %d) ==> failed.\n", host, port);
-		return sock;
+	int fd = transport_open(host, port);
+	if(fd < 0) {
+		log_debug("[mqtt] open trasport (hostname '%s' port %d) ==> failed.", host, port);
+		return fd;
 	} else {
-		printf("open mqtt trasport (hostname '%s' port %d) ==> ok.\n", host, port);
+		log_info("[mqtt] open trasport (hostname '%s' port %d) ==> ok.", host, port);
 	}
 
 	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
 	data.clientID.cstring = "public";
-	data.keepAliveInterval = 20;
+	data.keepAliveInterval = KEEPALIVE;
 	data.cleansession = 1;
-	data.username.cstring = "";
-	data.password.cstring = "";
+
+	struct timeval tv = { RECEIVE_TIMEOUT, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
 	len = MQTTSerialize_connect(buf, buflen, &data);
-	rc = transport_sendPacketBuffer(sock, buf, len);
+	rc = transport_sendPacketBuffer(fd, buf, len);
 
-	if (MQTTPacket_read(buf, buflen, transport_getdata) == CONNACK)
+	if (rc == len && MQTTPacket_read(buf, buflen, transport_getdata) == CONNACK)
 	{
 		unsigned char sessionPresent, connack_rc;
 
 		if (MQTTDeserialize_connack(&sessionPresent, &connack_rc, buf, buflen) != 1 || connack_rc != 0)
 		{
-			printf("Unable to connect, return code %d\n", connack_rc);
+			log_warn("[mqtt] unable to connect, return code %d", connack_rc);
+			transport_close(fd);
 			return -1;
 		}
 	}
 	else {
-		printf("mqtt connection info read failed.\n");
+		log_warn("[mqtt] connection info read failed.");
+		transport_close(fd);
 		return -1;
 	}
 
-	printf("mqtt brocker connected successfully.\n");
+	/* the SUBACK is taken by mqtt_receive, it may come after the first commands */
+	if(g_config->commandEnable && g_config->commandTopicCount > 0) {
+		unsigned char sub[2048];
+		MQTTString topics[UAMQ_MAX_COMMAND_TOPICS];
+		int qos[UAMQ_MAX_COMMAND_TOPICS];
+		for (int i = 0; i < g_config->commandTopicCount; i++) {
+			MQTTString t = MQTTString_initializer;
+			t.cstring = g_config->commandTopics[i];
+			topics[i] = t;
+			qos[i] = 0;
+		}
+		len = MQTTSerialize_subscribe(sub, sizeof(sub), 0, 1, g_config->commandTopicCount, topics, qos);
+		if(len <= 0 || transport_sendPacketBuffer(fd, sub, len) != len) {
+			log_warn("[mqtt] subscribe to the command topics failed.");
+			transport_close(fd);
+			return -1;
+		}
+	}
+
+	/* the retained dictionary is gone if the broker restarted */
+	codec_dictionary_lost(codec);
+
+	pthread_mutex_lock(&sending);
+	sock = fd;
+	connected = 1;
+	lastSent = time(NULL);
+	pthread_mutex_unlock(&sending);
+
+	log_info("[mqtt] brocker connected successfully.");
 
 	return 0;
 }
 
-int mqtt_publish(const char* mode, char* topic, const char* value) 
+/* reads exactly count bytes of the packet the broker is sending */
+static int receive(unsigned char* buf, int count)
+{
+	int got = 0;
+	while (got < count) {
+		int rc = (int)recv(sock, buf + got, count - got, 0);
+		if(rc <= 0) {
+			return -1;
+		}
+		got += rc;
+	}
+	return got;
+}
+
+static void lost(const char* why)
+{
+	pthread_mutex_lock(&sending);
+	if(connected) {
+		connected = 0;
+		log_warn("[mqtt] connection to the brocker lost (%s).", why);
+	}
+	pthread_mutex_unlock(&sending);
+}
+
+/* waits up to timeout ms for a packet from the broker and handles it */
+static void mqtt_receive(int timeout)
+{
+	struct pollfd p = { sock, POLLIN, 0 };
+	if(poll(&p, 1, timeout) <= 0) {
+		return;
+	}
+
+	int type = MQTTPacket_read(inbuf, sizeof(inbuf), receive);
+	switch(type) {
+		case PUBLISH : {
+			unsigned char dup, retained;
+			unsigned short id;
+			int qos, payloadlen;
+			unsigned char* payload;
+			MQTTString topic;
+			if(MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic, &payload, &payloadlen, inbuf, sizeof(inbuf)) != 1) {
+				lost("invalid PUBLISH");
+				break;
+			}
+			/* a retained command is an old one */
+			if(retained) {
+				log_warn("[mqtt] retained command on %.*s ignored.", topic.lenstring.len, topic.lenstring.data);
+				break;
+			}
+			/* our own answers are never commands */
+			if(topic.lenstring.len == (int)strlen(g_config->commandResponseTopic) &&
+			   !memcmp(topic.lenstring.data, g_config->commandResponseTopic, topic.lenstring.len)) {
+				break;
+			}
+			command_submit(COMMAND_MQTT, 0, (const char*)payload, payloadlen);
+		}
+		break;
+		case SUBACK : {
+			unsigned short id;
+			int count = 0;
+			int granted[UAMQ_MAX_COMMAND_TOPICS];
+			MQTTDeserialize_suback(&id, UAMQ_MAX_COMMAND_TOPICS, &count, granted, inbuf, sizeof(inbuf));
+			for (int i = 0; i < count; i++) {
+				if(granted[i] == 0x80) {
+					log_warn("[mqtt] subscription to %s refused.", g_config->commandTopics[i]);
+				} else {
+					log_info("[mqtt] subscribed to %s.", g_config->commandTopics[i]);
+				}
+			}
+		}
+		break;
+		case PINGRESP :
+		break;
+		default : {
+			lost(type < 0 ? "read failed" : "unexpected packet");
+		}
+		break;
+	}
+}
+
+static int mqtt_send(char* topic, const unsigned char* payload, int payloadlen, unsigned char retained)
 {
-	printf("[mqtt] publish (%s) %s\t%s \n", mode, topic, value);
-	
 	MQTTString topicString = MQTTString_initializer;
-	
-	unsigned char buf[200] = {0, };
-	int buflen = sizeof(buf);
+
+	unsigned char small[512];
+	unsigned char* buf = small;
+	int buflen = payloadlen + (int)strlen(topic) + 16;
 	int len = 0;
 
+	if(buflen > (int)sizeof(small)) {
+		buf = (unsigned char*)malloc(buflen);
+		if(!buf) {
+			return -1;
+		}
+	} else {
+		buflen = sizeof(small);
+	}
+
 	topicString.cstring = topic;
 #pragma GCC diagnostic push  // require GCC 4.6
 #pragma GCC diagnostic ignored "-Wcast-qual"
-	len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)value, strlen(value));
+	len = MQTTSerialize_publish(buf, buflen, 0, 0, retained, 0, topicString, (unsigned char*)payload, payloadlen);
 #pragma GCC diagnostic pop 
-	int rc = transport_sendPacketBuffer(sock, buf, len);
+
+	int rc = -1;
+	pthread_mutex_lock(&sending);
+	if(connected && len > 0) {
+		rc = transport_sendPacketBuffer(sock, buf, len);
+		lastSent = time(NULL);
+		if(rc < 0) {
+			/* mqtt_main reconnects, messages are dropped until then */
+			connected = 0;
+			log_warn("[mqtt] connection to the brocker lost.");
+		}
+	}
+	pthread_mutex_unlock(&sending);
+
+	if(buf != small) {
+		free(buf);
+	}
+
+	return rc;
+}
+
+static void counted(int rc)
+{
+	if(rc < 0) {
+		metrics_add(dropped, 1);
+		return;
+	}
+	metrics_add(published, 1);
+	metrics_add(bytes, (uint64_t)rc);
+}
+
+/* bytes the kernel has not sent yet */
+static long queued(void* arg)
+{
+	int n = 0;
+	if(sock <= 0 || ioctl(sock, TIOCOUTQ, &n) != 0) {
+		return 0;
+	}
+	return n;
+}
+
+int mqtt_topic_matches(const char* filter, const char* topic)
+{
+	for (;;) {
+		if(filter[0] == '#' && filter[1] == '\0') {
+			return 1;
+		}
+
+		/* one level, '+' takes it whole */
+		if(filter[0] == '+' && (filter[1] == '/' || filter[1] == '\0')) {
+			filter++;
+			while (*topic && *topic != '/') {
+				topic++;
+			}
+		} else {
+			while (*filter && *filter != '/' && *filter == *topic) {
+				filter++;
+				topic++;
+			}
+			if((*filter && *filter != '/') || (*topic && *topic != '/')) {
+				return 0;
+			}
+		}
+
+		if(!*filter) {
+			return !*topic;
+		}
+		if(!*topic) {
+			/* "a/#" matches "a" as well */
+			return filter[1] == '#' && filter[2] == '\0';
+		}
+		filter++;
+		topic++;
+	}
+}
+
+int mqtt_publish(const char* mode, char* topic, const char* value) 
+{
+	log_debug("[mqtt] publish (%s) %s\t%s", mode, topic, value);
+
+	unsigned char* frame = NULL;
+	unsigned int id = 0;
+	int len = codec_take_dictionary(codec, &frame, &id);
+	if(len > 0) {
+		/* retained, so that consumers joining later can decode */
+		char dtopic[128];
+		snprintf(dtopic, sizeof(dtopic), "%s/%s/$dictionary/%u", g_config->topicBase, g_config->deviceID, id);
+		if(mqtt_send(dtopic, frame, len, 1) >= 0) {
+			codec_dictionary_sent(codec, id);
+		}
+	}
+
+	int rc = 0;
+	len = codec_encode(codec, (const unsigned char*)value, (int)strlen(value), &frame);
+	if(len > 0) {
+		rc = mqtt_send(topic, frame, len, 0);
+	} else {
+		rc = mqtt_send(topic, (const unsigned char*)value, (int)strlen(value), 0);
+	}
+	counted(rc);
+	if(rc < 0) {
+		log_warn("[mqtt] publish (%s) %s ==> FAILED", mode, topic);
+	}
 
 	return rc;
 }
@@ -106,61 +360,76 @@ int mqtt_main(int argc, char *argv[])
 		return 0;
 	}
 
-	do {
-		rc = mqtt_connect(argc, argv);
-	} while(!beStop && rc < 0 );
+	codec = codec_new(&g_config->mqttCompression, "mqtt");
 
+	published = metrics_series(METRIC_PUBLISHED, "sink=\"mqtt\"");
+	bytes = metrics_series(METRIC_PUBLISHED_BYTES, "sink=\"mqtt\"");
+	dropped = metrics_series(METRIC_DROPPED, "sink=\"mqtt\"");
+	metrics_gauge(METRIC_QUEUED_BYTES, "sink=\"mqtt\"", queued, NULL);
 
-	MQTTString topicString = MQTTString_initializer;
-	unsigned char buf[256];
+	unsigned char buf[16];
 	int buflen = sizeof(buf);
-	
-	char* payload = "hello";
-	int payloadlen = strlen(payload);
 	int len = 0;
 
-	topicString.cstring = "sensor";
+	useconds_t backoff = BACKOFF_MIN;
 	while (!beStop)
 	{
-		#if 0
-		printf("1\n");
-		if (MQTTPacket_read(buf, buflen, transport_getdata) == PUBLISH)
-		{
-			printf("2\n");
-			unsigned char dup;
-			int qos;
-			unsigned char retained;
-			unsigned short msgid;
-			int payloadlen_in;
-			unsigned char* payload_in;
-			int rc;
-			MQTTString receivedTopic;
+		if(connected) {
+			mqtt_receive(100);
+
+			pthread_mutex_lock(&sending);
+			if(connected && time(NULL) - lastSent >= KEEPALIVE / 2) {
+				len = MQTTSerialize_pingreq(buf, buflen);
+				if(transport_sendPacketBuffer(sock, buf, len) != len) {
+					connected = 0;
+					log_warn("[mqtt] connection to the brocker lost.");
+				}
+				lastSent = time(NULL);
+			}
+			pthread_mutex_unlock(&sending);
+			continue;
+		}
 
-			printf("3\n");
+		pthread_mutex_lock(&sending);
+		if(sock > 0) {
+			transport_close(sock);
+			sock = 0;
+		}
+		pthread_mutex_unlock(&sending);
 
-			rc = MQTTDeserialize_publish(&dup, &qos, &retained, &msgid, &receivedTopic, &payload_in, &payloadlen_in, buf, buflen);
-			printf("message arrived %.*s\n", payloadlen_in, payload_in);
-			usleep(500000);
+		if(mqtt_connect(argc, argv) == 0) {
+			backoff = BACKOFF_MIN;
+			continue;
 		}
-		#endif
-		sleep(3);
 
-		// printf("publish: %s --> %s\n", topicString.cstring, payload);
-		// len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)payload, payloadlen);
-		// rc = transport_sendPacketBuffer(sock, buf, len);
+		usleep(backoff);
+		backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
 	}
 
-	printf("disconnecting\n");
-	len = MQTTSerialize_disconnect(buf, buflen);
-	rc = transport_sendPacketBuffer(sock, buf, len);
-
-exit:
-	transport_close(sock);
+	pthread_mutex_lock(&sending);
+	if(connected) {
+		log_info("[mqtt] disconnecting.");
+		len = MQTTSerialize_disconnect(buf, buflen);
+		rc = transport_sendPacketBuffer(sock, buf, len);
+		connected = 0;
+	}
+	if(sock > 0) {
+		transport_close(sock);
+		sock = 0;
+	}
+	pthread_mutex_unlock(&sending);
 
 	return 0;
 }
 
+int mqtt_ready(void)
+{
+	return connected;
+}
+
 void* mqtt_run(void* param)
 {
+	rt_thread(UAMQ_ROLE_MQTT, -1, "mqtt");
+	rt_prefault(inbuf, sizeof(inbuf));
 	return (void*)mqtt_main(0, 0);
 }
@@ -14,63 +14,63 @@
 # include <stdlib.h>
 #endif
 
-#include <iostream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <algorithm>
-#include <iterator>
+#include <errno.h>
+
 #include <map>
+#include <vector>
 using namespace std;
 
 #include "client-common.h"
 #include "client-nodemap.h"
 #include "client-nodeid.h"
 
-extern map<int, Group>* gmap;
-
-template<typename Out>
-void split(const std::string &s, char delim, Out result) {
-    std::stringstream ss;
-    ss.str(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        *(result++) = item;
+/* a decimal number without sign or blanks that fits max */
+static bool parse_number(const char* p, char** end, unsigned long max, unsigned long* out)
+{
+    if(*p < '0' || *p > '9') {
+        return false;
     }
-}
 
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    split(s, delim, std::back_inserter(elems));
-    return elems;
+    errno = 0;
+    *out = strtoul(p, end, 10);
+    return errno == 0 && *out <= max;
 }
 
-UA_NodeIdType getUA_NodeID(char* id, UA_NodeId* ua)
+/* parses "ns=<n>;i=<n>" and "ns=<n>;s=<string>", the namespace is optional.
+ * everything after "s=" belongs to the identifier, ';' included. guid and
+ * opaque ids are not supported. ua is left empty if the id is invalid. */
+UA_StatusCode getUA_NodeID(const char* id, UA_NodeId* ua)
 {
-    string s(id);
-    vector<string> x = split(s, ';');
+    const char* p = id;
+    char* end = NULL;
+    unsigned long n = 0;
 
-    for(int i = 0; i < (int)x.size(); i++) {
+    UA_NodeId_init(ua);
 
-        vector<string> y = split(x[i], '=');
-        for(int j = 0; j < (int)x.size(); j++) {
+    if(!strncmp(p, "ns=", 3)) {
+        if(!parse_number(p + 3, &end, UA_UINT16_MAX, &n) || *end != ';') {
+            return UA_STATUSCODE_BADNODEIDINVALID;
+        }
+        ua->namespaceIndex = (UA_UInt16)n;
+        p = end + 1;
+    }
 
-            if(y[j].compare(string("ns")) == 0) {
-                ua->namespaceIndex = atoi(y[j+1].c_str());
-                continue;
-            }
-            else if(y[j].compare(string("i")) == 0) {
-                ua->identifierType = UA_NODEIDTYPE_NUMERIC;
-                ua->identifier.numeric = atoi(y[j+1].c_str());
-                break;
-            }
-            else if(y[j].compare(string("s")) == 0) {
-                ua->identifierType = UA_NODEIDTYPE_STRING;
-                ua->identifier.string = UA_STRING_ALLOC(y[j+1].c_str());
-                break;
-            }
+    if(!strncmp(p, "i=", 2)) {
+        if(!parse_number(p + 2, &end, UA_UINT32_MAX, &n) || *end != '\0') {
+            UA_NodeId_init(ua);
+            return UA_STATUSCODE_BADNODEIDINVALID;
         }
+        ua->identifierType = UA_NODEIDTYPE_NUMERIC;
+        ua->identifier.numeric = (UA_UInt32)n;
+        return UA_STATUSCODE_GOOD;
     }
 
-    return ua->identifierType;
-}
\ No newline at end of file
+    if(!strncmp(p, "s=", 2) && p[2] != '\0') {
+        ua->identifierType = UA_NODEIDTYPE_STRING;
+        ua->identifier.string = UA_STRING_ALLOC(p + 2);
+        return ua->identifier.string.data ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+
+    UA_NodeId_init(ua);
+    return UA_STATUSCODE_BADNODEIDINVALID;
+}
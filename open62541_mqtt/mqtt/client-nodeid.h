@@ -20,7 +20,7 @@ extern "C" {
 # include <stdlib.h>
 #endif
 
-UA_NodeIdType getUA_NodeID(char*, UA_NodeId*);
+UA_StatusCode getUA_NodeID(const char*, UA_NodeId*);
 
 
 #ifdef __cplusplus
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <map>
+#include <vector>
+#include <unordered_set>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -20,8 +24,6 @@ extern "C" {
 # include <stdlib.h>
 #endif
 
-#include <map>
-
 struct Group;
 
 typedef struct Node {
@@ -33,18 +35,48 @@ typedef struct Node {
 } Node;
 
 typedef struct Group {
+	char* key;		/* name, unique across the node-map and stable across reloads */
 	char* name;
 	char* method;
 	char* topic;
 	char* format;
+	char* server;
+	int endpoint;	/* index of the server in the configuration */
 	int intervalUSec;
 	bool mqtt;
 	bool amqp;
 	bool tcp;
 	bool enable;
-	map<int, Node> nodes;
+	vector<Node> nodes;
+	int rtt;		/* metric series of the group */
+	int latency;
+	int serverLatency;
+	int failures;
 } Group;
 
+/*
+ * Read-only strings of a node-map. Every distinct string is stored once, in
+ * large blocks that are freed together with the node-map; topics and aliases
+ * repeat a lot on big sites.
+ */
+struct StringsHash {
+	size_t operator()(const char* s) const;
+};
+
+struct StringsEqual {
+	bool operator()(const char* a, const char* b) const { return strcmp(a, b) == 0; }
+};
+
+typedef struct Strings {
+	vector<char*> blocks;
+	size_t used;
+	size_t size;
+	unordered_set<const char*, StringsHash, StringsEqual> index;
+} Strings;
+
+char* strings_intern(Strings* s, const char* str);
+void strings_clear(Strings* s);
+
 enum enumMonitorMode { 
 	enumEvent, 
 	enumPoll
@@ -0,0 +1,180 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-reader.h"
+
+#define RETRY_MIN_USEC 1000000
+#define RETRY_MAX_USEC 300000000
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void reader_init(GroupReader* r)
+{
+	memset(r, 0, sizeof(GroupReader));
+	r->endpoint = -1;
+	r->backoff = RETRY_MIN_USEC;
+	UA_ReadRequest_init(&r->request);
+}
+
+static void unregister(GroupReader* r, UAMQ_Endpoint* ep)
+{
+	/* registrations end with the session anyway */
+	if(!r->registered || r->endpoint != ep->index || r->session != ep->session) {
+		return;
+	}
+
+	UA_UnregisterNodesRequest req;
+	UA_UnregisterNodesRequest_init(&req);
+	req.nodesToUnregister = r->ids;
+	req.nodesToUnregisterSize = r->size;
+
+	UA_UnregisterNodesResponse resp = UA_Client_Service_unregisterNodes(ep->client, req);
+	UA_UnregisterNodesResponse_deleteMembers(&resp);
+}
+
+void reader_clear(GroupReader* r, UAMQ_Endpoint* ep)
+{
+	if(ep) {
+		unregister(r, ep);
+	}
+
+	UA_Array_delete(r->ids, r->size, &UA_TYPES[UA_TYPES_NODEID]);
+	free(r->nodes);
+	reader_init(r);
+}
+
+void reader_invalidate(GroupReader* r)
+{
+	/* the configured ids are read as they are, registering again can't help */
+	if(!r->registered || r->retryAt) {
+		return;
+	}
+
+	r->retryAt = now_usec() + r->backoff;
+	r->backoff = r->backoff * 2 > RETRY_MAX_USEC ? RETRY_MAX_USEC : r->backoff * 2;
+}
+
+bool reader_prepare(GroupReader* r, UAMQ_Endpoint* ep, Group* p, unsigned long generation)
+{
+	unsigned long session = ep->session;
+	bool same = r->generation == generation && r->endpoint == ep->index && r->session == session;
+
+	if(same && (!r->retryAt || now_usec() < r->retryAt)) {
+		return true;
+	}
+	/* the backoff only grows while nothing else changes */
+	uint64_t backoff = same ? r->backoff : RETRY_MIN_USEC;
+
+	/* ids registered with another server are not ours to unregister */
+	reader_clear(r, r->endpoint == ep->index ? ep : NULL);
+
+	size_t size = p->nodes.size();
+	UA_NodeId* ids = (UA_NodeId*)calloc(size ? size : 1, sizeof(UA_NodeId));
+	if(!ids) {
+		return false;
+	}
+	for (size_t i = 0; i < size; i++) {
+		ids[i] = p->nodes[i].ua;
+	}
+
+	UA_RegisterNodesRequest req;
+	UA_RegisterNodesRequest_init(&req);
+	req.nodesToRegister = ids;
+	req.nodesToRegisterSize = size;
+
+	UA_RegisterNodesResponse resp = UA_Client_Service_registerNodes(ep->client, req);
+	UA_StatusCode retval = resp.responseHeader.serviceResult;
+
+	if(size > 0 && retval == UA_STATUSCODE_GOOD && resp.registeredNodeIdsSize == size) {
+		r->ids = resp.registeredNodeIds;
+		resp.registeredNodeIds = NULL;
+		resp.registeredNodeIdsSize = 0;
+		r->registered = true;
+	} else {
+		/* read with the ids from the node-map meanwhile */
+		r->ids = (UA_NodeId*)UA_Array_new(size, &UA_TYPES[UA_TYPES_NODEID]);
+		for (size_t i = 0; r->ids && i < size; i++) {
+			UA_NodeId_copy(&p->nodes[i].ua, &r->ids[i]);
+		}
+		r->registered = false;
+
+		/* a server without the service is not asked again in this session,
+		 * other failures may pass */
+		if(size > 0 && retval != UA_STATUSCODE_BADSERVICEUNSUPPORTED) {
+			r->retryAt = now_usec() + backoff;
+			backoff = backoff * 2 > RETRY_MAX_USEC ? RETRY_MAX_USEC : backoff * 2;
+		}
+	}
+	UA_RegisterNodesResponse_deleteMembers(&resp);
+
+	/* the ids were borrowed from the node-map */
+	free(ids);
+
+	if(!r->ids) {
+		reader_clear(r, NULL);
+		return false;
+	}
+
+	r->size = size;
+	r->nodes = (UA_ReadValueId*)calloc(size ? size : 1, sizeof(UA_ReadValueId));
+	if(!r->nodes) {
+		r->endpoint = ep->index;
+		r->session = session;
+		reader_clear(r, ep);
+		return false;
+	}
+	for (size_t i = 0; i < size; i++) {
+		UA_ReadValueId_init(&r->nodes[i]);
+		r->nodes[i].nodeId = r->ids[i];
+		r->nodes[i].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+
+	UA_ReadRequest_init(&r->request);
+	r->request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+	r->request.nodesToRead = r->nodes;
+	r->request.nodesToReadSize = size;
+
+	r->generation = generation;
+	r->endpoint = ep->index;
+	r->session = session;
+	r->backoff = backoff;
+	return true;
+}
+
+UA_ReadResponse reader_read(GroupReader* r, UAMQ_Endpoint* ep)
+{
+	UA_ReadResponse resp = UA_Client_Service_read(ep->client, r->request);
+
+	if(resp.responseHeader.serviceResult == UA_STATUSCODE_GOOD && resp.resultsSize != r->size) {
+		resp.responseHeader.serviceResult = UA_STATUSCODE_BADUNEXPECTEDERROR;
+	}
+
+	return resp;
+}
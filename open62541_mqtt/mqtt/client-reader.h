@@ -0,0 +1,52 @@
+#ifndef OPCUA_MQTT_BRIDGE_READER_H_
+#define OPCUA_MQTT_BRIDGE_READER_H_
+
+#pragma once
+
+#include "client-nodemap.h"
+#include "client-config.h"
+
+/*
+ * The Read request of a poll group, built once and sent every cycle. The
+ * nodes are registered with RegisterNodes first, servers answer with ids
+ * that are cheaper to encode and to look up (e.g. numeric aliases for long
+ * string ids). Registered ids are only valid in the session they were
+ * registered in, so the request is rebuilt after a reconnect and when the
+ * group changes on a node-map reload or moves to another server. Servers
+ * without RegisterNodes are read with the configured ids.
+ *
+ * A server that reports a registered id as unknown may have dropped the
+ * registration, the nodes are registered again after a backoff that doubles
+ * up to RETRY_MAX_USEC while the group, the server and the session stay the
+ * same. A node that is really gone is not re-registered every cycle. A
+ * RegisterNodes that fails for other reasons than a missing service is
+ * retried with the same backoff, the configured ids are read meanwhile.
+ */
+typedef struct GroupReader {
+	unsigned long generation;	/* topology the request was built from, 0 = none */
+	int endpoint;				/* server the ids were registered with, -1 = none */
+	unsigned long session;		/* session the ids were registered in */
+	bool registered;
+	uint64_t retryAt;			/* register again from then on (monotonic us), 0 = no */
+	uint64_t backoff;			/* usec until the next retry */
+	UA_NodeId* ids;
+	size_t size;
+	UA_ReadValueId* nodes;
+	UA_ReadRequest request;
+} GroupReader;
+
+void reader_init(GroupReader* r);
+/* NULL leaves the registrations to the end of the session */
+void reader_clear(GroupReader* r, UAMQ_Endpoint* ep);
+
+/* rebuilds the request when the group, the server or the session changed,
+ * false when it could not be built (out of memory) */
+bool reader_prepare(GroupReader* r, UAMQ_Endpoint* ep, Group* p, unsigned long generation);
+
+/* registers the nodes again once the backoff has passed */
+void reader_invalidate(GroupReader* r);
+
+/* reads all nodes of the group, results are in node order */
+UA_ReadResponse reader_read(GroupReader* r, UAMQ_Endpoint* ep);
+
+#endif /* OPCUA_MQTT_BRIDGE_READER_H_ */
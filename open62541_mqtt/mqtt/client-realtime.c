@@ -0,0 +1,211 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "client-config.h"
+#include "client-realtime.h"
+#include "client-log.h"
+
+extern UAMQ_Configuration* g_config;
+
+#define PAGE 4096
+#define STACK_PREFAULT (64 * 1024)
+
+static const char* roles[UAMQ_ROLES] = { "main", "poll", "opcua", "mqtt", "tcp", "command", "metrics", "log" };
+
+int rt_role_of(const char* name)
+{
+	for (int i = 0; i < UAMQ_ROLES; i++) {
+		if(!strcmp(roles[i], name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int prefaulting(void)
+{
+	return g_config->lockMemory || g_config->prefaultKB > 0;
+}
+
+void rt_prefault(void* buf, size_t len)
+{
+	if(!prefaulting()) {
+		return;
+	}
+
+	/* a write faults the page in, the contents stay */
+	volatile unsigned char* p = (volatile unsigned char*)buf;
+	for (size_t i = 0; i < len; i += PAGE) {
+		p[i] = p[i];
+	}
+}
+
+static void __attribute__((noinline)) prefault_stack(void)
+{
+	volatile unsigned char stack[STACK_PREFAULT];
+	for (size_t i = 0; i < sizeof(stack); i += PAGE) {
+		stack[i] = 0;
+	}
+}
+
+/* "0-3,6" */
+static void cpus_text(const cpu_set_t* set, char* out, size_t size)
+{
+	size_t n = 0;
+	out[0] = 0;
+	for (int c = 0; c < CPU_SETSIZE && n < size; c++) {
+		if(!CPU_ISSET(c, set)) {
+			continue;
+		}
+		int last = c;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+			last++;
+		}
+		int w = last > c ? snprintf(out + n, size - n, "%s%d-%d", n ? "," : "", c, last)
+						 : snprintf(out + n, size - n, "%s%d", n ? "," : "", c);
+		n += w > 0 ? (size_t)w : 0;
+		c = last;
+	}
+}
+
+/* the placement the thread really got */
+static void report(const char* name)
+{
+	cpu_set_t set;
+	char cpus[128] = "?";
+	CPU_ZERO(&set);
+	if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+		cpus_text(&set, cpus, sizeof(cpus));
+	}
+
+	int policy = SCHED_OTHER;
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	pthread_getschedparam(pthread_self(), &policy, &sp);
+
+	if(policy == SCHED_FIFO) {
+		log_info("[rt] %s: cpus %s, SCHED_FIFO %d.", name, cpus, sp.sched_priority);
+	} else {
+		log_info("[rt] %s: cpus %s, normal scheduling.", name, cpus);
+	}
+}
+
+void rt_thread(int role, int cpu, const char* name)
+{
+	UAMQ_Placement* p = &g_config->placement[role];
+
+	if(p->cpus || cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if(p->cpus) {
+			for (int c = 0; c < 64; c++) {
+				if(p->cpus & (1ULL << c)) {
+					CPU_SET(c, &set);
+				}
+			}
+		} else {
+			CPU_SET(cpu, &set);
+		}
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			char cpus[128];
+			cpus_text(&set, cpus, sizeof(cpus));
+			log_warn("[rt] %s: can't run on cpus %s.", name, cpus);
+		}
+	}
+
+	/* threads inherit SCHED_FIFO of the main thread, a role without a priority gives it up */
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	int policy = SCHED_OTHER;
+	pthread_getschedparam(pthread_self(), &policy, &sp);
+
+	if(p->priority > 0) {
+		sp.sched_priority = p->priority;
+		int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if(rc != 0) {
+			log_warn("[rt] %s: no SCHED_FIFO %d (%s), needs CAP_SYS_NICE or RLIMIT_RTPRIO.", name, p->priority, strerror(rc));
+		}
+	} else if(role != UAMQ_ROLE_MAIN && policy != SCHED_OTHER) {
+		sp.sched_priority = 0;
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+	}
+
+	if(prefaulting()) {
+		prefault_stack();
+	}
+
+	report(name);
+}
+
+/* VmLck of /proc/self/status, -1 if it can't be read */
+static long locked_kb(void)
+{
+	FILE* f = fopen("/proc/self/status", "r");
+	if(!f) {
+		return -1;
+	}
+	char line[256];
+	long kb = -1;
+	while (fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "VmLck: %ld kB", &kb) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+	return kb;
+}
+
+void rt_process(void)
+{
+	if(g_config->stackKB > 0) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		int rc = pthread_attr_setstacksize(&attr, (size_t)g_config->stackKB * 1024);
+		if(rc == 0) {
+			rc = pthread_setattr_default_np(&attr);
+		}
+		if(rc != 0) {
+			log_warn("[rt] thread stacks of %d KB not set (%s).", g_config->stackKB, strerror(rc));
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	if(prefaulting()) {
+		/* freed memory stays with the process, faulted in and locked */
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+	}
+
+	if(g_config->lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		log_warn("[rt] memory not locked (%s), needs CAP_IPC_LOCK or RLIMIT_MEMLOCK.", strerror(errno));
+	}
+
+	if(g_config->prefaultKB > 0) {
+		size_t len = (size_t)g_config->prefaultKB * 1024;
+		volatile unsigned char* heap = (volatile unsigned char*)malloc(len);
+		if(heap) {
+			/* volatile, a memset before the free would be optimized out */
+			for (size_t i = 0; i < len; i += PAGE) {
+				heap[i] = 0;
+			}
+			free((void*)(uintptr_t)heap);
+		}
+	}
+
+	if(prefaulting()) {
+		log_info("[rt] memory: %ld KB locked, %d KB heap prefaulted, thread stacks %d KB.", locked_kb(),
+			g_config->prefaultKB, g_config->stackKB);
+	}
+
+	rt_thread(UAMQ_ROLE_MAIN, -1, "main");
+}
@@ -0,0 +1,52 @@
+#ifndef OPCUA_MQTT_BRIDGE_REALTIME_H_
+#define OPCUA_MQTT_BRIDGE_REALTIME_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * Placement of the threads and the memory of the bridge, from the optional
+ * "realtime" block in server-configuration:
+ *
+ *   "realtime": {
+ *       "lockMemory": true, "prefaultKB": 8192, "stackKB": 512,
+ *       "threads": {
+ *           "main": { "cpu": 0 },
+ *           "poll": { "cpu": [2, 3], "priority": 80 },
+ *           "opcua": { "cpu": 2, "priority": 70 },
+ *           "mqtt": { "cpu": 3, "priority": 60 }
+ *       }
+ *   }
+ *
+ * A role without "cpu" keeps the cores it inherits from the main thread;
+ * connection workers and poll groups then run on the "cpu" of their server.
+ * A priority above 0 runs the threads of the role with SCHED_FIFO. Every
+ * thread reports the placement it got, settings the system refuses are
+ * reported and skipped.
+ */
+
+/* the role of a name in "threads", -1 for an unknown name */
+int rt_role_of(const char* name);
+
+/* applies the memory settings and places the main thread, before the other threads start */
+void rt_process(void);
+
+/*
+ * places the calling thread: on the cores of its role, else on cpu when it
+ * is >= 0, with the priority of the role; then touches its stack
+ */
+void rt_thread(int role, int cpu, const char* name);
+
+/* touches the pages of a buffer, so the first use doesn't fault */
+void rt_prefault(void* buf, size_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_REALTIME_H_ */
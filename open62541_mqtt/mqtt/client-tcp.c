@@ -19,12 +19,32 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
 
 #include "MQTTPacket.h"
 #include "client-config.h"
 #include "client-trans-tcp.h"
+#include "client-compress.h"
+#include "client-metrics.h"
+#include "client-log.h"
+#include "client-realtime.h"
 
 static int sock = 0;
+static UAMQ_Codec* codec = NULL;
+
+/* publishers of all groups share the connection, a frame is written whole */
+static pthread_mutex_t sending = PTHREAD_MUTEX_INITIALIZER;
+static volatile int connected = 0;
+
+/* reconnect backoff, doubled up to the limit while the receiver is away */
+#define BACKOFF_MIN 100000
+#define BACKOFF_MAX 5000000
+
+/* metric series, registered before the connect */
+static int published = -1;
+static int bytes = -1;
+static int dropped = -1;
 
 extern int beStop;
 extern UAMQ_Configuration* g_config;
@@ -34,27 +54,87 @@ int tcp_connect(int argc, char *argv[])
 	char* host = g_config->tcpBrockerIP;
 	int port = g_config->tcpBrockerPORT;
 	
-	sock = tcp_open(host, port);
-	if(sock < 0) {
-		return sock;
+	int fd = tcp_open(host, port);
+	if(fd < 0) {
+		return fd;
 	}
 
+	/* the receiver may be a new one, it gets the dictionary first */
+	codec_dictionary_lost(codec);
+
+	pthread_mutex_lock(&sending);
+	sock = fd;
+	connected = 1;
+	pthread_mutex_unlock(&sending);
+
+	log_info("[tcp] connected to %s:%d.", host, port);
+
 	return 0;
 }
 
-int tcp_publish(const char* mode, char* topic, const char* value) 
+static int send_frame(unsigned char* frame, int len)
 {
-	printf("[tcp] publish (%s) %s\t%s ", mode, topic, value);
+	int rc = -1;
+	pthread_mutex_lock(&sending);
+	if(connected) {
+		rc = tcp_sendPacketBuffer(sock, frame, len);
+		if(rc != len) {
+			/* tcp_main reconnects, messages are dropped until then */
+			rc = -1;
+			connected = 0;
+			log_warn("[tcp] connection to the receiver lost.");
+		}
+	}
+	pthread_mutex_unlock(&sending);
+	return rc;
+}
+
+static void counted(int rc)
+{
+	if(rc < 0) {
+		metrics_add(dropped, 1);
+		return;
+	}
+	metrics_add(published, 1);
+	metrics_add(bytes, (uint64_t)rc);
+}
 
+/* bytes the kernel has not sent yet */
+static long queued(void* arg)
+{
+	int n = 0;
+	if(sock <= 0 || ioctl(sock, TIOCOUTQ, &n) != 0) {
+		return 0;
+	}
+	return n;
+}
+
+int tcp_publish(const char* mode, char* topic, const char* value) 
+{
 #pragma GCC diagnostic push  // require GCC 4.6
 #pragma GCC diagnostic ignored "-Wcast-qual"
 
-	int rc = tcp_sendPacketBuffer(sock, (unsigned char*)value, strlen(value));
+	unsigned char* frame = NULL;
+	unsigned int id = 0;
+	int len = codec_take_dictionary(codec, &frame, &id);
+	if(len > 0 && send_frame(frame, len) >= 0) {
+		codec_dictionary_sent(codec, id);
+	}
+
+	int rc = 0;
+	len = codec_encode(codec, (const unsigned char*)value, (int)strlen(value), &frame);
+	if(len > 0) {
+		rc = send_frame(frame, len);
+	} else {
+		rc = send_frame((unsigned char*)value, (int)strlen(value));
+	}
 
 	if(rc < 0) {
-		printf(" ==> FAILED");
+		log_warn("[tcp] publish (%s) %s ==> FAILED", mode, topic);
+	} else {
+		log_debug("[tcp] publish (%s) %s\t%s", mode, topic, value);
 	}
-	printf("\n");
+	counted(rc);
 
 	return rc;
 
@@ -69,25 +149,57 @@ int tcp_main(int argc, char *argv[])
 		return 0;
 	}
 
-	printf("\n[tcp] start publisher connection.\n");
+	codec = codec_new(&g_config->tcpCompression, "tcp");
 
-	do {
-		rc = tcp_connect(argc, argv);
-	} while(!beStop && rc < 0 );
+	published = metrics_series(METRIC_PUBLISHED, "sink=\"tcp\"");
+	bytes = metrics_series(METRIC_PUBLISHED_BYTES, "sink=\"tcp\"");
+	dropped = metrics_series(METRIC_DROPPED, "sink=\"tcp\"");
+	metrics_gauge(METRIC_QUEUED_BYTES, "sink=\"tcp\"", queued, NULL);
+
+	printf("\n[tcp] start publisher connection.\n");
 
-	printf("[tcp] start publisher message loop.\n");
+	useconds_t backoff = BACKOFF_MIN;
 	while (!beStop)
 	{
-		sleep(5);
+		if(connected) {
+			usleep(100000);
+			continue;
+		}
+
+		pthread_mutex_lock(&sending);
+		if(sock > 0) {
+			tcp_close(sock);
+			sock = 0;
+		}
+		pthread_mutex_unlock(&sending);
+
+		if(tcp_connect(argc, argv) == 0) {
+			backoff = BACKOFF_MIN;
+			continue;
+		}
+
+		usleep(backoff);
+		backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
 	}
 
-exit:
-	tcp_close(sock);
+	pthread_mutex_lock(&sending);
+	connected = 0;
+	if(sock > 0) {
+		tcp_close(sock);
+		sock = 0;
+	}
+	pthread_mutex_unlock(&sending);
 
 	return 0;
 }
 
+int tcp_ready(void)
+{
+	return connected;
+}
+
 void* tcp_run(void* param)
 {
+	rt_thread(UAMQ_ROLE_TCP, -1, "tcp");
 	return (void*)tcp_main(0, 0);
 }
@@ -0,0 +1,467 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-topology.h"
+#include "client-discovery.h"
+#include "client-metrics.h"
+#include "client-log.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+int make_group(json_object *r, Group* G, Strings* pool, const char* path);
+json_object* read_config(const char* fn);
+
+//===================================================================================================================================================================
+// read side
+
+#define MAX_READERS 256
+
+/* epoch the reader entered its read section in, 0 if outside */
+static atomic<unsigned long> readers[MAX_READERS];
+static atomic<bool> used[MAX_READERS];
+static atomic<unsigned long> epoch(1);
+static atomic<Topology*> current(NULL);
+
+static __thread int slot = -1;
+
+static int reader_slot(void)
+{
+	if(slot >= 0) {
+		return slot;
+	}
+
+	for(int i = 0; i < MAX_READERS; i++) {
+		bool expected = false;
+		if(used[i].compare_exchange_strong(expected, true)) {
+			slot = i;
+			return slot;
+		}
+	}
+
+	printf("[error] more than %d threads read the node-map.\n", MAX_READERS);
+	abort();
+}
+
+void topology_read_begin(void)
+{
+	/* announce the read before loading the pointer; a writer that swaps the
+	 * pointer afterwards sees the announcement and waits for us */
+	readers[reader_slot()].store(epoch.load());
+}
+
+void topology_read_end(void)
+{
+	readers[reader_slot()].store(0, memory_order_release);
+}
+
+Topology* topology_current(void)
+{
+	return current.load();
+}
+
+Group* topology_find(Topology* t, const char* key)
+{
+	map<string, Group*>::iterator i = t->byKey.find(key);
+	return i == t->byKey.end() ? NULL : i->second;
+}
+
+Group* topology_group(const char* key)
+{
+	return topology_find(current.load(), key);
+}
+
+Topology* topology_acquire(void)
+{
+	/* the writer drops the reference of the current topology only after the
+	 * grace period, so it cannot reach 0 while we are in the read section */
+	topology_read_begin();
+	Topology* t = current.load();
+	t->refs.fetch_add(1);
+	topology_read_end();
+	return t;
+}
+
+void topology_release(Topology* t)
+{
+	if(t->refs.fetch_sub(1) == 1) {
+		topology_delete(t);
+	}
+}
+
+void topology_thread_exit(void)
+{
+	if(slot < 0) {
+		return;
+	}
+	readers[slot].store(0);
+	used[slot].store(false);
+	slot = -1;
+}
+
+//===================================================================================================================================================================
+// write side
+
+static pthread_mutex_t writer = PTHREAD_MUTEX_INITIALIZER;
+
+/* waits until every reader has left the read sections that started before
+ * the pointer was swapped */
+static void synchronize(void)
+{
+	unsigned long e = epoch.fetch_add(1) + 1;
+
+	for(int i = 0; i < MAX_READERS; i++) {
+		if(i == slot) {
+			continue;
+		}
+		for(;;) {
+			unsigned long r = readers[i].load();
+			if(r == 0 || r >= e) {
+				break;
+			}
+			usleep(1000);
+		}
+	}
+}
+
+void topology_publish(Topology* t)
+{
+	pthread_mutex_lock(&writer);
+
+	Topology* old = current.load();
+	t->generation = old ? old->generation + 1 : 1;
+	current.store(t);
+
+	if(old) {
+		synchronize();
+		topology_release(old);
+	}
+
+	pthread_mutex_unlock(&writer);
+}
+
+//===================================================================================================================================================================
+
+#define STRINGS_BLOCK (64 * 1024)
+
+size_t StringsHash::operator()(const char* s) const
+{
+	/* FNV-1a */
+	size_t h = 14695981039346656037ULL;
+	for (; *s; s++) {
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	}
+	return h;
+}
+
+char* strings_intern(Strings* s, const char* str)
+{
+	unordered_set<const char*, StringsHash, StringsEqual>::iterator i = s->index.find(str);
+	if(i != s->index.end()) {
+		return const_cast<char*>(*i);
+	}
+
+	size_t len = strlen(str) + 1;
+	if(s->blocks.empty() || s->used + len > s->size) {
+		s->size = len > STRINGS_BLOCK ? len : STRINGS_BLOCK;
+		s->blocks.push_back((char*)malloc(s->size));
+		s->used = 0;
+	}
+
+	char* p = s->blocks.back() + s->used;
+	memcpy(p, str, len);
+	s->used += len;
+
+	s->index.insert(p);
+	return p;
+}
+
+void strings_clear(Strings* s)
+{
+	for (size_t i = 0; i < s->blocks.size(); i++) {
+		free(s->blocks[i]);
+	}
+	s->blocks.clear();
+	s->index.clear();
+	s->used = s->size = 0;
+}
+
+Topology* topology_build(json_object* nodemap)
+{
+	Topology* t = new Topology();
+	t->generation = 0;
+	t->refs.store(1);
+	t->strings.used = t->strings.size = 0;
+
+	int l = nodemap ? json_object_array_length(nodemap) : 0;
+	t->groups.reserve(l);
+
+	for (int i = 0; i < l; i++) {
+		json_object *n = json_object_array_get_idx(nodemap, i);
+
+		char path[32];
+		snprintf(path, sizeof(path), "node-map[%d]", i);
+
+		if(json_object_get_type(n) != json_type_object) {
+			printf("[error] %s: expected an object.\n", path);
+			topology_delete(t);
+			return NULL;
+		}
+
+		t->groups.push_back(Group());
+		Group* g = &t->groups.back();
+		if(make_group(n, g, &t->strings, path) != 0) {
+			topology_delete(t);
+			return NULL;
+		}
+
+		/* group names need not be unique, number the duplicates */
+		string key(g->name);
+		for(int k = 2; t->byKey.count(key); k++) {
+			key = string(g->name) + "#" + to_string(k);
+		}
+		g->key = strings_intern(&t->strings, key.c_str());
+		t->byKey[g->key] = g;
+
+		/* the escaped values, the label names and quotes */
+		char name[256], server[128];
+		char labels[sizeof(name) + sizeof(server) + 32];
+		metrics_label(name, sizeof(name), g->key);
+		metrics_label(server, sizeof(server), g->server);
+		snprintf(labels, sizeof(labels), "group=\"%s\",server=\"%s\"", name, server);
+		g->rtt = metrics_series(METRIC_READ_SECONDS, labels);
+		g->latency = metrics_series(METRIC_LATENCY_SECONDS, labels);
+		g->serverLatency = metrics_series(METRIC_SERVER_LATENCY_SECONDS, labels);
+		g->failures = metrics_series(METRIC_READ_FAILURES, labels);
+	}
+
+	for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
+
+		for (size_t n = 0; n < p->nodes.size(); n++) {
+			Node* d = &p->nodes[n];
+			d->parent = p;
+			/* the id was validated by make_node() */
+			getUA_NodeID(d->id, &d->ua);
+		}
+	}
+
+	return t;
+}
+
+void topology_delete(Topology* t)
+{
+	if(!t) {
+		return;
+	}
+
+	for (size_t i = 0; i < t->groups.size(); i++) {
+		Group* p = &t->groups[i];
+
+		for (size_t n = 0; n < p->nodes.size(); n++) {
+			UA_NodeId_deleteMembers(&p->nodes[n].ua);
+		}
+	}
+
+	strings_clear(&t->strings);
+	delete t;
+}
+
+static bool same_group(const Group* a, const Group* b)
+{
+	if(a->enable != b->enable || a->endpoint != b->endpoint || a->intervalUSec != b->intervalUSec || a->mqtt != b->mqtt ||
+	   a->amqp != b->amqp || a->tcp != b->tcp || a->nodes.size() != b->nodes.size()) {
+		return false;
+	}
+	if(strcmp(a->method, b->method) || strcmp(a->topic, b->topic) || strcmp(a->format, b->format)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < a->nodes.size(); i++) {
+		const Node* m = &a->nodes[i];
+		const Node* n = &b->nodes[i];
+		if(strcmp(m->id, n->id) || strcmp(m->topic, n->topic) || strcmp(m->alias, n->alias)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int topology_reload(void)
+{
+	json_object* jobj = read_config(g_config->configFile);
+	if(!jobj) {
+		log_error("[reload] the file (%s) has invalid json syntax, keeping the current node-map.", g_config->configFile);
+		return -1;
+	}
+
+	json_object* o = NULL;
+	if(!json_object_object_get_ex(jobj, "node-map", &o)) {
+		o = json_object_new_array();
+		json_object_object_add(jobj, "node-map", o);
+	}
+	discovery_append(jobj, o);
+
+	Topology* t = topology_build(o);
+	json_object_put(jobj);
+
+	if(!t) {
+		log_error("[reload] invalid node-map, keeping the current one.");
+		return -1;
+	}
+
+	/* report what changes, only the node-map is reloaded. changes to the
+	 * connections need a restart */
+	int added = 0, removed = 0, changed = 0;
+
+	topology_read_begin();
+	Topology* old = topology_current();
+
+	map<string, Group*>::iterator g;
+	for (g = t->byKey.begin(); g != t->byKey.end(); ++g) {
+		map<string, Group*>::iterator o = old->byKey.find(g->first);
+		if(o == old->byKey.end()) {
+			log_info("[reload] + group \"%s\"", g->first.c_str());
+			added++;
+		} else if(!same_group(o->second, g->second)) {
+			log_info("[reload] ~ group \"%s\"", g->first.c_str());
+			changed++;
+		}
+	}
+	for (g = old->byKey.begin(); g != old->byKey.end(); ++g) {
+		if(!t->byKey.count(g->first)) {
+			log_info("[reload] - group \"%s\"", g->first.c_str());
+			removed++;
+		}
+	}
+	topology_read_end();
+
+	if(!added && !removed && !changed) {
+		log_info("[reload] node-map unchanged.");
+		topology_delete(t);
+		return 0;
+	}
+
+	topology_publish(t);
+
+	/* poll groups pick up the new topology on their next cycle, new groups
+	 * need a thread and monitored items are updated by the publish loop */
+	poll_schedule();
+	monitor_schedule();
+
+	log_info("[reload] node-map generation %lu: %d added, %d removed, %d changed.", t->generation, added, removed, changed);
+
+	return 0;
+}
+
+//===================================================================================================================================================================
+
+static int wakeup[2] = {-1, -1};
+
+void config_watch_signal(void)
+{
+	/* called from the signal handler, write() is async-signal-safe */
+	if(wakeup[1] >= 0) {
+		char c = 'r';
+		ssize_t w = write(wakeup[1], &c, 1);
+		(void)w;
+	}
+}
+
+void* config_watch(void* param)
+{
+	if(pipe(wakeup) != 0) {
+		return NULL;
+	}
+	fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+
+	char dir[256] = {0, };
+	char file[256] = {0, };
+	strncpy(dir, g_config->configFile, sizeof(dir) - 1);
+	strncpy(file, g_config->configFile, sizeof(file) - 1);
+	char* folder = dirname(dir);
+	char* name = basename(file);
+
+	/* watch the folder, editors replace the file rather than writing it */
+	int fd = inotify_init1(IN_NONBLOCK);
+	if(fd >= 0 && inotify_add_watch(fd, folder, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	log_info("[reload] watching %s/%s%s.", folder, name, fd < 0 ? " (SIGHUP only)" : "");
+
+	while (!beStop) {
+		struct pollfd fds[2] = { { wakeup[0], POLLIN, 0 }, { fd, POLLIN, 0 } };
+		if(poll(fds, fd < 0 ? 1 : 2, 1000) <= 0) {
+			continue;
+		}
+
+		bool reload = false;
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+		if(fds[0].revents & POLLIN) {
+			while (read(wakeup[0], buf, sizeof(buf)) > 0);
+			reload = true;
+		}
+
+		if(fd >= 0 && (fds[1].revents & POLLIN)) {
+			ssize_t len;
+			while ((len = read(fd, buf, sizeof(buf))) > 0) {
+				for (char* p = buf; p < buf + len; ) {
+					struct inotify_event* e = (struct inotify_event*)p;
+					if(e->len && !strcmp(e->name, name)) {
+						reload = true;
+					}
+					p += sizeof(struct inotify_event) + e->len;
+				}
+			}
+		}
+
+		if(reload) {
+			/* let the writer finish and coalesce bursts of events */
+			usleep(200000);
+			while (read(wakeup[0], buf, sizeof(buf)) > 0);
+			while (fd >= 0 && read(fd, buf, sizeof(buf)) > 0);
+
+			log_info("[reload] reloading node-map from %s.", g_config->configFile);
+			topology_reload();
+		}
+	}
+
+	if(fd >= 0) {
+		close(fd);
+	}
+
+	return NULL;
+}
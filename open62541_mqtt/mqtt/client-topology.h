@@ -0,0 +1,58 @@
+#ifndef OPCUA_MQTT_BRIDGE_TOPOLOGY_H_
+#define OPCUA_MQTT_BRIDGE_TOPOLOGY_H_
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "client-nodemap.h"
+#include "json.h"
+
+/*
+ * The node-map currently in use. A topology is never modified once it has
+ * been published: a reload builds a new one and swaps the pointer, readers
+ * that still hold the old one finish their cycle undisturbed. The old
+ * topology is freed once no reader can reference it anymore (RCU style, the
+ * read side is a single store on entry and exit, it never takes a lock).
+ * Threads that use the topology across blocking I/O hold a reference instead
+ * of staying in the read section, a reload then does not wait for them.
+ */
+typedef struct Topology {
+	unsigned long generation;
+	std::atomic<int> refs;	/* 1 while current, plus one per holder */
+	vector<Group> groups;
+	map<string, Group*> byKey;
+	Strings strings;
+} Topology;
+
+Topology* topology_build(json_object* nodemap);
+void topology_delete(Topology* t);
+
+/* read side, the returned topology is valid until topology_read_end() */
+void topology_read_begin(void);
+Topology* topology_current(void);
+Group* topology_group(const char* key);
+void topology_read_end(void);
+
+/* a reference to the current topology, valid until topology_release() */
+Topology* topology_acquire(void);
+void topology_release(Topology* t);
+Group* topology_find(Topology* t, const char* key);
+
+/* to be called by reader threads before they exit */
+void topology_thread_exit(void);
+
+/* swaps in the new topology and frees the old one after a grace period */
+void topology_publish(Topology* t);
+
+/* re-reads the node-map from the config file */
+int topology_reload(void);
+
+/* reloads on SIGHUP and whenever the config file is rewritten */
+void* config_watch(void* param);
+void config_watch_signal(void);
+
+#endif /* OPCUA_MQTT_BRIDGE_TOPOLOGY_H_ */
@@ -91,7 +91,17 @@ int tcp_sendPacketBuffer(int sock, unsigned char* buf, int len)
 {
 	int rc = 0;
 
-    rc = send(sock, (const void *)buf, len , MSG_NOSIGNAL); 
+    while (rc < len) {
+        int n = send(sock, (const void *)(buf + rc), len - rc, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            rc = -1;
+            break;
+        }
+        rc += n;
+    }
 
     if(g_config->singleshot) {
         close(sock);
@@ -208,6 +218,13 @@ int* sock = &tcpsock;
 	}
 	if (tcpsock == INVALID_SOCKET)
 		return rc;
+	if (rc != 0)
+	{
+		/* nobody listening, don't hand out an unconnected socket */
+		close(tcpsock);
+		tcpsock = INVALID_SOCKET;
+		return -1;
+	}
 
 	tv.tv_sec = 1;  /* 1 second Timeout */
 	tv.tv_usec = 0;  
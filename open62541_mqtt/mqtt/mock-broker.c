@@ -0,0 +1,513 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "MQTTPacket.h"
+#include "client-compress.h"
+#include "mock-broker.h"
+
+#define MAX_PACKET (4 * 1024 * 1024)
+#define MAX_SAMPLES (1 << 20)
+#define MAX_FILTERS 16
+
+/* a stamp cut off by the end of the buffer is kept for the next read */
+#define STAMP_TAIL 32
+
+struct MockServer {
+	int tcp;			/* TCP sink receiver instead of a broker */
+	MockFaults faults;
+	int listener;
+	int port;
+	volatile int stop;
+	pthread_t thread;
+
+	MockStats stats;
+	unsigned long connectsSeen;
+
+	uint32_t* samples;	/* the first MAX_SAMPLES latencies in us */
+
+	unsigned char* buf;
+	int used;
+};
+
+static void count(unsigned long* counter, unsigned long n)
+{
+	__atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void sample(MockServer* m, uint64_t stamp)
+{
+	uint64_t now = now_usec();
+	uint64_t usecs = now > stamp ? now - stamp : 0;
+
+	unsigned long n = m->stats.samples;
+	if(n < MAX_SAMPLES) {
+		m->samples[n] = usecs > UINT32_MAX ? UINT32_MAX : (uint32_t)usecs;
+	}
+	__atomic_store_n(&m->stats.samples, n + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t be32(const unsigned char* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int is_frame(const unsigned char* p, int len)
+{
+	return len >= 3 && p[0] == 'U' && p[1] == 'Z' && p[2] == UAMQ_FRAME_VERSION;
+}
+
+/* finds the next "time" field, returns its offset and sets the offset of the digits */
+static int find_stamp(const unsigned char* p, int len, int* digits)
+{
+	static const char* keys[] = { "\"time\":", "time=" };
+
+	for (int i = 0; i < len; i++) {
+		if(p[i] != '"' && p[i] != 't') {
+			continue;
+		}
+		for (int k = 0; k < 2; k++) {
+			int n = (int)strlen(keys[k]);
+			if(i + n <= len && !memcmp(p + i, keys[k], n)) {
+				*digits = i + n;
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+/* Counts the stamps of plain text. Returns the bytes consumed, less than len
+ * when the text may continue in the next read (final = 0). */
+static int scan_text(MockServer* m, const unsigned char* p, int len, int final)
+{
+	int at = 0;
+	while (at < len) {
+		int digits = 0;
+		int hit = find_stamp(p + at, len - at, &digits);
+		if(hit < 0) {
+			if(!final && len - at > STAMP_TAIL) {
+				return len - STAMP_TAIL;
+			}
+			return final ? len : at;
+		}
+
+		int d = at + digits;
+		uint64_t stamp = 0;
+		while (d < len && p[d] >= '0' && p[d] <= '9') {
+			stamp = stamp * 10 + (uint64_t)(p[d] - '0');
+			d++;
+		}
+		if(d == len && !final) {
+			return at + hit;
+		}
+
+		if(m->tcp) {
+			count(&m->stats.messages, 1);
+		}
+		if(d > at + digits) {
+			sample(m, stamp);
+		}
+		at = d;
+	}
+	return len;
+}
+
+/* a compressed frame, complete; returns 0 when the header doesn't match */
+static int frame(MockServer* m, const unsigned char* p, int len)
+{
+	if(len < UAMQ_FRAME_HEADER_SIZE || be32(p + 12) != (uint32_t)(len - UAMQ_FRAME_HEADER_SIZE)) {
+		return 0;
+	}
+	if(p[3] & UAMQ_FRAME_DICTIONARY) {
+		count(&m->stats.dictionaries, 1);
+	} else {
+		count(&m->stats.messages, 1);
+		count(&m->stats.frames, 1);
+	}
+	return 1;
+}
+
+//===================================================================================================================================================================
+// MQTT
+
+static int reply(int fd, unsigned char* buf, int len)
+{
+	return len > 0 && send(fd, buf, len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+/* handles the packet at the start of the buffer. Returns its length, 0 when
+ * it isn't complete yet, -1 to close the connection */
+static int mqtt_packet(MockServer* m, int fd, unsigned char* p, int used, int* session)
+{
+	/* fixed header: type, then up to 4 bytes of remaining length */
+	int rem = 0;
+	int mult = 1;
+	int i = 1;
+	for (;; i++) {
+		if(i >= used) {
+			return 0;
+		}
+		if(i > 4) {
+			count(&m->stats.invalid, 1);
+			return -1;
+		}
+		rem += (p[i] & 127) * mult;
+		mult *= 128;
+		if(!(p[i] & 128)) {
+			break;
+		}
+	}
+	int total = i + 1 + rem;
+	if(total > MAX_PACKET) {
+		count(&m->stats.invalid, 1);
+		return -1;
+	}
+	if(used < total) {
+		return 0;
+	}
+
+	unsigned char out[8];
+	switch (p[0] >> 4) {
+	case CONNECT: {
+		MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+		if(*session || MQTTDeserialize_connect(&data, p, total) != 1) {
+			count(&m->stats.invalid, 1);
+			return -1;
+		}
+		count(&m->stats.connects, 1);
+		m->connectsSeen++;
+
+		if(m->connectsSeen <= (unsigned long)m->faults.dropConnacks) {
+			break;
+		}
+		if(m->connectsSeen <= (unsigned long)(m->faults.dropConnacks + m->faults.refuseConnects)) {
+			reply(fd, out, MQTTSerialize_connack(out, sizeof(out), 3, 0));
+			return -1;
+		}
+		*session = 1;
+		if(reply(fd, out, MQTTSerialize_connack(out, sizeof(out), 0, 0)) < 0) {
+			return -1;
+		}
+		break;
+	}
+	case PUBLISH: {
+		unsigned char dup = 0;
+		int qos = 0;
+		unsigned char retained = 0;
+		unsigned short id = 0;
+		MQTTString topic = MQTTString_initializer;
+		unsigned char* payload = NULL;
+		int payloadlen = 0;
+
+		if(!*session || MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic, &payload, &payloadlen, p, total) != 1
+			|| qos != 0 || topic.lenstring.len == 0) {
+			count(&m->stats.invalid, 1);
+			return -1;
+		}
+
+		count(&m->stats.bytes, (unsigned long)payloadlen);
+		if(is_frame(payload, payloadlen)) {
+			if(!frame(m, payload, payloadlen)) {
+				count(&m->stats.invalid, 1);
+				return -1;
+			}
+		} else {
+			count(&m->stats.messages, 1);
+			scan_text(m, payload, payloadlen, 1);
+		}
+		break;
+	}
+	case SUBSCRIBE: {
+		unsigned char dup = 0;
+		unsigned short id = 0;
+		int n = 0;
+		MQTTString filters[MAX_FILTERS];
+		int qos[MAX_FILTERS];
+		unsigned char suback[8 + MAX_FILTERS];
+
+		if(!*session || MQTTDeserialize_subscribe(&dup, &id, MAX_FILTERS, &n, filters, qos, p, total) != 1 || n == 0) {
+			count(&m->stats.invalid, 1);
+			return -1;
+		}
+		count(&m->stats.subscribes, 1);
+
+		/* granted as requested, nothing is ever published to them */
+		if(reply(fd, suback, MQTTSerialize_suback(suback, sizeof(suback), id, n, qos)) < 0) {
+			return -1;
+		}
+		break;
+	}
+	case PINGREQ:
+		if(reply(fd, out, MQTTSerialize_ack(out, sizeof(out), PINGRESP, 0, 0)) < 0) {
+			return -1;
+		}
+		break;
+	case DISCONNECT:
+		return -1;
+	default:
+		count(&m->stats.invalid, 1);
+		return -1;
+	}
+
+	return total;
+}
+
+//===================================================================================================================================================================
+// TCP sink
+
+/* handles what is buffered, returns the bytes consumed or -1 */
+static int tcp_stream(MockServer* m, int final)
+{
+	unsigned char* p = m->buf;
+	int used = m->used;
+	int at = 0;
+
+	while (at < used) {
+		if(used - at < 3 && !final) {
+			break;
+		}
+		if(is_frame(p + at, used - at)) {
+			if(used - at < UAMQ_FRAME_HEADER_SIZE) {
+				break;
+			}
+			int len = UAMQ_FRAME_HEADER_SIZE + (int)be32(p + at + 12);
+			if(len > MAX_PACKET) {
+				count(&m->stats.invalid, 1);
+				return -1;
+			}
+			if(used - at < len) {
+				break;
+			}
+			frame(m, p + at, len);
+			at += len;
+			continue;
+		}
+
+		/* plain text up to the next frame */
+		int end = at + 1;
+		while (end < used && !is_frame(p + end, used - end) && !(p[end] == 'U' && used - end < 3)) {
+			end++;
+		}
+		int n = scan_text(m, p + at, end - at, final || end < used);
+		if(n < end - at) {
+			at += n;
+			break;
+		}
+		at = end;
+	}
+
+	count(&m->stats.bytes, (unsigned long)at);
+	return at;
+}
+
+//===================================================================================================================================================================
+// connections
+
+static void serve(MockServer* m, int fd)
+{
+	int session = 0;
+	unsigned long received = m->stats.messages;
+	m->used = 0;
+
+	if(m->tcp) {
+		count(&m->stats.connects, 1);
+	}
+
+	while (!m->stop) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if(poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		int n = (int)recv(fd, m->buf + m->used, MAX_PACKET - m->used, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			if(m->tcp) {
+				tcp_stream(m, 1);
+			}
+			break;
+		}
+		m->used += n;
+
+		unsigned long before = m->stats.messages;
+		int consumed = 0;
+		if(m->tcp) {
+			consumed = tcp_stream(m, 0);
+		} else {
+			int len = 0;
+			while ((len = mqtt_packet(m, fd, m->buf + consumed, m->used - consumed, &session)) > 0) {
+				consumed += len;
+			}
+			if(len < 0) {
+				consumed = -1;
+			}
+		}
+		if(consumed < 0) {
+			break;
+		}
+		memmove(m->buf, m->buf + consumed, m->used - consumed);
+		m->used -= consumed;
+
+		if(m->faults.slowUsec > 0) {
+			usleep((useconds_t)(m->faults.slowUsec * (m->stats.messages - before)));
+		}
+		if(m->faults.closeAfter > 0 && m->stats.messages - received >= (unsigned long)m->faults.closeAfter) {
+			break;
+		}
+	}
+
+	count(&m->stats.disconnects, 1);
+	close(fd);
+}
+
+static void* mock_run(void* param)
+{
+	MockServer* m = (MockServer*)param;
+
+	while (!m->stop) {
+		struct pollfd pfd = { m->listener, POLLIN, 0 };
+		if(poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+		int fd = accept(m->listener, NULL, NULL);
+		if(fd >= 0) {
+			serve(m, fd);
+		}
+	}
+	return NULL;
+}
+
+static MockServer* mock_start(int tcp, int port, const MockFaults* faults)
+{
+	MockServer* m = (MockServer*)calloc(1, sizeof(MockServer));
+	if(!m) {
+		return NULL;
+	}
+	m->tcp = tcp;
+	if(faults) {
+		m->faults = *faults;
+	}
+	m->samples = (uint32_t*)malloc(MAX_SAMPLES * sizeof(uint32_t));
+	m->buf = (unsigned char*)malloc(MAX_PACKET);
+	m->listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(!m->samples || !m->buf || m->listener < 0) {
+		goto failed;
+	}
+
+	int on = 1;
+	setsockopt(m->listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t)port);
+	socklen_t len = sizeof(addr);
+	if(bind(m->listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m->listener, 4) != 0
+		|| getsockname(m->listener, (struct sockaddr*)&addr, &len) != 0) {
+		fprintf(stderr, "[mock] can't listen on port %d: %s\n", port, strerror(errno));
+		goto failed;
+	}
+	m->port = ntohs(addr.sin_port);
+
+	if(pthread_create(&m->thread, NULL, mock_run, m) == 0) {
+		return m;
+	}
+
+failed:
+	if(m->listener >= 0) {
+		close(m->listener);
+	}
+	free(m->samples);
+	free(m->buf);
+	free(m);
+	return NULL;
+}
+
+MockServer* mock_mqtt_start(int port, const MockFaults* faults)
+{
+	return mock_start(0, port, faults);
+}
+
+MockServer* mock_tcp_start(int port, const MockFaults* faults)
+{
+	return mock_start(1, port, faults);
+}
+
+void mock_stop(MockServer* m)
+{
+	if(!m) {
+		return;
+	}
+	m->stop = 1;
+	pthread_join(m->thread, NULL);
+	close(m->listener);
+	free(m->samples);
+	free(m->buf);
+	free(m);
+}
+
+int mock_port(MockServer* m)
+{
+	return m->port;
+}
+
+void mock_stats(MockServer* m, MockStats* out)
+{
+	unsigned long* from = (unsigned long*)&m->stats;
+	unsigned long* to = (unsigned long*)out;
+	for (size_t i = 0; i < sizeof(MockStats) / sizeof(unsigned long); i++) {
+		to[i] = __atomic_load_n(&from[i], __ATOMIC_ACQUIRE);
+	}
+}
+
+static int ascending(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+double mock_latency(MockServer* m, double q)
+{
+	unsigned long n = __atomic_load_n(&m->stats.samples, __ATOMIC_ACQUIRE);
+	if(n > MAX_SAMPLES) {
+		n = MAX_SAMPLES;
+	}
+	if(n == 0) {
+		return 0;
+	}
+
+	uint32_t* sorted = (uint32_t*)malloc(n * sizeof(uint32_t));
+	if(!sorted) {
+		return 0;
+	}
+	memcpy(sorted, m->samples, n * sizeof(uint32_t));
+	qsort(sorted, n, sizeof(uint32_t), ascending);
+
+	size_t at = (size_t)(q * (double)(n - 1) + 0.5);
+	double usecs = sorted[at < n ? at : n - 1];
+	free(sorted);
+	return usecs;
+}
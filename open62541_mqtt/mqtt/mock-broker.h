@@ -0,0 +1,61 @@
+#ifndef OPCUA_MQTT_BRIDGE_MOCK_BROKER_H_
+#define OPCUA_MQTT_BRIDGE_MOCK_BROKER_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process receivers for the sinks of the bridge: a minimal MQTT 3.1.1
+ * broker (CONNECT, PUBLISH with QoS 0, SUBSCRIBE, PINGREQ, DISCONNECT; the
+ * subscriptions are granted but nothing is forwarded) and a TCP sink
+ * receiver. Both listen on 127.0.0.1, serve one connection at
+ * a time from their own thread, validate what they receive and count it.
+ *
+ * A message carrying the "time" field of the bridge ("time":<us> in JSON,
+ * time=<us> in key/value payloads) adds a latency sample, time of receipt
+ * minus that stamp. Compressed frames are checked against their header and
+ * counted, they have no readable stamp. The TCP stream has no framing of its
+ * own, so there a plain message is counted by its stamp.
+ *
+ * A malformed packet counts as invalid and closes the connection.
+ */
+typedef struct {
+	int slowUsec;			/* slow consumer, pause after every message */
+	int closeAfter;			/* close the connection after that many messages, 0 = never */
+	int dropConnacks;		/* leave the first n CONNECTs unanswered */
+	int refuseConnects;		/* answer the first n CONNECTs with "server unavailable" */
+} MockFaults;
+
+typedef struct {
+	unsigned long connects;
+	unsigned long disconnects;	/* connections closed, by either side */
+	unsigned long messages;		/* payloads, dictionaries not included */
+	unsigned long bytes;		/* payload bytes as received */
+	unsigned long frames;		/* compressed frames among the messages */
+	unsigned long dictionaries;
+	unsigned long invalid;
+	unsigned long samples;		/* messages with a time stamp */
+	unsigned long subscribes;
+} MockStats;
+
+typedef struct MockServer MockServer;
+
+/* port 0 picks a free port, see mock_port(); faults may be NULL */
+MockServer* mock_mqtt_start(int port, const MockFaults* faults);
+MockServer* mock_tcp_start(int port, const MockFaults* faults);
+void mock_stop(MockServer* m);
+
+int mock_port(MockServer* m);
+void mock_stats(MockServer* m, MockStats* out);
+
+/* q-quantile (0 ... 1) of the latency samples in microseconds, 0 without samples */
+double mock_latency(MockServer* m, double q);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_MOCK_BROKER_H_ */
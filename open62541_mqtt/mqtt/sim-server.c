@@ -0,0 +1,313 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+/*
+ * Load generator for the bridge: a server with N variables of mixed types
+ * that change at a configurable rate, and a bridge config that polls or
+ * monitors all of them.
+ *
+ *   opcua-sim-server -n 1000 -t int32,double,bool -a 0 -i 100 -c 50 \
+ *                    -g 10 -m poll -u 100000 -o sim.json
+ *
+ * Every tick (-i ms) the next c percent of the variables get a new value, so
+ * each variable changes every 100 / c ticks. Arrays (-a) apply to the numeric
+ * types, strings and booleans stay scalar.
+ */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_server.h"
+# include "ua_config_standard.h"
+# include "ua_network_tcp.h"
+# include "ua_log_stdout.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+UA_Boolean running = true;
+UA_Logger logger = UA_Log_Stdout;
+
+typedef struct {
+    const char* name;
+    int type;
+    int numeric;
+} SimType;
+
+static const SimType types[] = {
+    { "bool", UA_TYPES_BOOLEAN, 0 },
+    { "int16", UA_TYPES_INT16, 1 },
+    { "int32", UA_TYPES_INT32, 1 },
+    { "uint32", UA_TYPES_UINT32, 1 },
+    { "int64", UA_TYPES_INT64, 1 },
+    { "float", UA_TYPES_FLOAT, 1 },
+    { "double", UA_TYPES_DOUBLE, 1 },
+    { "string", UA_TYPES_STRING, 0 },
+};
+
+#define TYPES (sizeof(types) / sizeof(types[0]))
+
+typedef struct {
+    int port;
+    int count;
+    const SimType* use[TYPES];
+    int useCount;
+    int arraySize;
+    int intervalMs;
+    int percent;
+    int groupSize;
+    const char* method;
+    int pollUsec;
+    const char* output;
+} Sim;
+
+static Sim sim = { 16664, 100, { NULL }, 0, 0, 100, 100, 10, "poll", 100000, NULL };
+
+static unsigned long tick = 0;
+static int next = 0;
+static unsigned long writes = 0;
+
+static void stopHandler(int sign) {
+    running = false;
+}
+
+static const SimType* type_of(int i) {
+    return sim.use[i % sim.useCount];
+}
+
+static int array_of(const SimType* t) {
+    return t->numeric ? sim.arraySize : 0;
+}
+
+static UA_NodeId node_of(int i) {
+    char id[32];
+    snprintf(id, sizeof(id), "sim.%d", i);
+    return UA_NODEID_STRING_ALLOC(1, id);
+}
+
+/* the value of variable i after k changes, as a variant owning its data */
+static void value_of(int i, unsigned long k, UA_Variant* v) {
+    const SimType* t = type_of(i);
+    const UA_DataType* type = &UA_TYPES[t->type];
+    long base = (long)(k + (unsigned long)i);
+    int n = array_of(t);
+    size_t count = n > 0 ? (size_t)n : 1;
+
+    void* data = UA_Array_new(count, type);
+    for(size_t e = 0; e < count; e++) {
+        void* p = (char*)data + e * type->memSize;
+        double wave = sin((double)(base + (long)e) / 10.0) * 100.0;
+        switch(t->type) {
+            case UA_TYPES_BOOLEAN: *(UA_Boolean*)p = (base & 1) != 0; break;
+            case UA_TYPES_INT16: *(UA_Int16*)p = (UA_Int16)(base + (long)e); break;
+            case UA_TYPES_INT32: *(UA_Int32*)p = (UA_Int32)(base + (long)e); break;
+            case UA_TYPES_UINT32: *(UA_UInt32*)p = (UA_UInt32)(base + (long)e); break;
+            case UA_TYPES_INT64: *(UA_Int64*)p = (UA_Int64)(base + (long)e); break;
+            case UA_TYPES_FLOAT: *(UA_Float*)p = (UA_Float)wave; break;
+            case UA_TYPES_DOUBLE: *(UA_Double*)p = wave; break;
+            case UA_TYPES_STRING: {
+                char s[32];
+                snprintf(s, sizeof(s), "v%ld", base);
+                *(UA_String*)p = UA_STRING_ALLOC(s);
+            }
+            break;
+            default: break;
+        }
+    }
+
+    UA_Variant_init(v);
+    if(n > 0) {
+        UA_Variant_setArray(v, data, count, type);
+    } else {
+        UA_Variant_setScalar(v, data, type);
+    }
+}
+
+static void change(UA_Server *server, void *data) {
+    int changes = sim.count * sim.percent / 100;
+    if(changes < 1) {
+        changes = 1;
+    }
+
+    for(int c = 0; c < changes; c++) {
+        UA_Variant v;
+        UA_NodeId id = node_of(next);
+        value_of(next, tick, &v);
+        UA_Server_writeValue(server, id, v);
+        UA_Variant_deleteMembers(&v);
+        UA_NodeId_deleteMembers(&id);
+
+        if(++next == sim.count) {
+            next = 0;
+            tick++;
+        }
+    }
+    writes += (unsigned long)changes;
+}
+
+static void report(UA_Server *server, void *data) {
+    static unsigned long last = 0;
+    printf("[sim] %lu changes/s\n", (writes - last) / 5);
+    last = writes;
+}
+
+static void populate(UA_Server* server) {
+    UA_ObjectAttributes folder;
+    UA_ObjectAttributes_init(&folder);
+    folder.displayName = UA_LOCALIZEDTEXT("en_US", "Sim");
+    UA_Server_addObjectNode(server, UA_NODEID_STRING(1, "sim"),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER), UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+        UA_QUALIFIEDNAME(1, "Sim"), UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE), folder, NULL, NULL);
+
+    for(int i = 0; i < sim.count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "v%d", i);
+
+        UA_VariableAttributes attr;
+        UA_VariableAttributes_init(&attr);
+        attr.displayName = UA_LOCALIZEDTEXT("en_US", name);
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+        attr.valueRank = array_of(type_of(i)) > 0 ? 1 : -1;
+        value_of(i, 0, &attr.value);
+
+        UA_NodeId id = node_of(i);
+        UA_Server_addVariableNode(server, id, UA_NODEID_STRING(1, "sim"),
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT), UA_QUALIFIEDNAME(1, name),
+            UA_NODEID_NULL, attr, NULL, NULL);
+        UA_NodeId_deleteMembers(&id);
+        UA_Variant_deleteMembers(&attr.value);
+    }
+}
+
+/* a bridge config that serves every variable of the server */
+static int write_config(const char* fn) {
+    FILE* f = fopen(fn, "w");
+    if(!f) {
+        printf("[sim] can't write %s.\n", fn);
+        return -1;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "    \"device-configuration\": { \"Device\": { \"deviceID\": \"sim\" } },\n");
+    fprintf(f, "    \"server-configuration\": {\n");
+    fprintf(f, "        \"opcuaServer\": { \"EndpointURL\": \"opc.tcp://localhost:%d\", \"publishIntervalUs\": %d, "
+               "\"asycRequestSupported\": false, \"method\": \"%s\" },\n", sim.port, sim.intervalMs * 1000, sim.method);
+    fprintf(f, "        \"mqttBrocker\": { \"enable\": true, \"ip\": \"127.0.0.1\", \"port\": 1883, \"topicBase\": \"bench\" },\n");
+    fprintf(f, "        \"amqpRabbit\": { \"enable\": false, \"ip\": \"127.0.0.1\", \"port\": 5672, \"topicBase\": \"bench\" },\n");
+    fprintf(f, "        \"tcpSever\": { \"enable\": false, \"ip\": \"127.0.0.1\", \"port\": 5555, \"sampleIntervalUs\": 100, \"singleshot\": false },\n");
+    fprintf(f, "        \"metrics\": { \"enable\": true, \"address\": \"127.0.0.1\", \"port\": 9464 },\n");
+    fprintf(f, "        \"log\": { \"level\": \"info\", \"ratePerSecond\": 20 }\n");
+    fprintf(f, "    },\n");
+    fprintf(f, "    \"node-map\": [\n");
+
+    int groups = (sim.count + sim.groupSize - 1) / sim.groupSize;
+    for(int g = 0; g < groups; g++) {
+        fprintf(f, "        { \"name\": \"g%d\", \"enable\": true, \"method\": \"%s\", \"intervalUSec\": %d, \"topic\": \"g%d\", "
+                   "\"mqtt\": true, \"tcp\": false, \"format\": \"json\", \"nodes\": [\n", g, sim.method, sim.pollUsec, g);
+        int last = (g + 1) * sim.groupSize < sim.count ? (g + 1) * sim.groupSize : sim.count;
+        for(int i = g * sim.groupSize; i < last; i++) {
+            fprintf(f, "            { \"id\": \"ns=1;s=sim.%d\", \"topic\": \"v%d\" }%s\n", i, i, i + 1 < last ? "," : "");
+        }
+        fprintf(f, "        ] }%s\n", g + 1 < groups ? "," : "");
+    }
+
+    fprintf(f, "    ]\n}\n");
+    fclose(f);
+
+    printf("[sim] bridge config for %d variables in %d groups written to %s.\n", sim.count, groups, fn);
+    return 0;
+}
+
+static int parse_types(char* list) {
+    sim.useCount = 0;
+    for(char* t = strtok(list, ","); t; t = strtok(NULL, ",")) {
+        size_t k = 0;
+        while(k < TYPES && strcmp(types[k].name, t)) {
+            k++;
+        }
+        if(k == TYPES || sim.useCount == (int)TYPES) {
+            printf("[sim] unknown type %s.\n", t);
+            return -1;
+        }
+        sim.use[sim.useCount++] = &types[k];
+    }
+    return sim.useCount > 0 ? 0 : -1;
+}
+
+static void usage(const char* exe) {
+    printf("uses: %s [-p port] [-n variables] [-t bool,int16,int32,uint32,int64,float,double,string]\n"
+           "       [-a array size] [-i tick ms] [-c percent changed per tick]\n"
+           "       [-g nodes per group] [-m poll|event] [-u poll interval us] [-o bridge config]\n", exe);
+}
+
+int main(int argc, char** argv) {
+    char all[] = "bool,int16,int32,uint32,int64,float,double,string";
+    parse_types(all);
+
+    int opt;
+    while((opt = getopt(argc, argv, "p:n:t:a:i:c:g:m:u:o:h")) != -1) {
+        switch(opt) {
+            case 'p': sim.port = atoi(optarg); break;
+            case 'n': sim.count = atoi(optarg); break;
+            case 't': if(parse_types(optarg) != 0) { return 1; } break;
+            case 'a': sim.arraySize = atoi(optarg); break;
+            case 'i': sim.intervalMs = atoi(optarg); break;
+            case 'c': sim.percent = atoi(optarg); break;
+            case 'g': sim.groupSize = atoi(optarg); break;
+            case 'm': sim.method = optarg; break;
+            case 'u': sim.pollUsec = atoi(optarg); break;
+            case 'o': sim.output = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if(sim.count < 1 || sim.groupSize < 1 || sim.intervalMs < 5 || sim.percent < 0 || sim.percent > 100 || sim.arraySize < 0 ||
+       (strcmp(sim.method, "poll") && strcmp(sim.method, "event"))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(sim.output && write_config(sim.output) != 0) {
+        return 1;
+    }
+
+    signal(SIGINT, stopHandler);
+    signal(SIGTERM, stopHandler);
+
+    UA_ServerConfig config = UA_ServerConfig_standard;
+#ifdef __linux__
+    /* many bridges may connect to one simulation */
+    UA_ServerNetworkLayer nl = UA_ServerNetworkLayerTCP_epoll(UA_ConnectionConfig_standard, (UA_UInt16)sim.port);
+#else
+    UA_ServerNetworkLayer nl = UA_ServerNetworkLayerTCP(UA_ConnectionConfig_standard, (UA_UInt16)sim.port);
+#endif
+    config.networkLayers = &nl;
+    config.networkLayersSize = 1;
+    config.logger = logger;
+    UA_Server *server = UA_Server_new(config);
+
+    populate(server);
+    printf("[sim] %d variables, %d%% changed every %d ms, port %d.\n", sim.count, sim.percent, sim.intervalMs, sim.port);
+
+    UA_Job job;
+    job.type = UA_JOBTYPE_METHODCALL;
+    job.job.methodCall.data = NULL;
+    if(sim.percent > 0) {
+        job.job.methodCall.method = change;
+        UA_Server_addRepeatedJob(server, job, (UA_UInt32)sim.intervalMs, NULL);
+    }
+    job.job.methodCall.method = report;
+    UA_Server_addRepeatedJob(server, job, 5000, NULL);
+
+    UA_StatusCode retval = UA_Server_run(server, &running);
+    UA_Server_delete(server);
+    nl.deleteMembers(&nl);
+
+    return (int)retval;
+}
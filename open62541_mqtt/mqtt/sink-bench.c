@@ -0,0 +1,321 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+/*
+ * Benchmark of the sinks of the bridge against the in-process receivers of
+ * mock-broker.c: publishes n messages of s bytes from t threads through
+ * mqtt_publish or tcp_publish, then reports what arrived, the throughput and
+ * the latency from publish to receipt. Before that it times the payload
+ * encoders: the JSON and key/value payloads as the monitoring callbacks build
+ * them, and the codec of the sink (-z).
+ *
+ *   opcua-mqtt-bench -k mqtt -n 100000 -s 200 -t 4 -z lz4 -o bench.json
+ *   opcua-mqtt-bench -k tcp -n 50000 -S 50 -D 10000 -C 2
+ *
+ * Faults: -S slow consumer (us per message), -D close the connection after
+ * that many messages, -C leave the first CONNACKs out, -R refuse the first
+ * connects. -c subscribes the mqtt sink to a command topic, as the bridge
+ * does with commands enabled. The exit code is 1 when messages were invalid,
+ * or lost without a fault that explains it, or the subscription made the
+ * sink reconnect, so the run can gate a build. -o writes the results
+ * in the JSON format of benchmarks/benchmark.h, the sink as "sink/<kind>" with
+ * the receive latency as its percentiles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client-config.h"
+#include "client-common.h"
+#include "client-log.h"
+#include "client-compress.h"
+#include "mock-broker.h"
+#include "benchmark.h"
+#include "json.h"
+
+int beStop = 0;
+UAMQ_Configuration g_Configutation;
+UAMQ_Configuration* g_config = &g_Configutation;
+
+/* nothing is published to the command topic */
+void command_submit(int origin, unsigned long connection, const char* payload, int len)
+{
+}
+
+static int tcp = 0;
+static long messages = 100000;
+static int size = 200;
+static int threads = 1;
+static long rate = 0;
+
+typedef struct {
+	int index;
+	long sent;
+	long dropped;
+} Publisher;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void* publish(void* param)
+{
+	Publisher* p = (Publisher*)param;
+
+	long n = messages / threads + (p->index < messages % threads ? 1 : 0);
+	long period = rate > 0 ? 1000000L * threads / rate : 0;
+
+	/* "<topicBase>/<deviceID>/t<index>" */
+	char topic[sizeof(g_config->topicBase) + sizeof(g_config->deviceID) + 16];
+	snprintf(topic, sizeof(topic), "%s/%s/t%d", g_config->topicBase, g_config->deviceID, p->index);
+
+	/* the "time" field like the bridge writes it, padded to the size */
+	char* payload = (char*)malloc((size_t)size + 64);
+	char* pad = (char*)malloc((size_t)size + 1);
+	int fill = size > 40 ? size - 40 : 1;
+	memset(pad, 'x', (size_t)fill);
+	pad[fill] = 0;
+
+	uint64_t start = now_usec();
+	for (long i = 0; i < n && !beStop; i++) {
+		if(period > 0) {
+			uint64_t due = start + (uint64_t)(i * period);
+			uint64_t now = now_usec();
+			if(due > now) {
+				usleep((useconds_t)(due - now));
+			}
+		}
+
+		snprintf(payload, (size_t)size + 64, "{\"v\":\"%s\",\"seq\":%ld,\"time\":%lu}", pad, i, (unsigned long)now_usec());
+		int rc = tcp ? tcp_publish("poll", topic, payload) : mqtt_publish("poll", topic, payload);
+		p->sent++;
+		if(rc < 0) {
+			p->dropped++;
+		}
+	}
+
+	free(pad);
+	free(payload);
+	return NULL;
+}
+
+//===================================================================================================================================================================
+// payload encoders
+
+typedef struct {
+	char alias[16];
+	double value;
+	char payload[256];
+	UAMQ_Codec* codec;
+	unsigned char* frame;
+} Encoder;
+
+static void encode_json(void* param)
+{
+	Encoder* e = (Encoder*)param;
+	json_object* jobj = json_object_new_object();
+	json_object_object_add(jobj, e->alias, json_object_new_double(e->value));
+	json_object_object_add(jobj, "time", json_object_new_int64((int64_t)now_usec()));
+	json_object_object_add(jobj, "serverTime", json_object_new_int64((int64_t)now_usec()));
+	json_object_object_add(jobj, "status", json_object_new_int64(0));
+	const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+	snprintf(e->payload, sizeof(e->payload), "%s", contents);
+	json_object_put(jobj);
+}
+
+static void encode_kv(void* param)
+{
+	Encoder* e = (Encoder*)param;
+	snprintf(e->payload, sizeof(e->payload), "%s=%lu, %s=%lu, %s=%u, %s=%f", "time", (unsigned long)now_usec(),
+		"serverTime", (unsigned long)now_usec(), "status", 0u, e->alias, e->value);
+}
+
+static void encode_codec(void* param)
+{
+	Encoder* e = (Encoder*)param;
+	codec_encode(e->codec, (const unsigned char*)e->payload, (int)strlen(e->payload), &e->frame);
+}
+
+static void bench_encoders(const char* codec)
+{
+	Encoder e;
+	memset(&e, 0, sizeof(e));
+	strcpy(e.alias, "speed");
+	e.value = 1234.5;
+
+	Bench_run("payload/json", encode_json, &e, 0);
+	Bench_run("payload/kv", encode_kv, &e, 0);
+
+	UAMQ_Compression conf;
+	memset(&conf, 0, sizeof(conf));
+	snprintf(conf.codec, sizeof(conf.codec), "%s", codec);
+	e.codec = codec_new(&conf, "bench");
+	if(e.codec) {
+		char name[64];
+		encode_json(&e);
+		snprintf(name, sizeof(name), "payload/%s", codec);
+		Bench_run(name, encode_codec, &e, (double)strlen(e.payload));
+		codec_delete(e.codec);
+	}
+}
+
+static void usage(void)
+{
+	printf("usage: opcua-mqtt-bench [-k mqtt|tcp] [-n messages] [-s bytes] [-t threads] [-r messages/s]\n"
+		"                        [-z none|lz4|zstd] [-S slow-us] [-D close-after] [-C dropped-connacks]\n"
+		"                        [-R refused-connects] [-c command-topic] [-o results.json]\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* codec = "none";
+	const char* output = NULL;
+	MockFaults faults;
+	memset(&faults, 0, sizeof(faults));
+
+	int opt;
+	while ((opt = getopt(argc, argv, "k:n:s:t:r:z:S:D:C:R:c:o:h")) != -1) {
+		switch (opt) {
+		case 'k': tcp = !strcmp(optarg, "tcp"); break;
+		case 'n': messages = atol(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 't': threads = atoi(optarg); break;
+		case 'r': rate = atol(optarg); break;
+		case 'z': codec = optarg; break;
+		case 'S': faults.slowUsec = atoi(optarg); break;
+		case 'D': faults.closeAfter = atoi(optarg); break;
+		case 'C': faults.dropConnacks = atoi(optarg); break;
+		case 'R': faults.refuseConnects = atoi(optarg); break;
+		case 'c':
+			g_config->commandEnable = true;
+			snprintf(g_config->commandTopics[0], sizeof(g_config->commandTopics[0]), "%s", optarg);
+			g_config->commandTopicCount = 1;
+			break;
+		case 'o': output = optarg; break;
+		default: usage(); return 2;
+		}
+	}
+	if(messages <= 0 || size <= 0 || threads <= 0) {
+		usage();
+		return 2;
+	}
+
+	log_level = UAMQ_LOG_WARN;
+	log_rate = 5;
+	log_start();
+
+	if(Bench_init("opcua-mqtt-bridge", "", NULL, 0.2, output) != 0) {
+		log_stop();
+		return 2;
+	}
+	bench_encoders(codec);
+
+	MockServer* mock = tcp ? mock_tcp_start(0, &faults) : mock_mqtt_start(0, &faults);
+	if(!mock) {
+		log_stop();
+		return 2;
+	}
+
+	strcpy(g_config->deviceID, "bench");
+	strcpy(g_config->topicBase, "bench");
+	UAMQ_Compression* compression = tcp ? &g_config->tcpCompression : &g_config->mqttCompression;
+	snprintf(compression->codec, sizeof(compression->codec), "%s", codec);
+	if(tcp) {
+		g_config->tcpEnable = true;
+		strcpy(g_config->tcpBrockerIP, "127.0.0.1");
+		g_config->tcpBrockerPORT = mock_port(mock);
+	} else {
+		g_config->mqttEnable = true;
+		strcpy(g_config->mqttBrockerIP, "127.0.0.1");
+		g_config->mqttBrockerPORT = mock_port(mock);
+	}
+
+	pthread_t sink;
+	pthread_create(&sink, NULL, tcp ? tcp_run : mqtt_run, NULL);
+
+	/* wait for the connect, faults may delay it by some backoff rounds */
+	for (int i = 0; i < 300 && !(tcp ? tcp_ready() : mqtt_ready()); i++) {
+		usleep(100000);
+	}
+
+	Publisher* pubs = (Publisher*)calloc((size_t)threads, sizeof(Publisher));
+	pthread_t* tids = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+
+	long long allocs = Bench_allocations();
+	uint64_t start = now_usec();
+	for (int i = 0; i < threads; i++) {
+		pubs[i].index = i;
+		pthread_create(&tids[i], NULL, publish, &pubs[i]);
+	}
+	long sent = 0;
+	long dropped = 0;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+		sent += pubs[i].sent;
+		dropped += pubs[i].dropped;
+	}
+	uint64_t elapsed = now_usec() - start;
+	long long allocsAfter = Bench_allocations();
+
+	/* the receiver drains what is still on the way */
+	MockStats stats;
+	mock_stats(mock, &stats);
+	for (int idle = 0; idle < 10 && (long)stats.messages < sent - dropped; ) {
+		unsigned long before = stats.messages;
+		usleep(100000);
+		mock_stats(mock, &stats);
+		idle = stats.messages == before ? idle + 1 : 0;
+	}
+
+	double p50 = mock_latency(mock, 0.5);
+	double p90 = mock_latency(mock, 0.9);
+	double p99 = mock_latency(mock, 0.99);
+	double max = mock_latency(mock, 1.0);
+
+	beStop = 1;
+	pthread_join(sink, NULL);
+	mock_stop(mock);
+	log_stop();
+
+	double seconds = elapsed > 0 ? (double)elapsed / 1e6 : 1e-6;
+	long lost = sent - dropped - (long)stats.messages;
+
+	printf("sink %s, codec %s, %ld messages of %d bytes from %d threads\n", tcp ? "tcp" : "mqtt", codec, sent, size, threads);
+	printf("sent      %.0f messages/s, %.2f MB/s of payload\n", (double)sent / seconds, (double)sent * size / seconds / 1e6);
+	printf("received  %lu messages, %lu bytes, %lu compressed, %lu dictionaries\n", stats.messages, stats.bytes, stats.frames, stats.dictionaries);
+	printf("dropped   %ld by the sink, %ld lost on the way, %lu invalid\n", dropped, lost, stats.invalid);
+	printf("connects  %lu, disconnects %lu, subscribes %lu\n", stats.connects, stats.disconnects, stats.subscribes);
+	printf("latency   p50 %.0f us, p90 %.0f us, p99 %.0f us, max %.0f us (%lu stamped)\n", p50, p90, p99, max, stats.samples);
+
+	Bench_Result r;
+	r.name = tcp ? "sink/tcp" : "sink/mqtt";
+	r.iterations = (size_t)sent;
+	r.nsPerOp = sent > 0 ? (double)elapsed * 1000.0 / (double)sent : 0;
+	r.allocsPerOp = allocs < 0 || sent == 0 ? -1 : (double)(allocsAfter - allocs) / (double)sent;
+	r.bytesPerOp = size;
+	r.p50 = p50 * 1000.0;
+	r.p90 = p90 * 1000.0;
+	r.p99 = p99 * 1000.0;
+	r.max = max * 1000.0;
+	Bench_report(&r);
+
+	free(tids);
+	free(pubs);
+
+	if(Bench_finish() != 0) {
+		return 2;
+	}
+
+	/* closing the connection loses what was in flight, the sink can't know */
+	int faulted = faults.closeAfter > 0;
+	/* every connection of the mqtt sink subscribes once */
+	int unsubscribed = !tcp && g_config->commandEnable && stats.subscribes != stats.connects - (unsigned long)faults.dropConnacks - (unsigned long)faults.refuseConnects;
+	return stats.invalid > 0 || (lost != 0 && !faulted) || (dropped > 0 && !faulted) || unsubscribed ? 1 : 0;
+}
@@ -73,9 +73,17 @@ static int mysock = INVALID_SOCKET;
 
 int transport_sendPacketBuffer(int sock, unsigned char* buf, int buflen)
 {
-	int rc = 0;
-	rc = (int)write(sock, buf, buflen);
-	return rc;
+	int sent = 0;
+	while (sent < buflen)
+	{
+		int rc = (int)send(sock, buf + sent, buflen - sent, MSG_NOSIGNAL);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		sent += rc;
+	}
+	return sent;
 }
 
 
@@ -186,6 +194,13 @@ int* sock = &mysock;
 	}
 	if (mysock == INVALID_SOCKET)
 		return rc;
+	if (rc != 0)
+	{
+		/* nobody listening, don't hand out an unconnected socket */
+		close(mysock);
+		mysock = INVALID_SOCKET;
+		return -1;
+	}
 
 	tv.tv_sec = 1;  /* 1 second Timeout */
 	tv.tv_usec = 0;  
@@ -42,6 +42,8 @@
 # include <fcntl.h>
 # include <unistd.h> // read, write, close
 # include <netdb.h>
+# include <sys/socket.h>
+# include <sys/uio.h> // iovec
 # ifdef __QNX__
 #  include <sys/socket.h>
 # endif
@@ -85,6 +87,136 @@
 # define AGAIN EAGAIN
 #endif
 
+/****************/
+/* Buffer Pools */
+/****************/
+
+/* Every recv needs a buffer of the full receive buffer size. The pool hands
+ * out buffers of a slab that is allocated at the first use and reuses them
+ * last-in first-out, so a recv neither mallocs nor touches fresh pages. When
+ * the slab is used up, or a larger buffer is asked for, the buffer is
+ * malloced and freed on release.
+ *
+ * Buffers are taken by the thread that reads the sockets and returned by
+ * any thread. In the multithreaded build the free list is a lock-free stack.
+ * It has a single consumer, so a buffer can't be taken and returned between
+ * reading the head and swapping it (no ABA).
+ *
+ * Send buffers come from a second pool. In the multithreaded build the
+ * workers take send buffers at the same time, so that pool has no buffers
+ * and every send buffer is malloced. */
+
+#define RECV_POOL_SERVER 64 /* buffers in flight: jobs dispatched, not processed */
+#define RECV_POOL_CLIENT 2 /* the client processes a message before it reads on */
+#define SEND_POOL_SERVER 17 /* a batch of chunks and the chunk being encoded */
+#define SEND_POOL_CLIENT 17
+
+typedef struct PooledBuffer {
+    struct PooledBuffer *next;
+} PooledBuffer;
+
+typedef struct {
+    size_t bufferSize;
+    size_t buffersSize;
+    UA_Byte *slab;
+    PooledBuffer *free;
+} BufferPool;
+
+static void
+BufferPool_init(BufferPool *pool, size_t bufferSize, size_t buffersSize) {
+    memset(pool, 0, sizeof(BufferPool));
+    pool->bufferSize = bufferSize;
+    pool->buffersSize = buffersSize;
+}
+
+static UA_Byte *
+BufferPool_get(BufferPool *pool, size_t size) {
+    if(!pool || size > pool->bufferSize || pool->buffersSize == 0)
+        return (UA_Byte *)malloc(size);
+
+    if(!pool->slab) {
+        pool->slab = (UA_Byte *)malloc(pool->bufferSize * pool->buffersSize);
+        if(!pool->slab)
+            return (UA_Byte *)malloc(size);
+        for(size_t i = pool->buffersSize; i > 0; --i) {
+            PooledBuffer *b = (PooledBuffer *)(void *)&pool->slab[(i - 1) * pool->bufferSize];
+            b->next = pool->free;
+            pool->free = b;
+        }
+    }
+
+#ifdef UA_ENABLE_MULTITHREADING
+    PooledBuffer *b = uatomic_read(&pool->free);
+    while(b) {
+        PooledBuffer *seen = uatomic_cmpxchg(&pool->free, b, b->next);
+        if(seen == b)
+            break;
+        b = seen;
+    }
+#else
+    PooledBuffer *b = pool->free;
+    if(b)
+        pool->free = b->next;
+#endif
+    return b ? (UA_Byte *)b : (UA_Byte *)malloc(pool->bufferSize);
+}
+
+static void
+BufferPool_release(BufferPool *pool, UA_Byte *data) {
+    if(!data)
+        return;
+    if(!pool || !pool->slab || data < pool->slab ||
+       data >= pool->slab + pool->bufferSize * pool->buffersSize) {
+        free(data);
+        return;
+    }
+
+    PooledBuffer *b = (PooledBuffer *)(void *)data;
+#ifdef UA_ENABLE_MULTITHREADING
+    PooledBuffer *head = uatomic_read(&pool->free);
+    for(;;) {
+        b->next = head;
+        PooledBuffer *seen = uatomic_cmpxchg(&pool->free, head, b);
+        if(seen == head)
+            break;
+        head = seen;
+    }
+#else
+    b->next = pool->free;
+    pool->free = b;
+#endif
+}
+
+/* only when all buffers are back */
+static void
+BufferPool_deleteMembers(BufferPool *pool) {
+    free(pool->slab);
+    pool->slab = NULL;
+    pool->free = NULL;
+}
+
+/* The pools of a connection, the first member of its handle */
+typedef struct {
+    BufferPool recv;
+    BufferPool send;
+} ConnectionBuffers;
+
+static void
+ConnectionBuffers_init(ConnectionBuffers *buffers, const UA_ConnectionConfig *conf,
+                       size_t recvBuffers, size_t sendBuffers) {
+    BufferPool_init(&buffers->recv, conf->recvBufferSize, recvBuffers);
+#ifdef UA_ENABLE_MULTITHREADING
+    sendBuffers = 0;
+#endif
+    BufferPool_init(&buffers->send, conf->sendBufferSize, sendBuffers);
+}
+
+static void
+ConnectionBuffers_deleteMembers(ConnectionBuffers *buffers) {
+    BufferPool_deleteMembers(&buffers->recv);
+    BufferPool_deleteMembers(&buffers->send);
+}
+
 /****************************/
 /* Generic Socket Functions */
 /****************************/
@@ -96,6 +228,22 @@ socket_close(UA_Connection *connection) {
     CLOSESOCKET(connection->sockfd);
 }
 
+static BufferPool *
+socket_recvPool(UA_Connection *connection) {
+    return connection->handle ? &((ConnectionBuffers *)connection->handle)->recv : NULL;
+}
+
+static BufferPool *
+socket_sendPool(UA_Connection *connection) {
+    return connection->handle ? &((ConnectionBuffers *)connection->handle)->send : NULL;
+}
+
+static void
+socket_releaseSendBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    BufferPool_release(socket_sendPool(connection), buf->data);
+    *buf = UA_BYTESTRING_NULL;
+}
+
 static UA_StatusCode
 socket_write(UA_Connection *connection, UA_ByteString *buf) {
     size_t nWritten = 0;
@@ -110,19 +258,94 @@ socket_write(UA_Connection *connection, UA_ByteString *buf) {
             if(n < 0 && errno__ != INTERRUPTED && errno__ != AGAIN) {
                 connection->close(connection);
                 socket_close(connection);
-                UA_ByteString_deleteMembers(buf);
+                socket_releaseSendBuffer(connection, buf);
                 return UA_STATUSCODE_BADCONNECTIONCLOSED;
             }
         } while(n < 0);
         nWritten += (size_t)n;
     } while(nWritten < buf->length);
-    UA_ByteString_deleteMembers(buf);
+    socket_releaseSendBuffer(connection, buf);
     return UA_STATUSCODE_GOOD;
 }
 
+#ifndef _WIN32
+
+#define SENDV_MAX 32 /* buffers per sendmsg */
+
+/* The chunks of a message in one sendmsg. A partial write continues in the
+ * middle of the buffer where it stopped. */
+static UA_StatusCode
+socket_writev(UA_Connection *connection, UA_ByteString *bufs, size_t bufsSize) {
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    struct iovec iov[SENDV_MAX];
+    for(size_t i = 0; i < bufsSize && retval == UA_STATUSCODE_GOOD; i += SENDV_MAX) {
+        size_t iovSize = bufsSize - i < SENDV_MAX ? bufsSize - i : SENDV_MAX;
+        for(size_t k = 0; k < iovSize; ++k) {
+            iov[k].iov_base = bufs[i + k].data;
+            iov[k].iov_len = bufs[i + k].length;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovSize;
+        while(msg.msg_iovlen > 0) {
+            ssize_t n = sendmsg(connection->sockfd, &msg, 0);
+            if(n < 0) {
+                if(errno__ == INTERRUPTED || errno__ == AGAIN)
+                    continue;
+                connection->close(connection);
+                socket_close(connection);
+                retval = UA_STATUSCODE_BADCONNECTIONCLOSED;
+                break;
+            }
+            size_t sent = (size_t)n;
+            while(msg.msg_iovlen > 0 && sent >= msg.msg_iov->iov_len) {
+                sent -= msg.msg_iov->iov_len;
+                ++msg.msg_iov;
+                --msg.msg_iovlen;
+            }
+            if(msg.msg_iovlen > 0) {
+                msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + sent;
+                msg.msg_iov->iov_len -= sent;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < bufsSize; ++i)
+        socket_releaseSendBuffer(connection, &bufs[i]);
+    return retval;
+}
+
+#endif
+
+static void
+socket_releaseRecvBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    BufferPool_release(socket_recvPool(connection), buf->data);
+    *buf = UA_BYTESTRING_NULL;
+}
+
+/* Bytes to read. When a chunk is half-received, only its rest is read. The
+ * chunk is then completed without copying the next chunks along, and the
+ * following reads start at chunk boundaries again. */
+static size_t
+socket_recvSize(const UA_Connection *connection) {
+    size_t size = connection->localConf.recvBufferSize;
+    const UA_ByteString *incomplete = &connection->incompleteMessage;
+    if(incomplete->length < 8)
+        return size;
+    size_t chunkLength = (size_t)incomplete->data[4] + ((size_t)incomplete->data[5] << 8) +
+        ((size_t)incomplete->data[6] << 16) + ((size_t)incomplete->data[7] << 24);
+    if(chunkLength > incomplete->length && chunkLength - incomplete->length < size)
+        size = chunkLength - incomplete->length;
+    return size;
+}
+
 static UA_StatusCode
 socket_recv(UA_Connection *connection, UA_ByteString *response, UA_UInt32 timeout) {
-    response->data = (UA_Byte *)malloc(connection->localConf.recvBufferSize);
+    size_t size = socket_recvSize(connection);
+    response->data = BufferPool_get(socket_recvPool(connection),
+                                    connection->localConf.recvBufferSize);
     if(!response->data) {
         response->length = 0;
         return UA_STATUSCODE_BADOUTOFMEMORY; /* not enough memory retry */
@@ -145,7 +368,7 @@ socket_recv(UA_Connection *connection, UA_ByteString *response, UA_UInt32 timeou
                              (const char*)&timeout_dw, sizeof(DWORD));
 #endif
         if(0 != ret) {
-            UA_ByteString_deleteMembers(response);
+            socket_releaseRecvBuffer(connection, response);
             socket_close(connection);
             return UA_STATUSCODE_BADCONNECTIONCLOSED;
         }
@@ -164,29 +387,29 @@ socket_recv(UA_Connection *connection, UA_ByteString *response, UA_UInt32 timeou
         int retval = select(connection->sockfd+1, &fdset, NULL, NULL, &tmptv);
         if(retval && UA_fd_isset(connection->sockfd, &fdset)) {
             ret = recv(connection->sockfd, (char*)response->data,
-                       connection->localConf.recvBufferSize, 0);
+                       WIN32_INT size, 0);
         } else {
             ret = 0;
         }
     } else {
         ret = recv(connection->sockfd, (char*)response->data,
-                   connection->localConf.recvBufferSize, 0);
+                   WIN32_INT size, 0);
     }
 #else
     ssize_t ret = recv(connection->sockfd, (char*)response->data,
-                       connection->localConf.recvBufferSize, 0);
+                       WIN32_INT size, 0);
 #endif
 
     /* server has closed the connection */
     if(ret == 0) {
-        UA_ByteString_deleteMembers(response);
+        socket_releaseRecvBuffer(connection, response);
         socket_close(connection);
         return UA_STATUSCODE_BADCONNECTIONCLOSED;
     }
 
     /* error case */
     if(ret < 0) {
-        UA_ByteString_deleteMembers(response);
+        socket_releaseRecvBuffer(connection, response);
         if(errno__ == INTERRUPTED || (timeout > 0) ?
            false : (errno__ == EAGAIN || errno__ == WOULDBLOCK))
             return UA_STATUSCODE_GOOD; /* statuscode_good but no data -> retry */
@@ -262,6 +485,7 @@ typedef struct {
 } ConnectionMapping;
 
 typedef struct {
+    ConnectionBuffers buffers; /* first, the sockets find it at the handle */
     UA_ConnectionConfig conf;
     UA_UInt16 port;
     UA_Logger logger; // Set during start
@@ -276,18 +500,15 @@ static UA_StatusCode
 ServerNetworkLayerGetSendBuffer(UA_Connection *connection, size_t length, UA_ByteString *buf) {
     if(length > connection->remoteConf.recvBufferSize)
         return UA_STATUSCODE_BADCOMMUNICATIONERROR;
-    return UA_ByteString_allocBuffer(buf, length);
-}
-
-static void
-ServerNetworkLayerReleaseSendBuffer(UA_Connection *connection, UA_ByteString *buf) {
-    UA_ByteString_deleteMembers(buf);
+    buf->data = BufferPool_get(socket_sendPool(connection), length);
+    if(!buf->data) {
+        buf->length = 0;
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
 }
 
-static void
-ServerNetworkLayerReleaseRecvBuffer(UA_Connection *connection, UA_ByteString *buf) {
-    UA_ByteString_deleteMembers(buf);
-}
 
 /* after every select, we need to reset the sockets we want to listen on */
 static UA_Int32
@@ -326,13 +547,9 @@ ServerNetworkLayerTCP_closeConnection(UA_Connection *connection) {
     shutdown(connection->sockfd, 2);
 }
 
-/* call only from the single networking thread */
-static UA_StatusCode
-ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd) {
-    UA_Connection *c = (UA_Connection *)malloc(sizeof(UA_Connection));
-    if(!c)
-        return UA_STATUSCODE_BADINTERNALERROR;
-
+static void
+ServerNetworkLayerTCP_initConnection(ServerNetworkLayerTCP *layer, UA_Connection *c,
+                                     UA_Int32 newsockfd) {
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(struct sockaddr_in);
     int res = getpeername(newsockfd, (struct sockaddr*)&addr, &addrlen);
@@ -351,11 +568,24 @@ ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd) {
     c->localConf = layer->conf;
     c->remoteConf = layer->conf;
     c->send = socket_write;
+#ifndef _WIN32
+    c->sendv = socket_writev;
+#endif
     c->close = ServerNetworkLayerTCP_closeConnection;
     c->getSendBuffer = ServerNetworkLayerGetSendBuffer;
-    c->releaseSendBuffer = ServerNetworkLayerReleaseSendBuffer;
-    c->releaseRecvBuffer = ServerNetworkLayerReleaseRecvBuffer;
+    c->releaseSendBuffer = socket_releaseSendBuffer;
+    c->releaseRecvBuffer = socket_releaseRecvBuffer;
     c->state = UA_CONNECTION_OPENING;
+}
+
+/* call only from the single networking thread */
+static UA_StatusCode
+ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd) {
+    UA_Connection *c = (UA_Connection *)malloc(sizeof(UA_Connection));
+    if(!c)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    ServerNetworkLayerTCP_initConnection(layer, c, newsockfd);
+
     ConnectionMapping *nm;
     nm  = (ConnectionMapping *)realloc(layer->mappings, sizeof(ConnectionMapping)*(layer->mappingsSize+1));
     if(!nm) {
@@ -577,6 +807,7 @@ ServerNetworkLayerTCP_stop(UA_ServerNetworkLayer *nl, UA_Job **jobs) {
 /* run only when the server is stopped */
 static void ServerNetworkLayerTCP_deleteMembers(UA_ServerNetworkLayer *nl) {
     ServerNetworkLayerTCP *layer = (ServerNetworkLayerTCP *)nl->handle;
+    ConnectionBuffers_deleteMembers(&layer->buffers);
     free(layer->mappings);
     free(layer);
     UA_String_deleteMembers(&nl->discoveryUrl);
@@ -597,6 +828,7 @@ UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port) {
     if(!layer)
         return nl;
     
+    ConnectionBuffers_init(&layer->buffers, &conf, RECV_POOL_SERVER, SEND_POOL_SERVER);
     layer->conf = conf;
     layer->port = port;
 
@@ -608,6 +840,300 @@ UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port) {
     return nl;
 }
 
+#ifdef __linux__
+
+/*********************************/
+/* Server NetworkLayer TCP epoll */
+/*********************************/
+
+/**
+ * The epoll network layer accepts and reads like the select network layer
+ * above, but the sockets are registered once with an edge-triggered epoll
+ * instance and "GetJobs" only touches the connections that became readable.
+ * So the cost of an iteration does not grow with the number of idle
+ * connections and there is no FD_SETSIZE limit.
+ *
+ * Edge-triggered means a socket is reported once when data arrives. A
+ * connection is read once per "GetJobs" (one message job per connection,
+ * like the select network layer). When the read filled the whole receive
+ * buffer, more data may be waiting and the connection stays on the ready
+ * list for the next call. At most EPOLL_MAXEVENTS connections are read per
+ * call, the others wait on the ready list in arrival order.
+ *
+ * The jobs are written to a buffer of the layer that the server returns
+ * with "releaseJobs" instead of freeing it. */
+
+#include <sys/epoll.h>
+
+#define EPOLL_MAXEVENTS 256
+#define EPOLL_MAXACCEPT 64
+
+typedef struct EpollConnection {
+    UA_Connection connection; /* first, freed by FreeConnectionCallback */
+    struct EpollConnection *prev;
+    struct EpollConnection *next;
+    struct EpollConnection *nextReady;
+    UA_Boolean ready;
+} EpollConnection;
+
+typedef struct {
+    ServerNetworkLayerTCP tcp; /* first, the handle of the connections */
+    int epollfd;
+
+    /* open connections */
+    EpollConnection *connections;
+    size_t connectionsSize;
+
+    /* connections with unread data */
+    EpollConnection *readyFirst;
+    EpollConnection *readyLast;
+
+    struct epoll_event events[EPOLL_MAXEVENTS];
+    UA_Job jobs[EPOLL_MAXEVENTS * 2];
+} ServerNetworkLayerEpoll;
+
+static void
+epollReady(ServerNetworkLayerEpoll *layer, EpollConnection *ec) {
+    if(ec->ready)
+        return;
+    ec->ready = true;
+    ec->nextReady = NULL;
+    if(layer->readyLast)
+        layer->readyLast->nextReady = ec;
+    else
+        layer->readyFirst = ec;
+    layer->readyLast = ec;
+}
+
+static EpollConnection *
+epollNextReady(ServerNetworkLayerEpoll *layer) {
+    EpollConnection *ec = layer->readyFirst;
+    if(!ec)
+        return NULL;
+    layer->readyFirst = ec->nextReady;
+    if(!layer->readyFirst)
+        layer->readyLast = NULL;
+    ec->ready = false;
+    return ec;
+}
+
+static void
+epollAccept(ServerNetworkLayerEpoll *layer) {
+    /* the server socket is level-triggered, what is left is reported again */
+    for(size_t i = 0; i < EPOLL_MAXACCEPT; ++i) {
+        int newsockfd = accept(layer->tcp.serversockfd, NULL, NULL);
+        if(newsockfd < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                UA_LOG_WARNING(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                               "Accepting a connection failed with errno %i", errno);
+            return;
+        }
+        socket_set_nonblocking(newsockfd);
+        /* Do not merge packets on the socket (disable Nagle's algorithm) */
+        int nodelay = 1;
+        setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+
+        EpollConnection *ec = (EpollConnection *)malloc(sizeof(EpollConnection));
+        if(!ec) {
+            UA_LOG_ERROR(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                         "No memory for a new Connection");
+            CLOSESOCKET(newsockfd);
+            continue;
+        }
+        memset(ec, 0, sizeof(EpollConnection));
+        ServerNetworkLayerTCP_initConnection(&layer->tcp, &ec->connection, newsockfd);
+
+        /* data that arrived before is reported by the registration */
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = ec;
+        if(epoll_ctl(layer->epollfd, EPOLL_CTL_ADD, newsockfd, &ev) != 0) {
+            UA_LOG_WARNING(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                           "Connection %i | Registration with epoll failed "
+                           "with errno %i", newsockfd, errno);
+            CLOSESOCKET(newsockfd);
+            free(ec);
+            continue;
+        }
+
+        ec->next = layer->connections;
+        if(layer->connections)
+            layer->connections->prev = ec;
+        layer->connections = ec;
+        ++layer->connectionsSize;
+    }
+}
+
+/* the connection is freed once the jobs dispatched before are done */
+static size_t
+epollDetach(ServerNetworkLayerEpoll *layer, EpollConnection *ec, UA_Job *js) {
+    if(ec->prev)
+        ec->prev->next = ec->next;
+    else
+        layer->connections = ec->next;
+    if(ec->next)
+        ec->next->prev = ec->prev;
+    --layer->connectionsSize;
+
+    js[0].type = UA_JOBTYPE_DETACHCONNECTION;
+    js[0].job.closeConnection = &ec->connection;
+    js[1].type = UA_JOBTYPE_METHODCALL_DELAYED;
+    js[1].job.methodCall.method = FreeConnectionCallback;
+    js[1].job.methodCall.data = ec;
+    return 2;
+}
+
+static UA_StatusCode
+ServerNetworkLayerEpoll_start(UA_ServerNetworkLayer *nl, UA_Logger logger) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    UA_StatusCode retval = ServerNetworkLayerTCP_start(nl, logger);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    /* many clients may connect at once */
+    listen(layer->tcp.serversockfd, SOMAXCONN);
+
+    layer->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the server socket */
+    if(layer->epollfd < 0 ||
+       epoll_ctl(layer->epollfd, EPOLL_CTL_ADD, layer->tcp.serversockfd, &ev) != 0) {
+        UA_LOG_WARNING(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                       "Error creating the epoll instance, errno %i", errno);
+        if(layer->epollfd >= 0)
+            close(layer->epollfd);
+        layer->epollfd = -1;
+        CLOSESOCKET(layer->tcp.serversockfd);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static size_t
+ServerNetworkLayerEpoll_getJobs(UA_ServerNetworkLayer *nl, UA_Job **jobs,
+                                UA_UInt16 timeout) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+
+    /* don't wait while there is data left from the last call */
+    int n = epoll_wait(layer->epollfd, layer->events, EPOLL_MAXEVENTS,
+                       layer->readyFirst ? 0 : (int)timeout);
+    for(int i = 0; i < n; ++i) {
+        EpollConnection *ec = (EpollConnection *)layer->events[i].data.ptr;
+        if(!ec)
+            epollAccept(layer);
+        else
+            epollReady(layer, ec);
+    }
+
+    /* Read from the ready connections, every connection once. Those with
+     * more data are added to the end of the list again. */
+    size_t totalJobs = 0;
+    EpollConnection *last = layer->readyLast;
+    for(size_t i = 0; i < EPOLL_MAXEVENTS && layer->readyFirst; ++i) {
+        EpollConnection *ec = epollNextReady(layer);
+        UA_Connection *c = &ec->connection;
+
+        if(c->state == UA_CONNECTION_CLOSED) {
+            /* closed by the server, the shutdown woke us up */
+            socket_close(c);
+            totalJobs += epollDetach(layer, ec, &layer->jobs[totalJobs]);
+        } else {
+            UA_ByteString buf = UA_BYTESTRING_NULL;
+            size_t size = socket_recvSize(c);
+            UA_StatusCode retval = socket_recv(c, &buf, 0);
+            if(retval == UA_STATUSCODE_GOOD && buf.length > 0) {
+                layer->jobs[totalJobs].type = UA_JOBTYPE_BINARYMESSAGE_NETWORKLAYER;
+                layer->jobs[totalJobs].job.binaryMessage.connection = c;
+                layer->jobs[totalJobs].job.binaryMessage.message = buf;
+                ++totalJobs;
+                if(buf.length == size)
+                    epollReady(layer, ec);
+            } else if(retval == UA_STATUSCODE_BADCONNECTIONCLOSED) {
+                /* the socket is closed, which removes it from epoll */
+                UA_LOG_INFO(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                            "Connection %i | Connection closed from remote", c->sockfd);
+                totalJobs += epollDetach(layer, ec, &layer->jobs[totalJobs]);
+            } else if(retval != UA_STATUSCODE_GOOD) {
+                epollReady(layer, ec); /* out of memory, try again */
+            }
+        }
+        if(ec == last)
+            break;
+    }
+
+    *jobs = totalJobs > 0 ? layer->jobs : NULL;
+    return totalJobs;
+}
+
+/* the jobs buffer is reused */
+static void
+ServerNetworkLayerEpoll_releaseJobs(UA_ServerNetworkLayer *nl, UA_Job *jobs) {
+}
+
+static size_t
+ServerNetworkLayerEpoll_stop(UA_ServerNetworkLayer *nl, UA_Job **jobs) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    UA_LOG_INFO(layer->tcp.logger, UA_LOGCATEGORY_NETWORK,
+                "Shutting down the TCP network layer with %d open connection(s)",
+                layer->connectionsSize);
+    shutdown(layer->tcp.serversockfd, 2);
+    CLOSESOCKET(layer->tcp.serversockfd);
+    layer->readyFirst = layer->readyLast = NULL;
+
+    /* the server frees the array */
+    size_t size = layer->connectionsSize * 2;
+    UA_Job *items = (UA_Job *)malloc(sizeof(UA_Job) * (size > 0 ? size : 1));
+    if(!items)
+        return 0;
+    size_t k = 0;
+    while(layer->connections) {
+        EpollConnection *ec = layer->connections;
+        socket_close(&ec->connection);
+        k += epollDetach(layer, ec, &items[k]);
+    }
+    *jobs = items;
+    return k;
+}
+
+/* run only when the server is stopped */
+static void
+ServerNetworkLayerEpoll_deleteMembers(UA_ServerNetworkLayer *nl) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    if(layer->epollfd >= 0)
+        close(layer->epollfd);
+    ConnectionBuffers_deleteMembers(&layer->tcp.buffers);
+    free(layer);
+    UA_String_deleteMembers(&nl->discoveryUrl);
+}
+
+UA_ServerNetworkLayer
+UA_ServerNetworkLayerTCP_epoll(UA_ConnectionConfig conf, UA_UInt16 port) {
+    UA_ServerNetworkLayer nl;
+    memset(&nl, 0, sizeof(UA_ServerNetworkLayer));
+    ServerNetworkLayerEpoll *layer =
+        (ServerNetworkLayerEpoll *)calloc(1, sizeof(ServerNetworkLayerEpoll));
+    if(!layer)
+        return nl;
+
+    ConnectionBuffers_init(&layer->tcp.buffers, &conf, RECV_POOL_SERVER, SEND_POOL_SERVER);
+    layer->tcp.conf = conf;
+    layer->tcp.port = port;
+    layer->epollfd = -1;
+
+    nl.handle = layer;
+    nl.start = ServerNetworkLayerEpoll_start;
+    nl.getJobs = ServerNetworkLayerEpoll_getJobs;
+    nl.releaseJobs = ServerNetworkLayerEpoll_releaseJobs;
+    nl.stop = ServerNetworkLayerEpoll_stop;
+    nl.deleteMembers = ServerNetworkLayerEpoll_deleteMembers;
+    return nl;
+}
+
+#endif /* __linux__ */
+
 /***************************/
 /* Client NetworkLayer TCP */
 /***************************/
@@ -619,12 +1145,23 @@ ClientNetworkLayerGetBuffer(UA_Connection *connection, size_t length,
         return UA_STATUSCODE_BADCOMMUNICATIONERROR;
     if(connection->state == UA_CONNECTION_CLOSED)
         return UA_STATUSCODE_BADCONNECTIONCLOSED;
-    return UA_ByteString_allocBuffer(buf, connection->remoteConf.recvBufferSize);
+    buf->data = BufferPool_get(socket_sendPool(connection), length);
+    if(!buf->data) {
+        buf->length = 0;
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
 }
 
 static void
-ClientNetworkLayerReleaseBuffer(UA_Connection *connection, UA_ByteString *buf) {
-    UA_ByteString_deleteMembers(buf);
+ClientNetworkLayerCleanup(UA_Connection *connection) {
+    ConnectionBuffers *buffers = (ConnectionBuffers *)connection->handle;
+    if(!buffers)
+        return;
+    ConnectionBuffers_deleteMembers(buffers);
+    free(buffers);
+    connection->handle = NULL;
 }
 
 static void
@@ -640,7 +1177,7 @@ ClientNetworkLayerClose(UA_Connection *connection) {
     socket_close(connection);
 }
 
-/* we have no networklayer. instead, attach the reusable buffer to the handle */
+/* we have no networklayer. instead, attach the buffer pools to the handle */
 UA_Connection
 UA_ClientConnectionTCP(UA_ConnectionConfig conf, const char *endpointUrl,
                        UA_Logger logger) {
@@ -657,11 +1194,15 @@ UA_ClientConnectionTCP(UA_ConnectionConfig conf, const char *endpointUrl,
     connection.localConf = conf;
     connection.remoteConf = conf;
     connection.send = socket_write;
+#ifndef _WIN32
+    connection.sendv = socket_writev;
+#endif
     connection.recv = socket_recv;
     connection.close = ClientNetworkLayerClose;
     connection.getSendBuffer = ClientNetworkLayerGetBuffer;
-    connection.releaseSendBuffer = ClientNetworkLayerReleaseBuffer;
-    connection.releaseRecvBuffer = ClientNetworkLayerReleaseBuffer;
+    connection.releaseSendBuffer = socket_releaseSendBuffer;
+    connection.releaseRecvBuffer = socket_releaseRecvBuffer;
+    connection.cleanup = ClientNetworkLayerCleanup;
 
     UA_String endpointUrlString = UA_STRING((char*)(uintptr_t)endpointUrl);
     UA_String hostnameString = UA_STRING_NULL;
@@ -742,6 +1283,12 @@ UA_ClientConnectionTCP(UA_ConnectionConfig conf, const char *endpointUrl,
         return connection;
     }
 
+    /* without a pool the buffers are malloced */
+    ConnectionBuffers *buffers = (ConnectionBuffers *)malloc(sizeof(ConnectionBuffers));
+    if(buffers)
+        ConnectionBuffers_init(buffers, &conf, RECV_POOL_CLIENT, SEND_POOL_CLIENT);
+    connection.handle = buffers;
+
 #ifdef SO_NOSIGPIPE
     int val = 1;
     int sso_result = setsockopt(connection.sockfd,
@@ -14,6 +14,13 @@ extern "C" {
 UA_ServerNetworkLayer UA_EXPORT
 UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port);
 
+#ifdef __linux__
+/* Like UA_ServerNetworkLayerTCP, with epoll instead of select: an iteration
+ * only touches the connections with data, for servers with many clients. */
+UA_ServerNetworkLayer UA_EXPORT
+UA_ServerNetworkLayerTCP_epoll(UA_ConnectionConfig conf, UA_UInt16 port);
+#endif
+
 UA_Connection UA_EXPORT
 UA_ClientConnectionTCP(UA_ConnectionConfig conf, const char *endpointUrl, UA_Logger logger);
 
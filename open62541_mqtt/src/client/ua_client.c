@@ -644,6 +644,59 @@ UA_StatusCode UA_Client_manuallyRenewSecureChannel(UA_Client *client) {
     return retval;
 }
 
+UA_StatusCode UA_Client_renewSecureChannel(UA_Client *client) {
+    client->nextChannelRenewal = 0;
+    return UA_Client_manuallyRenewSecureChannel(client);
+}
+
+UA_StatusCode UA_Client_reconnect(UA_Client *client) {
+    if(!client->endpointUrl.data ||
+       UA_NodeId_equal(&client->authenticationToken, &UA_NODEID_NULL))
+        return UA_STATUSCODE_BADSESSIONIDINVALID;
+
+    /* Drop the old connection and channel. The session and its subscriptions
+     * live on in the server until the session times out. */
+    if(client->connection.state != UA_CONNECTION_CLOSED)
+        client->connection.close(&client->connection);
+    UA_SecureChannel_deleteMembersCleanup(&client->channel);
+    UA_Connection_deleteMembers(&client->connection);
+    memset(&client->channel, 0, sizeof(UA_SecureChannel));
+    client->channel.connection = &client->connection;
+    client->nextChannelRenewal = 0;
+
+    char *endpointUrl = (char*)UA_malloc(client->endpointUrl.length + 1);
+    if(!endpointUrl)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    memcpy(endpointUrl, client->endpointUrl.data, client->endpointUrl.length);
+    endpointUrl[client->endpointUrl.length] = 0;
+    client->connection =
+        client->config.connectionFunc(UA_ConnectionConfig_standard,
+                                      endpointUrl, client->config.logger);
+    UA_free(endpointUrl);
+    if(client->connection.state != UA_CONNECTION_OPENING) {
+        client->state = UA_CLIENTSTATE_FAULTED;
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+    }
+
+    /* Open a new channel and move the session over */
+    client->connection.localConf = client->config.localConnectionConfig;
+    UA_StatusCode retval = HelAckHandshake(client);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = SecureChannelHandshake(client, false);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = ActivateSession(client);
+    if(retval != UA_STATUSCODE_GOOD) {
+        client->state = UA_CLIENTSTATE_FAULTED;
+        return retval;
+    }
+
+    client->connection.state = UA_CONNECTION_ESTABLISHED;
+    client->state = UA_CLIENTSTATE_CONNECTED;
+    UA_LOG_INFO(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                "Reactivated the session on a new SecureChannel");
+    return UA_STATUSCODE_GOOD;
+}
+
 /****************/
 /* Raw Services */
 /****************/
@@ -667,6 +720,17 @@ processServiceResponse(struct ResponseDescription *rd, UA_SecureChannel *channel
         UA_NODEID_NUMERIC(0, UA_TYPES[UA_TYPES_SERVICEFAULT].binaryEncodingId);
 
     UA_ResponseHeader *respHeader = (UA_ResponseHeader*)rd->response;
+
+    /* A session moved to a new channel gets the answers to the requests still
+     * pending in the server, e.g. publish requests, sent on the new channel.
+     * Skip them and keep waiting for our response. The ids are compared as
+     * serial numbers, they wrap around. */
+    if(messageType == UA_MESSAGETYPE_MSG &&
+       (UA_Int32)(requestId - rd->requestId) < 0) {
+        UA_LOG_DEBUG(rd->client->config.logger, UA_LOGCATEGORY_CLIENT,
+                     "Discarding the response to the earlier request %u", requestId);
+        return;
+    }
     rd->processed = true;
 
     /* Forward declaration for the goto */
@@ -792,6 +856,9 @@ __UA_Client_Service(UA_Client *client, const void *request, const UA_DataType *r
         }
         if(retval != UA_STATUSCODE_GOOD) {
             respHeader->serviceResult = retval;
+            /* The connection is gone, the session may still be recovered */
+            if(client->connection.state == UA_CONNECTION_CLOSED)
+                client->state = UA_CLIENTSTATE_FAULTED;
             break;
         }
         /* ProcessChunks and call processServiceResponse for complete messages */
@@ -40,6 +40,7 @@ UA_Client_Subscriptions_new(UA_Client *client, UA_SubscriptionSettings settings,
     newSub->subscriptionID = response.subscriptionId;
     newSub->notificationsPerPublish = request.maxNotificationsPerPublish;
     newSub->priority = request.priority;
+    newSub->lastSequenceNumber = 0;
     LIST_INSERT_HEAD(&client->subscriptions, newSub, listEntry);
 
     if(newSubscriptionId)
@@ -127,6 +128,7 @@ UA_Client_Subscriptions_addMonitoredItem(UA_Client *client, UA_UInt32 subscripti
     UA_CreateMonitoredItemsRequest request;
     UA_CreateMonitoredItemsRequest_init(&request);
     request.subscriptionId = subscriptionId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
     UA_MonitoredItemCreateRequest item;
     UA_MonitoredItemCreateRequest_init(&item);
     item.itemToMonitor.nodeId = nodeId;
@@ -221,6 +223,91 @@ UA_Client_Subscriptions_removeMonitoredItem(UA_Client *client, UA_UInt32 subscri
     return UA_STATUSCODE_GOOD;
 }
 
+static void
+processNotificationMessage(UA_Client *client, UA_Client_Subscription *sub,
+                           UA_NotificationMessage *msg) {
+    for(size_t k = 0; k < msg->notificationDataSize; ++k) {
+        if(msg->notificationData[k].encoding != UA_EXTENSIONOBJECT_DECODED)
+            continue;
+
+        /* Currently only dataChangeNotifications are supported */
+        if(msg->notificationData[k].content.decoded.type != &UA_TYPES[UA_TYPES_DATACHANGENOTIFICATION])
+            continue;
+
+        UA_DataChangeNotification *dataChangeNotification = (UA_DataChangeNotification *)msg->notificationData[k].content.decoded.data;
+        for(size_t j = 0; j < dataChangeNotification->monitoredItemsSize; ++j) {
+            UA_MonitoredItemNotification *mitemNot = &dataChangeNotification->monitoredItems[j];
+            UA_Client_MonitoredItem *mon;
+            LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
+                if(mon->clientHandle == mitemNot->clientHandle) {
+                    mon->handler(mon->monitoredItemId, &mitemNot->value, mon->handlerContext);
+                    break;
+                }
+            }
+            if(!mon)
+                UA_LOG_DEBUG(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                             "Could not process a notification with clienthandle %u on subscription %u",
+                             mitemNot->clientHandle, sub->subscriptionID);
+        }
+    }
+}
+
+static void
+addPendingAck(UA_Client *client, UA_Client_Subscription *sub, UA_UInt32 sequenceNumber) {
+    UA_Client_NotificationsAckNumber *tmpAck =
+        (UA_Client_NotificationsAckNumber*)UA_malloc(sizeof(UA_Client_NotificationsAckNumber));
+    if(!tmpAck) {
+        UA_LOG_WARNING(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                       "Not enough memory to store the acknowledgement for a publish "
+                       "message on subscription %u", sub->subscriptionID);
+        return;
+    }
+    tmpAck->subAck.sequenceNumber = sequenceNumber;
+    tmpAck->subAck.subscriptionId = sub->subscriptionID;
+    LIST_INSERT_HEAD(&client->pendingNotificationsAcks, tmpAck, listEntry);
+}
+
+/* Do not ask for more messages than a server usually keeps for retransmission */
+#define UA_MAXREPUBLISH 64
+
+/* Fetches the messages between the last one processed and the given sequence
+ * number from the retransmission queue of the server. They were sent while
+ * the connection was down. */
+static void
+republishMissing(UA_Client *client, UA_Client_Subscription *sub, UA_UInt32 next) {
+    UA_UInt32 first = sub->lastSequenceNumber + 1;
+    if(next - first > UA_MAXREPUBLISH) {
+        UA_LOG_WARNING(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                       "Subscription %u lost the notification messages %u to %u",
+                       sub->subscriptionID, first, next - UA_MAXREPUBLISH - 1);
+        first = next - UA_MAXREPUBLISH;
+    }
+
+    for(UA_UInt32 seq = first; seq < next; ++seq) {
+        UA_RepublishRequest request;
+        UA_RepublishRequest_init(&request);
+        request.subscriptionId = sub->subscriptionID;
+        request.retransmitSequenceNumber = seq;
+
+        UA_RepublishResponse response;
+        __UA_Client_Service(client, &request, &UA_TYPES[UA_TYPES_REPUBLISHREQUEST],
+                            &response, &UA_TYPES[UA_TYPES_REPUBLISHRESPONSE]);
+        if(response.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+            UA_LOG_DEBUG(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                         "Republished notification message %u on subscription %u",
+                         seq, sub->subscriptionID);
+            processNotificationMessage(client, sub, &response.notificationMessage);
+            addPendingAck(client, sub, seq);
+        } else {
+            UA_LOG_WARNING(client->config.logger, UA_LOGCATEGORY_CLIENT,
+                           "Subscription %u lost the notification message %u",
+                           sub->subscriptionID, seq);
+        }
+        UA_RepublishResponse_deleteMembers(&response);
+        UA_RepublishRequest_deleteMembers(&request);
+    }
+}
+
 static void
 UA_Client_processPublishResponse(UA_Client *client, UA_PublishRequest *request,
                                  UA_PublishResponse *response) {
@@ -261,50 +348,27 @@ UA_Client_processPublishResponse(UA_Client *client, UA_PublishRequest *request,
         }
     }
 
-    /* Process the notification messages */
+    /* A gap in the sequence numbers means responses were lost on the way, e.g.
+     * when the connection broke. A keep-alive carries the number of the next
+     * message, a notification message its own. */
     UA_NotificationMessage *msg = &response->notificationMessage;
-    for(size_t k = 0; k < msg->notificationDataSize; ++k) {
-        if(msg->notificationData[k].encoding != UA_EXTENSIONOBJECT_DECODED)
-            continue;
+    if(msg->sequenceNumber > sub->lastSequenceNumber + 1)
+        republishMissing(client, sub, msg->sequenceNumber);
 
-        /* Currently only dataChangeNotifications are supported */
-        if(msg->notificationData[k].content.decoded.type != &UA_TYPES[UA_TYPES_DATACHANGENOTIFICATION])
-            continue;
-
-        UA_DataChangeNotification *dataChangeNotification = (UA_DataChangeNotification *)msg->notificationData[k].content.decoded.data;
-        for(size_t j = 0; j < dataChangeNotification->monitoredItemsSize; ++j) {
-            UA_MonitoredItemNotification *mitemNot = &dataChangeNotification->monitoredItems[j];
-            UA_Client_MonitoredItem *mon;
-            LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
-                if(mon->clientHandle == mitemNot->clientHandle) {
-                    mon->handler(mon->monitoredItemId, &mitemNot->value, mon->handlerContext);
-                    break;
-                }
-            }
-            if(!mon)
-                UA_LOG_DEBUG(client->config.logger, UA_LOGCATEGORY_CLIENT,
-                             "Could not process a notification with clienthandle %u on subscription %u",
-                             mitemNot->clientHandle, sub->subscriptionID);
-        }
-    }
+    /* Process the notification messages */
+    processNotificationMessage(client, sub, msg);
+    if(msg->notificationDataSize > 0)
+        sub->lastSequenceNumber = msg->sequenceNumber;
+    else if(msg->sequenceNumber > 0)
+        sub->lastSequenceNumber = msg->sequenceNumber - 1;
 
     /* Add to the list of pending acks */
-    UA_Client_NotificationsAckNumber *tmpAck =
-        (UA_Client_NotificationsAckNumber*)UA_malloc(sizeof(UA_Client_NotificationsAckNumber));
-    if(!tmpAck) {
-        UA_LOG_WARNING(client->config.logger, UA_LOGCATEGORY_CLIENT,
-                       "Not enough memory to store the acknowledgement for a publish "
-                       "message on subscription %u", sub->subscriptionID);
-        return;
-    }
-    tmpAck->subAck.sequenceNumber = msg->sequenceNumber;
-    tmpAck->subAck.subscriptionId = sub->subscriptionID;
-    LIST_INSERT_HEAD(&client->pendingNotificationsAcks, tmpAck, listEntry);
+    addPendingAck(client, sub, msg->sequenceNumber);
 }
 
 UA_StatusCode
 UA_Client_Subscriptions_manuallySendPublishRequest(UA_Client *client) {
-    if (client->state == UA_CLIENTSTATE_ERRORED)
+    if (client->state == UA_CLIENTSTATE_ERRORED || client->state == UA_CLIENTSTATE_FAULTED)
         return UA_STATUSCODE_BADSERVERNOTCONNECTED;
 
     UA_Boolean moreNotifications = true;
@@ -22,6 +22,7 @@ struct UA_NodeStore {
     UA_UInt32 size;
     UA_UInt32 count;
     UA_UInt32 sizePrimeIndex;
+    UA_UInt32 generation; /* incremented when a node is replaced or removed */
 };
 
 /* The size of the hash-map is always a prime number. They are chosen to be
@@ -190,6 +191,7 @@ UA_NodeStore_new(void) {
     ns->sizePrimeIndex = higher_prime_index(UA_NODESTORE_MINSIZE);
     ns->size = primes[ns->sizePrimeIndex];
     ns->count = 0;
+    ns->generation = 0;
     ns->entries = (UA_NodeStoreEntry **)UA_calloc(ns->size, sizeof(UA_NodeStoreEntry*));
     if(!ns->entries) {
         UA_free(ns);
@@ -279,6 +281,7 @@ UA_NodeStore_replace(UA_NodeStore *ns, UA_Node *node) {
     }
     deleteEntry(*entry);
     *entry = newEntry;
+    ++ns->generation;
     return UA_STATUSCODE_GOOD;
 }
 
@@ -290,6 +293,11 @@ UA_NodeStore_get(UA_NodeStore *ns, const UA_NodeId *nodeid) {
     return (const UA_Node*)&(*entry)->node;
 }
 
+UA_UInt32
+UA_NodeStore_generation(const UA_NodeStore *ns) {
+    return ns->generation;
+}
+
 UA_Node *
 UA_NodeStore_getCopy(UA_NodeStore *ns, const UA_NodeId *nodeid) {
     UA_NodeStoreEntry **slot = findNode(ns, nodeid);
@@ -315,6 +323,7 @@ UA_NodeStore_remove(UA_NodeStore *ns, const UA_NodeId *nodeid) {
     deleteEntry(*slot);
     *slot = UA_NODESTORE_TOMBSTONE;
     --ns->count;
+    ++ns->generation;
     /* Downsize the hashmap if it is very empty */
     if(ns->count * 8 < ns->size && ns->size > 32)
         expand(ns); // this can fail. we just continue with the bigger hashmap.
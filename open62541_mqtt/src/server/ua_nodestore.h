@@ -70,6 +70,12 @@ UA_StatusCode UA_NodeStore_insert(UA_NodeStore *ns, UA_Node *node);
 /* The returned node is immutable. */
 const UA_Node * UA_NodeStore_get(UA_NodeStore *ns, const UA_NodeId *nodeid);
 
+#ifndef UA_ENABLE_MULTITHREADING
+/* Changes whenever a node is replaced or removed. A pointer returned by
+ * UA_NodeStore_get remains valid as long as the generation is unchanged. */
+UA_UInt32 UA_NodeStore_generation(const UA_NodeStore *ns);
+#endif
+
 /* Returns an editable copy of a node (needs to be deleted with the deleteNode
    function or inserted / replaced into the nodestore). */
 UA_Node * UA_NodeStore_getCopy(UA_NodeStore *ns, const UA_NodeId *nodeid);
@@ -14,6 +14,10 @@
 #include "ua_namespaceinit_generated.h"
 #endif
 
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+#include "ua_subscription.h"
+#endif
+
 #if defined(UA_ENABLE_MULTITHREADING) && !defined(NDEBUG)
 UA_THREAD_LOCAL bool rcu_locked = false;
 #endif
@@ -142,6 +146,9 @@ UA_Server_forEachChildNodeCall(UA_Server *server, UA_NodeId parentNodeId,
 void UA_Server_delete(UA_Server *server) {
     // Delete the timed work
     UA_RepeatedJobsList_deleteMembers(&server->repeatedJobs);
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    UA_Server_deleteSamplingSets(server);
+#endif
 
     // Delete all internal data
     UA_SecureChannelManager_deleteMembers(&server->secureChannelManager);
@@ -191,10 +198,6 @@ void UA_Server_delete(UA_Server *server) {
 
 #endif
 
-#ifdef UA_ENABLE_MULTITHREADING
-    pthread_cond_destroy(&server->dispatchQueue_condition);
-    pthread_mutex_destroy(&server->dispatchQueue_mutex);
-#endif
     UA_free(server);
 }
 
@@ -281,15 +284,19 @@ UA_Server_new(const UA_ServerConfig config) {
                              (UA_RepeatedJobsListProcessCallback)UA_Server_processJob, server);
 #endif
 
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    LIST_INIT(&server->samplingSets);
+#endif
+
     /* Initialized the linked list for delayed callbacks */
 #ifndef UA_ENABLE_MULTITHREADING
     SLIST_INIT(&server->delayedCallbacks);
 #endif
 
-    /* Initialized the dispatch queue for worker threads */
+    /* Initialized the dispatch queue entries for worker threads */
 #ifdef UA_ENABLE_MULTITHREADING
     rcu_init();
-    cds_wfcq_init(&server->dispatchQueue_head, &server->dispatchQueue_tail);
+    cds_lfs_init(&server->dispatchReturned);
     cds_lfs_init(&server->mainLoopJobs);
 #endif
 
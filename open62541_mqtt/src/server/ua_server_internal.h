@@ -70,13 +70,24 @@ typedef struct UA_ExternalNamespace {
 #endif
 
 #ifdef UA_ENABLE_MULTITHREADING
+/* Every worker has its own queue of dispatched jobs. Idle workers steal from
+ * the queues of the others. A worker sleeps on its own condition and is woken
+ * up only when a job is waiting for it. */
 typedef struct {
+    /* Written by the main thread on dispatch */
+    struct cds_wfcq_tail queue_tail;
+    volatile UA_Boolean sleeping;
+    char padding1[64 - sizeof(struct cds_wfcq_tail) - sizeof(UA_Boolean)];
+
+    /* Dequeued by the worker and by thieves */
+    struct cds_wfcq_head queue_head;
     UA_Server *server;
     pthread_t thr;
     UA_UInt32 counter;
     volatile UA_Boolean running;
-    char padding[64 - sizeof(void*) - sizeof(pthread_t) -
-                 sizeof(UA_UInt32) - sizeof(UA_Boolean)]; // separate cache lines
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t sleep_condition;
+    char padding2[64]; // separate cache lines
 } UA_Worker;
 
 struct MainLoopJob {
@@ -179,18 +190,21 @@ struct UA_Server {
     /* Jobs with a repetition interval */
     UA_RepeatedJobsList repeatedJobs;
 
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    /* Monitored items with the same sampling interval share one sample job */
+    LIST_HEAD(UA_SamplingSets, UA_SamplingSet) samplingSets;
+#endif
+
 #ifndef UA_ENABLE_MULTITHREADING
     SLIST_HEAD(DelayedJobsList, UA_DelayedJob) delayedCallbacks;
 #else
-    /* Dispatch queue head for the worker threads (the tail should not be in the same cache line) */
-    struct cds_wfcq_head dispatchQueue_head;
     UA_Worker *workers; /* there are nThread workers in a running server */
+    size_t dispatchNext; /* round robin for jobs without a connection */
+    struct cds_lfs_node *dispatchPool; /* free queue entries, used by the main thread only */
+    struct cds_lfs_stack dispatchReturned; /* queue entries the workers are done with */
     struct cds_lfs_stack mainLoopJobs; /* Work that shall be executed only in the main loop and not
                                           by worker threads */
     struct DelayedJobs *delayedJobs;
-    pthread_cond_t dispatchQueue_condition; /* so the workers don't spin if the queue is empty */
-    pthread_mutex_t dispatchQueue_mutex; /* mutex for access to condition variable */
-    struct cds_wfcq_tail dispatchQueue_tail; /* Dispatch queue tail for the worker threads */
 #endif
 
     /* Config is the last element so that MSVC allows the usernamePasswordLogins
@@ -316,6 +330,12 @@ void Service_Read_single(UA_Server *server, UA_Session *session,
                          UA_TimestampsToReturn timestamps,
                          const UA_ReadValueId *id, UA_DataValue *v);
 
+/* Read an attribute of a node that was already looked up. The dataEncoding and
+ * the indexRange are not checked. */
+void ReadWithNode(const UA_Node *node, UA_Server *server, UA_Session *session,
+                  UA_TimestampsToReturn timestamps,
+                  const UA_ReadValueId *id, UA_DataValue *v);
+
 void Service_Call_single(UA_Server *server, UA_Session *session,
                          const UA_CallMethodRequest *request,
                          UA_CallMethodResult *result);
@@ -35,10 +35,12 @@
  * [2] Hart, T. E., McKenney, P. E., Brown, A. D., & Walpole, J. (2007). Performance of memory reclamation
  *     for lockless synchronization. Journal of Parallel and Distributed Computing, 67(12), 1270-1285.
  *
- * Future Plans: Use work-stealing to load-balance between cores.
- * [3] Le, Nhat Minh, et al. "Correct and efficient work-stealing for weak
- *     memory models." ACM SIGPLAN Notices. Vol. 48. No. 8. ACM, 2013.
- */
+ * Every worker has its own queue. Messages and connection jobs are dispatched
+ * to the worker of their connection, so a connection stays on the same core
+ * while the workers keep up. Other jobs go round robin. A worker that runs out
+ * of jobs steals from the queues of the others before it sleeps. The main
+ * thread wakes up only the worker it dispatched to, or one sleeping worker to
+ * steal the job when that one is busy. */
 
 #define UA_MAXTIMEOUT 50 // max timeout in millisec until the next main loop iteration
 
@@ -89,11 +91,108 @@ UA_Server_processJob(UA_Server *server, UA_Job *job) {
 
 #ifdef UA_ENABLE_MULTITHREADING
 
+/* A job in the queue of a worker. The entries are taken from a pool of the
+ * main thread, the workers return them to a lock-free stack. The pool keeps as
+ * many entries as were queued at once. */
 struct DispatchJob {
-    struct cds_wfcq_node node; // node for the queue
+    union {
+        struct cds_wfcq_node queue; // node for the queue of a worker
+        struct cds_lfs_node pool; // node in the pool of free entries
+    } node;
     UA_Job job;
 };
 
+static struct DispatchJob *
+getDispatchJob(UA_Server *server) {
+    /* take back everything the workers returned in one go */
+    if(!server->dispatchPool) {
+        struct cds_lfs_head *head = __cds_lfs_pop_all(&server->dispatchReturned);
+        if(head)
+            server->dispatchPool = &head->node;
+    }
+    struct cds_lfs_node *node = server->dispatchPool;
+    if(!node)
+        return (struct DispatchJob*)UA_malloc(sizeof(struct DispatchJob));
+    server->dispatchPool = node->next;
+    return (struct DispatchJob*)node;
+}
+
+static void
+returnDispatchJob(UA_Server *server, struct DispatchJob *dj) {
+    cds_lfs_node_init(&dj->node.pool);
+    cds_lfs_push(&server->dispatchReturned, &dj->node.pool);
+}
+
+static void
+freeDispatchJobs(UA_Server *server) {
+    struct cds_lfs_head *head = __cds_lfs_pop_all(&server->dispatchReturned);
+    struct cds_lfs_node *node = head ? &head->node : NULL;
+    while(node) {
+        struct cds_lfs_node *next = node->next;
+        UA_free(node);
+        node = next;
+    }
+    node = server->dispatchPool;
+    while(node) {
+        struct cds_lfs_node *next = node->next;
+        UA_free(node);
+        node = next;
+    }
+    server->dispatchPool = NULL;
+}
+
+static struct DispatchJob *
+dequeueJob(UA_Worker *worker) {
+    if(cds_wfcq_empty(&worker->queue_head, &worker->queue_tail))
+        return NULL;
+    return (struct DispatchJob*)
+        cds_wfcq_dequeue_blocking(&worker->queue_head, &worker->queue_tail);
+}
+
+/* The own queue first, then steal from the others */
+static struct DispatchJob *
+takeJob(UA_Server *server, UA_Worker *worker) {
+    struct DispatchJob *dj = dequeueJob(worker);
+    size_t self = (size_t)(worker - server->workers);
+    for(size_t i = 1; !dj && i < server->config.nThreads; ++i)
+        dj = dequeueJob(&server->workers[(self + i) % server->config.nThreads]);
+    return dj;
+}
+
+static UA_Boolean
+jobsQueued(UA_Server *server) {
+    for(size_t i = 0; i < server->config.nThreads; ++i) {
+        UA_Worker *worker = &server->workers[i];
+        if(!cds_wfcq_empty(&worker->queue_head, &worker->queue_tail))
+            return true;
+    }
+    return false;
+}
+
+/* The sleeping flag is set before the queues are checked. The main thread
+ * enqueues before it checks the flag. So either the worker sees the job or
+ * the main thread sees the sleeping worker and wakes it up. */
+static void
+workerSleep(UA_Server *server, UA_Worker *worker) {
+    pthread_mutex_lock(&worker->sleep_mutex);
+    worker->sleeping = true;
+    UA_atomic_sync();
+    if(worker->running && !jobsQueued(server)) {
+        while(worker->sleeping)
+            pthread_cond_wait(&worker->sleep_condition, &worker->sleep_mutex);
+    }
+    worker->sleeping = false;
+    pthread_mutex_unlock(&worker->sleep_mutex);
+}
+
+static void
+wakeWorker(UA_Worker *worker) {
+    pthread_mutex_lock(&worker->sleep_mutex);
+    worker->sleeping = false;
+    pthread_cond_signal(&worker->sleep_condition);
+    pthread_mutex_unlock(&worker->sleep_mutex);
+}
+
 static void *
 workerLoop(UA_Worker *worker) {
     UA_Server *server = worker->server;
@@ -105,16 +204,13 @@ workerLoop(UA_Worker *worker) {
     rcu_register_thread();
 
     while(*running) {
-        struct DispatchJob *dj = (struct DispatchJob*)
-            cds_wfcq_dequeue_blocking(&server->dispatchQueue_head, &server->dispatchQueue_tail);
+        struct DispatchJob *dj = takeJob(server, worker);
         if(dj) {
             UA_Server_processJob(server, &dj->job);
-            UA_free(dj);
+            returnDispatchJob(server, dj);
         } else {
-            /* nothing to do. sleep until a job is dispatched (and wakes up all worker threads) */
-            pthread_mutex_lock(&server->dispatchQueue_mutex);
-            pthread_cond_wait(&server->dispatchQueue_condition, &server->dispatchQueue_mutex);
-            pthread_mutex_unlock(&server->dispatchQueue_mutex);
+            /* nothing to do. sleep until a job is dispatched to this worker */
+            workerSleep(server, worker);
         }
         UA_atomic_add(counter, 1);
     }
@@ -126,23 +222,70 @@ workerLoop(UA_Worker *worker) {
     return NULL;
 }
 
+/* Call from the main thread only */
+static void
+dispatchToWorker(UA_Server *server, UA_Worker *worker, const UA_Job *job) {
+    struct DispatchJob *dj = getDispatchJob(server);
+    if(!dj) {
+        UA_LOG_ERROR(server->config.logger, UA_LOGCATEGORY_SERVER,
+                     "Not enough memory to dispatch a job, process it in the main loop");
+        UA_Job j = *job;
+        UA_Server_processJob(server, &j);
+        return;
+    }
+    dj->job = *job;
+    cds_wfcq_node_init(&dj->node.queue);
+    cds_wfcq_enqueue(&worker->queue_head, &worker->queue_tail, &dj->node.queue);
+    UA_atomic_sync(); /* see workerSleep */
+    if(worker->sleeping) {
+        wakeWorker(worker);
+        return;
+    }
+
+    /* the worker is busy. wake up a sleeping one to steal the job */
+    for(size_t i = 0; i < server->config.nThreads; ++i) {
+        if(server->workers[i].sleeping) {
+            wakeWorker(&server->workers[i]);
+            return;
+        }
+    }
+}
+
 void
 UA_Server_dispatchJob(UA_Server *server, const UA_Job *job) {
-    struct DispatchJob *dj = UA_malloc(sizeof(struct DispatchJob));
-    // todo: check malloc
-    dj->job = *job;
-    cds_wfcq_node_init(&dj->node);
-    cds_wfcq_enqueue(&server->dispatchQueue_head, &server->dispatchQueue_tail, &dj->node);
+    if(!server->workers) {
+        UA_Job j = *job;
+        UA_Server_processJob(server, &j);
+        return;
+    }
+
+    /* the jobs of a connection go to the same worker */
+    const UA_Connection *connection = NULL;
+    if(job->type == UA_JOBTYPE_BINARYMESSAGE_NETWORKLAYER ||
+       job->type == UA_JOBTYPE_BINARYMESSAGE_ALLOCATED)
+        connection = job->job.binaryMessage.connection;
+    else if(job->type == UA_JOBTYPE_DETACHCONNECTION)
+        connection = job->job.closeConnection;
+
+    size_t index;
+    if(connection)
+        index = (size_t)connection->sockfd % server->config.nThreads;
+    else
+        index = server->dispatchNext++ % server->config.nThreads;
+    dispatchToWorker(server, &server->workers[index], job);
 }
 
+/* Process what is still queued after the workers have stopped */
 static void
 emptyDispatchQueue(UA_Server *server) {
-    while(!cds_wfcq_empty(&server->dispatchQueue_head, &server->dispatchQueue_tail)) {
-        struct DispatchJob *dj = (struct DispatchJob*)
-            cds_wfcq_dequeue_blocking(&server->dispatchQueue_head, &server->dispatchQueue_tail);
-        UA_Server_processJob(server, &dj->job);
-        UA_free(dj);
+    for(size_t i = 0; i < server->config.nThreads; ++i) {
+        struct DispatchJob *dj;
+        while((dj = dequeueJob(&server->workers[i]))) {
+            UA_Server_processJob(server, &dj->job);
+            returnDispatchJob(server, dj);
+        }
     }
+    freeDispatchJobs(server);
 }
 
 #endif
@@ -196,16 +339,35 @@ processDelayedCallbacks(UA_Server *server) {
 struct DelayedJobs {
     struct DelayedJobs *next;
     UA_UInt32 *workerCounters; // initially NULL until the counter are set
+    UA_UInt32 markers; // worker queues that still hold jobs dispatched before the list was full
     UA_UInt32 jobsCount; // the size of the array is DELAYEDJOBSSIZE, the count may be less
     UA_Job jobs[DELAYEDJOBSSIZE]; // when it runs full, a new delayedJobs entry is created
 };
 
-/* Dispatched as an ordinary job when the DelayedJobs list is full */
-static void getCounters(UA_Server *server, struct DelayedJobs *delayed) {
+/* Set instead of the counters when they could not be allocated. They are
+ * taken later on, when the delayed jobs are checked. */
+static UA_UInt32 countersMissing;
+
+static UA_UInt32 *
+copyCounters(UA_Server *server) {
     UA_UInt32 *counters = UA_malloc(server->config.nThreads * sizeof(UA_UInt32));
+    if(!counters)
+        return NULL;
     for(UA_UInt16 i = 0; i < server->config.nThreads; ++i)
         counters[i] = server->workers[i].counter;
-    delayed->workerCounters = counters;
+    return counters;
+}
+
+/* Dispatched into the queue of every worker when the DelayedJobs list is
+ * full. When the last of them runs, all jobs dispatched before have been
+ * taken from the queues. Then the counters are set. */
+static void getCounters(UA_Server *server, struct DelayedJobs *delayed) {
+    if(UA_atomic_add(&delayed->markers, (UA_UInt32)-1) > 0)
+        return;
+    UA_UInt32 *counters = copyCounters(server);
+    if(!counters)
+        counters = &countersMissing;
+    UA_atomic_xchg((void**)&delayed->workerCounters, counters);
 }
 
 /* Call from the main thread only. This is the only function that modifies */
@@ -228,11 +390,13 @@ addDelayedJob(UA_Server *server, UA_Job *job) {
         server->delayedJobs = dj;
 
         /* dispatch a method that sets the counter for the full list that comes afterwards */
-        if(dj->next) {
+        if(dj->next && server->workers) {
             UA_Job setCounter = (UA_Job){
                 .type = UA_JOBTYPE_METHODCALL, .job.methodCall =
                 {.method = (void (*)(UA_Server*, void*))getCounters, .data = dj->next}};
-            UA_Server_dispatchJob(server, &setCounter);
+            dj->next->markers = server->config.nThreads;
+            for(size_t i = 0; i < server->config.nThreads; ++i)
+                dispatchToWorker(server, &server->workers[i], &setCounter);
         }
     }
     dj->jobs[dj->jobsCount] = *job;
@@ -260,6 +424,19 @@ UA_Server_delayedCallback(UA_Server *server, UA_ServerCallback callback, void *d
     return UA_STATUSCODE_GOOD;
 }
 
+static void
+processDelayedJobsList(UA_Server *server, struct DelayedJobs *dw) {
+    while(dw) {
+        for(size_t i = 0; i < dw->jobsCount; ++i)
+            UA_Server_processJob(server, &dw->jobs[i]);
+        struct DelayedJobs *next = dw->next;
+        if(dw->workerCounters != &countersMissing)
+            UA_free(dw->workerCounters);
+        UA_free(dw);
+        dw = next;
+    }
+}
+
 /* Find out which delayed jobs can be executed now */
 static void
 dispatchDelayedJobs(UA_Server *server, void *_) {
@@ -275,9 +452,21 @@ dispatchDelayedJobs(UA_Server *server, void *_) {
             dw = dw->next;
             continue;
         }
+        /* counters taken now are later than the markers, the jobs wait at
+         * least as long. try again on the next check if that fails too. */
+        if(dw->workerCounters == &countersMissing) {
+            UA_UInt32 *counters = copyCounters(server);
+            if(counters)
+                dw->workerCounters = counters;
+            beforedw = dw;
+            dw = dw->next;
+            continue;
+        }
         UA_Boolean allMoved = true;
+        /* a sleeping worker has finished its job */
         for(size_t i = 0; i < server->config.nThreads; ++i) {
-            if(dw->workerCounters[i] == server->workers[i].counter) {
+            if(dw->workerCounters[i] == server->workers[i].counter &&
+               !server->workers[i].sleeping) {
                 allMoved = false;
                 break;
             }
@@ -288,15 +477,19 @@ dispatchDelayedJobs(UA_Server *server, void *_) {
         dw = dw->next;
     }
 
-    /* process and free all delayed jobs from here on */
-    while(dw) {
-        for(size_t i = 0; i < dw->jobsCount; ++i)
-            UA_Server_processJob(server, &dw->jobs[i]);
-        struct DelayedJobs *next = UA_atomic_xchg((void**)&beforedw->next, NULL);
-        UA_free(dw->workerCounters);
-        UA_free(dw);
-        dw = next;
-    }
+    /* cut the list and process and free all delayed jobs from here on */
+    if(dw)
+        UA_atomic_xchg((void**)&beforedw->next, NULL);
+    processDelayedJobsList(server, dw);
+}
+
+/* Call when the workers have stopped. Nothing can still use what the delayed
+ * jobs free. */
+static void
+processAllDelayedJobs(UA_Server *server) {
+    struct DelayedJobs *dw = server->delayedJobs;
+    server->delayedJobs = NULL;
+    processDelayedJobsList(server, dw);
 }
 
 #endif
@@ -327,18 +520,23 @@ UA_StatusCode UA_Server_run_startup(UA_Server *server) {
     /* Spin up the worker threads */
     UA_LOG_INFO(server->config.logger, UA_LOGCATEGORY_SERVER,
                 "Spinning up %u worker thread(s)", server->config.nThreads);
-    pthread_cond_init(&server->dispatchQueue_condition, 0);
-    pthread_mutex_init(&server->dispatchQueue_mutex, 0);
-    server->workers = UA_malloc(server->config.nThreads * sizeof(UA_Worker));
-    if(!server->workers)
+    UA_Worker *workers = UA_malloc(server->config.nThreads * sizeof(UA_Worker));
+    if(!workers)
         return UA_STATUSCODE_BADOUTOFMEMORY;
     for(size_t i = 0; i < server->config.nThreads; ++i) {
-        UA_Worker *worker = &server->workers[i];
+        UA_Worker *worker = &workers[i];
+        cds_wfcq_init(&worker->queue_head, &worker->queue_tail);
+        pthread_mutex_init(&worker->sleep_mutex, 0);
+        pthread_cond_init(&worker->sleep_condition, 0);
         worker->server = server;
         worker->counter = 0;
         worker->running = true;
-        pthread_create(&worker->thr, NULL, (void* (*)(void*))workerLoop, worker);
+        worker->sleeping = false;
     }
+    /* the workers steal from each other, all queues exist before the first starts */
+    server->workers = workers;
+    for(size_t i = 0; i < server->config.nThreads; ++i)
+        pthread_create(&workers[i].thr, NULL, (void* (*)(void*))workerLoop, &workers[i]);
 
     /* Try to execute delayed callbacks every 10 sec */
     UA_Job processDelayed = {.type = UA_JOBTYPE_METHODCALL,
@@ -396,7 +594,7 @@ UA_UInt16 UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal) {
 #endif
     /* Process repeated work */
     UA_DateTime now = UA_DateTime_nowMonotonic();
-    UA_Boolean dispatched = false; /* to wake up worker threads */
+    UA_Boolean dispatched = false;
     UA_DateTime nextRepeated =
         UA_RepeatedJobsList_process(&server->repeatedJobs, now, &dispatched);
     UA_DateTime latest = now + (UA_MAXTIMEOUT * UA_MSEC_TO_DATETIME);
@@ -436,22 +634,21 @@ UA_UInt16 UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal) {
         for(size_t j = 0; j < jobsSize; ++j) {
 #ifdef UA_ENABLE_MULTITHREADING
             UA_Server_dispatchJob(server, &jobs[j]);
-            dispatched = true;
 #else
             UA_Server_processJob(server, &jobs[j]);
 #endif
         }
 
         /* Clean up jobs list */
-        if(jobsSize > 0)
-            UA_free(jobs);
+        if(jobsSize > 0) {
+            if(nl->releaseJobs)
+                nl->releaseJobs(nl, jobs);
+            else
+                UA_free(jobs);
+        }
     }
 
-#ifdef UA_ENABLE_MULTITHREADING
-    /* Wake up worker threads */
-    if(dispatched)
-        pthread_cond_broadcast(&server->dispatchQueue_condition);
-#else
+#ifndef UA_ENABLE_MULTITHREADING
     processDelayedCallbacks(server);
 #endif
 
@@ -480,8 +677,16 @@ UA_StatusCode UA_Server_run_shutdown(UA_Server *server) {
         UA_ServerNetworkLayer *nl = &server->config.networkLayers[i];
         UA_Job *stopJobs = NULL;
         size_t stopJobsSize = nl->stop(nl, &stopJobs);
-        for(size_t j = 0; j < stopJobsSize; ++j)
+        for(size_t j = 0; j < stopJobsSize; ++j) {
+#ifdef UA_ENABLE_MULTITHREADING
+            /* Free the connections after the workers have stopped */
+            if(stopJobs[j].type == UA_JOBTYPE_METHODCALL_DELAYED && server->workers) {
+                addDelayedJob(server, &stopJobs[j]);
+                continue;
+            }
+#endif
             UA_Server_processJob(server, &stopJobs[j]);
+        }
         UA_free(stopJobs);
     }
 
@@ -491,18 +696,25 @@ UA_StatusCode UA_Server_run_shutdown(UA_Server *server) {
         UA_LOG_INFO(server->config.logger, UA_LOGCATEGORY_SERVER,
                     "Shutting down %u worker thread(s)", server->config.nThreads);
         /* Wait for all worker threads to finish */
-        for(size_t i = 0; i < server->config.nThreads; ++i)
+        for(size_t i = 0; i < server->config.nThreads; ++i) {
             server->workers[i].running = false;
-        pthread_cond_broadcast(&server->dispatchQueue_condition);
+            wakeWorker(&server->workers[i]);
+        }
         for(size_t i = 0; i < server->config.nThreads; ++i)
             pthread_join(server->workers[i].thr, NULL);
+
+        /* Manually finish the work still enqueued */
+        emptyDispatchQueue(server);
+        processAllDelayedJobs(server);
+
         /* Free the worker structures */
+        for(size_t i = 0; i < server->config.nThreads; ++i) {
+            pthread_mutex_destroy(&server->workers[i].sleep_mutex);
+            pthread_cond_destroy(&server->workers[i].sleep_condition);
+        }
         UA_free(server->workers);
         server->workers = NULL;
     }
-
-    /* Manually finish the work still enqueued */
-    emptyDispatchQueue(server);
     UA_ASSERT_RCU_UNLOCKED();
     rcu_barrier(); // wait for all scheduled call_rcu work to complete
 #else
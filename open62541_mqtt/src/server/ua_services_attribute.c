@@ -747,6 +747,12 @@ void Service_Read_single(UA_Server *server, UA_Session *session,
         return;
     }
 
+    ReadWithNode(node, server, session, timestamps, id, v);
+}
+
+void ReadWithNode(const UA_Node *node, UA_Server *server, UA_Session *session,
+                  const UA_TimestampsToReturn timestamps,
+                  const UA_ReadValueId *id, UA_DataValue *v) {
     /* Read the attribute */
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     switch(id->attributeId) {
@@ -141,10 +141,99 @@ Service_SetPublishingMode(UA_Server *server, UA_Session *session,
     }
 }
 
-static void
+/* The EURange property of an analog item */
+static const UA_VariableNode *
+getEURangeNode(UA_Server *server, const UA_VariableNode *vn) {
+    UA_NodeId hasProperty = UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY);
+    UA_String euRange = UA_STRING("EURange");
+    for(size_t i = 0; i < vn->referencesSize; ++i) {
+        if(vn->references[i].isInverse ||
+           !UA_NodeId_equal(&hasProperty, &vn->references[i].referenceTypeId))
+            continue;
+        const UA_Node *target =
+            UA_NodeStore_get(server->nodestore, &vn->references[i].targetId.nodeId);
+        if(target && target->nodeClass == UA_NODECLASS_VARIABLE &&
+           target->browseName.namespaceIndex == 0 &&
+           UA_String_equal(&euRange, &target->browseName.name))
+            return (const UA_VariableNode*)target;
+    }
+    return NULL;
+}
+
+/* Computes the absolute deadband of a DataChangeFilter. A percent deadband
+ * refers to the EURange of the item. The EURange is read when the item is
+ * created or modified. Later changes of the EURange are not seen by the
+ * item until it is modified again. */
+static UA_StatusCode
+getDeadband(UA_Server *server, const UA_MonitoredItem *mon,
+            const UA_DataChangeFilter *filter, UA_Double *deadband) {
+    *deadband = 0.0;
+    if(filter->deadbandType == UA_DEADBANDTYPE_NONE)
+        return UA_STATUSCODE_GOOD;
+    if(filter->deadbandType != UA_DEADBANDTYPE_ABSOLUTE &&
+       filter->deadbandType != UA_DEADBANDTYPE_PERCENT)
+        return UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+    if(!(filter->deadbandValue >= 0.0)) /* also catches nan */
+        return UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+
+    /* Deadbands apply to the value of numeric variables only */
+    if(mon->attributeID != UA_ATTRIBUTEID_VALUE)
+        return UA_STATUSCODE_BADFILTERNOTALLOWED;
+    const UA_VariableNode *vn = (const UA_VariableNode*)
+        UA_NodeStore_get(server->nodestore, &mon->monitoredNodeId);
+    if(!vn || vn->nodeClass != UA_NODECLASS_VARIABLE)
+        return UA_STATUSCODE_BADFILTERNOTALLOWED;
+    UA_NodeId numberId = UA_NODEID_NUMERIC(0, UA_NS0ID_NUMBER);
+    UA_NodeId hasSubtype = UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE);
+    if(!isNodeInTree(server->nodestore, &vn->dataType, &numberId, &hasSubtype, 1))
+        return UA_STATUSCODE_BADFILTERNOTALLOWED;
+
+    if(filter->deadbandType == UA_DEADBANDTYPE_ABSOLUTE) {
+        *deadband = filter->deadbandValue;
+        return UA_STATUSCODE_GOOD;
+    }
+
+    /* Percent deadband */
+    if(filter->deadbandValue > 100.0)
+        return UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+    const UA_VariableNode *euRangeNode = getEURangeNode(server, vn);
+    if(!euRangeNode)
+        return UA_STATUSCODE_BADMONITOREDITEMFILTERUNSUPPORTED;
+    UA_DataValue v;
+    UA_DataValue_init(&v);
+    UA_StatusCode retval = readValueAttribute(server, euRangeNode, &v);
+    if(retval == UA_STATUSCODE_GOOD) {
+        if(v.hasValue && UA_Variant_hasScalarType(&v.value, &UA_TYPES[UA_TYPES_RANGE])) {
+            const UA_Range *range = (const UA_Range*)v.value.data;
+            if(range->high >= range->low) /* also catches nan */
+                *deadband = (filter->deadbandValue / 100.0) * (range->high - range->low);
+            else
+                retval = UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+        } else {
+            retval = UA_STATUSCODE_BADMONITOREDITEMFILTERUNSUPPORTED;
+        }
+    }
+    UA_DataValue_deleteMembers(&v);
+    return retval;
+}
+
+static UA_StatusCode
 setMonitoredItemSettings(UA_Server *server, UA_MonitoredItem *mon,
                          UA_MonitoringMode monitoringMode,
                          const UA_MonitoringParameters *params) {
+    /* Filter. Checked first, the item is unchanged if the filter is invalid. */
+    UA_DataChangeTrigger trigger = UA_DATACHANGETRIGGER_STATUSVALUE; /* Default */
+    UA_Double deadband = 0.0;
+    if(params->filter.encoding == UA_EXTENSIONOBJECT_DECODED &&
+       params->filter.content.decoded.type == &UA_TYPES[UA_TYPES_DATACHANGEFILTER]) {
+        const UA_DataChangeFilter *filter =
+            (const UA_DataChangeFilter *)params->filter.content.decoded.data;
+        UA_StatusCode retval = getDeadband(server, mon, filter, &deadband);
+        if(retval != UA_STATUSCODE_GOOD)
+            return retval;
+        trigger = filter->trigger;
+    }
+
     MonitoredItem_unregisterSampleJob(server, mon);
     mon->monitoringMode = monitoringMode;
 
@@ -170,14 +259,8 @@ setMonitoredItemSettings(UA_Server *server, UA_MonitoredItem *mon,
         mon->samplingInterval = server->config.samplingIntervalLimits.min;
 
     /* Filter */
-    if(params->filter.encoding != UA_EXTENSIONOBJECT_DECODED ||
-       params->filter.content.decoded.type != &UA_TYPES[UA_TYPES_DATACHANGEFILTER]) {
-        /* Default: Trigger only on the value and the statuscode */
-        mon->trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
-    } else {
-        UA_DataChangeFilter *filter = (UA_DataChangeFilter *)params->filter.content.decoded.data;
-        mon->trigger = filter->trigger;
-    }
+    mon->trigger = trigger;
+    mon->deadband = deadband;
 
     /* QueueSize */
     UA_BOUNDEDVALUE_SETWBOUNDS(server->config.queueSizeLimits,
@@ -189,6 +272,7 @@ setMonitoredItemSettings(UA_Server *server, UA_MonitoredItem *mon,
     /* Register sample job if reporting is enabled */
     if(monitoringMode == UA_MONITORINGMODE_REPORTING)
         MonitoredItem_registerSampleJob(server, mon);
+    return UA_STATUSCODE_GOOD;
 }
 
 static const UA_String binaryEncoding = {sizeof("Default Binary")-1, (UA_Byte*)"Default Binary"};
@@ -248,9 +332,14 @@ Service_CreateMonitoredItems_single(UA_Server *server, UA_Session *session,
     newMon->attributeID = request->itemToMonitor.attributeId;
     newMon->itemId = ++(sub->lastMonitoredItemId);
     newMon->timestampsToReturn = timestampsToReturn;
-    setMonitoredItemSettings(server, newMon, request->monitoringMode,
-                             &request->requestedParameters);
     LIST_INSERT_HEAD(&sub->monitoredItems, newMon, listEntry);
+    retval = setMonitoredItemSettings(server, newMon, request->monitoringMode,
+                                      &request->requestedParameters);
+    if(retval != UA_STATUSCODE_GOOD) {
+        result->statusCode = retval;
+        MonitoredItem_delete(server, newMon);
+        return;
+    }
 
     /* Create the first sample */
     if(request->monitoringMode == UA_MONITORINGMODE_REPORTING)
@@ -312,8 +401,12 @@ Service_ModifyMonitoredItems_single(UA_Server *server, UA_Session *session, UA_S
         return;
     }
 
-    setMonitoredItemSettings(server, mon, mon->monitoringMode,
-                             &request->requestedParameters);
+    UA_StatusCode retval = setMonitoredItemSettings(server, mon, mon->monitoringMode,
+                                                    &request->requestedParameters);
+    if(retval != UA_STATUSCODE_GOOD) {
+        result->statusCode = retval;
+        return;
+    }
     result->revisedSamplingInterval = mon->samplingInterval;
     result->revisedQueueSize = mon->maxQueueSize;
 }
@@ -25,12 +25,18 @@ UA_MonitoredItem * UA_MonitoredItem_new() {
     newItem->maxQueueSize = 0;
     newItem->monitoredItemType = UA_MONITOREDITEMTYPE_CHANGENOTIFY; /* currently hardcoded */
     newItem->timestampsToReturn = UA_TIMESTAMPSTORETURN_SOURCE;
+    newItem->deadband = 0.0;
     UA_String_init(&newItem->indexRange);
-    TAILQ_INIT(&newItem->queue);
+    newItem->queue = NULL;
+    newItem->queueCapacity = 0;
+    newItem->queueStart = 0;
     UA_NodeId_init(&newItem->monitoredNodeId);
     newItem->lastSampledValue = UA_BYTESTRING_NULL;
-    memset(&newItem->sampleJobGuid, 0, sizeof(UA_Guid));
-    newItem->sampleJobIsRegistered = false;
+    newItem->samplingSet = NULL;
+#ifndef UA_ENABLE_MULTITHREADING
+    newItem->sampledNode = NULL;
+    newItem->sampledNodeGeneration = 0;
+#endif
     newItem->itemId = 0;
     return newItem;
 }
@@ -38,12 +44,11 @@ UA_MonitoredItem * UA_MonitoredItem_new() {
 void MonitoredItem_delete(UA_Server *server, UA_MonitoredItem *monitoredItem) {
     MonitoredItem_unregisterSampleJob(server, monitoredItem);
     /* clear the queued samples */
-    MonitoredItem_queuedValue *val, *val_tmp;
-    TAILQ_FOREACH_SAFE(val, &monitoredItem->queue, listEntry, val_tmp) {
-        TAILQ_REMOVE(&monitoredItem->queue, val, listEntry);
-        UA_DataValue_deleteMembers(&val->value);
-        UA_free(val);
+    for(UA_UInt32 i = 0; i < monitoredItem->currentQueueSize; ++i) {
+        UA_UInt32 pos = (monitoredItem->queueStart + i) % monitoredItem->queueCapacity;
+        UA_DataValue_deleteMembers(&monitoredItem->queue[pos].value);
     }
+    UA_free(monitoredItem->queue);
     monitoredItem->currentQueueSize = 0;
     LIST_REMOVE(monitoredItem, listEntry);
     UA_String_deleteMembers(&monitoredItem->indexRange);
@@ -52,29 +57,172 @@ void MonitoredItem_delete(UA_Server *server, UA_MonitoredItem *monitoredItem) {
     UA_free(monitoredItem);
 }
 
+/* Remove the oldest or the newest sample */
 static void
-ensureSpaceInMonitoredItemQueue(UA_MonitoredItem *mon) {
-    if(mon->currentQueueSize < mon->maxQueueSize)
-        return;
-    MonitoredItem_queuedValue *queueItem;
-    if(mon->discardOldest)
-        queueItem = TAILQ_FIRST(&mon->queue);
+discardQueuedValue(UA_MonitoredItem *mon, UA_Boolean oldest) {
+    UA_assert(mon->currentQueueSize > 0);
+    UA_UInt32 pos = mon->queueStart;
+    if(oldest)
+        mon->queueStart = (mon->queueStart + 1) % mon->queueCapacity;
     else
-        queueItem = TAILQ_LAST(&mon->queue,
-                               memberstruct(UA_MonitoredItem,QueueOfQueueDataValues));
-    UA_assert(queueItem); /* When the currentQueueSize > 0, then there is an item */
-    TAILQ_REMOVE(&mon->queue, queueItem, listEntry);
-    UA_DataValue_deleteMembers(&queueItem->value);
-    UA_free(queueItem);
+        pos = (mon->queueStart + mon->currentQueueSize - 1) % mon->queueCapacity;
+    UA_DataValue_deleteMembers(&mon->queue[pos].value);
     --mon->currentQueueSize;
 }
 
+/* Reallocate the ring buffer for maxQueueSize samples. Samples that no longer
+ * fit are discarded according to discardOldest. */
+static UA_StatusCode
+resizeQueue(UA_MonitoredItem *mon) {
+    UA_UInt32 capacity = mon->maxQueueSize > 0 ? mon->maxQueueSize : 1;
+    MonitoredItem_queuedValue *queue = (MonitoredItem_queuedValue*)
+        UA_malloc(capacity * sizeof(MonitoredItem_queuedValue));
+    if(!queue)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    while(mon->currentQueueSize > capacity)
+        discardQueuedValue(mon, mon->discardOldest);
+    for(UA_UInt32 i = 0; i < mon->currentQueueSize; ++i) {
+        MonitoredItem_queuedValue *qv = &queue[i];
+        *qv = mon->queue[(mon->queueStart + i) % mon->queueCapacity];
+        if(qv->value.value.storageType == UA_VARIANT_DATA_NODELETE)
+            qv->value.value.data = &qv->inlineValue;
+    }
+    UA_free(mon->queue);
+    mon->queue = queue;
+    mon->queueCapacity = capacity;
+    mon->queueStart = 0;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_Boolean
+isInlineValue(const UA_DataValue *value) {
+    const UA_Variant *v = &value->value;
+    return value->hasValue && UA_Variant_isScalar(v) && v->type->builtin &&
+        v->type->pointerFree &&
+        v->type->memSize <= sizeof(((MonitoredItem_queuedValue*)0)->inlineValue);
+}
+
+/* Samples with the value of a builtin type without pointers (numbers, boolean,
+ * DateTime, Guid, StatusCode) are compared in their native representation.
+ * Instead of the binary encoding, a key is built from the fields that remain
+ * after the trigger filter. Comparing the key with memcmp detects the same
+ * changes as comparing the encoding. The marker cannot be the first byte of an
+ * encoded DataValue, so keys and encodings never match. */
+#define UA_SAMPLEKEY_MARKER 0xff
+#define UA_SAMPLEKEY_ARRAY 0x10 /* flag in the second byte */
+#define UA_SAMPLEKEY_HEADER (2 + sizeof(UA_StatusCode) + sizeof(UA_DateTime) + sizeof(UA_UInt16))
+
+/* Returns zero if the value needs to be encoded */
+static size_t
+sampleKeySize(const UA_DataValue *value) {
+    if(!value->hasValue)
+        return UA_SAMPLEKEY_HEADER;
+    const UA_Variant *v = &value->value;
+    if(!v->type || !v->type->builtin || !v->type->pointerFree ||
+       v->arrayDimensionsSize > 0)
+        return 0;
+    size_t size = UA_SAMPLEKEY_HEADER + sizeof(const UA_DataType*);
+    if(UA_Variant_isScalar(v))
+        return size + v->type->memSize;
+    return size + sizeof(size_t) + (v->type->memSize * v->arrayLength);
+}
+
+static void
+writeSampleKey(const UA_DataValue *value, UA_ByteString *key) {
+    UA_Byte *pos = key->data;
+    *pos++ = UA_SAMPLEKEY_MARKER;
+    UA_Boolean isArray = value->hasValue && !UA_Variant_isScalar(&value->value);
+    *pos++ = (UA_Byte)(value->hasValue | (value->hasStatus << 1) |
+                       (value->hasSourceTimestamp << 2) |
+                       (value->hasSourcePicoseconds << 3) |
+                       (isArray ? UA_SAMPLEKEY_ARRAY : 0));
+    UA_StatusCode status = value->hasStatus ? value->status : 0;
+    memcpy(pos, &status, sizeof(UA_StatusCode));
+    pos += sizeof(UA_StatusCode);
+    UA_DateTime sourceTimestamp = value->hasSourceTimestamp ? value->sourceTimestamp : 0;
+    memcpy(pos, &sourceTimestamp, sizeof(UA_DateTime));
+    pos += sizeof(UA_DateTime);
+    UA_UInt16 sourcePicoseconds = value->hasSourcePicoseconds ? value->sourcePicoseconds : 0;
+    memcpy(pos, &sourcePicoseconds, sizeof(UA_UInt16));
+    pos += sizeof(UA_UInt16);
+
+    if(value->hasValue) {
+        const UA_Variant *v = &value->value;
+        memcpy(pos, &v->type, sizeof(const UA_DataType*));
+        pos += sizeof(const UA_DataType*);
+        if(UA_Variant_isScalar(v)) {
+            memcpy(pos, v->data, v->type->memSize);
+            pos += v->type->memSize;
+        } else {
+            /* An undefined array (NULL) differs from an empty array */
+            size_t length = v->data ? v->arrayLength : (size_t)-1;
+            memcpy(pos, &length, sizeof(size_t));
+            pos += sizeof(size_t);
+            if(v->arrayLength > 0) {
+                memcpy(pos, v->data, v->type->memSize * v->arrayLength);
+                pos += v->type->memSize * v->arrayLength;
+            }
+        }
+    }
+    key->length = (size_t)(pos - key->data);
+}
+
+static UA_Boolean
+readNumeric(const UA_DataType *type, const UA_Byte *data, UA_Double *out) {
+    switch(type->typeIndex) {
+    case UA_TYPES_SBYTE: { UA_SByte v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_BYTE: { UA_Byte v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_INT16: { UA_Int16 v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_UINT16: { UA_UInt16 v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_INT32: { UA_Int32 v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_UINT32: { UA_UInt32 v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_INT64: { UA_Int64 v; memcpy(&v, data, sizeof(v)); *out = (UA_Double)v; return true; }
+    case UA_TYPES_UINT64: { UA_UInt64 v; memcpy(&v, data, sizeof(v)); *out = (UA_Double)v; return true; }
+    case UA_TYPES_FLOAT: { UA_Float v; memcpy(&v, data, sizeof(v)); *out = v; return true; }
+    case UA_TYPES_DOUBLE: memcpy(out, data, sizeof(UA_Double)); return true;
+    default: return false;
+    }
+}
+
+/* A changed numeric value within the deadband of the last reported value is
+ * no change. The keys of both samples must be equal up to the values. */
+static UA_Boolean
+outsideDeadband(const UA_MonitoredItem *mon, const UA_ByteString *key,
+                const UA_ByteString *lastKey) {
+    size_t offset = UA_SAMPLEKEY_HEADER + sizeof(const UA_DataType*);
+    if(key->length != lastKey->length || key->length <= offset ||
+       memcmp(key->data, lastKey->data, offset) != 0)
+        return true;
+    const UA_DataType *type;
+    memcpy(&type, &key->data[UA_SAMPLEKEY_HEADER], sizeof(const UA_DataType*));
+    if(key->data[1] & UA_SAMPLEKEY_ARRAY) { /* array of the same length */
+        if(memcmp(&key->data[offset], &lastKey->data[offset], sizeof(size_t)) != 0)
+            return true;
+        offset += sizeof(size_t);
+    }
+    for(; offset < key->length; offset += type->memSize) {
+        UA_Double v, last;
+        if(!readNumeric(type, &key->data[offset], &v) ||
+           !readNumeric(type, &lastKey->data[offset], &last))
+            return true;
+        UA_Double diff = v - last;
+        if(diff < 0.0)
+            diff = -diff;
+        if(!(diff <= mon->deadband)) /* also nan */
+            return true;
+    }
+    return false;
+}
+
 /* Errors are returned as no change detected */
 static UA_Boolean
 detectValueChangeWithFilter(UA_MonitoredItem *mon, UA_DataValue *value,
                             UA_ByteString *encoding) {
-    /* Encode the data for comparison */
-    size_t binsize = UA_calcSizeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE]);
+    /* Values of simple types are compared without the encoding */
+    size_t keysize = sampleKeySize(value);
+    size_t binsize = keysize;
+    if(keysize == 0)
+        binsize = UA_calcSizeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE]);
     if(binsize == 0)
         return false;
 
@@ -83,16 +231,26 @@ detectValueChangeWithFilter(UA_MonitoredItem *mon, UA_DataValue *value,
        UA_ByteString_allocBuffer(encoding, binsize) != UA_STATUSCODE_GOOD)
         return false;
 
-    /* Encode the value */
-    size_t encodingOffset = 0;
-    UA_StatusCode retval = UA_encodeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE],
-                                           NULL, NULL, encoding, &encodingOffset);
-    if(retval != UA_STATUSCODE_GOOD)
-        return false;
+    if(keysize > 0) {
+        writeSampleKey(value, encoding);
+    } else {
+        /* Encode the value */
+        size_t encodingOffset = 0;
+        UA_StatusCode retval = UA_encodeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE],
+                                               NULL, NULL, encoding, &encodingOffset);
+        if(retval != UA_STATUSCODE_GOOD)
+            return false;
+        encoding->length = encodingOffset;
+    }
 
     /* The value has changed */
-    encoding->length = encodingOffset;
-    return !mon->lastSampledValue.data || !UA_String_equal(encoding, &mon->lastSampledValue);
+    if(!mon->lastSampledValue.data)
+        return true;
+    if(UA_String_equal(encoding, &mon->lastSampledValue))
+        return false;
+    if(mon->deadband > 0.0 && keysize > 0)
+        return outsideDeadband(mon, encoding, &mon->lastSampledValue);
+    return true;
 }
 
 /* Has this sample changed from the last one? The method may allocate additional
@@ -142,13 +300,14 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
     if(!changed)
         return false;
 
-    /* Allocate the entry for the publish queue */
-    MonitoredItem_queuedValue *newQueueItem =
-        (MonitoredItem_queuedValue *)UA_malloc(sizeof(MonitoredItem_queuedValue));
-    if(!newQueueItem) {
+    /* Allocate the ring buffer for the publish queue */
+    UA_UInt32 capacity = monitoredItem->maxQueueSize > 0 ?
+        monitoredItem->maxQueueSize : 1;
+    if(monitoredItem->queueCapacity != capacity &&
+       resizeQueue(monitoredItem) != UA_STATUSCODE_GOOD) {
         UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
                                "Subscription %u | MonitoredItem %i | "
-                               "Item for the publishing queue could not be allocated",
+                               "Queue for the publishing could not be allocated",
                                sub->subscriptionID, monitoredItem->itemId);
         return false;
     }
@@ -161,27 +320,28 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
                                    "Subscription %u | MonitoredItem %i | "
                                    "ByteString to compare values could not be created",
                                    sub->subscriptionID, monitoredItem->itemId);
-            UA_free(newQueueItem);
             return false;
         }
         *valueEncoding = cbs;
     }
 
-    /* Prepare the newQueueItem */
-    if(value->hasValue && value->value.storageType == UA_VARIANT_DATA_NODELETE) {
+    /* Prepare the value for the queue. Small scalars are copied into the queue
+     * entry later on. */
+    UA_Boolean inlineValue = isInlineValue(value);
+    UA_DataValue queuedValue;
+    if(!inlineValue && value->hasValue &&
+       value->value.storageType == UA_VARIANT_DATA_NODELETE) {
         /* Make a deep copy of the value */
-        if(UA_DataValue_copy(value, &newQueueItem->value) != UA_STATUSCODE_GOOD) {
+        if(UA_DataValue_copy(value, &queuedValue) != UA_STATUSCODE_GOOD) {
             UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
                                    "Subscription %u | MonitoredItem %i | "
                                    "Item for the publishing queue could not be prepared",
                                    sub->subscriptionID, monitoredItem->itemId);
-            UA_free(newQueueItem);
             return false;
         }
     } else {
-        newQueueItem->value = *value; /* Just copy the value and do not release it */
+        queuedValue = *value; /* Just copy the value and do not release it */
     }
-    newQueueItem->clientHandle = monitoredItem->clientHandle;
 
     /* <-- Point of no return --> */
 
@@ -193,11 +353,24 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
     UA_ByteString_deleteMembers(&monitoredItem->lastSampledValue);
     monitoredItem->lastSampledValue = *valueEncoding;
 
-    /* Add the sample to the queue for publication */
-    ensureSpaceInMonitoredItemQueue(monitoredItem);
-    TAILQ_INSERT_TAIL(&monitoredItem->queue, newQueueItem, listEntry);
+    /* Add the sample to the queue for publication. When the queue is full, the
+     * entry of the discarded sample is overwritten. */
+    if(monitoredItem->currentQueueSize >= monitoredItem->queueCapacity)
+        discardQueuedValue(monitoredItem, monitoredItem->discardOldest);
+    MonitoredItem_queuedValue *qv =
+        &monitoredItem->queue[(monitoredItem->queueStart + monitoredItem->currentQueueSize) %
+                              monitoredItem->queueCapacity];
     ++monitoredItem->currentQueueSize;
-    return true;;
+    qv->clientHandle = monitoredItem->clientHandle;
+    qv->value = queuedValue;
+    if(inlineValue) {
+        memcpy(&qv->inlineValue, value->value.data, value->value.type->memSize);
+        qv->value.value.data = &qv->inlineValue;
+        qv->value.value.storageType = UA_VARIANT_DATA_NODELETE;
+        if(value->value.storageType == UA_VARIANT_DATA)
+            UA_free(value->value.data);
+    }
+    return true;
 }
 
 void UA_MoniteredItem_SampleCallback(UA_Server *server, UA_MonitoredItem *monitoredItem) {
@@ -218,8 +391,26 @@ void UA_MoniteredItem_SampleCallback(UA_Server *server, UA_MonitoredItem *monito
     rvid.indexRange = monitoredItem->indexRange;
     UA_DataValue value;
     UA_DataValue_init(&value);
+#ifndef UA_ENABLE_MULTITHREADING
+    /* Look up the node only when the nodestore has changed. The dataEncoding
+     * and indexRange were checked when the item was created. */
+    UA_UInt32 generation = UA_NodeStore_generation(server->nodestore);
+    if(!monitoredItem->sampledNode || monitoredItem->sampledNodeGeneration != generation) {
+        monitoredItem->sampledNode = UA_NodeStore_get(server->nodestore,
+                                                      &monitoredItem->monitoredNodeId);
+        monitoredItem->sampledNodeGeneration = generation;
+    }
+    if(monitoredItem->sampledNode) {
+        ReadWithNode(monitoredItem->sampledNode, server, sub->session,
+                     monitoredItem->timestampsToReturn, &rvid, &value);
+    } else {
+        value.hasStatus = true;
+        value.status = UA_STATUSCODE_BADNODEIDUNKNOWN;
+    }
+#else
     Service_Read_single(server, sub->session, monitoredItem->timestampsToReturn,
                         &rvid, &value);
+#endif
 
     /* Stack-allocate some memory for the value encoding. We might heap-allocate
      * more memory if needed. This is just enough for scalars and small
@@ -241,25 +432,77 @@ void UA_MoniteredItem_SampleCallback(UA_Server *server, UA_MonitoredItem *monito
     }
 }
 
+static void
+UA_SamplingSet_sampleCallback(UA_Server *server, UA_SamplingSet *set) {
+    UA_MonitoredItem *mon;
+    LIST_FOREACH(mon, &set->monitoredItems, samplingEntry)
+        UA_MoniteredItem_SampleCallback(server, mon);
+}
+
 UA_StatusCode
 MonitoredItem_registerSampleJob(UA_Server *server, UA_MonitoredItem *mon) {
-    UA_Job job;
-    job.type = UA_JOBTYPE_METHODCALL;
-    job.job.methodCall.method = (UA_ServerCallback)UA_MoniteredItem_SampleCallback;
-    job.job.methodCall.data = mon;
-    UA_StatusCode retval = UA_Server_addRepeatedJob(server, job,
-                                                    (UA_UInt32)mon->samplingInterval,
-                                                    &mon->sampleJobGuid);
-    if(retval == UA_STATUSCODE_GOOD)
-        mon->sampleJobIsRegistered = true;
-    return retval;
+    if(mon->samplingSet)
+        return UA_STATUSCODE_GOOD;
+
+    /* Find the set with the sampling interval or create it */
+    UA_UInt32 interval = (UA_UInt32)mon->samplingInterval;
+    UA_SamplingSet *set;
+    LIST_FOREACH(set, &server->samplingSets, listEntry) {
+        if(set->samplingInterval == interval)
+            break;
+    }
+    if(!set) {
+        set = (UA_SamplingSet*)UA_malloc(sizeof(UA_SamplingSet));
+        if(!set)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        set->samplingInterval = interval;
+        LIST_INIT(&set->monitoredItems);
+        UA_Job job;
+        job.type = UA_JOBTYPE_METHODCALL;
+        job.job.methodCall.method = (UA_ServerCallback)UA_SamplingSet_sampleCallback;
+        job.job.methodCall.data = set;
+        UA_StatusCode retval = UA_Server_addRepeatedJob(server, job, interval,
+                                                        &set->sampleJobGuid);
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_free(set);
+            return retval;
+        }
+        LIST_INSERT_HEAD(&server->samplingSets, set, listEntry);
+    }
+
+    LIST_INSERT_HEAD(&set->monitoredItems, mon, samplingEntry);
+    mon->samplingSet = set;
+    return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode MonitoredItem_unregisterSampleJob(UA_Server *server, UA_MonitoredItem *mon) {
-    if(!mon->sampleJobIsRegistered)
+    UA_SamplingSet *set = mon->samplingSet;
+    if(!set)
+        return UA_STATUSCODE_GOOD;
+    LIST_REMOVE(mon, samplingEntry);
+    mon->samplingSet = NULL;
+    if(!LIST_EMPTY(&set->monitoredItems))
         return UA_STATUSCODE_GOOD;
-    mon->sampleJobIsRegistered = false;
-    return UA_Server_removeRepeatedJob(server, mon->sampleJobGuid);
+
+    /* The last item is gone. The removal of the repeated job takes effect with
+     * the next iteration, so the set might still be sampled until then. */
+    LIST_REMOVE(set, listEntry);
+    UA_StatusCode retval = UA_Server_removeRepeatedJob(server, set->sampleJobGuid);
+    UA_Server_delayedFree(server, set);
+    return retval;
+}
+
+void UA_Server_deleteSamplingSets(UA_Server *server) {
+    UA_SamplingSet *set, *set_tmp;
+    LIST_FOREACH_SAFE(set, &server->samplingSets, listEntry, set_tmp) {
+        UA_MonitoredItem *mon;
+        while((mon = LIST_FIRST(&set->monitoredItems))) {
+            LIST_REMOVE(mon, samplingEntry);
+            mon->samplingSet = NULL;
+        }
+        LIST_REMOVE(set, listEntry);
+        UA_free(set);
+    }
 }
 
 /****************/
@@ -337,14 +580,12 @@ countQueuedNotifications(UA_Subscription *sub, UA_Boolean *moreNotifications) {
     if(sub->publishingEnabled) {
         UA_MonitoredItem *mon;
         LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
-            MonitoredItem_queuedValue *qv;
-            TAILQ_FOREACH(qv, &mon->queue, listEntry) {
-                if(notifications >= sub->notificationsPerPublish) {
-                    *moreNotifications = true;
-                    break;
-                }
-                ++notifications;
+            if(notifications + mon->currentQueueSize > sub->notificationsPerPublish) {
+                notifications = sub->notificationsPerPublish;
+                *moreNotifications = true;
+                break;
             }
+            notifications += mon->currentQueueSize;
         }
     }
     return notifications;
@@ -406,28 +647,36 @@ prepareNotificationMessage(UA_Subscription *sub, UA_NotificationMessage *message
     data->content.decoded.data = dcn;
     data->content.decoded.type = &UA_TYPES[UA_TYPES_DATACHANGENOTIFICATION];
 
-    /* Allocate array of notifications */
+    /* Allocate array of notifications. The inline values of the queue are
+     * moved behind the array, so they are freed together with it. */
+    const size_t inlineSize = sizeof(((MonitoredItem_queuedValue*)0)->inlineValue);
     dcn->monitoredItems = (UA_MonitoredItemNotification *)
-        UA_Array_new(notifications, &UA_TYPES[UA_TYPES_MONITOREDITEMNOTIFICATION]);
+        UA_calloc(notifications, sizeof(UA_MonitoredItemNotification) + inlineSize);
     if(!dcn->monitoredItems) {
         UA_NotificationMessage_deleteMembers(message);
         return UA_STATUSCODE_BADOUTOFMEMORY;
     }
     dcn->monitoredItemsSize = notifications;
+    UA_Byte *inlineValues = (UA_Byte*)&dcn->monitoredItems[notifications];
 
     /* Move notifications into the response .. the point of no return */
     size_t l = 0;
     UA_MonitoredItem *mon;
     LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
-        MonitoredItem_queuedValue *qv, *qv_tmp;
-        TAILQ_FOREACH_SAFE(qv, &mon->queue, listEntry, qv_tmp) {
+        while(mon->currentQueueSize > 0) {
             if(l >= notifications)
                 return UA_STATUSCODE_GOOD;
+            MonitoredItem_queuedValue *qv = &mon->queue[mon->queueStart];
             UA_MonitoredItemNotification *min = &dcn->monitoredItems[l];
             min->clientHandle = qv->clientHandle;
             min->value = qv->value;
-            TAILQ_REMOVE(&mon->queue, qv, listEntry);
-            UA_free(qv);
+            if(qv->value.value.storageType == UA_VARIANT_DATA_NODELETE) {
+                /* The message outlives the queue entry */
+                UA_Byte *inlineValue = &inlineValues[l * inlineSize];
+                memcpy(inlineValue, &qv->inlineValue, inlineSize);
+                min->value.value.data = inlineValue;
+            }
+            mon->queueStart = (mon->queueStart + 1) % mon->queueCapacity;
             --mon->currentQueueSize;
             ++l;
         }
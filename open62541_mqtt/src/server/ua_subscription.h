@@ -22,9 +22,15 @@ typedef enum {
 } UA_MonitoredItemType;
 
 typedef struct MonitoredItem_queuedValue {
-    TAILQ_ENTRY(MonitoredItem_queuedValue) listEntry;
     UA_UInt32 clientHandle;
     UA_DataValue value;
+    /* Scalars of builtin types without pointers are stored inline. The variant
+     * then has the storagetype UA_VARIANT_DATA_NODELETE. */
+    union {
+        UA_Guid guid;
+        UA_Int64 int64;
+        UA_Double dbl;
+    } inlineValue;
 } MonitoredItem_queuedValue;
 
 typedef struct UA_MonitoredItem {
@@ -46,14 +52,22 @@ typedef struct UA_MonitoredItem {
     UA_String indexRange;
     // TODO: dataEncoding is hardcoded to UA binary
     UA_DataChangeTrigger trigger;
-
-    /* Sample Job */
-    UA_Guid sampleJobGuid;
-    UA_Boolean sampleJobIsRegistered;
-
-    /* Sample Queue */
+    UA_Double deadband; /* absolute, 0 for none */
+
+    /* Sampling */
+    LIST_ENTRY(UA_MonitoredItem) samplingEntry;
+    struct UA_SamplingSet *samplingSet; /* NULL if not sampled */
+#ifndef UA_ENABLE_MULTITHREADING
+    const UA_Node *sampledNode; /* valid while the nodestore generation is unchanged */
+    UA_UInt32 sampledNodeGeneration;
+#endif
+
+    /* Sample Queue. A ring buffer that is allocated for maxQueueSize samples
+     * when a sample is added. */
     UA_ByteString lastSampledValue;
-    TAILQ_HEAD(QueueOfQueueDataValues, MonitoredItem_queuedValue) queue;
+    MonitoredItem_queuedValue *queue;
+    UA_UInt32 queueCapacity;
+    UA_UInt32 queueStart; /* index of the oldest sample */
 } UA_MonitoredItem;
 
 UA_MonitoredItem *UA_MonitoredItem_new(void);
@@ -62,6 +76,19 @@ void UA_MoniteredItem_SampleCallback(UA_Server *server, UA_MonitoredItem *monito
 UA_StatusCode MonitoredItem_registerSampleJob(UA_Server *server, UA_MonitoredItem *mon);
 UA_StatusCode MonitoredItem_unregisterSampleJob(UA_Server *server, UA_MonitoredItem *mon);
 
+/* The monitored items with the same sampling interval are sampled by a single
+ * repeated job, one after the other. */
+typedef struct UA_SamplingSet {
+    LIST_ENTRY(UA_SamplingSet) listEntry;
+    UA_UInt32 samplingInterval; /* [ms] */
+    UA_Guid sampleJobGuid;
+    LIST_HEAD(UA_ListOfSampledItems, UA_MonitoredItem) monitoredItems;
+} UA_SamplingSet;
+
+/* Detach the monitored items and free the sets. Only used when the server is
+ * deleted and the sample jobs are already gone. */
+void UA_Server_deleteSamplingSets(UA_Server *server);
+
 /****************/
 /* Subscription */
 /****************/
@@ -11,6 +11,38 @@
 
 void UA_Connection_deleteMembers(UA_Connection *connection) {
     UA_ByteString_deleteMembers(&connection->incompleteMessage);
+    if(connection->cleanup)
+        connection->cleanup(connection);
+}
+
+/* The length of the stored chunk from its header, 0 if the header is incomplete */
+static size_t
+incompleteChunkLength(const UA_ByteString *incomplete) {
+    if(incomplete->length < 8)
+        return 0;
+    UA_UInt32 chunk_length = 0;
+    size_t length_pos = 4;
+    UA_UInt32_decodeBinary(incomplete, &length_pos, &chunk_length);
+    return chunk_length;
+}
+
+/* A stored chunk with a complete header is allocated at its full length, so
+ * that the rest is copied in without a realloc */
+static UA_StatusCode
+storeIncomplete(UA_Connection *connection, const UA_Byte *data, size_t length) {
+    size_t chunk_length = 0;
+    if(length >= 8) {
+        UA_ByteString header = {length, (UA_Byte*)(uintptr_t)data};
+        chunk_length = incompleteChunkLength(&header);
+    }
+    UA_StatusCode retval =
+        UA_ByteString_allocBuffer(&connection->incompleteMessage,
+                                  chunk_length > length ? chunk_length : length);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    memcpy(connection->incompleteMessage.data, data, length);
+    connection->incompleteMessage.length = length;
+    return UA_STATUSCODE_GOOD;
 }
 
 static UA_StatusCode
@@ -18,6 +50,21 @@ prependIncomplete(UA_Connection *connection, UA_ByteString * UA_RESTRICT message
                   UA_Boolean * UA_RESTRICT realloced) {
     UA_assert(connection->incompleteMessage.length > 0);
 
+    /* The message continues the stored chunk and does not go beyond it. Only
+     * the received bytes are copied, into the space reserved for the chunk. */
+    size_t chunk_length = incompleteChunkLength(&connection->incompleteMessage);
+    if(chunk_length > connection->incompleteMessage.length &&
+       message->length <= chunk_length - connection->incompleteMessage.length) {
+        memcpy(&connection->incompleteMessage.data[connection->incompleteMessage.length],
+               message->data, message->length);
+        connection->incompleteMessage.length += message->length;
+        connection->releaseRecvBuffer(connection, message);
+        *message = connection->incompleteMessage;
+        connection->incompleteMessage = UA_BYTESTRING_NULL;
+        *realloced = true;
+        return UA_STATUSCODE_GOOD;
+    }
+
     /* Allocate the new message buffer */
     size_t length = connection->incompleteMessage.length + message->length;
     UA_Byte *data = (UA_Byte*)UA_realloc(connection->incompleteMessage.data, length);
@@ -96,27 +143,32 @@ separateIncompleteChunk(UA_Connection *connection, UA_ByteString * UA_RESTRICT m
     /* No good chunk, buffer the entire message */
     if(complete_until == 0) {
         if(!*realloced) {
-            UA_StatusCode retval =
-                UA_ByteString_allocBuffer(&connection->incompleteMessage, message->length);
+            UA_StatusCode retval = storeIncomplete(connection, message->data, message->length);
             if(retval != UA_STATUSCODE_GOOD)
                 return retval;
-            memcpy(connection->incompleteMessage.data, message->data, message->length);
             connection->releaseRecvBuffer(connection, message);
             *realloced = true;
-        } else {
-            connection->incompleteMessage = *message;
-            *message = UA_BYTESTRING_NULL;
+            return UA_STATUSCODE_GOOD;
         }
+        /* Keep the buffer. Make room for the full chunk if it was not
+         * allocated at the chunk length already. */
+        size_t chunk_length = incompleteChunkLength(message);
+        if(chunk_length > message->length) {
+            UA_Byte *data = (UA_Byte*)UA_realloc(message->data, chunk_length);
+            if(!data)
+                return UA_STATUSCODE_BADOUTOFMEMORY;
+            message->data = data;
+        }
+        connection->incompleteMessage = *message;
+        *message = UA_BYTESTRING_NULL;
         return UA_STATUSCODE_GOOD;
     }
 
     /* At least one good chunk and an incomplete one */
-    size_t incomplete_length = message->length - complete_until;
-    UA_StatusCode retval =
-        UA_ByteString_allocBuffer(&connection->incompleteMessage, incomplete_length);
+    UA_StatusCode retval = storeIncomplete(connection, &message->data[complete_until],
+                                           message->length - complete_until);
     if(retval != UA_STATUSCODE_GOOD)
         return retval;
-    memcpy(connection->incompleteMessage.data, &message->data[complete_until], incomplete_length);
     message->length = complete_until;
     return UA_STATUSCODE_GOOD;
 }
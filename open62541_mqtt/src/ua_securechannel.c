@@ -122,6 +122,18 @@ void UA_SecureChannel_revolveTokens(UA_SecureChannel *channel) {
 /* Send Binary Message */
 /***********************/
 
+/* Sends the collected chunks. A single chunk goes out with send. */
+static void
+UA_SecureChannel_flushChunks(UA_ChunkInfo *ci, UA_Connection *connection) {
+    if(ci->pendingSize == 1 || !connection->sendv) {
+        for(size_t i = 0; i < ci->pendingSize; ++i)
+            connection->send(connection, &ci->pending[i]);
+    } else if(ci->pendingSize > 1) {
+        connection->sendv(connection, ci->pending, ci->pendingSize);
+    }
+    ci->pendingSize = 0;
+}
+
 static UA_StatusCode
 UA_SecureChannel_sendChunk(UA_ChunkInfo *ci, UA_ByteString *dst, size_t offset) {
     UA_SecureChannel *channel = ci->channel;
@@ -129,6 +141,11 @@ UA_SecureChannel_sendChunk(UA_ChunkInfo *ci, UA_ByteString *dst, size_t offset)
     if(!connection)
        return UA_STATUSCODE_BADINTERNALERROR;
 
+    /* No buffer for the next chunk could be allocated, the queued chunks
+     * were sent already */
+    if(!dst->data)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+
     /* adjust the buffer where the header was hidden */
     dst->data = &dst->data[-UA_SECURE_MESSAGE_HEADER_LENGTH];
     dst->length += UA_SECURE_MESSAGE_HEADER_LENGTH;
@@ -174,16 +191,22 @@ UA_SecureChannel_sendChunk(UA_ChunkInfo *ci, UA_ByteString *dst, size_t offset)
     UA_SymmetricAlgorithmSecurityHeader_encodeBinary(&symSecHeader, dst, &offset_header);
     UA_SequenceHeader_encodeBinary(&seqHeader, dst, &offset_header);
 
-    /* Send the chunk, the buffer is freed in the network layer */
+    /* Queue the chunk, the buffers are freed in the network layer. The batch
+     * goes out when it is full and with the final chunk. */
     dst->length = offset; /* set the buffer length to the content length */
-    connection->send(channel->connection, dst);
+    ci->pending[ci->pendingSize++] = *dst;
+    *dst = UA_BYTESTRING_NULL;
+    if(ci->final || ci->pendingSize == UA_SECURECHANNEL_SENDBATCH)
+        UA_SecureChannel_flushChunks(ci, connection);
 
     /* Replace with the buffer for the next chunk */
     if(!ci->final) {
         UA_StatusCode retval =
             connection->getSendBuffer(connection, connection->localConf.sendBufferSize, dst);
-        if(retval != UA_STATUSCODE_GOOD)
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_SecureChannel_flushChunks(ci, connection);
             return retval;
+        }
         /* Forward the data pointer so that the payload is encoded after the message header.
          * TODO: This works but is a bit too clever. Instead, we could return an offset to the
          * binary encoding exchangeBuffer function. */
@@ -226,6 +249,7 @@ UA_SecureChannel_sendBinaryMessage(UA_SecureChannel *channel, UA_UInt32 requestI
     ci.final = false;
     ci.messageType = UA_MESSAGETYPE_MSG;
     ci.errorCode = UA_STATUSCODE_GOOD;
+    ci.pendingSize = 0;
     if(typeId.identifier.numeric == 446 || typeId.identifier.numeric == 449)
         ci.messageType = UA_MESSAGETYPE_OPN;
     else if(typeId.identifier.numeric == 452 || typeId.identifier.numeric == 455)
@@ -270,12 +294,19 @@ UA_SecureChannel_removeChunk(UA_SecureChannel *channel, UA_UInt32 requestId) {
 static void
 appendChunk(struct ChunkEntry *ch, const UA_ByteString *msg,
             size_t offset, size_t chunklength) {
-    UA_Byte* new_bytes = (UA_Byte *)UA_realloc(ch->bytes.data, ch->bytes.length + chunklength);
-    if(!new_bytes) {
-        UA_ByteString_deleteMembers(&ch->bytes);
-        return;
+    if(ch->bytes.length + chunklength > ch->capacity) {
+        size_t capacity = ch->capacity > 0 ? ch->capacity : 4 * chunklength;
+        while(capacity < ch->bytes.length + chunklength)
+            capacity *= 2;
+        UA_Byte* new_bytes = (UA_Byte *)UA_realloc(ch->bytes.data, capacity);
+        if(!new_bytes) {
+            UA_ByteString_deleteMembers(&ch->bytes);
+            ch->capacity = 0;
+            return;
+        }
+        ch->bytes.data = new_bytes;
+        ch->capacity = capacity;
     }
-    ch->bytes.data = new_bytes;
     memcpy(&ch->bytes.data[ch->bytes.length], &msg->data[offset], chunklength);
     ch->bytes.length += chunklength;
 }
@@ -305,6 +336,7 @@ UA_SecureChannel_appendChunk(UA_SecureChannel *channel, UA_UInt32 requestId,
             return;
         ch->requestId = requestId;
         UA_ByteString_init(&ch->bytes);
+        ch->capacity = 0;
         LIST_INSERT_HEAD(&channel->chunks, ch, pointers);
     }
 
@@ -22,14 +22,20 @@ struct SessionEntry {
     UA_Session *session; // Just a pointer. The session is held in the session manager or the client
 };
 
-/* For chunked requests */
+/* For chunked requests. The buffer grows by doubling, so every chunk is
+ * copied once and large messages are not moved for every chunk. */
 struct ChunkEntry {
     LIST_ENTRY(ChunkEntry) pointers;
     UA_UInt32 requestId;
     UA_ByteString bytes;
+    size_t capacity;
 };
 
-/* For chunked responses */
+/* Chunks of a message that are sent together */
+#define UA_SECURECHANNEL_SENDBATCH 16
+
+/* For chunked responses. The encoded chunks are collected and sent in batches,
+ * with one connection->sendv for all chunks of a batch. */
 typedef struct {
     UA_SecureChannel *channel;
     UA_UInt32 requestId;
@@ -38,6 +44,8 @@ typedef struct {
     size_t messageSizeSoFar;
     UA_Boolean final;
     UA_StatusCode errorCode;
+    UA_ByteString pending[UA_SECURECHANNEL_SENDBATCH];
+    size_t pendingSize;
 } UA_ChunkInfo;
 
 struct UA_SecureChannel {
@@ -9,21 +9,48 @@
  * thread with the event loop. All other threads may add changes to the repeated
  * jobs to a multi-producer single-consumer queue. The queue is based on a
  * design by Dmitry Vyukov.
- * http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue */
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ *
+ * The jobs that are due together are executed as a batch. A batch is
+ * rescheduled once for all its jobs. With many monitored items the number of
+ * batches stays at about the number of distinct sampling intervals. */
 
 struct UA_RepeatedJob {
-    SLIST_ENTRY(UA_RepeatedJob) next; /* Next element in the list */
-    UA_DateTime nextTime;             /* The next time when the jobs are to be executed */
+    SLIST_ENTRY(UA_RepeatedJob) next; /* Next element in the queue of changes
+                                         or in the pending list */
+    LIST_ENTRY(UA_RepeatedJob) batchEntry; /* Entry in the batch */
+    LIST_ENTRY(UA_RepeatedJob) indexEntry; /* Entry in the index by id */
+    UA_RepeatedJobsBatch *batch;      /* NULL while pending */
+    UA_DateTime nextTime;             /* UA_INT64_MAX in a change marks a removal */
     UA_UInt64 interval;               /* Interval in 100ns resolution */
     UA_Guid id;                       /* Id of the repeated job */
     UA_Job job;                       /* The job description itself */
 };
 
+struct UA_RepeatedJobsBatch {
+    LIST_HEAD(RepeatedJobsBatchJobs, UA_RepeatedJob) jobs;
+    LIST_ENTRY(UA_RepeatedJobsBatch) indexEntry; /* Entry in the index by interval */
+    UA_DateTime nextTime;             /* The next time when the jobs are to be executed */
+    UA_UInt64 interval;               /* Interval in 100ns resolution */
+    size_t heapIndex;                 /* Position in the heap */
+};
+
+#define UA_REPEATEDJOBS_ARITY 4
+#define UA_REPEATEDJOBS_INITIALSIZE 16
+
 void
 UA_RepeatedJobsList_init(UA_RepeatedJobsList *rjl,
                          UA_RepeatedJobsListProcessCallback processCallback,
                          void *processContext) {
-    SLIST_INIT(&rjl->repeatedJobs);
+    rjl->heap = NULL;
+    rjl->heapSize = 0;
+    rjl->heapCapacity = 0;
+    rjl->jobsIndex = NULL;
+    rjl->jobsIndexSize = 0;
+    rjl->jobsCount = 0;
+    rjl->batchesIndex = NULL;
+    rjl->batchesIndexSize = 0;
+    SLIST_INIT(&rjl->pending);
     rjl->changes_head = (UA_RepeatedJob*)&rjl->changes_stub;
     rjl->changes_tail = (UA_RepeatedJob*)&rjl->changes_stub;
     rjl->changes_stub = NULL;
@@ -98,35 +125,213 @@ UA_RepeatedJobsList_addRepeatedJob(UA_RepeatedJobsList *rjl, const UA_Job job,
     return UA_STATUSCODE_GOOD;
 }
 
+/********/
+/* Heap */
+/********/
+
 static void
-addRepeatedJob(UA_RepeatedJobsList *rjl,
-               UA_RepeatedJob * UA_RESTRICT rj,
-               UA_DateTime nowMonotonic) {
-    /* The latest time for the first execution */
-    rj->nextTime = nowMonotonic + (UA_Int64)rj->interval;
+heapSet(UA_RepeatedJobsList *rjl, size_t i, UA_RepeatedJobsBatch *batch) {
+    rjl->heap[i] = batch;
+    batch->heapIndex = i;
+}
+
+static void
+siftUp(UA_RepeatedJobsList *rjl, size_t i) {
+    UA_RepeatedJobsBatch *batch = rjl->heap[i];
+    while(i > 0) {
+        size_t parent = (i - 1) / UA_REPEATEDJOBS_ARITY;
+        if(rjl->heap[parent]->nextTime <= batch->nextTime)
+            break;
+        heapSet(rjl, i, rjl->heap[parent]);
+        i = parent;
+    }
+    heapSet(rjl, i, batch);
+}
 
-    /* Find the last entry before this job */
-    UA_RepeatedJob *tmpRj, *afterRj = NULL;
-    SLIST_FOREACH(tmpRj, &rjl->repeatedJobs, next) {
-        if(tmpRj->nextTime >= rj->nextTime)
+static void
+siftDown(UA_RepeatedJobsList *rjl, size_t i) {
+    UA_RepeatedJobsBatch *batch = rjl->heap[i];
+    while(true) {
+        size_t first = (i * UA_REPEATEDJOBS_ARITY) + 1;
+        if(first >= rjl->heapSize)
+            break;
+        size_t last = first + UA_REPEATEDJOBS_ARITY;
+        if(last > rjl->heapSize)
+            last = rjl->heapSize;
+        size_t min = first;
+        for(size_t c = first + 1; c < last; ++c) {
+            if(rjl->heap[c]->nextTime < rjl->heap[min]->nextTime)
+                min = c;
+        }
+        if(rjl->heap[min]->nextTime >= batch->nextTime)
             break;
-        afterRj = tmpRj;
-
-        /* The goal is to have many repeated jobs with the same repetition
-         * interval in a "block" in order to reduce linear search for re-entry
-         * to the sorted list after processing. Allow the first execution to lie
-         * between "nextTime - 1s" and "nextTime" if this adjustment groups jobs
-         * with the same repetition interval. */
-        if(tmpRj->interval == rj->interval &&
-           tmpRj->nextTime > (rj->nextTime - UA_SEC_TO_DATETIME))
-            rj->nextTime = tmpRj->nextTime;
+        heapSet(rjl, i, rjl->heap[min]);
+        i = min;
+    }
+    heapSet(rjl, i, batch);
+}
+
+static void
+heapRemove(UA_RepeatedJobsList *rjl, UA_RepeatedJobsBatch *batch) {
+    size_t i = batch->heapIndex;
+    --rjl->heapSize;
+    if(i == rjl->heapSize)
+        return;
+    UA_RepeatedJobsBatch *moved = rjl->heap[rjl->heapSize];
+    heapSet(rjl, i, moved);
+    siftUp(rjl, i);
+    siftDown(rjl, moved->heapIndex);
+}
+
+/***********/
+/* Indexes */
+/***********/
+
+static size_t
+jobHash(const UA_Guid *id) {
+    /* The ids are random */
+    return (size_t)(id->data1 ^ ((UA_UInt32)id->data2 << 16) ^ id->data3);
+}
+
+static size_t
+intervalHash(UA_UInt64 interval) {
+    return (size_t)((interval * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static UA_RepeatedJob *
+findJob(UA_RepeatedJobsList *rjl, const UA_Guid *id) {
+    if(rjl->jobsIndexSize == 0)
+        return NULL;
+    UA_RepeatedJob *rj;
+    LIST_FOREACH(rj, &rjl->jobsIndex[jobHash(id) & (rjl->jobsIndexSize - 1)], indexEntry) {
+        if(UA_Guid_equal(id, &rj->id))
+            return rj;
+    }
+    return NULL;
+}
+
+/* Double the number of buckets when there are more jobs than buckets. If that
+ * fails, the chains get longer. */
+static UA_StatusCode
+growJobsIndex(UA_RepeatedJobsList *rjl) {
+    if(rjl->jobsCount < rjl->jobsIndexSize)
+        return UA_STATUSCODE_GOOD;
+    size_t size = rjl->jobsIndexSize ? rjl->jobsIndexSize * 2 : UA_REPEATEDJOBS_INITIALSIZE;
+    struct RepeatedJobsIndex *index = (struct RepeatedJobsIndex*)
+        UA_calloc(size, sizeof(struct RepeatedJobsIndex));
+    if(!index)
+        return rjl->jobsIndexSize ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < rjl->jobsIndexSize; ++i) {
+        UA_RepeatedJob *rj;
+        while((rj = LIST_FIRST(&rjl->jobsIndex[i]))) {
+            LIST_REMOVE(rj, indexEntry);
+            LIST_INSERT_HEAD(&index[jobHash(&rj->id) & (size - 1)], rj, indexEntry);
+        }
+    }
+    UA_free(rjl->jobsIndex);
+    rjl->jobsIndex = index;
+    rjl->jobsIndexSize = size;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+growBatches(UA_RepeatedJobsList *rjl) {
+    if(rjl->heapSize == rjl->heapCapacity) {
+        size_t capacity = rjl->heapCapacity ? rjl->heapCapacity * 2 : UA_REPEATEDJOBS_INITIALSIZE;
+        UA_RepeatedJobsBatch **heap = (UA_RepeatedJobsBatch**)
+            UA_realloc(rjl->heap, capacity * sizeof(UA_RepeatedJobsBatch*));
+        if(!heap)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        rjl->heap = heap;
+        rjl->heapCapacity = capacity;
+    }
+
+    if(rjl->heapSize < rjl->batchesIndexSize)
+        return UA_STATUSCODE_GOOD;
+    size_t size = rjl->batchesIndexSize ? rjl->batchesIndexSize * 2 : UA_REPEATEDJOBS_INITIALSIZE;
+    struct RepeatedJobsBatchIndex *index = (struct RepeatedJobsBatchIndex*)
+        UA_calloc(size, sizeof(struct RepeatedJobsBatchIndex));
+    if(!index)
+        return rjl->batchesIndexSize ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < rjl->batchesIndexSize; ++i) {
+        UA_RepeatedJobsBatch *batch;
+        while((batch = LIST_FIRST(&rjl->batchesIndex[i]))) {
+            LIST_REMOVE(batch, indexEntry);
+            LIST_INSERT_HEAD(&index[intervalHash(batch->interval) & (size - 1)],
+                             batch, indexEntry);
+        }
     }
+    UA_free(rjl->batchesIndex);
+    rjl->batchesIndex = index;
+    rjl->batchesIndexSize = size;
+    return UA_STATUSCODE_GOOD;
+}
 
-    /* Add the repeated job */
-    if(afterRj)
-        SLIST_INSERT_AFTER(afterRj, rj, next);
-    else
-        SLIST_INSERT_HEAD(&rjl->repeatedJobs, rj, next);
+static void
+removeBatch(UA_RepeatedJobsList *rjl, UA_RepeatedJobsBatch *batch) {
+    heapRemove(rjl, batch);
+    LIST_REMOVE(batch, indexEntry);
+    UA_free(batch);
+}
+
+/* The first execution of a job may be moved up to one second earlier to join a
+ * batch with the same interval. The earliest such batch is taken. */
+static UA_RepeatedJobsBatch *
+findBatch(UA_RepeatedJobsList *rjl, UA_UInt64 interval, UA_DateTime nextTime) {
+    if(rjl->batchesIndexSize == 0)
+        return NULL;
+    UA_RepeatedJobsBatch *batch, *found = NULL;
+    size_t bucket = intervalHash(interval) & (rjl->batchesIndexSize - 1);
+    LIST_FOREACH(batch, &rjl->batchesIndex[bucket], indexEntry) {
+        if(batch->interval != interval || batch->nextTime > nextTime ||
+           batch->nextTime <= nextTime - UA_SEC_TO_DATETIME)
+            continue;
+        if(!found || batch->nextTime < found->nextTime)
+            found = batch;
+    }
+    return found;
+}
+
+/* Schedule an indexed job. Returns an error if a new batch could not be
+ * allocated. */
+static UA_StatusCode
+scheduleJob(UA_RepeatedJobsList *rjl, UA_RepeatedJob *rj, UA_DateTime nowMonotonic) {
+    /* The latest time for the first execution */
+    UA_DateTime nextTime = nowMonotonic + (UA_Int64)rj->interval;
+    UA_RepeatedJobsBatch *batch = findBatch(rjl, rj->interval, nextTime);
+    if(!batch) {
+        if(growBatches(rjl) != UA_STATUSCODE_GOOD)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        batch = (UA_RepeatedJobsBatch*)UA_malloc(sizeof(UA_RepeatedJobsBatch));
+        if(!batch)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        LIST_INIT(&batch->jobs);
+        batch->interval = rj->interval;
+        batch->nextTime = nextTime;
+        size_t bucket = intervalHash(batch->interval) & (rjl->batchesIndexSize - 1);
+        LIST_INSERT_HEAD(&rjl->batchesIndex[bucket], batch, indexEntry);
+        heapSet(rjl, rjl->heapSize, batch);
+        ++rjl->heapSize;
+        siftUp(rjl, batch->heapIndex);
+    }
+    LIST_INSERT_HEAD(&batch->jobs, rj, batchEntry);
+    rj->batch = batch;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+addRepeatedJob(UA_RepeatedJobsList *rjl, UA_RepeatedJob *rj,
+               UA_DateTime nowMonotonic) {
+    rj->batch = NULL;
+    if(growJobsIndex(rjl) != UA_STATUSCODE_GOOD ||
+       scheduleJob(rjl, rj, nowMonotonic) != UA_STATUSCODE_GOOD) {
+        SLIST_INSERT_HEAD(&rjl->pending, rj, next);
+        if(rjl->jobsIndexSize == 0)
+            return;
+    }
+    LIST_INSERT_HEAD(&rjl->jobsIndex[jobHash(&rj->id) & (rjl->jobsIndexSize - 1)],
+                     rj, indexEntry);
+    ++rjl->jobsCount;
 }
 
 /* Removing a repeated job: Add an entry with the "nextTime" timestamp set to
@@ -150,22 +355,52 @@ UA_RepeatedJobsList_removeRepeatedJob(UA_RepeatedJobsList *rjl, const UA_Guid jo
 
 static void
 removeRepeatedJob(UA_RepeatedJobsList *rjl, const UA_Guid *jobId) {
-    UA_RepeatedJob *rj, *prev = NULL;
-    SLIST_FOREACH(rj, &rjl->repeatedJobs, next) {
-        if(UA_Guid_equal(jobId, &rj->id)) {
-            if(prev)
-                SLIST_REMOVE_AFTER(prev, next);
-            else
-                SLIST_REMOVE_HEAD(&rjl->repeatedJobs, next);
-            UA_free(rj);
-            break;
+    UA_RepeatedJob *rj = findJob(rjl, jobId);
+    if(!rj) {
+        /* pending and not indexed */
+        UA_RepeatedJob *prev = NULL;
+        SLIST_FOREACH(rj, &rjl->pending, next) {
+            if(UA_Guid_equal(jobId, &rj->id))
+                break;
+            prev = rj;
         }
-        prev = rj;
+        if(!rj)
+            return;
+        if(prev)
+            SLIST_REMOVE_AFTER(prev, next);
+        else
+            SLIST_REMOVE_HEAD(&rjl->pending, next);
+        UA_free(rj);
+        return;
     }
+
+    LIST_REMOVE(rj, indexEntry);
+    --rjl->jobsCount;
+    if(rj->batch) {
+        LIST_REMOVE(rj, batchEntry);
+        if(LIST_EMPTY(&rj->batch->jobs))
+            removeBatch(rjl, rj->batch);
+    } else {
+        SLIST_REMOVE(&rjl->pending, rj, UA_RepeatedJob, next);
+    }
+    UA_free(rj);
 }
 
 static void
 processChanges(UA_RepeatedJobsList *rjl, UA_DateTime nowMonotonic) {
+    /* Retry the jobs that could not be scheduled */
+    UA_RepeatedJob *rj = SLIST_FIRST(&rjl->pending);
+    SLIST_INIT(&rjl->pending);
+    while(rj) {
+        UA_RepeatedJob *next = SLIST_NEXT(rj, next);
+        if(findJob(rjl, &rj->id) != rj) {
+            addRepeatedJob(rjl, rj, nowMonotonic);
+        } else if(scheduleJob(rjl, rj, nowMonotonic) != UA_STATUSCODE_GOOD) {
+            SLIST_INSERT_HEAD(&rjl->pending, rj, next);
+        }
+        rj = next;
+    }
+
     UA_RepeatedJob *change;
     while((change = dequeueChange(rjl))) {
         if(change->nextTime < UA_INT64_MAX) {
@@ -177,6 +412,28 @@ processChanges(UA_RepeatedJobsList *rjl, UA_DateTime nowMonotonic) {
     }
 }
 
+/* Merge a rescheduled batch into a batch with the same interval that is due at
+ * the same time. This happens when the execution falls behind. */
+static void
+mergeBatch(UA_RepeatedJobsList *rjl, UA_RepeatedJobsBatch *batch) {
+    size_t bucket = intervalHash(batch->interval) & (rjl->batchesIndexSize - 1);
+    UA_RepeatedJobsBatch *other;
+    LIST_FOREACH(other, &rjl->batchesIndex[bucket], indexEntry) {
+        if(other != batch && other->interval == batch->interval &&
+           other->nextTime == batch->nextTime)
+            break;
+    }
+    if(!other)
+        return;
+    UA_RepeatedJob *rj;
+    while((rj = LIST_FIRST(&batch->jobs))) {
+        LIST_REMOVE(rj, batchEntry);
+        LIST_INSERT_HEAD(&other->jobs, rj, batchEntry);
+        rj->batch = other;
+    }
+    removeBatch(rjl, batch);
+}
+
 UA_DateTime
 UA_RepeatedJobsList_process(UA_RepeatedJobsList *rjl,
                             UA_DateTime nowMonotonic,
@@ -184,83 +441,33 @@ UA_RepeatedJobsList_process(UA_RepeatedJobsList *rjl,
     /* Insert and remove jobs */
     processChanges(rjl, nowMonotonic);
 
-    /* Find the last job to be executed now */
-    UA_RepeatedJob *firstAfter, *lastNow = NULL;
-    SLIST_FOREACH(firstAfter, &rjl->repeatedJobs, next) {
-        if(firstAfter->nextTime > nowMonotonic)
-            break;
-        lastNow = firstAfter;
-    }
-
-    /* Nothing to do */
-    if(!lastNow) {
-        if(firstAfter)
-            return firstAfter->nextTime;
-        return UA_INT64_MAX;
-    }
-
-    /* Put the jobs that are executed now in a separate list */
-    struct memberstruct(UA_RepeatedJobsList,RepeatedJobsSList) executedNowList;
-    executedNowList.slh_first = SLIST_FIRST(&rjl->repeatedJobs);
-    lastNow->next.sle_next = NULL;
-
-    /* Fake entry to represent the first element in the newly-sorted list */
-    UA_RepeatedJob tmp_first;
-    tmp_first.nextTime = nowMonotonic - 1; /* never matches for last_dispatched */
-    tmp_first.next.sle_next = firstAfter;
-    UA_RepeatedJob *last_dispatched = &tmp_first;
-
-    /* Iterate over the list of jobs to process now */
-    UA_RepeatedJob *rj;
-    while((rj = SLIST_FIRST(&executedNowList))) {
-        /* Remove from the list */
-        SLIST_REMOVE_HEAD(&executedNowList, next);
-
-        /* Dispatch/process job */
-        rjl->processCallback(rjl->processContext, &rj->job);
-        *dispatched = true;
+    /* Execute the batches that are due. Jobs that add or remove repeated jobs
+     * only enqueue changes, so the batch does not change while it runs. */
+    while(rjl->heapSize > 0 && rjl->heap[0]->nextTime <= nowMonotonic) {
+        UA_RepeatedJobsBatch *batch = rjl->heap[0];
+        UA_RepeatedJob *rj;
+        LIST_FOREACH(rj, &batch->jobs, batchEntry) {
+            rjl->processCallback(rjl->processContext, &rj->job);
+            *dispatched = true;
+        }
 
         /* Set the time for the next execution. Prevent an infinite loop by
          * forcing the next processing into the next iteration. */
-        rj->nextTime += (UA_Int64)rj->interval;
-        if(rj->nextTime < nowMonotonic)
-            rj->nextTime = nowMonotonic + 1;
-
-        /* Find the new position for rj to keep the list sorted */
-        UA_RepeatedJob *prev_rj;
-        if(last_dispatched->nextTime == rj->nextTime) {
-            /* We "batch" repeatedJobs with the same interval in
-             * addRepeatedJobs. So this might occur quite often. */
-            UA_assert(last_dispatched != &tmp_first);
-            prev_rj = last_dispatched;
-        } else {
-            /* Find the position for the next execution by a linear search
-             * starting at the first possible job */
-            prev_rj = &tmp_first;
-            while(true) {
-                UA_RepeatedJob *n = SLIST_NEXT(prev_rj, next);
-                if(!n || n->nextTime >= rj->nextTime)
-                    break;
-                prev_rj = n;
-            }
-
-            /* Update last_dispatched */
-            last_dispatched = rj;
-        }
-
-        /* Add entry to the new position in the sorted list */
-        SLIST_INSERT_AFTER(prev_rj, rj, next);
+        batch->nextTime += (UA_Int64)batch->interval;
+        if(batch->nextTime <= nowMonotonic)
+            batch->nextTime = nowMonotonic + 1;
+        siftDown(rjl, 0);
+        mergeBatch(rjl, batch);
     }
 
-    /* Set the entry-point for the newly sorted list */
-    rjl->repeatedJobs.slh_first = tmp_first.next.sle_next;
-
     /* Re-repeat processAddRemoved since one of the jobs might have removed or
      * added a job. So we get the returned timeout right. */
     processChanges(rjl, nowMonotonic);
 
     /* Return timestamp of next repetition */
-    return SLIST_FIRST(&rjl->repeatedJobs)->nextTime;
+    if(rjl->heapSize == 0)
+        return UA_INT64_MAX;
+    return rjl->heap[0]->nextTime;
 }
 
 void
@@ -269,9 +476,23 @@ UA_RepeatedJobsList_deleteMembers(UA_RepeatedJobsList *rjl) {
     processChanges(rjl, 0);
 
     /* Remove repeated jobs */
-    UA_RepeatedJob *current;
-    while((current = SLIST_FIRST(&rjl->repeatedJobs))) {
-        SLIST_REMOVE_HEAD(&rjl->repeatedJobs, next);
-        UA_free(current);
+    UA_RepeatedJob *rj;
+    for(size_t i = 0; i < rjl->jobsIndexSize; ++i) {
+        while((rj = LIST_FIRST(&rjl->jobsIndex[i]))) {
+            LIST_REMOVE(rj, indexEntry);
+            if(!rj->batch)
+                SLIST_REMOVE(&rjl->pending, rj, UA_RepeatedJob, next);
+            UA_free(rj);
+        }
+    }
+    while((rj = SLIST_FIRST(&rjl->pending))) {
+        SLIST_REMOVE_HEAD(&rjl->pending, next);
+        UA_free(rj);
     }
+    for(size_t i = 0; i < rjl->heapSize; ++i)
+        UA_free(rjl->heap[i]);
+    UA_free(rjl->heap);
+    UA_free(rjl->jobsIndex);
+    UA_free(rjl->batchesIndex);
+    UA_RepeatedJobsList_init(rjl, rjl->processCallback, rjl->processContext);
 }
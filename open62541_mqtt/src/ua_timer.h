@@ -18,9 +18,28 @@ typedef void
 struct UA_RepeatedJob;
 typedef struct UA_RepeatedJob UA_RepeatedJob;
 
+struct UA_RepeatedJobsBatch;
+typedef struct UA_RepeatedJobsBatch UA_RepeatedJobsBatch;
+
 typedef struct {
-    /* The linked list of jobs is sorted according to the execution timestamp. */
-    SLIST_HEAD(RepeatedJobsSList, UA_RepeatedJob) repeatedJobs;
+    /* Jobs with the same interval and the same next execution time form a
+     * batch. The batches are kept in a 4-ary min-heap of the next execution
+     * time. */
+    UA_RepeatedJobsBatch **heap;
+    size_t heapSize;
+    size_t heapCapacity;
+
+    /* Hash tables of the jobs by id and of the batches by interval. Adding and
+     * removing a job does not search the heap. */
+    LIST_HEAD(RepeatedJobsIndex, UA_RepeatedJob) *jobsIndex;
+    size_t jobsIndexSize;
+    size_t jobsCount;
+    LIST_HEAD(RepeatedJobsBatchIndex, UA_RepeatedJobsBatch) *batchesIndex;
+    size_t batchesIndexSize;
+
+    /* Jobs that could not be scheduled for lack of memory. Retried in the
+     * next iteration. */
+    SLIST_HEAD(RepeatedJobsSList, UA_RepeatedJob) pending;
 
     /* Changes to the repeated jobs in a multi-producer single-consumer queue */
     UA_RepeatedJob * volatile changes_head;
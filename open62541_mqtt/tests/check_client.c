@@ -11,6 +11,7 @@
 #include "ua_client.h"
 #include "ua_config_standard.h"
 #include "ua_network_tcp.h"
+#include "client/ua_client_internal.h"
 #include "check.h"
 
 UA_Server *server;
@@ -56,11 +57,34 @@ START_TEST(Client_connect) {
 }
 END_TEST
 
+START_TEST(Client_requestIdWraps) {
+    UA_Client *client = UA_Client_new(UA_ClientConfig_standard);
+    UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:16664");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* the responses after the wrap are not taken for earlier ones */
+    client->requestId = UA_UINT32_MAX - 2;
+    for(size_t i = 0; i < 5; i++) {
+        UA_Variant value;
+        UA_Variant_init(&value);
+        retval = UA_Client_readValueAttribute(client,
+                     UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_CURRENTTIME), &value);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        UA_Variant_deleteMembers(&value);
+    }
+    ck_assert_uint_lt(client->requestId, 10);
+
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+}
+END_TEST
+
 static Suite* testSuite_Client(void) {
     Suite *s = suite_create("Client");
     TCase *tc_client = tcase_create("Client Basic");
     tcase_add_checked_fixture(tc_client, setup, teardown);
     tcase_add_test(tc_client, Client_connect);
+    tcase_add_test(tc_client, Client_requestIdWraps);
     suite_add_tcase(s,tc_client);
     return s;
 }
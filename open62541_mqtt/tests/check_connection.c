@@ -0,0 +1,248 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ua_types.h"
+#include "ua_types_generated_handling.h"
+#include "ua_connection_internal.h"
+#include "check.h"
+
+#define RECV_BUFFER_SIZE 1024
+
+static UA_Connection connection;
+static size_t released;
+
+/* receive buffers are heap copies of the test data, as in the network layers */
+static void
+releaseRecvBuffer(UA_Connection *c, UA_ByteString *buf) {
+    released++;
+    UA_ByteString_deleteMembers(buf);
+}
+
+static void setup(void) {
+    memset(&connection, 0, sizeof(UA_Connection));
+    connection.localConf.recvBufferSize = RECV_BUFFER_SIZE;
+    connection.releaseRecvBuffer = releaseRecvBuffer;
+    released = 0;
+}
+
+static void teardown(void) {
+    UA_Connection_deleteMembers(&connection);
+}
+
+/* a MSG chunk of the given length, the body counts up from seed */
+static void
+makeChunk(UA_Byte *buf, UA_UInt32 length, UA_Byte seed) {
+    memcpy(buf, "MSGF", 4);
+    buf[4] = (UA_Byte)length;
+    buf[5] = (UA_Byte)(length >> 8);
+    buf[6] = (UA_Byte)(length >> 16);
+    buf[7] = (UA_Byte)(length >> 24);
+    for(size_t i = 8; i < length; i++)
+        buf[i] = (UA_Byte)(seed + i);
+}
+
+/* hands length bytes to the connection as one read. returns the complete
+ * chunks in out, the caller frees them. */
+static UA_StatusCode
+receive(const UA_Byte *data, size_t length, UA_ByteString *out) {
+    UA_ByteString_allocBuffer(out, length);
+    memcpy(out->data, data, length);
+    /* the chunks are returned in the receive buffer or in a new allocation,
+     * both are on the heap here */
+    UA_Boolean realloced = false;
+    return UA_Connection_completeMessages(&connection, out, &realloced);
+}
+
+static void
+expectChunks(UA_ByteString *out, const UA_Byte *expected, size_t length) {
+    ck_assert_uint_eq(out->length, length);
+    if(length > 0)
+        ck_assert_int_eq(memcmp(out->data, expected, length), 0);
+    UA_ByteString_deleteMembers(out);
+}
+
+START_TEST(Connection_oneChunk) {
+    UA_Byte chunk[100];
+    makeChunk(chunk, sizeof(chunk), 1);
+
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(chunk, sizeof(chunk), &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+START_TEST(Connection_splitInHeader) {
+    UA_Byte chunk[100];
+    makeChunk(chunk, sizeof(chunk), 2);
+
+    /* the length field is cut in two */
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(chunk, 5, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 5);
+    expectChunks(&out, NULL, 0);
+
+    ck_assert_uint_eq(receive(&chunk[5], sizeof(chunk) - 5, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+START_TEST(Connection_splitAtHeaderEnd) {
+    UA_Byte chunk[100];
+    makeChunk(chunk, sizeof(chunk), 3);
+
+    /* the header is complete, the body is still to come */
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(chunk, 8, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 8);
+    expectChunks(&out, NULL, 0);
+
+    ck_assert_uint_eq(receive(&chunk[8], sizeof(chunk) - 8, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+START_TEST(Connection_splitInBody) {
+    UA_Byte chunk[100];
+    makeChunk(chunk, sizeof(chunk), 4);
+
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(chunk, 40, &out), UA_STATUSCODE_GOOD);
+    expectChunks(&out, NULL, 0);
+    ck_assert_uint_eq(receive(&chunk[40], 30, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 70);
+    expectChunks(&out, NULL, 0);
+    ck_assert_uint_eq(receive(&chunk[70], 30, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+START_TEST(Connection_severalChunks) {
+    UA_Byte data[60 + 100 + 200];
+    makeChunk(data, 60, 5);
+    makeChunk(&data[60], 100, 6);
+    makeChunk(&data[160], 200, 7);
+
+    /* all complete, returned in the receive buffer */
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(data, sizeof(data), &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    ck_assert_uint_eq(released, 0);
+    expectChunks(&out, data, sizeof(data));
+
+    /* the last one is cut, it is kept for the next read */
+    ck_assert_uint_eq(receive(data, 250, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 90);
+    expectChunks(&out, data, 160);
+
+    ck_assert_uint_eq(receive(&data[250], sizeof(data) - 250, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, &data[160], 200);
+}
+END_TEST
+
+START_TEST(Connection_restAndNextChunk) {
+    UA_Byte data[100 + 80];
+    makeChunk(data, 100, 8);
+    makeChunk(&data[100], 80, 9);
+
+    /* the read completes the stored chunk and starts the next one */
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(data, 30, &out), UA_STATUSCODE_GOOD);
+    expectChunks(&out, NULL, 0);
+    ck_assert_uint_eq(receive(&data[30], 120, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 50);
+    expectChunks(&out, data, 100);
+
+    ck_assert_uint_eq(receive(&data[150], 30, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, &data[100], 80);
+}
+END_TEST
+
+START_TEST(Connection_byteByByte) {
+    /* the stored chunk grows from a partial header to its full length */
+    UA_Byte chunk[RECV_BUFFER_SIZE];
+    makeChunk(chunk, sizeof(chunk), 10);
+
+    UA_ByteString out;
+    for(size_t i = 0; i < sizeof(chunk) - 1; i++) {
+        ck_assert_uint_eq(receive(&chunk[i], 1, &out), UA_STATUSCODE_GOOD);
+        ck_assert_uint_eq(connection.incompleteMessage.length, i + 1);
+        expectChunks(&out, NULL, 0);
+    }
+    ck_assert_uint_eq(receive(&chunk[sizeof(chunk) - 1], 1, &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+START_TEST(Connection_chunkTooLarge) {
+    UA_Byte data[100 + 16];
+    makeChunk(data, 100, 11);
+
+    /* only the header is looked at, the chunk is refused before its body
+     * arrives */
+    UA_Byte large[16];
+    makeChunk(large, 16, 13);
+    large[4] = (UA_Byte)(RECV_BUFFER_SIZE + 1);
+    large[5] = (UA_Byte)((RECV_BUFFER_SIZE + 1) >> 8);
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(large, sizeof(large), &out), UA_STATUSCODE_BADDECODINGERROR);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    UA_ByteString_deleteMembers(&out);
+
+    /* after a good chunk, the large one is dropped */
+    memcpy(&data[100], large, sizeof(large));
+    ck_assert_uint_eq(receive(data, sizeof(data), &out), UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    expectChunks(&out, data, 100);
+}
+END_TEST
+
+START_TEST(Connection_largestChunk) {
+    /* a chunk of exactly recvBufferSize is accepted */
+    UA_Byte chunk[RECV_BUFFER_SIZE];
+    makeChunk(chunk, sizeof(chunk), 14);
+
+    UA_ByteString out;
+    ck_assert_uint_eq(receive(chunk, 100, &out), UA_STATUSCODE_GOOD);
+    expectChunks(&out, NULL, 0);
+    ck_assert_uint_eq(receive(&chunk[100], sizeof(chunk) - 100, &out), UA_STATUSCODE_GOOD);
+    expectChunks(&out, chunk, sizeof(chunk));
+}
+END_TEST
+
+static Suite *testSuite_Connection(void) {
+    Suite *s = suite_create("Connection");
+    TCase *tc_complete = tcase_create("CompleteMessages");
+    tcase_add_checked_fixture(tc_complete, setup, teardown);
+    tcase_add_test(tc_complete, Connection_oneChunk);
+    tcase_add_test(tc_complete, Connection_splitInHeader);
+    tcase_add_test(tc_complete, Connection_splitAtHeaderEnd);
+    tcase_add_test(tc_complete, Connection_splitInBody);
+    tcase_add_test(tc_complete, Connection_severalChunks);
+    tcase_add_test(tc_complete, Connection_restAndNextChunk);
+    tcase_add_test(tc_complete, Connection_byteByByte);
+    tcase_add_test(tc_complete, Connection_chunkTooLarge);
+    tcase_add_test(tc_complete, Connection_largestChunk);
+    suite_add_tcase(s, tc_complete);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_Connection();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -74,12 +74,53 @@ START_TEST(Server_repeatedJobRemoveItself) {
 }
 END_TEST
 
+#define MANYJOBS 1000
+
+static UA_UInt32 manyExecuted;
+
+static void
+countJob(UA_Server *serverPtr, void *data) {
+    UA_atomic_add(&manyExecuted, 1);
+}
+
+START_TEST(Server_manyRepeatedJobs) {
+    manyExecuted = 0;
+    UA_Guid ids[MANYJOBS];
+    UA_Job rj = (UA_Job){
+        .type = UA_JOBTYPE_METHODCALL,
+        .job.methodCall = {.data = NULL, .method = countJob}
+    };
+    /* Jobs with a different interval in between */
+    for(size_t i = 0; i < MANYJOBS; i++)
+        UA_Server_addRepeatedJob(server, rj, i % 2 ? 10 : 20, &ids[i]);
+    UA_Server_run_iterate(server, false);
+
+    /* Every job has timed out once */
+    usleep(25*1000);
+    UA_Server_run_iterate(server, false);
+    usleep(15*1000);
+    ck_assert_uint_ge(manyExecuted, MANYJOBS);
+
+    /* Removed jobs are not executed any more */
+    for(size_t i = 0; i < MANYJOBS; i++)
+        UA_Server_removeRepeatedJob(server, ids[i]);
+    UA_Server_run_iterate(server, false);
+    usleep(15*1000);
+    UA_UInt32 executed = manyExecuted;
+    usleep(25*1000);
+    UA_Server_run_iterate(server, false);
+    usleep(15*1000);
+    ck_assert_uint_eq(manyExecuted, executed);
+}
+END_TEST
+
 static Suite* testSuite_Client(void) {
     Suite *s = suite_create("Server Jobs");
     TCase *tc_server = tcase_create("Server Repeated Jobs");
     tcase_add_checked_fixture(tc_server, setup, teardown);
     tcase_add_test(tc_server, Server_addRemoveRepeatedJob);
     tcase_add_test(tc_server, Server_repeatedJobRemoveItself);
+    tcase_add_test(tc_server, Server_manyRepeatedJobs);
     suite_add_tcase(s, tc_server);
     return s;
 }
@@ -309,6 +309,341 @@ START_TEST(Server_deleteMonitoredItems) {
 }
 END_TEST
 
+static UA_UInt32
+createSampledSubscription(void) {
+    UA_CreateSubscriptionRequest request;
+    UA_CreateSubscriptionRequest_init(&request);
+    UA_CreateSubscriptionResponse response;
+    UA_CreateSubscriptionResponse_init(&response);
+    Service_CreateSubscription(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&response);
+    return subId;
+}
+
+static void
+deleteSampledSubscription(UA_UInt32 subId) {
+    UA_DeleteSubscriptionsRequest request;
+    UA_DeleteSubscriptionsRequest_init(&request);
+    request.subscriptionIdsSize = 1;
+    request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse response;
+    UA_DeleteSubscriptionsResponse_init(&response);
+    Service_DeleteSubscriptions(server, &adminSession, &request, &response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&response);
+}
+
+/* Monitors the value of the node */
+static UA_StatusCode
+monitorValue(UA_UInt32 subId, const UA_NodeId nodeId,
+             const UA_MonitoringParameters *params, UA_MonitoredItem **mon) {
+    UA_MonitoredItemCreateRequest item;
+    UA_MonitoredItemCreateRequest_init(&item);
+    item.itemToMonitor.nodeId = nodeId;
+    item.itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+    item.monitoringMode = UA_MONITORINGMODE_REPORTING;
+    item.requestedParameters = *params;
+    UA_CreateMonitoredItemsRequest request;
+    UA_CreateMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToCreateSize = 1;
+    request.itemsToCreate = &item;
+    UA_CreateMonitoredItemsResponse response;
+    UA_CreateMonitoredItemsResponse_init(&response);
+    Service_CreateMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.resultsSize, 1);
+    UA_StatusCode retval = response.results[0].statusCode;
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    *mon = UA_Subscription_getMonitoredItem(sub, response.results[0].monitoredItemId);
+    UA_CreateMonitoredItemsResponse_deleteMembers(&response);
+    return retval;
+}
+
+START_TEST(Server_sampleMonitoredItemsTogether) {
+    UA_UInt32 subId = createSampledSubscription();
+
+    /* Two items with the same sampling interval */
+    UA_MonitoringParameters params;
+    UA_MonitoringParameters_init(&params);
+    params.samplingInterval = 250.0;
+    const UA_NodeId nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_CURRENTTIME);
+    UA_MonitoredItem *first, *second;
+    UA_StatusCode retval = monitorValue(subId, nodeId, &params, &first);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    retval = monitorValue(subId, nodeId, &params, &second);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* They share one sampling set */
+    ck_assert(first->samplingSet != NULL);
+    ck_assert_ptr_eq(first->samplingSet, second->samplingSet);
+    UA_SamplingSet *set = first->samplingSet;
+
+    /* The set remains while an item is left */
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    UA_Subscription_deleteMonitoredItem(server, sub, first->itemId);
+    ck_assert_ptr_eq(second->samplingSet, set);
+    ck_assert_ptr_eq(LIST_FIRST(&server->samplingSets), set);
+    UA_Subscription_deleteMonitoredItem(server, sub, second->itemId);
+    ck_assert(LIST_EMPTY(&server->samplingSets));
+
+    deleteSampledSubscription(subId);
+}
+END_TEST
+
+START_TEST(Server_detectValueChange) {
+    UA_VariableAttributes vattr;
+    UA_VariableAttributes_init(&vattr);
+    UA_Double d = 1.0;
+    UA_Variant_setScalar(&vattr.value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_NodeId doubleNodeId = UA_NODEID_STRING(1, "sampled.double");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, doubleNodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "sampled double"),
+                                  UA_NODEID_NULL, vattr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_Int32 ints[3] = {1, 2, 3};
+    UA_Variant_setArray(&vattr.value, ints, 3, &UA_TYPES[UA_TYPES_INT32]);
+    UA_NodeId arrayNodeId = UA_NODEID_STRING(1, "sampled.array");
+    retval = UA_Server_addVariableNode(server, arrayNodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                       UA_QUALIFIEDNAME(1, "sampled array"),
+                                       UA_NODEID_NULL, vattr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_UInt32 subId = createSampledSubscription();
+    UA_MonitoringParameters params;
+    UA_MonitoringParameters_init(&params);
+    params.samplingInterval = 100.0;
+    params.queueSize = 10;
+    UA_MonitoredItem *scalarMon, *arrayMon;
+    retval = monitorValue(subId, doubleNodeId, &params, &scalarMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    retval = monitorValue(subId, arrayNodeId, &params, &arrayMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* The first sample is taken when the item is created */
+    ck_assert_uint_eq(scalarMon->currentQueueSize, 1);
+    ck_assert_uint_eq(arrayMon->currentQueueSize, 1);
+
+    /* Unchanged */
+    UA_MoniteredItem_SampleCallback(server, scalarMon);
+    UA_MoniteredItem_SampleCallback(server, arrayMon);
+    ck_assert_uint_eq(scalarMon->currentQueueSize, 1);
+    ck_assert_uint_eq(arrayMon->currentQueueSize, 1);
+
+    /* Changed */
+    UA_Variant value;
+    d = 2.0;
+    UA_Variant_setScalar(&value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_Server_writeValue(server, doubleNodeId, value);
+    ints[2] = 4;
+    UA_Variant_setArray(&value, ints, 3, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Server_writeValue(server, arrayNodeId, value);
+    UA_MoniteredItem_SampleCallback(server, scalarMon);
+    UA_MoniteredItem_SampleCallback(server, arrayMon);
+    ck_assert_uint_eq(scalarMon->currentQueueSize, 2);
+    ck_assert_uint_eq(arrayMon->currentQueueSize, 2);
+
+    /* A shorter array */
+    UA_Variant_setArray(&value, ints, 2, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Server_writeValue(server, arrayNodeId, value);
+    UA_MoniteredItem_SampleCallback(server, arrayMon);
+    UA_MoniteredItem_SampleCallback(server, arrayMon);
+    ck_assert_uint_eq(arrayMon->currentQueueSize, 3);
+
+    deleteSampledSubscription(subId);
+}
+END_TEST
+
+static void
+writeDouble(const UA_NodeId nodeId, UA_Double d) {
+    UA_Variant value;
+    UA_Variant_setScalar(&value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_StatusCode retval = UA_Server_writeValue(server, nodeId, value);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+}
+
+START_TEST(Server_deadbandFilter) {
+    UA_VariableAttributes vattr;
+    UA_VariableAttributes_init(&vattr);
+    UA_Double d = 10.0;
+    UA_Variant_setScalar(&vattr.value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    vattr.dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+    UA_NodeId analogNodeId = UA_NODEID_STRING(1, "deadband.analog");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, analogNodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "analog"), UA_NODEID_NULL, vattr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* The EURange property of the analog item */
+    UA_VariableAttributes rattr;
+    UA_VariableAttributes_init(&rattr);
+    UA_Range range;
+    range.low = 0.0;
+    range.high = 200.0;
+    UA_Variant_setScalar(&rattr.value, &range, &UA_TYPES[UA_TYPES_RANGE]);
+    rattr.dataType = UA_TYPES[UA_TYPES_RANGE].typeId;
+    UA_NodeId rangeNodeId;
+    retval = UA_Server_addVariableNode(server, UA_NODEID_NULL, analogNodeId,
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY),
+                                       UA_QUALIFIEDNAME(0, "EURange"),
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_PROPERTYTYPE),
+                                       rattr, NULL, &rangeNodeId);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_UInt32 subId = createSampledSubscription();
+    UA_DataChangeFilter filter;
+    UA_DataChangeFilter_init(&filter);
+    filter.trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+    UA_MonitoringParameters params;
+    UA_MonitoringParameters_init(&params);
+    params.samplingInterval = 100.0;
+    params.queueSize = 10;
+    params.filter.encoding = UA_EXTENSIONOBJECT_DECODED;
+    params.filter.content.decoded.type = &UA_TYPES[UA_TYPES_DATACHANGEFILTER];
+    params.filter.content.decoded.data = &filter;
+
+    /* Absolute deadband of 0.5 */
+    filter.deadbandType = UA_DEADBANDTYPE_ABSOLUTE;
+    filter.deadbandValue = 0.5;
+    UA_MonitoredItem *absoluteMon;
+    retval = monitorValue(subId, analogNodeId, &params, &absoluteMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* Percent deadband of 1% of the EURange, 2.0 */
+    filter.deadbandType = UA_DEADBANDTYPE_PERCENT;
+    filter.deadbandValue = 1.0;
+    UA_MonitoredItem *percentMon;
+    retval = monitorValue(subId, analogNodeId, &params, &percentMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(absoluteMon->currentQueueSize, 1);
+    ck_assert_uint_eq(percentMon->currentQueueSize, 1);
+
+    /* Within both deadbands */
+    writeDouble(analogNodeId, 10.4);
+    UA_MoniteredItem_SampleCallback(server, absoluteMon);
+    UA_MoniteredItem_SampleCallback(server, percentMon);
+    ck_assert_uint_eq(absoluteMon->currentQueueSize, 1);
+    ck_assert_uint_eq(percentMon->currentQueueSize, 1);
+
+    /* Outside the absolute deadband */
+    writeDouble(analogNodeId, 9.4);
+    UA_MoniteredItem_SampleCallback(server, absoluteMon);
+    UA_MoniteredItem_SampleCallback(server, percentMon);
+    ck_assert_uint_eq(absoluteMon->currentQueueSize, 2);
+    ck_assert_uint_eq(percentMon->currentQueueSize, 1);
+
+    /* Compared with the last reported value, not the last sample */
+    writeDouble(analogNodeId, 12.5);
+    UA_MoniteredItem_SampleCallback(server, absoluteMon);
+    UA_MoniteredItem_SampleCallback(server, percentMon);
+    ck_assert_uint_eq(absoluteMon->currentQueueSize, 3);
+    ck_assert_uint_eq(percentMon->currentQueueSize, 2);
+
+    /* Deadbands apply to numeric variables only */
+    UA_MonitoredItem *mon;
+    retval = monitorValue(subId, UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_CURRENTTIME),
+                          &params, &mon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADFILTERNOTALLOWED);
+    filter.deadbandType = 7;
+    retval = monitorValue(subId, analogNodeId, &params, &mon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADDEADBANDFILTERINVALID);
+
+    /* A percent deadband needs a valid EURange */
+    range.low = 200.0;
+    range.high = 0.0;
+    UA_Variant value;
+    UA_Variant_setScalar(&value, &range, &UA_TYPES[UA_TYPES_RANGE]);
+    retval = UA_Server_writeValue(server, rangeNodeId, value);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    filter.deadbandType = UA_DEADBANDTYPE_PERCENT;
+    retval = monitorValue(subId, analogNodeId, &params, &mon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADDEADBANDFILTERINVALID);
+
+    deleteSampledSubscription(subId);
+}
+END_TEST
+
+static UA_Double
+queuedDouble(const UA_MonitoredItem *mon, UA_UInt32 i) {
+    const MonitoredItem_queuedValue *qv =
+        &mon->queue[(mon->queueStart + i) % mon->queueCapacity];
+    ck_assert(UA_Variant_hasScalarType(&qv->value.value, &UA_TYPES[UA_TYPES_DOUBLE]));
+    return *(UA_Double*)qv->value.value.data;
+}
+
+START_TEST(Server_queueOverflow) {
+    UA_VariableAttributes vattr;
+    UA_VariableAttributes_init(&vattr);
+    UA_Double d = 0.0;
+    UA_Variant_setScalar(&vattr.value, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "queued.double");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "queued"), UA_NODEID_NULL, vattr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_UInt32 subId = createSampledSubscription();
+    UA_MonitoringParameters params;
+    UA_MonitoringParameters_init(&params);
+    params.samplingInterval = 100.0;
+    params.queueSize = 3;
+    params.discardOldest = true;
+    UA_MonitoredItem *oldestMon;
+    retval = monitorValue(subId, nodeId, &params, &oldestMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    params.discardOldest = false;
+    UA_MonitoredItem *newestMon;
+    retval = monitorValue(subId, nodeId, &params, &newestMon);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* Five samples in queues of three */
+    for(size_t i = 1; i < 5; ++i) {
+        writeDouble(nodeId, (UA_Double)i);
+        UA_MoniteredItem_SampleCallback(server, oldestMon);
+        UA_MoniteredItem_SampleCallback(server, newestMon);
+    }
+    ck_assert_uint_eq(oldestMon->currentQueueSize, 3);
+    ck_assert(queuedDouble(oldestMon, 0) == 2.0);
+    ck_assert(queuedDouble(oldestMon, 1) == 3.0);
+    ck_assert(queuedDouble(oldestMon, 2) == 4.0);
+    ck_assert_uint_eq(newestMon->currentQueueSize, 3);
+    ck_assert(queuedDouble(newestMon, 0) == 0.0);
+    ck_assert(queuedDouble(newestMon, 1) == 1.0);
+    ck_assert(queuedDouble(newestMon, 2) == 4.0);
+
+    /* A smaller queue keeps the newest samples */
+    UA_ModifyMonitoredItemsRequest request;
+    UA_ModifyMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    UA_MonitoredItemModifyRequest item;
+    UA_MonitoredItemModifyRequest_init(&item);
+    item.monitoredItemId = oldestMon->itemId;
+    item.requestedParameters = params;
+    item.requestedParameters.queueSize = 2;
+    item.requestedParameters.discardOldest = true;
+    request.itemsToModifySize = 1;
+    request.itemsToModify = &item;
+    UA_ModifyMonitoredItemsResponse response;
+    UA_ModifyMonitoredItemsResponse_init(&response);
+    Service_ModifyMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    UA_ModifyMonitoredItemsResponse_deleteMembers(&response);
+    writeDouble(nodeId, 5.0);
+    UA_MoniteredItem_SampleCallback(server, oldestMon);
+    ck_assert_uint_eq(oldestMon->currentQueueSize, 2);
+    ck_assert(queuedDouble(oldestMon, 0) == 4.0);
+    ck_assert(queuedDouble(oldestMon, 1) == 5.0);
+
+    deleteSampledSubscription(subId);
+}
+END_TEST
 
 static Suite* testSuite_Client(void) {
     Suite *s = suite_create("Server Subscription");
@@ -321,6 +656,10 @@ static Suite* testSuite_Client(void) {
     tcase_add_test(tc_server, Server_modifyMonitoredItems);
     tcase_add_test(tc_server, Server_setMonitoringMode);
     tcase_add_test(tc_server, Server_deleteMonitoredItems);
+    tcase_add_test(tc_server, Server_sampleMonitoredItemsTogether);
+    tcase_add_test(tc_server, Server_detectValueChange);
+    tcase_add_test(tc_server, Server_deadbandFilter);
+    tcase_add_test(tc_server, Server_queueOverflow);
     tcase_add_test(tc_server, Server_republish);
     tcase_add_test(tc_server, Server_deleteSubscription);
     tcase_add_test(tc_server, Server_republish_invalid);
@@ -45,8 +45,10 @@ UA_Connection createDummyConnection(void) {
     c.getSendBuffer = dummyGetSendBuffer;
     c.releaseSendBuffer = dummyReleaseSendBuffer;
     c.send = dummySend;
+    c.sendv = NULL;
     c.recv = NULL;
     c.releaseRecvBuffer = dummyReleaseRecvBuffer;
     c.close = dummyClose;
+    c.cleanup = NULL;
     return c;
 }